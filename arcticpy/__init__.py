@@ -1,4 +1,9 @@
-from arcticpy.src.cti import add_cti, remove_cti, CTI_model_for_HST_ACS
+from arcticpy.src.cti import (
+    add_cti,
+    remove_cti,
+    estimate_resources,
+    CTI_model_for_HST_ACS,
+)
 from arcticpy.src.ccd import CCDPhase, CCD
 from arcticpy.src.roe import ROE, ROEChargeInjection, ROETrapPumping
 from arcticpy.src.traps import (
@@ -125,6 +125,7 @@ def add_cti(
     parallel_time_stop=-1,
     parallel_prune_n_electrons=1e-10, 
     parallel_prune_frequency=20,
+    parallel_express_extrapolate=False,
     # Serial
     serial_ccd=None,
     serial_roe=None,
@@ -137,9 +138,11 @@ def add_cti(
     serial_time_stop=-1,
     serial_prune_n_electrons=1e-10, 
     serial_prune_frequency=20,
+    serial_express_extrapolate=False,
     # Output
     verbosity=1,
     iteration=0,
+    return_error_estimate=False,
 ):
     """
     Wrapper for arctic's add_cti() in src/cti.cpp, see its documentation.
@@ -165,6 +168,10 @@ def add_cti(
             0   No printing (except errors etc).
             1   Standard.
             2   Extra details.
+
+    return_error_estimate : bool (opt.)
+        If True, also return the extrapolated express error estimate, i.e.
+        return (image, error_estimate). Default False.
     """
     image = np.copy(image).astype(np.double)
 
@@ -232,7 +239,7 @@ def add_cti(
     # Add CTI
     # ========
     # Pass the extracted inputs to C++ via the cython wrapper
-    return w.cy_add_cti(
+    image, error_estimate = w.cy_add_cti(
         image,
         # ========
         # Parallel
@@ -270,6 +277,7 @@ def add_cti(
         parallel_time_stop,
         parallel_prune_n_es,
         parallel_prune_frequency,
+        parallel_express_extrapolate,
         # ========
         # Serial
         # ========
@@ -306,11 +314,16 @@ def add_cti(
         serial_time_stop,
         serial_prune_n_es, 
         serial_prune_frequency,
+        serial_express_extrapolate,
         # Output
         verbosity,
         iteration,
     )
 
+    if return_error_estimate:
+        return image, error_estimate
+    return image
+
 
 def remove_cti(
     image,
@@ -327,6 +340,7 @@ def remove_cti(
     parallel_time_stop=-1,
     parallel_prune_n_electrons=1e-10,
     parallel_prune_frequency=20,
+    parallel_express_extrapolate=False,
     # Serial
     serial_ccd=None,
     serial_roe=None,
@@ -339,8 +353,10 @@ def remove_cti(
     serial_time_stop=-1,
     serial_prune_n_electrons=1e-10, 
     serial_prune_frequency=20,
+    serial_express_extrapolate=False,
     # Output
     verbosity=1,
+    return_error_estimate=False,
 ):
     """
     Wrapper for arctic's remove_cti() in src/cti.cpp, see its documentation.
@@ -362,6 +378,11 @@ def remove_cti(
             0   No printing (except errors etc).
             1   Standard.
             2   Extra details.
+
+    return_error_estimate : bool (opt.)
+        If True, also return the extrapolated express error estimate of the
+        last iteration's added CTI, i.e. return (image, error_estimate).
+        Default False.
     """
     image = np.copy(image).astype(np.double)
     image_remove_cti = np.copy(image).astype(np.double)
@@ -369,13 +390,15 @@ def remove_cti(
     if verbosity >= 1:
         w.cy_print_version()
 
+    error_estimate = 0.0
+
     # Estimate the image with removed CTI more accurately each iteration
     for iteration in range(1, n_iterations + 1):
         if verbosity >= 1:
             print("Iter %d: " % iteration, end="", flush=True)
 
         # Model the effect of adding CTI trails
-        image_add_cti = add_cti(
+        image_add_cti, error_estimate = add_cti(
             image=image_remove_cti,
             # Parallel
             parallel_ccd=parallel_ccd,
@@ -389,6 +412,7 @@ def remove_cti(
             parallel_time_stop=parallel_time_stop,
             parallel_prune_n_electrons=parallel_prune_n_electrons,
             parallel_prune_frequency=parallel_prune_frequency,
+            parallel_express_extrapolate=parallel_express_extrapolate,
             # Serial
             serial_ccd=serial_ccd,
             serial_roe=serial_roe,
@@ -401,9 +425,11 @@ def remove_cti(
             serial_time_stop=serial_time_stop,
             serial_prune_n_electrons=serial_prune_n_electrons, 
             serial_prune_frequency=serial_prune_frequency,
+            serial_express_extrapolate=serial_express_extrapolate,
             # Output
             verbosity=verbosity,
             iteration=iteration,
+            return_error_estimate=True,
         )
 
         # Improve the estimate of the image with CTI trails removed
@@ -412,9 +438,156 @@ def remove_cti(
         # Prevent negative image values
         image_remove_cti[image_remove_cti < 0.0] = 0.0
 
+    if return_error_estimate:
+        return image_remove_cti, error_estimate
     return image_remove_cti
 
 
+_resource_keys = [
+    "image_bytes",
+    "express_setup_bytes",
+    "express_bytes",
+    "trap_manager_bytes",
+    "table_bytes",
+    "peak_bytes",
+    "n_pixel_transfers",
+    "runtime",
+]
+
+
+def estimate_resources(
+    shape,
+    # Parallel
+    parallel_ccd=None,
+    parallel_roe=None,
+    parallel_traps=None,
+    parallel_express=0,
+    parallel_window_offset=0,
+    # Serial
+    serial_ccd=None,
+    serial_roe=None,
+    serial_traps=None,
+    serial_express=0,
+    serial_window_offset=0,
+    # Options
+    n_iterations=0,
+    calibrate=True,
+    verbosity=0,
+):
+    """
+    Wrapper for arctic's estimate_resources() in src/resources.cpp, see its
+    documentation.
+
+    Predict the peak memory and the runtime for add_cti() (or remove_cti())
+    with these inputs, without running it, e.g. to schedule jobs.
+
+    Parameters (where different to add_cti())
+    ----------
+    shape : (int, int)
+        The image shape (n_rows, n_columns).
+
+    n_iterations : int (opt.)
+        The number of iterations for remove_cti(), or 0 (default) for
+        add_cti().
+
+    calibrate : bool (opt.)
+        Whether to time a small probe of each clocking direction to estimate
+        the runtime. Otherwise the runtime is 0.
+
+    Returns
+    -------
+    estimate : dict
+        The "parallel" and "serial" estimates, each a dict of the bytes for
+        each component, the peak bytes, the number of pixel transfers, and the
+        runtime (s), as for ResourceEstimate. Also the overall "peak_bytes" and
+        "runtime", since the directions are clocked one after the other.
+    """
+    n_rows, n_columns = shape
+    estimate = {}
+
+    for direction, ccd, roe, traps, express, window_offset, dir_shape in [
+        (
+            "parallel",
+            parallel_ccd,
+            parallel_roe,
+            parallel_traps,
+            parallel_express,
+            parallel_window_offset,
+            (n_rows, n_columns),
+        ),
+        (
+            "serial",
+            serial_ccd,
+            serial_roe,
+            serial_traps,
+            serial_express,
+            serial_window_offset,
+            (n_columns, n_rows),
+        ),
+    ]:
+        if traps is None:
+            continue
+
+        (
+            trap_densities,
+            trap_release_timescales,
+            trap_third_params,
+            trap_fourth_params,
+            n_traps_ic,
+            n_traps_sc,
+            n_traps_ic_co,
+            n_traps_sc_co,
+        ) = _extract_trap_parameters(traps)
+
+        values = w.cy_estimate_resources(
+            dir_shape[0],
+            dir_shape[1],
+            # ROE
+            roe.dwell_times,
+            roe.prescan_offset,
+            roe.overscan_start,
+            roe.empty_traps_between_columns,
+            roe.empty_traps_for_first_transfers,
+            roe.force_release_away_from_readout,
+            roe.use_integer_express_matrix,
+            roe.n_pumps,
+            roe.type,
+            # CCD
+            ccd.fraction_of_traps_per_phase,
+            ccd.full_well_depths,
+            ccd.well_notch_depths,
+            ccd.well_fill_powers,
+            # Traps
+            trap_densities,
+            trap_release_timescales,
+            trap_third_params,
+            trap_fourth_params,
+            n_traps_ic,
+            n_traps_sc,
+            n_traps_ic_co,
+            n_traps_sc_co,
+            # Misc
+            express,
+            window_offset,
+            calibrate,
+            # Output
+            verbosity,
+        )
+        estimate[direction] = dict(zip(_resource_keys, values))
+
+    # Both directions, plus the extra images kept by remove_cti()
+    n_bytes_image = 8.0 * n_rows * n_columns
+    estimate["peak_bytes"] = max(
+        [estimate[d]["peak_bytes"] for d in ["parallel", "serial"] if d in estimate]
+        + [0.0]
+    ) + (3.0 if n_iterations > 0 else 1.0) * n_bytes_image
+    estimate["runtime"] = max(n_iterations, 1) * sum(
+        [estimate[d]["runtime"] for d in ["parallel", "serial"] if d in estimate]
+    )
+
+    return estimate
+
+
 def CTI_model_for_HST_ACS(date):
     """
     Return arcticpy objects that provide a preset CTI model for the Hubble Space
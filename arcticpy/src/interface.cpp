@@ -41,6 +41,8 @@ void print_array_2D(double* array, int n_rows, int n_columns) {
     This wrapper converts the individual numbers and arrays from the Cython
     wrapper into C++ variables to pass to the main arcctic library. See
     cy_add_cti() in wrapper.pyx and add_cti() in cti.py.
+
+    Sets error_estimate_out[0] to the extrapolated express error estimate.
 */
 void add_cti(
     double* image, int n_rows, int n_columns,
@@ -72,6 +74,7 @@ void add_cti(
     int parallel_window_start, int parallel_window_stop,
     int parallel_time_start, int parallel_time_stop,
     double* parallel_prune_n_electrons, int parallel_prune_frequency,
+    bool parallel_express_extrapolate,
     // ========
     // Serial
     // ========
@@ -100,8 +103,9 @@ void add_cti(
     int serial_window_start, int serial_window_stop, 
     int serial_time_start, int serial_time_stop,
     double* serial_prune_n_electrons, int serial_prune_frequency,
+    bool serial_express_extrapolate,
     // Output
-    int verbosity, int iteration) {
+    int verbosity, int iteration, double* error_estimate_out) {
 
     set_verbosity(verbosity);
 
@@ -318,7 +322,8 @@ void add_cti(
             serial_time_start, serial_time_stop,
             serial_prune_n_electrons[0], serial_prune_frequency,
             // Output
-            iteration);
+            verbosity, iteration, nullptr, nullptr, nullptr, nullptr, false,
+            serial_express_extrapolate, error_estimate_out);
     }
     // No serial, parallel only
     else if (n_traps_serial == 0) {
@@ -335,7 +340,8 @@ void add_cti(
             nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 
             0, 0, serial_window_start, serial_window_stop, 0, 0, prune_zero, 0, 
             // Output
-            iteration);
+            verbosity, iteration, nullptr, nullptr, nullptr, nullptr,
+            parallel_express_extrapolate, false, error_estimate_out);
     }
     // Parallel and serial
     else {
@@ -356,7 +362,9 @@ void add_cti(
             serial_time_start, serial_time_stop,
             serial_prune_n_electrons[0], serial_prune_frequency,
             // Output
-            iteration);
+            verbosity, iteration, nullptr, nullptr, nullptr, nullptr,
+            parallel_express_extrapolate, serial_express_extrapolate,
+            error_estimate_out);
     }
 
     // Delete serial/parallel ROE if previously allocated
@@ -370,3 +378,115 @@ void add_cti(
         }
     }
 }
+
+/*
+    Wrapper for arctic's estimate_resources() in src/resources.cpp, for one
+    clocking direction.
+
+    Converts the individual numbers and arrays from the Cython wrapper into C++
+    variables as for add_cti(), and sets estimate_out to the 8 values of the
+    ResourceEstimate, in the same order as its attributes. See
+    cy_estimate_resources() in wrapper.pyx and estimate_resources() in cti.py.
+*/
+void estimate_resources(
+    int n_rows, int n_columns,
+    // ROE
+    double* dwell_times_in, int n_steps, int prescan_offset, int overscan_start,
+    bool empty_traps_between_columns, bool empty_traps_for_first_transfers,
+    bool force_release_away_from_readout, bool use_integer_express_matrix,
+    int n_pumps, int roe_type,
+    // CCD
+    double* fraction_of_traps_per_phase_in, int n_phases, double* full_well_depths,
+    double* well_notch_depths, double* well_fill_powers,
+    // Traps
+    double* trap_densities, double* trap_release_timescales,
+    double* trap_third_params, double* trap_fourth_params, int n_traps_ic,
+    int n_traps_sc, int n_traps_ic_co, int n_traps_sc_co,
+    // Misc
+    int express, int window_offset, bool calibrate,
+    // Output
+    double* estimate_out, int verbosity) {
+
+    set_verbosity(verbosity);
+
+    // ROE
+    std::valarray<double> dwell_times(0.0, n_steps);
+    for (int i_step = 0; i_step < n_steps; i_step++) {
+        dwell_times[i_step] = dwell_times_in[i_step];
+    }
+    ROE* p_roe = NULL;
+    if (roe_type == 0) {
+        p_roe = new ROE(
+            dwell_times, prescan_offset, overscan_start, empty_traps_between_columns,
+            empty_traps_for_first_transfers, force_release_away_from_readout,
+            use_integer_express_matrix);
+    } else if (roe_type == 1) {
+        p_roe = new ROEChargeInjection(
+            dwell_times, prescan_offset, overscan_start, empty_traps_between_columns,
+            force_release_away_from_readout, use_integer_express_matrix);
+    } else {
+        p_roe = new ROETrapPumping(
+            dwell_times, n_pumps, empty_traps_for_first_transfers,
+            use_integer_express_matrix);
+    }
+
+    // CCD
+    std::valarray<double> fraction_of_traps_per_phase(0.0, n_phases);
+    std::valarray<CCDPhase> phases(CCDPhase(0.0, 0.0, 0.0), n_phases);
+    for (int i_phase = 0; i_phase < n_phases; i_phase++) {
+        fraction_of_traps_per_phase[i_phase] = fraction_of_traps_per_phase_in[i_phase];
+        phases[i_phase].full_well_depth = full_well_depths[i_phase];
+        phases[i_phase].well_notch_depth = well_notch_depths[i_phase];
+        phases[i_phase].well_fill_power = well_fill_powers[i_phase];
+    }
+    CCD ccd(phases, fraction_of_traps_per_phase);
+
+    // Traps, in the same order as for add_cti()
+    std::valarray<TrapInstantCapture> traps_ic(
+        TrapInstantCapture(0.0, 0.0), n_traps_ic);
+    std::valarray<TrapSlowCapture> traps_sc(TrapSlowCapture(0.0, 0.0, 0.0), n_traps_sc);
+    std::valarray<TrapInstantCaptureContinuum> traps_ic_co(
+        TrapInstantCaptureContinuum(0.0, 0.0, 0.0), n_traps_ic_co);
+    std::valarray<TrapSlowCaptureContinuum> traps_sc_co(
+        TrapSlowCaptureContinuum(0.0, 0.0, 0.0, 0.0), n_traps_sc_co);
+
+    int i_trap = 0;
+    for (int i = 0; i < n_traps_ic; i++, i_trap++) {
+        traps_ic[i] = TrapInstantCapture(
+            trap_densities[i_trap], trap_release_timescales[i_trap],
+            trap_third_params[i_trap], trap_fourth_params[i_trap]);
+    }
+    for (int i = 0; i < n_traps_sc; i++, i_trap++) {
+        traps_sc[i] = TrapSlowCapture(
+            trap_densities[i_trap], trap_release_timescales[i_trap],
+            trap_third_params[i_trap]);
+    }
+    for (int i = 0; i < n_traps_ic_co; i++, i_trap++) {
+        traps_ic_co[i] = TrapInstantCaptureContinuum(
+            trap_densities[i_trap], trap_release_timescales[i_trap],
+            trap_third_params[i_trap]);
+    }
+    for (int i = 0; i < n_traps_sc_co; i++, i_trap++) {
+        traps_sc_co[i] = TrapSlowCaptureContinuum(
+            trap_densities[i_trap], trap_release_timescales[i_trap],
+            trap_third_params[i_trap], trap_fourth_params[i_trap]);
+    }
+
+    // ========
+    // Estimate
+    // ========
+    ResourceEstimate estimate = estimate_resources(
+        n_rows, n_columns, p_roe, &ccd, &traps_ic, &traps_sc, &traps_ic_co,
+        &traps_sc_co, express, window_offset, calibrate);
+
+    delete p_roe;
+
+    estimate_out[0] = estimate.image_bytes;
+    estimate_out[1] = estimate.express_setup_bytes;
+    estimate_out[2] = estimate.express_bytes;
+    estimate_out[3] = estimate.trap_manager_bytes;
+    estimate_out[4] = estimate.table_bytes;
+    estimate_out[5] = estimate.peak_bytes;
+    estimate_out[6] = estimate.n_pixel_transfers;
+    estimate_out[7] = estimate.runtime;
+}
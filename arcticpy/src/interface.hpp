@@ -1,5 +1,6 @@
 
 #include "cti.hpp"
+#include "resources.hpp"
 #include "roe.hpp"
 #include "trap_managers.hpp"
 #include "traps.hpp"
@@ -39,6 +40,7 @@ void add_cti(
     int parallel_window_start, int parallel_window_stop, 
     int parallel_time_start, int parallel_time_stop,
     double* parallel_prune_n_electrons, int parallel_prune_frequency,
+    bool parallel_express_extrapolate,
     // ========
     // Serial
     // ========
@@ -65,5 +67,25 @@ void add_cti(
     int serial_window_start, int serial_window_stop, 
     int serial_time_start, int serial_time_stop,
     double* serial_prune_n_electrons, int serial_prune_frequency,
+    bool serial_express_extrapolate,
     // Output
-    int verbosity, int iteration);
+    int verbosity, int iteration, double* error_estimate_out);
+
+void estimate_resources(
+    int n_rows, int n_columns,
+    // ROE
+    double* dwell_times_in, int n_steps, int prescan_offset, int overscan_start,
+    bool empty_traps_between_columns, bool empty_traps_for_first_transfers,
+    bool force_release_away_from_readout, bool use_integer_express_matrix,
+    int n_pumps, int roe_type,
+    // CCD
+    double* fraction_of_traps_per_phase_in, int n_phases, double* full_well_depths,
+    double* well_notch_depths, double* well_fill_powers,
+    // Traps
+    double* trap_densities, double* trap_release_timescales,
+    double* trap_third_params, double* trap_fourth_params, int n_traps_ic,
+    int n_traps_sc, int n_traps_ic_co, int n_traps_sc_co,
+    // Misc
+    int express, int window_offset, bool calibrate,
+    // Output
+    double* estimate_out, int verbosity);
@@ -50,6 +50,7 @@ cdef extern from "interface.hpp":
         int parallel_time_stop,
         double* parallel_prune_n_electrons, 
         int parallel_prune_frequency,
+        int parallel_express_extrapolate,
         # ========
         # Serial
         # ========
@@ -88,9 +89,48 @@ cdef extern from "interface.hpp":
         int serial_time_stop,
         double* serial_prune_n_electrons, 
         int serial_prune_frequency,
+        int serial_express_extrapolate,
         # Output
         int verbosity,
-        int iteration
+        int iteration,
+        double* error_estimate_out
+    )
+    void estimate_resources(
+        int n_rows,
+        int n_columns,
+        # ROE
+        double* dwell_times_in,
+        int n_steps,
+        int prescan_offset,
+        int overscan_start,
+        int empty_traps_between_columns,
+        int empty_traps_for_first_transfers,
+        int force_release_away_from_readout,
+        int use_integer_express_matrix,
+        int n_pumps,
+        int roe_type,
+        # CCD
+        double* fraction_of_traps_per_phase_in,
+        int n_phases,
+        double* full_well_depths,
+        double* well_notch_depths,
+        double* well_fill_powers,
+        # Traps
+        double* trap_densities,
+        double* trap_release_timescales,
+        double* trap_third_params,
+        double* trap_fourth_params,
+        int n_traps_ic,
+        int n_traps_sc,
+        int n_traps_ic_co,
+        int n_traps_sc_co,
+        # Misc
+        int express,
+        int window_offset,
+        int calibrate,
+        # Output
+        double* estimate_out,
+        int verbosity
     )
 
 
@@ -156,6 +196,7 @@ def cy_add_cti(
     int parallel_time_stop,
     np.ndarray[np.double_t, ndim=1] parallel_prune_n_electrons, 
     int parallel_prune_frequency,
+    int parallel_express_extrapolate,
     # ========
     # Serial
     # ========
@@ -192,6 +233,7 @@ def cy_add_cti(
     int serial_time_stop,
     np.ndarray[np.double_t, ndim=1] serial_prune_n_electrons, 
     int serial_prune_frequency,
+    int serial_express_extrapolate,
     # Output
     int verbosity,
     int iteration,
@@ -201,9 +243,11 @@ def cy_add_cti(
 
     This wrapper passes the individual numbers and arrays extracted by the
     python wrapper to the C++ interface. See add_cti() in cti.py and add_cti()
-    in interface.cpp.
+    in interface.cpp. Returns the image and the extrapolated express error
+    estimate.
     """
     image = check_contiguous(image)
+    cdef np.ndarray[np.double_t, ndim=1] error_estimate = np.zeros(1, dtype=np.double)
 
     add_cti(
         &image[0, 0],
@@ -247,6 +291,7 @@ def cy_add_cti(
         parallel_time_stop,
         &parallel_prune_n_electrons[0], 
         parallel_prune_frequency,
+        parallel_express_extrapolate,
         # ========
         # Serial
         # ========
@@ -285,9 +330,95 @@ def cy_add_cti(
         serial_time_stop,
         &serial_prune_n_electrons[0], 
         serial_prune_frequency,
+        serial_express_extrapolate,
         # Output
         verbosity,
         iteration,
+        &error_estimate[0],
+    )
+
+    return image, error_estimate[0]
+
+
+def cy_estimate_resources(
+    int n_rows,
+    int n_columns,
+    # ROE
+    np.ndarray[np.double_t, ndim=1] dwell_times,
+    int prescan_offset,
+    int overscan_start,
+    int empty_traps_between_columns,
+    int empty_traps_for_first_transfers,
+    int force_release_away_from_readout,
+    int use_integer_express_matrix,
+    int n_pumps,
+    int roe_type,
+    # CCD
+    np.ndarray[np.double_t, ndim=1] fraction_of_traps_per_phase,
+    np.ndarray[np.double_t, ndim=1] full_well_depths,
+    np.ndarray[np.double_t, ndim=1] well_notch_depths,
+    np.ndarray[np.double_t, ndim=1] well_fill_powers,
+    # Traps
+    np.ndarray[np.double_t, ndim=1] trap_densities,
+    np.ndarray[np.double_t, ndim=1] trap_release_timescales,
+    np.ndarray[np.double_t, ndim=1] trap_third_params,
+    np.ndarray[np.double_t, ndim=1] trap_fourth_params,
+    int n_traps_ic,
+    int n_traps_sc,
+    int n_traps_ic_co,
+    int n_traps_sc_co,
+    # Misc
+    int express,
+    int window_offset,
+    int calibrate,
+    # Output
+    int verbosity,
+):
+    """
+    Cython wrapper for arctic's estimate_resources() in src/resources.cpp, for
+    one clocking direction.
+
+    Returns the 8 values of the ResourceEstimate in the order of its
+    attributes. See estimate_resources() in cti.py and interface.cpp.
+    """
+    cdef np.ndarray[np.double_t, ndim=1] estimate = np.zeros(8, dtype=np.double)
+
+    estimate_resources(
+        n_rows,
+        n_columns,
+        # ROE
+        &dwell_times[0],
+        len(dwell_times),
+        prescan_offset,
+        overscan_start,
+        empty_traps_between_columns,
+        empty_traps_for_first_transfers,
+        force_release_away_from_readout,
+        use_integer_express_matrix,
+        n_pumps,
+        roe_type,
+        # CCD
+        &fraction_of_traps_per_phase[0],
+        len(fraction_of_traps_per_phase),
+        &full_well_depths[0],
+        &well_notch_depths[0],
+        &well_fill_powers[0],
+        # Traps
+        &trap_densities[0],
+        &trap_release_timescales[0],
+        &trap_third_params[0],
+        &trap_fourth_params[0],
+        n_traps_ic,
+        n_traps_sc,
+        n_traps_ic_co,
+        n_traps_sc_co,
+        # Misc
+        express,
+        window_offset,
+        calibrate,
+        # Output
+        &estimate[0],
+        verbosity,
     )
 
-    return image
+    return estimate
@@ -0,0 +1,66 @@
+
+#ifndef ARCTIC_BATCH_HPP
+#define ARCTIC_BATCH_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <valarray>
+#include <vector>
+
+#include "model.hpp"
+
+/*
+    A thread-safe first-in-first-out queue with a maximum length, for passing
+    work between the stages of a pipeline.
+
+    push() waits while the queue is full. pop() waits while the queue is empty,
+    and returns false once the queue is both empty and closed.
+*/
+template <class T>
+class BoundedQueue {
+   public:
+    BoundedQueue(int max_size) : max_size(max_size), closed(false){};
+    ~BoundedQueue(){};
+
+    int max_size;
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return (int)items.size() < max_size; });
+        items.push_back(item);
+        not_empty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = items.front();
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+   private:
+    std::deque<T> items;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+std::string batch_output_filename(const std::string& filename, bool add);
+
+int run_batch(
+    std::vector<std::string>& filenames, CTIModel& model, bool add = false,
+    int n_iterations = -1, int queue_depth = 2, double memory_budget_mb = 1024);
+
+#endif  // ARCTIC_BATCH_HPP
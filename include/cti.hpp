@@ -2,10 +2,93 @@
 #ifndef ARCTIC_CTI_HPP
 #define ARCTIC_CTI_HPP
 
+#include <memory>
+#include <mutex>
+#include <valarray>
+#include <vector>
+
 #include "ccd.hpp"
 #include "roe.hpp"
+#include "trap_managers.hpp"
 #include "traps.hpp"
 
+class ClockingWorkspace {
+   public:
+    ClockingWorkspace(){};
+    ~ClockingWorkspace(){};
+
+    std::vector<TrapManagerManager> trap_manager_managers;
+    std::vector<std::valarray<std::valarray<double>>> strip_images;
+
+    void reserve(int n_strips);
+};
+
+class ClockingWorkspacePool {
+   public:
+    ClockingWorkspacePool(){};
+    ~ClockingWorkspacePool(){};
+
+    std::unique_ptr<ClockingWorkspace> acquire();
+    void release(std::unique_ptr<ClockingWorkspace> workspace);
+
+   private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ClockingWorkspace>> workspaces;
+};
+
+class ClockingCheckpoints {
+   public:
+    ClockingCheckpoints(int interval = 100, int max_n_states = 64)
+        : interval(interval),
+          max_n_states(max_n_states),
+          row_start(0),
+          n_active_rows(0),
+          column_start(0),
+          n_active_columns(0),
+          n_express_passes(0),
+          active_interval(0){};
+    ~ClockingCheckpoints(){};
+
+    int interval;
+    int max_n_states;
+    std::vector<int> first_changed_rows;
+
+    int row_start;
+    int n_active_rows;
+    int column_start;
+    int n_active_columns;
+    int n_express_passes;
+    int active_interval;
+    std::valarray<std::valarray<double>> image_out;
+    std::vector<std::vector<TrapStates>> column_states;
+
+    void clear();
+};
+
+class ClockingSettings {
+   public:
+    ClockingSettings();
+    ~ClockingSettings(){};
+
+    double collapse_factor;
+    double speculative_tolerance;
+    int speculative_n_warmup_columns;
+    double row_segment_tolerance;
+    int row_segment_n_warmup_rows;
+    double continuum_table_tolerance;
+};
+
+extern double collapse_factor;
+void set_collapse_trap_states(double factor);
+
+extern double speculative_tolerance;
+extern int speculative_n_warmup_columns;
+void set_speculative_columns(double tolerance, int n_warmup_columns = 2);
+
+extern double row_segment_tolerance;
+extern int row_segment_n_warmup_rows;
+void set_row_segments(double tolerance, int n_warmup_rows = 100);
+
 std::valarray<std::valarray<double>> clock_charge_in_one_direction(
     std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
     std::valarray<TrapInstantCapture>* traps_ic,
@@ -17,7 +100,38 @@ std::valarray<std::valarray<double>> clock_charge_in_one_direction(
     int column_start = 0, int column_stop = -1, 
     int time_start = 0, int time_stop = -1,
     double prune_n_electrons = 1e-10, int prune_frequency = 20,
-    int print_inputs = -1);
+    int print_inputs = -1, TrapManagerManager* trap_manager_manager_in = nullptr,
+    ClockingWorkspace* workspace = nullptr, ClockingCheckpoints* checkpoints = nullptr,
+    std::valarray<double>* column_density_scales = nullptr,
+    std::vector<TrapStates>* trap_states = nullptr,
+    ClockingSettings* settings = nullptr);
+
+void clock_column_window(
+    std::valarray<std::valarray<double>>& image, ROE* roe, CCD* ccd,
+    TrapManagerManager& trap_manager_manager, int row_start, int n_active_rows,
+    int column_index, double prune_n_electrons = 1e-10, int prune_frequency = 20);
+
+std::valarray<double> density_scales_from_map(
+    std::valarray<std::valarray<double>>& density_map, int n_columns);
+
+std::valarray<std::valarray<std::valarray<double>>> clock_charge_injection_batch(
+    std::valarray<std::valarray<std::valarray<double>>>& images, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co = nullptr, int express = 0,
+    int row_offset = 0, int row_start = 0, int row_stop = -1, int column_start = 0,
+    int column_stop = -1, double prune_n_electrons = 1e-10, int prune_frequency = 20);
+
+std::valarray<std::valarray<double>> pump_charge_in_all_pixels(
+    std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co = nullptr,
+    int row_start = 0, int row_stop = -1, int column_start = 0, int column_stop = -1,
+    double steady_state_tolerance = 1e-6, double prune_n_electrons = 1e-10,
+    int prune_frequency = 20);
 
 std::valarray<std::valarray<double>> add_cti(
     std::valarray<std::valarray<double>>& image_in,
@@ -41,7 +155,13 @@ std::valarray<std::valarray<double>> add_cti(
     int serial_window_start = 0, int serial_window_stop = -1, 
     int serial_time_start = 0, int serial_time_stop = -1,
     double serial_prune_n_electrons = 1e-10, int serial_prune_frequency = 20,
-    int verbosity = 0, int iteration = 0);
+    int verbosity = 0, int iteration = 0,
+    std::valarray<double>* parallel_density_scales = nullptr,
+    std::valarray<double>* serial_density_scales = nullptr,
+    std::vector<TrapStates>* parallel_trap_states = nullptr,
+    std::vector<TrapStates>* serial_trap_states = nullptr,
+    bool parallel_express_extrapolate = false, bool serial_express_extrapolate = false,
+    double* error_estimate = nullptr);
 
 std::valarray<std::valarray<double>> remove_cti(
     std::valarray<std::valarray<double>>& image_in, int n_iterations,
@@ -64,6 +184,34 @@ std::valarray<std::valarray<double>> remove_cti(
     int serial_express = 0, int serial_window_offset = 0, 
     int serial_window_start = 0, int serial_window_stop = -1, 
     int serial_time_start = 0, int serial_time_stop = -1,
-    double serial_prune_n_electrons = 1e-10, int serial_prune_frequency = 20);
+    double serial_prune_n_electrons = 1e-10, int serial_prune_frequency = 20,
+    std::valarray<std::valarray<double>>* image_estimate = nullptr,
+    std::valarray<double>* parallel_density_scales = nullptr,
+    std::valarray<double>* serial_density_scales = nullptr,
+    std::vector<TrapStates>* parallel_trap_states = nullptr,
+    std::vector<TrapStates>* serial_trap_states = nullptr,
+    bool parallel_express_extrapolate = false, bool serial_express_extrapolate = false,
+    double* error_estimate = nullptr);
+
+std::valarray<std::valarray<double>> clock_charge_in_one_direction_derivatives(
+    std::valarray<std::valarray<double>>& image_in,
+    std::valarray<std::valarray<std::valarray<double>>>& derivatives, ROE* roe,
+    CCD* ccd, std::valarray<TrapInstantCapture>* traps_ic, int express = 0,
+    int row_offset = 0, int row_start = 0, int row_stop = -1, int column_start = 0,
+    int column_stop = -1, int i_first_derivative = 0);
+
+std::valarray<std::valarray<double>> add_cti_derivatives(
+    std::valarray<std::valarray<double>>& image_in,
+    std::valarray<std::valarray<std::valarray<double>>>& derivatives,
+    // Parallel
+    ROE* parallel_roe = nullptr, CCD* parallel_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic = nullptr,
+    int parallel_express = 0, int parallel_window_offset = 0,
+    int parallel_window_start = 0, int parallel_window_stop = -1,
+    // Serial
+    ROE* serial_roe = nullptr, CCD* serial_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* serial_traps_ic = nullptr,
+    int serial_express = 0, int serial_window_offset = 0,
+    int serial_window_start = 0, int serial_window_stop = -1);
 
 #endif  // ARCTIC_CTI_HPP
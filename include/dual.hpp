@@ -0,0 +1,44 @@
+#ifndef ARCTIC_DUAL_HPP
+#define ARCTIC_DUAL_HPP
+
+#include <valarray>
+
+class Dual {
+   public:
+    Dual() : value(0.0), n_derivatives(0){};
+    Dual(double value) : value(value), n_derivatives(0){};
+    Dual(double value, int n_derivatives, int i_derivative);
+    Dual(double value, const std::valarray<double>& derivatives);
+    ~Dual(){};
+
+    // Enough for 2 per trap species for the parallel and serial traps combined
+    static const int max_n_derivatives = 16;
+
+    double value;
+    int n_derivatives;
+    double derivatives[max_n_derivatives];
+
+    double derivative(int i_derivative) const;
+
+    Dual& operator+=(const Dual& other);
+    Dual& operator-=(const Dual& other);
+    Dual& operator*=(const Dual& other);
+    Dual& operator*=(double factor);
+};
+
+Dual operator-(const Dual& a);
+Dual operator+(const Dual& a, const Dual& b);
+Dual operator-(const Dual& a, const Dual& b);
+Dual operator*(const Dual& a, const Dual& b);
+Dual operator/(const Dual& a, const Dual& b);
+
+Dual exp(const Dual& a);
+Dual pow(const Dual& a, double power);
+
+/*
+    The plain value of a number, for code templated on the scalar type.
+*/
+inline double value_of(double a) { return a; }
+inline double value_of(const Dual& a) { return a.value; }
+
+#endif  // ARCTIC_DUAL_HPP
@@ -0,0 +1,37 @@
+
+#ifndef ARCTIC_EXPRESS_HPP
+#define ARCTIC_EXPRESS_HPP
+
+#include <valarray>
+
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "roe.hpp"
+#include "trap_managers.hpp"
+#include "traps.hpp"
+
+std::valarray<std::valarray<double>> clock_charge_in_one_direction_adaptive_express(
+    std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, double express_tolerance,
+    int max_express = 0, int row_offset = 0, double prune_n_electrons = 1e-10,
+    int prune_frequency = 20, std::valarray<int>* column_express = nullptr,
+    TrapManagerManager* trap_manager_manager_in = nullptr,
+    ClockingSettings* settings = nullptr);
+
+std::valarray<std::valarray<double>> clock_charge_in_one_direction_extrapolated_express(
+    std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int express,
+    int row_offset = 0, double prune_n_electrons = 1e-10, int prune_frequency = 20,
+    double* error_estimate = nullptr,
+    TrapManagerManager* trap_manager_manager_in = nullptr,
+    ClockingWorkspace* workspace = nullptr,
+    std::valarray<double>* column_density_scales = nullptr,
+    ClockingSettings* settings = nullptr);
+
+#endif  // ARCTIC_EXPRESS_HPP
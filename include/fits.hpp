@@ -0,0 +1,45 @@
+
+#ifndef ARCTIC_FITS_HPP
+#define ARCTIC_FITS_HPP
+
+#include <string>
+#include <valarray>
+#include <vector>
+
+/*
+    Compression for saving FITS images, see save_image_to_fits():
+
+    fits_auto       Rice for *.fz files, otherwise none.
+    fits_none       An uncompressed primary image HDU.
+    fits_rice       Rice-compressed tiles of quantised values (lossy).
+    fits_gzip       GZIP-compressed tiles of the byte-shuffled values (lossless).
+*/
+enum FitsCompression { fits_auto = -1, fits_none, fits_rice, fits_gzip };
+
+/*
+    Global compression and quantisation step for saving FITS images with
+    save_image_to_file(), see set_fits_compression().
+*/
+extern int fits_compression;
+extern double fits_quantize_step;
+void set_fits_compression(int compression);
+void set_fits_quantize_step(double step);
+
+bool is_fits_filename(const std::string& filename);
+
+std::valarray<std::valarray<double>> load_image_from_fits(const char* filename);
+
+void load_image_shape_from_fits(const char* filename, int& n_rows, int& n_columns);
+
+void save_image_to_fits(
+    const char* filename, std::valarray<std::valarray<double>>& image,
+    int compression = fits_auto, double quantize_step = 0.01);
+
+// Tile codecs
+std::vector<unsigned char> rice_compress(
+    const int* values, int n_values, int bytepix = 4, int blocksize = 32);
+int rice_decompress(
+    const unsigned char* bytes, long n_bytes, int* values, int n_values,
+    int bytepix = 4, int blocksize = 32);
+
+#endif  // ARCTIC_FITS_HPP
@@ -0,0 +1,56 @@
+
+#ifndef ARCTIC_GEOMETRY_HPP
+#define ARCTIC_GEOMETRY_HPP
+
+#include <valarray>
+#include <vector>
+
+#include "model.hpp"
+
+class ReadoutRegion {
+   public:
+    ReadoutRegion(
+        CTIModel* model, int row_start = 0, int row_stop = -1, int column_start = 0,
+        int column_stop = -1, bool readout_at_row_stop = false,
+        bool readout_at_column_stop = false);
+    ~ReadoutRegion(){};
+
+    CTIModel* model;
+    int row_start;
+    int row_stop;
+    int column_start;
+    int column_stop;
+    bool readout_at_row_stop;
+    bool readout_at_column_stop;
+
+    std::valarray<std::valarray<double>> extract(
+        std::valarray<std::valarray<double>>& image);
+    void insert(
+        std::valarray<std::valarray<double>>& image,
+        std::valarray<std::valarray<double>>& region_image);
+};
+
+class ReadoutGeometry {
+   public:
+    ReadoutGeometry(){};
+    ReadoutGeometry(std::vector<ReadoutRegion> regions) : regions(regions){};
+    ~ReadoutGeometry(){};
+
+    std::vector<ReadoutRegion> regions;
+
+    void add_region(ReadoutRegion region);
+    std::vector<ReadoutRegion> resolve(int n_rows, int n_columns);
+};
+
+ReadoutGeometry quadrant_geometry(
+    int n_rows, int n_columns, CTIModel* model_a, CTIModel* model_b = nullptr,
+    CTIModel* model_c = nullptr, CTIModel* model_d = nullptr);
+
+std::valarray<std::valarray<double>> add_cti(
+    std::valarray<std::valarray<double>>& image_in, ReadoutGeometry& geometry);
+
+std::valarray<std::valarray<double>> remove_cti(
+    std::valarray<std::valarray<double>>& image_in, int n_iterations,
+    ReadoutGeometry& geometry);
+
+#endif  // ARCTIC_GEOMETRY_HPP
@@ -0,0 +1,81 @@
+
+#ifndef ARCTIC_JOBS_HPP
+#define ARCTIC_JOBS_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <valarray>
+
+#include "model.hpp"
+#include "server.hpp"
+
+enum JobStatus {
+    job_unknown,
+    job_queued,
+    job_running,
+    job_done,
+    job_cancelled,
+    job_failed
+};
+
+class CTIJob {
+   public:
+    CTIJob(
+        std::shared_ptr<CTIModel> model, std::valarray<std::valarray<double>> image,
+        bool add = true, int n_iterations = -1)
+        : model(model), image(image), add(add), n_iterations(n_iterations){};
+    ~CTIJob(){};
+
+    std::shared_ptr<CTIModel> model;
+    std::valarray<std::valarray<double>> image;
+    bool add;
+    int n_iterations;
+};
+
+typedef std::function<void(long, JobStatus, std::valarray<std::valarray<double>>&)>
+    JobCallback;
+
+class JobQueue {
+   public:
+    JobQueue(int n_workers = 0);
+    ~JobQueue();
+
+    long submit(CTIJob job, JobCallback callback = nullptr);
+    JobStatus poll(long handle);
+    JobStatus wait(
+        long handle, std::valarray<std::valarray<double>>* image_out = nullptr,
+        std::string* error_message_out = nullptr);
+    std::string error_message(long handle);
+    bool cancel(long handle);
+    long wait_any(double timeout = -1.0);
+    int n_pending();
+
+   private:
+    struct JobState {
+        JobState(CTIJob job, JobCallback callback)
+            : job(job), callback(callback), status(job_queued){};
+
+        CTIJob job;
+        JobCallback callback;
+        JobStatus status;
+        std::string error_message;
+    };
+
+    std::unordered_map<long, std::shared_ptr<JobState>> jobs;
+    std::deque<long> completed;
+    long next_handle;
+    int n_unfinished;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::unique_ptr<ThreadPool> pool;
+
+    void run_job(long handle, std::shared_ptr<JobState> state);
+    void finish_job(long handle, std::shared_ptr<JobState> state, JobStatus status);
+};
+
+#endif  // ARCTIC_JOBS_HPP
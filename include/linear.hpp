@@ -0,0 +1,119 @@
+
+#ifndef ARCTIC_LINEAR_HPP
+#define ARCTIC_LINEAR_HPP
+
+#include <valarray>
+
+#include "ccd.hpp"
+#include "roe.hpp"
+#include "traps.hpp"
+
+class TrailKernels {
+   public:
+    TrailKernels()
+        : n_rows(0),
+          n_kernels(0),
+          n_flux_levels(0),
+          d_min(0),
+          d_max(-1),
+          nonlinearity(0.0),
+          trail_fraction(0.0){};
+    TrailKernels(
+        int n_rows, ROE* roe, CCD* ccd, std::valarray<TrapInstantCapture>* traps_ic,
+        std::valarray<TrapSlowCapture>* traps_sc,
+        std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+        std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int express = 0,
+        int row_offset = 0, double reference_n_electrons = 100.0, int n_kernels = 8,
+        int n_flux_levels = 8, double kernel_tolerance = 1e-8);
+    ~TrailKernels(){};
+
+    int n_rows;
+    int n_kernels;
+    std::valarray<int> kernel_rows;
+    int n_flux_levels;
+    std::valarray<double> flux_levels;
+    int d_min;
+    int d_max;
+    std::valarray<std::valarray<double>> kernels;
+    double nonlinearity;
+    double trail_fraction;
+
+    void kernel_weights(
+        int source_row, double n_electrons, int* i_kernels, double* weights);
+    void add_trails(
+        std::valarray<std::valarray<double>>& image_in,
+        std::valarray<std::valarray<double>>& image_out, int column_index,
+        double scale = 1.0);
+    void remove_trails(
+        std::valarray<std::valarray<double>>& image_in,
+        std::valarray<std::valarray<double>>& image_out, int column_index);
+};
+
+std::valarray<std::valarray<double>> clock_charge_in_one_direction_linearised(
+    std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co = nullptr, int express = 0,
+    int row_offset = 0, double flux_threshold = 100.0, int n_kernels = 8,
+    double* error_bound = nullptr, double prune_n_electrons = 1e-10,
+    int prune_frequency = 20, std::valarray<double>* column_error_bounds = nullptr);
+
+std::valarray<std::valarray<double>> add_cti_linearised(
+    std::valarray<std::valarray<double>>& image_in,
+    // Parallel
+    ROE* parallel_roe = nullptr, CCD* parallel_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co = nullptr,
+    int parallel_express = 0, int parallel_window_offset = 0,
+    // Serial
+    ROE* serial_roe = nullptr, CCD* serial_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* serial_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* serial_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co = nullptr,
+    int serial_express = 0, int serial_window_offset = 0,
+    // Linearisation
+    double flux_threshold = 100.0, int n_kernels = 8, double* error_bound = nullptr);
+
+std::valarray<std::valarray<double>> remove_cti_linearised(
+    std::valarray<std::valarray<double>>& image_in, int n_iterations,
+    // Parallel
+    ROE* parallel_roe = nullptr, CCD* parallel_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co = nullptr,
+    int parallel_express = 0, int parallel_window_offset = 0,
+    // Serial
+    ROE* serial_roe = nullptr, CCD* serial_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* serial_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* serial_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co = nullptr,
+    int serial_express = 0, int serial_window_offset = 0,
+    // Linearisation
+    double flux_threshold = 100.0, int n_kernels = 8, double* error_bound = nullptr);
+
+std::valarray<std::valarray<double>> estimate_remove_cti_linearised(
+    std::valarray<std::valarray<double>>& image_in,
+    // Parallel
+    ROE* parallel_roe = nullptr, CCD* parallel_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co = nullptr,
+    int parallel_express = 0, int parallel_window_offset = 0,
+    // Serial
+    ROE* serial_roe = nullptr, CCD* serial_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* serial_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* serial_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co = nullptr,
+    int serial_express = 0, int serial_window_offset = 0,
+    // Linearisation
+    double reference_n_electrons = 100.0, int n_kernels = 8);
+
+#endif  // ARCTIC_LINEAR_HPP
@@ -0,0 +1,115 @@
+
+#ifndef ARCTIC_MODEL_HPP
+#define ARCTIC_MODEL_HPP
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <valarray>
+#include <vector>
+
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "roe.hpp"
+#include "trap_managers.hpp"
+#include "traps.hpp"
+
+class ClockingModel {
+   public:
+    ClockingModel();
+    ~ClockingModel(){};
+
+    // ROE
+    std::valarray<double> dwell_times;
+    bool charge_injection;
+    int prescan_offset;
+    int overscan_start;
+    bool empty_traps_between_columns;
+    bool empty_traps_for_first_transfers;
+    bool force_release_away_from_readout;
+    bool use_integer_express_matrix;
+
+    // CCD
+    double full_well_depth;
+    double well_notch_depth;
+    double well_fill_power;
+    std::valarray<double> fraction_of_traps_per_phase;
+
+    // Traps
+    std::valarray<TrapInstantCapture> traps_ic;
+    std::valarray<TrapSlowCapture> traps_sc;
+    std::valarray<TrapInstantCaptureContinuum> traps_ic_co;
+    std::valarray<TrapSlowCaptureContinuum> traps_sc_co;
+    std::valarray<double> density_scales;
+
+    // Clocking
+    int express;
+    double express_tolerance;
+    bool express_extrapolate;
+    int window_offset;
+    double prune_n_electrons;
+    int prune_frequency;
+    ClockingSettings settings;
+
+    // Prepared trap managers, and reusable workspaces for their working copies
+    TrapManagerManager trap_manager_manager;
+    int n_rows_prepared;
+    int n_columns_prepared;
+    std::shared_ptr<ClockingWorkspacePool> workspace_pool;
+
+    bool has_traps();
+    CCD make_ccd();
+    int set_parameter(std::string& key, std::string& value, std::string& message);
+    int check(std::string& message);
+    void prepare(int n_rows, int n_columns);
+    std::valarray<std::valarray<double>> clock_charge(
+        std::valarray<std::valarray<double>>& image,
+        ClockingCheckpoints* checkpoints = nullptr, double* error_estimate = nullptr);
+    std::valarray<std::valarray<double>> estimate_unclocked(
+        std::valarray<std::valarray<double>>& image,
+        double reference_n_electrons = 100.0, int n_kernels = 8);
+};
+
+class CTICheckpoints {
+   public:
+    CTICheckpoints(int interval = 100) : interval(interval){};
+    ~CTICheckpoints(){};
+
+    int interval;
+    std::vector<ClockingCheckpoints> parallel;
+    std::vector<ClockingCheckpoints> serial;
+};
+
+class CTIModel {
+   public:
+    CTIModel() : n_iterations(3){};
+    ~CTIModel(){};
+
+    ClockingModel parallel;
+    ClockingModel serial;
+    int n_iterations;
+
+    void prepare(int n_rows, int n_columns);
+    std::valarray<std::valarray<double>> add_cti(
+        std::valarray<std::valarray<double>>& image,
+        ClockingCheckpoints* parallel_checkpoints = nullptr,
+        ClockingCheckpoints* serial_checkpoints = nullptr,
+        double* error_estimate = nullptr);
+    std::valarray<std::valarray<double>> remove_cti(
+        std::valarray<std::valarray<double>>& image, int n_iterations = -1,
+        CTICheckpoints* checkpoints = nullptr,
+        std::valarray<std::valarray<double>>* image_estimate = nullptr,
+        double* error_estimate = nullptr);
+    std::valarray<std::valarray<double>> estimate_remove_cti(
+        std::valarray<std::valarray<double>>& image,
+        double reference_n_electrons = 100.0, int n_kernels = 8);
+    std::valarray<std::valarray<double>> remove_cti_again(
+        std::valarray<std::valarray<double>>& image,
+        const std::vector<std::pair<int, int>>& changed_pixels,
+        CTICheckpoints& checkpoints);
+};
+
+int load_model_from_text(
+    const std::string& text, CTIModel& model, std::string& message);
+
+#endif  // ARCTIC_MODEL_HPP
@@ -0,0 +1,50 @@
+
+#ifndef ARCTIC_RESOURCES_HPP
+#define ARCTIC_RESOURCES_HPP
+
+#include <string>
+#include <valarray>
+
+#include "ccd.hpp"
+#include "model.hpp"
+#include "roe.hpp"
+#include "traps.hpp"
+
+class ResourceEstimate {
+   public:
+    ResourceEstimate()
+        : image_bytes(0.0),
+          express_setup_bytes(0.0),
+          express_bytes(0.0),
+          trap_manager_bytes(0.0),
+          table_bytes(0.0),
+          peak_bytes(0.0),
+          n_pixel_transfers(0.0),
+          runtime(0.0){};
+    ~ResourceEstimate(){};
+
+    double image_bytes;
+    double express_setup_bytes;
+    double express_bytes;
+    double trap_manager_bytes;
+    double table_bytes;
+    double peak_bytes;
+    double n_pixel_transfers;
+    double runtime;
+
+    std::string to_text();
+};
+
+ResourceEstimate estimate_resources(
+    int n_rows, int n_columns, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co = nullptr, int express = 0,
+    int row_offset = 0, bool calibrate = true);
+
+ResourceEstimate estimate_resources(
+    int n_rows, int n_columns, CTIModel& model, int n_iterations = 0,
+    bool calibrate = true);
+
+#endif  // ARCTIC_RESOURCES_HPP
@@ -53,6 +53,7 @@ class ROE {
     bool use_integer_express_matrix;
 
     std::valarray<double> express_matrix;
+    std::valarray<double> express_multipliers;
     std::valarray<bool> store_trap_states_matrix;
     std::valarray<std::valarray<ROEStepPhase>> clock_sequence;
 
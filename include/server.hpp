@@ -0,0 +1,66 @@
+
+#ifndef ARCTIC_SERVER_HPP
+#define ARCTIC_SERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "model.hpp"
+
+class ThreadPool {
+   public:
+    ThreadPool(int n_workers);
+    ~ThreadPool();
+
+    int n_workers;
+
+    void submit(std::function<void()> task);
+
+   private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    int n_threads;
+    int n_busy;
+    bool stopping;
+
+    void run_worker();
+};
+
+class ModelCache {
+   public:
+    ModelCache(int capacity = 8);
+    ~ModelCache(){};
+
+    int capacity;
+    std::atomic<int> n_hits;
+    std::atomic<int> n_misses;
+
+    std::shared_ptr<CTIModel> get(
+        const std::string& text, int n_rows, int n_columns, std::string& message);
+    int size();
+
+   private:
+    typedef std::pair<std::string, std::shared_ptr<CTIModel>> Entry;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::mutex mutex;
+};
+
+std::string process_server_request(const std::string& request, ModelCache& cache);
+
+int run_server(const char* socket_path, int cache_size = 8, int n_workers = 0);
+
+std::string send_server_request(const char* socket_path, const std::string& request);
+
+#endif  // ARCTIC_SERVER_HPP
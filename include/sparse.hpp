@@ -0,0 +1,75 @@
+
+#ifndef ARCTIC_SPARSE_HPP
+#define ARCTIC_SPARSE_HPP
+
+#include <valarray>
+
+#include "ccd.hpp"
+#include "roe.hpp"
+#include "traps.hpp"
+
+class PixelEvent {
+   public:
+    PixelEvent() : row(0), column(0), n_electrons(0.0){};
+    PixelEvent(int row, int column, double n_electrons)
+        : row(row), column(column), n_electrons(n_electrons){};
+    ~PixelEvent(){};
+
+    int row;
+    int column;
+    double n_electrons;
+};
+
+std::valarray<std::valarray<double>> image_from_events(
+    std::valarray<PixelEvent>& events, int n_rows, int n_columns);
+
+std::valarray<PixelEvent> events_from_image(
+    std::valarray<std::valarray<double>>& image, double threshold = 0.0);
+
+std::valarray<PixelEvent> add_cti_sparse(
+    std::valarray<PixelEvent>& events, int n_rows, int n_columns,
+    // Parallel
+    ROE* parallel_roe = nullptr, CCD* parallel_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co = nullptr,
+    int parallel_express = 0, int parallel_window_offset = 0,
+    int parallel_max_trail_length = -1, double parallel_prune_n_electrons = 1e-10,
+    int parallel_prune_frequency = 20,
+    // Serial
+    ROE* serial_roe = nullptr, CCD* serial_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* serial_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* serial_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co = nullptr,
+    int serial_express = 0, int serial_window_offset = 0,
+    int serial_max_trail_length = -1, double serial_prune_n_electrons = 1e-10,
+    int serial_prune_frequency = 20,
+    // Output
+    double threshold = 0.0, double min_event_n_electrons = 1e-3);
+
+std::valarray<PixelEvent> remove_cti_sparse(
+    std::valarray<PixelEvent>& events, int n_iterations, int n_rows, int n_columns,
+    // Parallel
+    ROE* parallel_roe = nullptr, CCD* parallel_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co = nullptr,
+    int parallel_express = 0, int parallel_window_offset = 0,
+    int parallel_max_trail_length = -1, double parallel_prune_n_electrons = 1e-10,
+    int parallel_prune_frequency = 20,
+    // Serial
+    ROE* serial_roe = nullptr, CCD* serial_ccd = nullptr,
+    std::valarray<TrapInstantCapture>* serial_traps_ic = nullptr,
+    std::valarray<TrapSlowCapture>* serial_traps_sc = nullptr,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co = nullptr,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co = nullptr,
+    int serial_express = 0, int serial_window_offset = 0,
+    int serial_max_trail_length = -1, double serial_prune_n_electrons = 1e-10,
+    int serial_prune_frequency = 20,
+    // Output
+    double threshold = 0.0, double min_event_n_electrons = 1e-3);
+
+#endif  // ARCTIC_SPARSE_HPP
@@ -0,0 +1,62 @@
+
+#ifndef ARCTIC_TRACE_HPP
+#define ARCTIC_TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/*
+    Global trace level for recording timeline spans, see start_trace():
+
+    0       Off.
+    1       Setup, table preparation, iterations, and strips of columns.
+    2       Also each column and express pass.
+    3       Also watermark pruning and trap-state store/restore.
+
+    Atomic since it is read by every span on the worker threads, while tracing
+    may be started or stopped from another thread.
+*/
+extern std::atomic<int> trace_level;
+
+void start_trace(int level = 2);
+void stop_trace();
+void clear_trace();
+int save_trace(const char* filename);
+
+class TraceEvent {
+   public:
+    TraceEvent() : name(nullptr), tid(0), start_ns(0), duration_ns(0), index(-1){};
+    ~TraceEvent(){};
+
+    const char* name;
+    int tid;
+    long long start_ns;
+    long long duration_ns;
+    int index;
+};
+
+std::vector<TraceEvent> get_trace_events();
+std::string trace_events_to_json(const std::vector<TraceEvent>& events);
+
+void record_trace_event(
+    const char* name, std::chrono::steady_clock::time_point start, int index);
+
+class TraceSpan {
+   public:
+    TraceSpan(const char* name, int level, int index = -1)
+        : name(name), index(index), active(trace_level >= level) {
+        if (active) start = std::chrono::steady_clock::now();
+    };
+    ~TraceSpan() {
+        if (active) record_trace_event(name, start, index);
+    };
+
+    const char* name;
+    int index;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif  // ARCTIC_TRACE_HPP
@@ -3,10 +3,15 @@
 #define ARCTIC_TRAP_MANAGERS_HPP
 
 #include <valarray>
+#include <vector>
 
 #include "ccd.hpp"
+#include "dual.hpp"
 #include "traps.hpp"
 
+extern double continuum_table_tolerance;
+void set_continuum_table_tolerance(double tolerance);
+
 class TrapManagerBase {
    public:
     TrapManagerBase(){};
@@ -38,13 +43,19 @@ class TrapManagerBase {
     void reset_trap_states();
     void store_trap_states();
     void restore_trap_states();
+    void save_trap_state(std::valarray<double>& volumes, std::valarray<double>& fills);
+    void load_trap_state(
+        const std::valarray<double>& volumes, const std::valarray<double>& fills);
+    void scale_trap_densities(double factor);
     virtual void setup();
 
     virtual double n_trapped_electrons_in_watermark(int i_wmk);
     virtual std::valarray<double> n_trapped_electrons_per_watermark();
     virtual double n_trapped_electrons_total();
+    double n_trapped_electrons_up_to(double max_n_electrons);
     virtual double n_trapped_electrons_from_watermarks(
-        std::valarray<double> wmk_volumes, std::valarray<double> wmk_fills);
+        const std::valarray<double>& wmk_volumes,
+        const std::valarray<double>& wmk_fills);
     int watermark_index_above_cloud(double cloud_fractional_volume);
     virtual double n_electrons_released_from_wmk_above_cloud(int i_wmk);
 };
@@ -109,6 +120,7 @@ class TrapManagerInstantCaptureContinuum : public TrapManagerBase {
     double time_min;
     double time_max;
     int n_intp;
+    double table_tolerance;
 
     void prepare_interpolation_tables();
     void setup();
@@ -136,6 +148,7 @@ class TrapManagerSlowCaptureContinuum : public TrapManagerBase {
     double time_min;
     double time_max;
     int n_intp;
+    double table_tolerance;
 
     void prepare_interpolation_tables();
     void setup();
@@ -144,15 +157,29 @@ class TrapManagerSlowCaptureContinuum : public TrapManagerBase {
     double n_electrons_released_from_wmk_above_cloud(int i_wmk);
 };
 
+class TrapStates {
+   public:
+    TrapStates() : density_scale(1.0){};
+    ~TrapStates(){};
+
+    std::valarray<std::valarray<double>> watermark_volumes;
+    std::valarray<std::valarray<double>> watermark_fills;
+    double density_scale;
+
+    double difference(const TrapStates& other) const;
+    std::valarray<double> to_array() const;
+    void from_array(const std::valarray<double>& array);
+};
+
 class TrapManagerManager {
    public:
-    TrapManagerManager(){};
+    TrapManagerManager() : column_density_scales(nullptr), density_scale(1.0){};
     TrapManagerManager(
         std::valarray<TrapInstantCapture>& traps_ic,
         std::valarray<TrapSlowCapture>& traps_sc,
         std::valarray<TrapInstantCaptureContinuum>& traps_ic_co,
         std::valarray<TrapSlowCaptureContinuum>& traps_sc_co, int max_n_transfers,
-        CCD ccd, std::valarray<double>& dwell_times);
+        CCD ccd, std::valarray<double>& dwell_times, double table_tolerance = -1.0);
     ~TrapManagerManager(){};
 
     std::valarray<TrapInstantCapture> traps_ic;
@@ -171,10 +198,89 @@ class TrapManagerManager {
     std::valarray<TrapManagerInstantCaptureContinuum> trap_managers_ic_co;
     std::valarray<TrapManagerSlowCaptureContinuum> trap_managers_sc_co;
 
+    const double* column_density_scales;
+    double density_scale;
+
+    void reset_trap_states();
+    void store_trap_states();
+    void restore_trap_states();
+    void prune_watermarks(double min_n_electrons = 0);
+    bool collapse_trap_states(double min_n_electrons);
+    double n_electrons_released_and_captured(int phase_index, double n_free_electrons);
+    std::vector<TrapManagerBase*> all_trap_managers();
+    void save_trap_states(TrapStates& states);
+    void load_trap_states(const TrapStates& states);
+    void set_density_scale(double scale);
+    void set_column_density_scale(int column_index);
+};
+
+class TrapManagerInstantCaptureDual {
+   public:
+    TrapManagerInstantCaptureDual(){};
+    TrapManagerInstantCaptureDual(
+        std::valarray<TrapInstantCapture> traps, int max_n_transfers,
+        CCDPhase ccd_phase, double dwell_time, double fraction_of_traps,
+        int n_derivatives, int i_first_derivative);
+    ~TrapManagerInstantCaptureDual(){};
+
+    std::valarray<TrapInstantCapture> traps;
+    int max_n_transfers;
+    CCDPhase ccd_phase;
+    double dwell_time;
+    int n_derivatives;
+
+    std::valarray<Dual> watermark_volumes;
+    std::valarray<Dual> watermark_fills;
+    std::valarray<Dual> stored_watermark_volumes;
+    std::valarray<Dual> stored_watermark_fills;
+
+    int n_traps;
+    int n_active_watermarks;
+    int i_first_active_wmk;
+    int n_watermarks;
+    int stored_n_active_watermarks;
+    int stored_i_first_active_wmk;
+
+    std::valarray<Dual> trap_densities;
+    std::valarray<Dual> empty_probabilities_from_release;
+    bool any_non_uniform_traps;
+
+    void initialise_trap_states();
+    void reset_trap_states();
+    void store_trap_states();
+    void restore_trap_states();
+    void setup();
+
+    Dual cloud_fractional_volume_from_electrons(Dual n_electrons);
+    int watermark_index_above_cloud(double cloud_fractional_volume);
+    Dual n_electrons_released();
+    void update_watermarks_capture(Dual cloud_fractional_volume, int i_wmk_above_cloud);
+    void update_watermarks_capture_not_enough(
+        Dual cloud_fractional_volume, int i_wmk_above_cloud, Dual enough);
+    Dual n_electrons_captured(Dual n_free_electrons);
+    Dual n_electrons_released_and_captured(Dual n_free_electrons);
+};
+
+class TrapManagerManagerDual {
+   public:
+    TrapManagerManagerDual(){};
+    TrapManagerManagerDual(
+        std::valarray<TrapInstantCapture>& traps_ic, int max_n_transfers, CCD ccd,
+        std::valarray<double>& dwell_times, int n_derivatives, int i_first_derivative);
+    ~TrapManagerManagerDual(){};
+
+    int max_n_transfers;
+    CCD ccd;
+
+    int n_traps_ic;
+    std::valarray<TrapManagerInstantCaptureDual> trap_managers_ic;
+
     void reset_trap_states();
     void store_trap_states();
     void restore_trap_states();
     void prune_watermarks(double min_n_electrons = 0);
+    bool collapse_trap_states(double min_n_electrons);
+    Dual n_electrons_released_and_captured(int phase_index, Dual n_free_electrons);
 };
 
 #endif  // ARCTIC_TRAP_MANAGERS_HPP
@@ -58,9 +58,12 @@ class TrapInstantCaptureContinuum : public TrapInstantCapture {
     double fill_min;
     double fill_max;
     double d_log_time;
+    std::valarray<double> log_time_table;
+    std::valarray<int> knot_index_table;
+    double d_log_index;
 
     void prep_fill_fraction_and_time_elapsed_tables(
-        double time_min, double time_max, int n_intp = 1000);
+        double time_min, double time_max, int n_intp = 1000, double tolerance = 0.0);
     double fill_fraction_from_time_elapsed_table(double time_elapsed);
     double time_elapsed_from_fill_fraction_table(double fill_fraction);
 };
@@ -89,9 +92,12 @@ class TrapSlowCaptureContinuum : public TrapInstantCapture {
     double fill_min;
     double fill_max;
     double d_log_time;
+    std::valarray<double> log_time_table;
+    std::valarray<int> knot_index_table;
+    double d_log_index;
 
     void prep_fill_fraction_and_time_elapsed_tables(
-        double time_min, double time_max, int n_intp);
+        double time_min, double time_max, int n_intp, double tolerance = 0.0);
     double fill_fraction_from_time_elapsed_table(double time_elapsed);
     double time_elapsed_from_fill_fraction_table(double fill_fraction);
 
@@ -103,9 +109,13 @@ class TrapSlowCaptureContinuum : public TrapInstantCapture {
     double fill_capture_min;
     double fill_capture_max;
     double fill_capture_long_time;
+    std::valarray<double> log_time_capture_table;
+    std::valarray<int> knot_index_capture_table;
+    double d_log_index_capture;
 
     void prep_fill_fraction_after_slow_capture_tables(
-        double dwell_time, double time_min, double time_max, int n_intp);
+        double dwell_time, double time_min, double time_max, int n_intp,
+        double tolerance = 0.0);
     double fill_fraction_after_slow_capture_table(double time_elapsed);
 };
 
@@ -0,0 +1,52 @@
+
+#ifndef ARCTIC_TUNE_HPP
+#define ARCTIC_TUNE_HPP
+
+#include <string>
+#include <valarray>
+
+#include "model.hpp"
+
+class TuneSettings {
+   public:
+    TuneSettings()
+        : is_tuned(false),
+          express(0),
+          prune_n_electrons(1e-10),
+          prune_frequency(20),
+          max_error(0.0),
+          time(0.0),
+          time_reference(0.0){};
+    ~TuneSettings(){};
+
+    bool is_tuned;
+    int express;
+    double prune_n_electrons;
+    int prune_frequency;
+    double max_error;
+    double time;
+    double time_reference;
+};
+
+class TuneResult {
+   public:
+    TuneResult() : target_error(0.0){};
+    ~TuneResult(){};
+
+    double target_error;
+    TuneSettings parallel;
+    TuneSettings serial;
+
+    std::string to_text();
+    void apply(CTIModel& model);
+};
+
+TuneSettings tune_clocking_model(
+    std::valarray<std::valarray<double>>& image, ClockingModel& model,
+    double target_error, int max_n_probe_columns = 64, int n_repeats = 3);
+
+TuneResult autotune(
+    std::valarray<std::valarray<double>>& image, CTIModel& model,
+    double target_error, int max_n_probe_columns = 64, int n_repeats = 3);
+
+#endif  // ARCTIC_TUNE_HPP
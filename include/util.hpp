@@ -5,6 +5,9 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <functional>
+#include <stdexcept>
+#include <string>
 #include <valarray>
 #include <vector>
 
@@ -36,17 +39,34 @@ void set_verbosity(int v);
     })
 
 /*
-    Print an error message, including its origin, and exit.
+    Print an error message, including its origin, and exit. Or throw it as an
+    ArcticError instead while the thread has a ThrowErrors guard.
 */
 #define error(message, ...)                                                            \
     ({                                                                                 \
-        fflush(stdout);                                                                \
-        fprintf(                                                                       \
-            stderr, "%s:%s():%i: " message "\n", __FILENAME__, __FUNCTION__, __LINE__, \
-            ##__VA_ARGS__);                                                            \
-        exit(1);                                                                       \
+        char error_message_[4096];                                                     \
+        snprintf(                                                                      \
+            error_message_, sizeof(error_message_), "%s:%s():%i: " message,            \
+            __FILENAME__, __FUNCTION__, __LINE__, ##__VA_ARGS__);                      \
+        raise_error(error_message_);                                                   \
     })
 
+class ArcticError : public std::runtime_error {
+   public:
+    ArcticError(const std::string& message) : std::runtime_error(message){};
+};
+
+class ThrowErrors {
+   public:
+    ThrowErrors();
+    ~ThrowErrors();
+
+   private:
+    bool was_throwing;
+};
+
+[[noreturn]] void raise_error(const char* message);
+
 void print_version();
 
 void print_array(std::valarray<double>& array);
@@ -55,6 +75,39 @@ void print_array_2D(std::valarray<double>& image, int n_col);
 
 void print_array_2D(std::valarray<std::valarray<double>>& array);
 
+// ========
+// Threads
+// ========
+/*
+    Global number of threads to use for parallelised loops:
+
+    0       Use all available hardware threads.
+    1       Run serially.
+    n       Use up to n threads.
+*/
+extern int n_threads;
+void set_n_threads(int n);
+int get_n_threads();
+void set_thread_limit(int n);
+
+void parallel_for(
+    int n_tasks, std::function<void(int)> task, bool share_threads = false);
+
+/*
+    Global NUMA mode for parallelised loops over image strips:
+
+    0       Off.
+    -1      Use the NUMA nodes from /sys/devices/system/node.
+    n       Split the available CPUs into n pseudo-nodes, e.g. for testing.
+*/
+extern int numa_mode;
+void set_numa_mode(int mode);
+
+std::vector<int> parse_cpu_list(const char* cpu_list);
+std::vector<std::vector<int>> get_numa_nodes();
+bool pin_thread_to_cpus(const std::vector<int>& cpus);
+void parallel_for_numa(int n_tasks, std::function<void(int)> task);
+
 // ========
 // Arrays
 // ========
@@ -73,6 +126,13 @@ std::valarray<std::valarray<double>> load_image_from_txt(const char* filename);
 void save_image_to_txt(
     const char* filename, std::valarray<std::valarray<double>> image);
 
+std::valarray<std::valarray<double>> load_image_from_file(const char* filename);
+
+void load_image_shape_from_file(const char* filename, int& n_rows, int& n_columns);
+
+void save_image_to_file(
+    const char* filename, std::valarray<std::valarray<double>>& image);
+
 // ========
 // Misc
 // ========
@@ -0,0 +1,257 @@
+
+#include "batch.hpp"
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <valarray>
+#include <vector>
+
+#include "model.hpp"
+#include "util.hpp"
+
+/*
+    One image passing through the batch pipeline.
+*/
+class BatchImage {
+   public:
+    BatchImage(int index, double n_bytes_budget)
+        : index(index), n_bytes_budget(n_bytes_budget){};
+    ~BatchImage(){};
+
+    int index;
+    std::valarray<std::valarray<double>> image;
+
+    // The memory acquired from the budget for this image, released once saved
+    double n_bytes_budget;
+};
+
+/*
+    The memory for an image of a given shape.
+*/
+static double image_n_bytes(int n_rows, int n_columns) {
+    return (double)n_rows * n_columns * sizeof(double);
+}
+
+/*
+    The memory used by images between being loaded and saved, to limit how far
+    the loading can run ahead of the other stages.
+*/
+class MemoryBudget {
+   public:
+    MemoryBudget(double max_bytes) : max_bytes(max_bytes), n_bytes(0.0){};
+    ~MemoryBudget(){};
+
+    double max_bytes;
+
+    // Wait for space, but always allow one image so that a large one can't block
+    void acquire(double bytes) {
+        std::unique_lock<std::mutex> lock(mutex);
+        freed.wait(
+            lock, [&] { return (n_bytes == 0.0) || (n_bytes + bytes <= max_bytes); });
+        n_bytes += bytes;
+    }
+
+    void release(double bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        n_bytes -= bytes;
+        freed.notify_all();
+    }
+
+   private:
+    double n_bytes;
+    std::mutex mutex;
+    std::condition_variable freed;
+};
+
+/*
+    The output file name for an input file, with _cti_added or _cti_removed
+    inserted before the extension, e.g. image.txt -> image_cti_removed.txt, or
+    before both extensions of compressed files, e.g. image.fits.fz ->
+    image_cti_removed.fits.fz.
+*/
+std::string batch_output_filename(const std::string& filename, bool add) {
+    std::string suffix = add ? "_cti_added" : "_cti_removed";
+    size_t i_dot = filename.rfind('.');
+    size_t i_slash = filename.rfind('/');
+    if ((i_dot != std::string::npos) && (i_dot > 0) &&
+        ((filename.substr(i_dot) == ".fz") || (filename.substr(i_dot) == ".gz"))) {
+        size_t i_dot_inner = filename.rfind('.', i_dot - 1);
+        if ((i_dot_inner != std::string::npos) &&
+            ((i_slash == std::string::npos) || (i_dot_inner > i_slash)))
+            i_dot = i_dot_inner;
+    }
+
+    if ((i_dot == std::string::npos) ||
+        ((i_slash != std::string::npos) && (i_dot < i_slash)))
+        return filename + suffix;
+
+    return filename.substr(0, i_dot) + suffix + filename.substr(i_dot);
+}
+
+/*
+    Add or remove CTI from a batch of image files, with the loading, clocking,
+    and saving overlapped in a pipeline.
+
+    A loading thread reads ahead and a saving thread writes behind while each
+    image is being corrected, so the throughput is set by the slowest stage
+    instead of the sum of all three. The queues between the stages hold at most
+    queue_depth images each, and loading also waits while the images in flight
+    would exceed the memory budget.
+
+    Parameters
+    ----------
+    filenames : std::vector<std::string>&
+        The input image text or FITS files, see load_image_from_file(). Each
+        output is saved to batch_output_filename() in the same format, see
+        save_image_to_file() for the FITS compression.
+
+    model : CTIModel&
+        The CTI model, prepared for each image shape in turn.
+
+    add : bool (opt.)
+        Add CTI instead of removing it (default).
+
+    n_iterations : int (opt.)
+        The number of iterations for removing CTI, or -1 to use the model's.
+
+    queue_depth : int (opt.)
+        The maximum number of images waiting between each pair of stages.
+
+    memory_budget_mb : double (opt.)
+        The maximum memory (MB) for images between being loaded and saved,
+        except that one image is always allowed.
+
+    Returns
+    -------
+    status : int
+        0 for success, or 1 if any file failed to load and was skipped.
+*/
+int run_batch(
+    std::vector<std::string>& filenames, CTIModel& model, bool add, int n_iterations,
+    int queue_depth, double memory_budget_mb) {
+
+    int n_files = filenames.size();
+    if (queue_depth < 1) queue_depth = 1;
+
+    BoundedQueue<std::shared_ptr<BatchImage>> loaded_queue(queue_depth);
+    BoundedQueue<std::shared_ptr<BatchImage>> corrected_queue(queue_depth);
+    MemoryBudget memory_budget(memory_budget_mb * 1024 * 1024);
+    double time_load = 0.0;
+    double time_save = 0.0;
+    double time_clock = 0.0;
+    int n_skipped = 0;
+
+    print_v(
+        1, "Batch: %d file(s), queue depth %d, memory budget %g MB \n", n_files,
+        queue_depth, memory_budget_mb);
+
+    struct timeval wall_time_start;
+    struct timeval wall_time_end;
+    gettimeofday(&wall_time_start, nullptr);
+
+    // Load ahead
+    std::thread loader([&]() {
+        struct timeval time_start;
+        struct timeval time_end;
+
+        int n_rows;
+        int n_columns;
+
+        // Report and skip a file that fails to load, instead of exiting from
+        // this thread with the others still running
+        ThrowErrors throw_errors;
+
+        for (int i_file = 0; i_file < n_files; i_file++) {
+            std::shared_ptr<BatchImage> item;
+            try {
+                // Wait for space for the image before loading it, from its shape
+                load_image_shape_from_file(
+                    filenames[i_file].c_str(), n_rows, n_columns);
+                item.reset(new BatchImage(i_file, image_n_bytes(n_rows, n_columns)));
+                memory_budget.acquire(item->n_bytes_budget);
+
+                gettimeofday(&time_start, nullptr);
+                item->image = load_image_from_file(filenames[i_file].c_str());
+                gettimeofday(&time_end, nullptr);
+                time_load += gettimelapsed(time_start, time_end);
+
+                if ((item->image.size() == 0) || (item->image[0].size() == 0))
+                    error("Empty image");
+            } catch (const ArcticError& e) {
+                if (item != nullptr) memory_budget.release(item->n_bytes_budget);
+                fflush(stdout);
+                fprintf(
+                    stderr, "Skipping '%s': %s\n", filenames[i_file].c_str(),
+                    e.what());
+                n_skipped++;
+                continue;
+            }
+
+            loaded_queue.push(item);
+        }
+        loaded_queue.close();
+    });
+
+    // Save behind
+    std::thread saver([&]() {
+        struct timeval time_start;
+        struct timeval time_end;
+        std::shared_ptr<BatchImage> item;
+
+        while (corrected_queue.pop(item)) {
+            std::string filename = batch_output_filename(filenames[item->index], add);
+
+            gettimeofday(&time_start, nullptr);
+            save_image_to_file(filename.c_str(), item->image);
+            gettimeofday(&time_end, nullptr);
+            time_save += gettimelapsed(time_start, time_end);
+
+            print_v(1, "Saved %s \n", filename.c_str());
+            memory_budget.release(item->n_bytes_budget);
+            item.reset();
+        }
+    });
+
+    // Add or remove CTI
+    struct timeval time_start;
+    struct timeval time_end;
+    std::shared_ptr<BatchImage> item;
+    double error_estimate;
+
+    while (loaded_queue.pop(item)) {
+        gettimeofday(&time_start, nullptr);
+        model.prepare(item->image.size(), item->image[0].size());
+        if (add)
+            item->image = model.add_cti(item->image, nullptr, nullptr, &error_estimate);
+        else
+            item->image = model.remove_cti(
+                item->image, n_iterations, nullptr, nullptr, &error_estimate);
+        gettimeofday(&time_end, nullptr);
+        time_clock += gettimelapsed(time_start, time_end);
+        if (model.parallel.express_extrapolate || model.serial.express_extrapolate)
+            print_v(
+                1, "Extrapolated express error estimate %g for '%s' \n",
+                error_estimate, filenames[item->index].c_str());
+
+        corrected_queue.push(item);
+        item.reset();
+    }
+    corrected_queue.close();
+
+    loader.join();
+    saver.join();
+
+    gettimeofday(&wall_time_end, nullptr);
+    print_v(
+        1, "Batch time: load %.4g s, clock %.4g s, save %.4g s, wall-clock %.4g s \n",
+        time_load, time_clock, time_save,
+        gettimelapsed(wall_time_start, wall_time_end));
+
+    return (n_skipped > 0) ? 1 : 0;
+}
@@ -1,17 +1,1350 @@
 
 #include "cti.hpp"
 
+#include <math.h>
 #include <stdio.h>
 #include <sys/time.h>
 
+#include <algorithm>
 #include <valarray>
 
 #include "ccd.hpp"
+#include "dual.hpp"
+#include "express.hpp"
 #include "roe.hpp"
+#include "trace.hpp"
 #include "trap_managers.hpp"
 #include "traps.hpp"
 #include "util.hpp"
 
+/*
+    Add CTI trails to the columns of an image for charge injection, as for
+    clock_charge_in_one_direction() with an ROEChargeInjection.
+
+    Every injected row is clocked through the full register, so the express
+    multiplier is the same for every row in each express pass, and the trap
+    states never need storing between passes. This dedicated loop uses the one
+    multiplier per pass from ROEChargeInjection's express_multipliers, instead
+    of looking up (and checking for storing) every row in the express matrices.
+
+    Parameters
+    ----------
+    image : std::valarray<std::valarray<double>>&
+        The array of pixel values, updated in place.
+
+    roe : ROE*
+        The charge-injection ROE, already set up for this image by
+        set_clock_sequence() and set_express_matrix_from_rows_and_express().
+
+    ccd : CCD*
+        The CCD.
+
+    trap_manager_manager : TrapManagerManager&
+        The set-up trap managers, with their stored states for the first column.
+
+    row_start, n_active_rows : int
+    column_start, n_active_columns : int
+        The region of the image to clock.
+
+    prune_n_electrons, prune_frequency : double, int
+        See add_cti().
+*/
+static void clock_charge_injection_columns(
+    std::valarray<std::valarray<double>>& image, ROE* roe, CCD* ccd,
+    TrapManagerManager& trap_manager_manager, int row_start, int n_active_rows,
+    int column_start, int n_active_columns, double prune_n_electrons,
+    int prune_frequency) {
+
+    int column_index;
+    int row_index;
+    int row_write;
+    double n_free_electrons;
+    double n_electrons_released_and_captured;
+    double express_multiplier;
+    ROEStepPhase* roe_step_phase;
+
+    // Loop over:
+    //   Columns > Express passes > Rows > Clock-sequence steps > Pixel phases
+    for (int i_column = 0; i_column < n_active_columns; i_column++) {
+        column_index = column_start + i_column;
+        TraceSpan column_span("column", 2, column_index);
+        trap_manager_manager.set_column_density_scale(column_index);
+
+        for (int express_index = 0; express_index < roe->n_express_passes;
+             express_index++) {
+
+            // The same multiplier for every row in this pass
+            express_multiplier = roe->express_multipliers[express_index];
+            if (express_multiplier == 0) continue;
+            TraceSpan pass_span("express_pass", 2, express_index);
+
+            // Restore the trap occupancy levels from the start of the column
+            trap_manager_manager.restore_trap_states();
+
+            // Each pixel
+            for (int i_row = 0; i_row < n_active_rows; i_row++) {
+                row_index = row_start + i_row;
+
+                // Each step in the clock sequence
+                for (int i_step = 0; i_step < roe->n_steps; i_step++) {
+
+                    // Each phase in the pixel
+                    for (int i_phase = 0; i_phase < ccd->n_phases; i_phase++) {
+                        roe_step_phase = &roe->clock_sequence[i_step][i_phase];
+
+                        // Get the initial charge from the relevant pixel(s)
+                        n_free_electrons = 0;
+                        for (int i = 0; i < roe_step_phase->n_capture_pixels; i++)
+                            n_free_electrons +=
+                                image[row_index +
+                                      roe_step_phase->capture_from_which_pixels[i]]
+                                     [column_index];
+
+                        // Release and capture electrons with the traps
+                        n_electrons_released_and_captured =
+                            trap_manager_manager.n_electrons_released_and_captured(
+                                i_phase, n_free_electrons);
+
+                        // Return the charge to the relevant pixel(s)
+                        for (int i = 0; i < roe_step_phase->n_release_pixels; i++) {
+                            row_write =
+                                row_index + roe_step_phase->release_to_which_pixels[i];
+
+                            image[row_write][column_index] +=
+                                n_electrons_released_and_captured * express_multiplier *
+                                roe_step_phase->release_fraction_to_pixels[i];
+
+                            // Make sure image counts don't go negative
+                            if (image[row_write][column_index] < 0.0)
+                                image[row_write][column_index] = 0.0;
+                        }
+                    }
+                }
+
+                // Absorb really small watermarks into others, for speed
+                if ((prune_frequency > 0) && (((i_row + 1) % prune_frequency) == 0))
+                    trap_manager_manager.prune_watermarks(prune_n_electrons);
+            }
+        }
+
+        // Reset the trap states to empty and/or store them for the next column
+        if (roe->empty_traps_between_columns) trap_manager_manager.reset_trap_states();
+        trap_manager_manager.store_trap_states();
+    }
+}
+
+// ========
+// ClockingWorkspace::
+// ========
+/*
+    Class ClockingWorkspace.
+
+    Reusable storage for the per-call working state of
+    clock_charge_in_one_direction(): a copy of the trap managers for each strip
+    of columns, and each chunk's or row segment's scratch image.
+
+    Copying the prepared trap managers into the workspace's existing ones
+    doesn't reallocate any of their arrays if they have the same shape as in
+    the previous call. Together with the trap managers' in-place updates, this
+    means that clocking with a reused workspace and prepared trap managers does
+    no heap allocation for the trap managers, or at all inside the loops over
+    the pixels. A workspace must only be used by one call at a time.
+
+    Attributes
+    ----------
+    trap_manager_managers : std::vector<TrapManagerManager>
+        The working trap managers for each strip.
+
+    strip_images : std::vector<std::valarray<std::valarray<double>>>
+        The scratch copy of each speculative chunk of columns, or each row
+        segment's warm-up column.
+*/
+/*
+    Make sure there's room for at least n_strips strips.
+*/
+void ClockingWorkspace::reserve(int n_strips) {
+    if (trap_manager_managers.size() < n_strips) trap_manager_managers.resize(n_strips);
+    if (strip_images.size() < n_strips) strip_images.resize(n_strips);
+}
+
+// ========
+// ClockingWorkspacePool::
+// ========
+/*
+    Class ClockingWorkspacePool.
+
+    A thread-safe set of ClockingWorkspaces, so that e.g. a prepared
+    ClockingModel used by several threads at once can reuse one workspace for
+    each concurrent call.
+*/
+/*
+    Take a free workspace, or a new one if none are free.
+*/
+std::unique_ptr<ClockingWorkspace> ClockingWorkspacePool::acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (workspaces.empty())
+        return std::unique_ptr<ClockingWorkspace>(new ClockingWorkspace());
+
+    std::unique_ptr<ClockingWorkspace> workspace = std::move(workspaces.back());
+    workspaces.pop_back();
+
+    return workspace;
+}
+
+/*
+    Return a workspace to the pool for reuse.
+*/
+void ClockingWorkspacePool::release(std::unique_ptr<ClockingWorkspace> workspace) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    workspaces.push_back(std::move(workspace));
+}
+
+// ========
+// ClockingCheckpoints::
+// ========
+/*
+    Class ClockingCheckpoints.
+
+    The trap states of every column at regular intervals of rows in each
+    express pass, where a re-clock could start from them, and the output image,
+    kept from one call of clock_charge_in_one_direction() so that a later call
+    with a locally edited image only needs to re-clock the edited columns, from
+    the last checkpoint before the first edited pixel in each. See
+    clock_columns_with_checkpoints().
+
+    Parameters
+    ----------
+    interval : int (opt.)
+        The number of rows between checkpoints. Smaller intervals re-clock
+        fewer rows but keep more trap states in memory.
+
+    max_n_states : int (opt.)
+        The maximum number of trap states to keep for each column. The interval
+        is doubled until the checkpoints need no more than this, with a warning,
+        e.g. for a large number of express passes. If no checkpoints fit, then
+        only the unchanged columns are skipped.
+
+    Attributes
+    ----------
+    first_changed_rows : std::vector<int>
+        Set before a call to the first row (or the number of rows if none) in
+        each column of the image whose input pixels differ from those of the
+        previous call. Cleared by each call. If empty, or if the image's shape
+        or model differ, the whole image is clocked and the checkpoints reset.
+        The checkpoints must only be reused with the same ROE, CCD, and traps.
+
+    row_start, n_active_rows, column_start, n_active_columns, n_express_passes
+        The clocked region and the number of express passes of the checkpoints.
+
+    active_interval : int
+        The interval of the checkpoints, after any doubling for max_n_states.
+
+    image_out : std::valarray<std::valarray<double>>
+        The previous output image.
+
+    column_states : std::vector<std::vector<TrapStates>>
+        For each active column, the trap states before every interval-th row
+        (except row 0) in each express pass, if the previous pass stored its
+        states before that row, since otherwise a re-clock restores those.
+*/
+/*
+    Forget the checkpoints, so the next call clocks the whole image.
+*/
+void ClockingCheckpoints::clear() {
+    first_changed_rows.clear();
+    n_active_rows = 0;
+    n_active_columns = 0;
+    n_express_passes = 0;
+    active_interval = 0;
+    image_out.resize(0);
+    column_states.clear();
+}
+
+/*
+    The number of electrons held in the instant-capture traps of one phase, for
+    the debug printing in clock_pixels_in_express_pass().
+*/
+static double n_trapped_electrons_ic(
+    TrapManagerManager& trap_manager_manager, int i_phase) {
+    if (trap_manager_manager.n_traps_ic == 0) return 0.0;
+    TrapManagerInstantCapture& manager = trap_manager_manager.trap_managers_ic[i_phase];
+
+    return manager.n_trapped_electrons_from_watermarks(
+        manager.watermark_volumes, manager.watermark_fills);
+}
+
+static double n_trapped_electrons_ic(
+    TrapManagerManagerDual& trap_manager_manager, int i_phase) {
+    if (trap_manager_manager.n_traps_ic == 0) return 0.0;
+    TrapManagerInstantCaptureDual& manager =
+        trap_manager_manager.trap_managers_ic[i_phase];
+    double n_trapped_electrons = 0.0;
+
+    for (int i_wmk = manager.i_first_active_wmk;
+         i_wmk < manager.i_first_active_wmk + manager.n_active_watermarks; i_wmk++) {
+        for (int i_trap = 0; i_trap < manager.n_traps; i_trap++)
+            n_trapped_electrons +=
+                manager.watermark_fills[i_wmk * manager.n_traps + i_trap].value *
+                manager.watermark_volumes[i_wmk].value;
+    }
+
+    return n_trapped_electrons;
+}
+
+/*
+    Set the global default for emptying the traps once they hold a negligible
+    total charge, see TrapManagerManager::collapse_trap_states() and
+    ClockingSettings.
+
+    This is checked after every pixel, so e.g. the faint sky after a bright
+    source can be clocked as quickly as with empty traps, at the cost of
+    slightly changing the output. With empty_traps_between_columns false, this
+    also empties the traps carried on to the following columns.
+
+    Parameters
+    ----------
+    factor : double
+        The traps are emptied once their total number of trapped electrons is
+        below this multiple of prune_n_electrons, i.e. relative to the model's
+        precision, e.g. 1e6 for 1e-4 electrons with the default 1e-10. Default
+        0 to never collapse the trap states.
+*/
+double collapse_factor = 0.0;
+void set_collapse_trap_states(double factor) {
+    if (factor < 0.0)
+        error("Trap-state collapse factor (%g) must not be negative", factor);
+    collapse_factor = factor;
+}
+
+// ========
+// ClockingSettings::
+// ========
+/*
+    Class ClockingSettings.
+
+    The optional speedups for clocking in one direction that trade a little
+    accuracy for speed, so they can be set for each model instead of only
+    globally, see ClockingModel. Each starts from its global default, as set
+    e.g. by the command-line options.
+
+    Parameters
+    ----------
+    collapse_factor : double
+        See set_collapse_trap_states().
+
+    speculative_tolerance, speculative_n_warmup_columns : double, int
+        See set_speculative_columns().
+
+    row_segment_tolerance, row_segment_n_warmup_rows : double, int
+        See set_row_segments().
+
+    continuum_table_tolerance : double
+        See set_continuum_table_tolerance().
+*/
+ClockingSettings::ClockingSettings()
+    : collapse_factor(::collapse_factor),
+      speculative_tolerance(::speculative_tolerance),
+      speculative_n_warmup_columns(::speculative_n_warmup_columns),
+      row_segment_tolerance(::row_segment_tolerance),
+      row_segment_n_warmup_rows(::row_segment_n_warmup_rows),
+      continuum_table_tolerance(::continuum_table_tolerance) {}
+
+/*
+    Clock some of the pixels of one column through the traps for one express
+    pass, continuing from the current trap states.
+
+    Templated on the Scalar type of the pixel values and their trap managers:
+    double with a TrapManagerManager, or Dual with a TrapManagerManagerDual to
+    also track the derivatives with respect to the trap parameters.
+
+    Parameters
+    ----------
+    image, roe, ccd, trap_manager_manager, n_rows, row_start
+        As for clock_charge_columns().
+
+    column_index, express_index : int
+        The column and express pass.
+
+    i_row_start, i_row_stop : int
+        The range of active rows (counted from row_start) to clock.
+
+    prune_n_electrons, prune_frequency : double, int
+        See add_cti().
+
+    collapse_threshold : double
+        The number of trapped electrons below which to empty the traps, see
+        set_collapse_trap_states(). 0 to never collapse them.
+
+    Returns
+    -------
+    stored : bool
+        Whether the trap states were stored for the next express pass.
+*/
+template <typename Scalar, typename Managers>
+static bool clock_pixels_in_express_pass(
+    std::valarray<std::valarray<Scalar>>& image, ROE* roe, CCD* ccd,
+    Managers& trap_manager_manager, int n_rows, int column_index, int express_index,
+    int row_start, int i_row_start, int i_row_stop, double prune_n_electrons,
+    int prune_frequency, double collapse_threshold) {
+
+    int row_index;
+    int row_read;
+    int row_write;
+    Scalar n_free_electrons;
+    Scalar n_electrons_released_and_captured;
+    double express_multiplier;
+    ROEStepPhase* roe_step_phase;
+    bool stored = false;
+
+    // Each pixel
+    for (int i_row = i_row_start; i_row < i_row_stop; i_row++) {
+        row_index = row_start + i_row;
+
+        print_v(2, "# #  i_row, row_index  %d,  %d \n", i_row, row_index);
+
+        express_multiplier =
+            roe->express_matrix[express_index * n_rows + row_index];
+        if (express_multiplier == 0) continue;
+
+        print_v(2, "express_multiplier  %g \n", express_multiplier);
+
+        // Each step in the clock sequence
+        for (unsigned int i_step = 0; i_step < roe->n_steps; i_step++) {
+
+            // Each phase in the pixel
+            for (unsigned int i_phase = 0; i_phase < ccd->n_phases; i_phase++) {
+
+                if ((roe->n_steps > 1) || (ccd->n_phases > 1))
+                    print_v(
+                        2, "#  i_step, i_phase  %d,  %d \n", i_step, i_phase);
+
+                // State of the ROE in this step and phase of the sequence
+                roe_step_phase = &roe->clock_sequence[i_step][i_phase];
+
+                // Get the initial charge from the relevant pixel(s)
+                n_free_electrons = 0;
+                for (int i = 0; i < roe_step_phase->n_capture_pixels; i++) {
+                    row_read = row_index +
+                               roe_step_phase->capture_from_which_pixels[i];
+
+                    n_free_electrons += image[row_read][column_index];
+                }
+
+                print_v(2, "row_read  %d \n", row_read);
+                print_v(2, "n_free_electrons  %g \n", value_of(n_free_electrons));
+
+                // Release and capture electrons with the traps in this
+                // pixel/phase, for each type of traps
+                n_electrons_released_and_captured =
+                    trap_manager_manager.n_electrons_released_and_captured(
+                        i_phase, n_free_electrons);
+
+              
+/*                print_v(
+                    0, "%d ",
+                    trap_manager_manager.trap_managers_ic[i_phase]
+                            .n_active_watermarks);
+                print_array(
+                    trap_manager_manager.trap_managers_ic[i_phase]
+                            .watermark_volumes);
+                print_array(
+                    trap_manager_manager.trap_managers_ic[i_phase]
+                            .watermark_fills);
+*/              
+                print_v(
+                    2, "n_electrons_released_and_captured  %g \n",
+                    value_of(n_electrons_released_and_captured));
+
+                print_v(
+                    2, "n_trapped_electrons_from_watermarks  %g \n",
+                    n_trapped_electrons_ic(trap_manager_manager, i_phase));
+
+                print_v(2, "n_free_electrons  %g \n", value_of(n_free_electrons));
+
+
+                // Return the charge to the relevant pixel(s)
+                for (int i = 0; i < roe_step_phase->n_release_pixels; i++) {
+                    row_write =
+                        row_index + roe_step_phase->release_to_which_pixels[i];
+
+                    image[row_write][column_index] +=
+                        n_electrons_released_and_captured * express_multiplier *
+                        roe_step_phase->release_fraction_to_pixels[i];
+
+                    // Make sure image counts don't go negative, which
+                    // could happen with a too-large express multiplier
+                    if (value_of(image[row_write][column_index]) < 0.0)
+                        image[row_write][column_index] = 0.0;
+
+                    print_v(2, "row_write  %d \n", row_write);
+                    print_v(
+                        2, "image[%d][%d]  %g \n", row_write, column_index,
+                        value_of(image[row_write][column_index]));
+                }
+            }
+        }
+
+        // Absorb really small watermarks  into others, for speed
+        if (prune_frequency > 0) {
+            if (((i_row + 1) % prune_frequency) == 0) {
+                trap_manager_manager.prune_watermarks(prune_n_electrons);
+            }
+        }
+
+        // Empty the traps entirely once they hold a negligible total charge,
+        // e.g. in the sky after a bright source, if enabled
+        if (collapse_threshold > 0.0)
+            trap_manager_manager.collapse_trap_states(collapse_threshold);
+
+        // Store the trap states if needed for the next express pass
+        if (roe->store_trap_states_matrix[express_index * n_rows + row_index]) {
+            print_v(2, "store_trap_states \n");
+            trap_manager_manager.store_trap_states();
+            stored = true;
+        }
+    }
+
+    return stored;
+}
+
+/*
+    Clock the columns of an image through the traps, for the standard loop of
+    clock_charge_in_one_direction().
+
+    Parameters
+    ----------
+    image : std::valarray<std::valarray<double>>&
+        The array of pixel values, updated in place.
+
+    roe : ROE*
+        The ROE, already set up for this image by set_clock_sequence(),
+        set_express_matrix_from_rows_and_express(), and
+        set_store_trap_states_matrix().
+
+    ccd : CCD*
+        The CCD.
+
+    trap_manager_manager : TrapManagerManager&
+        The set-up trap managers, with their stored states for the first column.
+
+    n_rows : int
+        The number of rows in the full image, for the express matrices.
+
+    row_start, n_active_rows : int
+    column_start, n_active_columns : int
+        The region of the image to clock.
+
+    prune_n_electrons, prune_frequency : double, int
+        See add_cti().
+
+    trap_states : TrapStates* (opt.)
+        If provided, the trap states to start from and replaced by the final
+        states, for each column if the traps are emptied between columns, or
+        otherwise a single set for the start of the first column and the end
+        of the last. States with no trap managers are left empty to start.
+
+    settings : const ClockingSettings&
+        The optional speedups, see ClockingSettings.
+*/
+static void clock_charge_columns(
+    std::valarray<std::valarray<double>>& image, ROE* roe, CCD* ccd,
+    TrapManagerManager& trap_manager_manager, int n_rows, int row_start,
+    int n_active_rows, int column_start, int n_active_columns,
+    double prune_n_electrons, int prune_frequency, TrapStates* trap_states,
+    const ClockingSettings& settings) {
+
+    int column_index;
+
+    // ========
+    // Clock each column of pixels through the column of traps
+    // ========
+    // Print express matrix
+    //print_array_2D(roe->express_matrix, n_active_rows);
+    //print_array_2D((int)roe->store_trap_states_matrix, n_active_rows);
+    // Loop over:
+    //   Columns > Express passes > Rows > Clock-sequence steps > Pixel phases
+    for (int i_column = 0; i_column < n_active_columns; i_column++) {
+        column_index = column_start + i_column;
+
+        print_v(
+            2, "# # # #  i_column, column_index  %d,  %d \n", i_column, column_index);
+        TraceSpan column_span("column", 2, column_index);
+
+        // Start from the given trap states, e.g. from the previous exposure
+        TrapStates* column_trap_states = nullptr;
+        if (trap_states != nullptr)
+            column_trap_states =
+                roe->empty_traps_between_columns ? &trap_states[i_column] : trap_states;
+        if ((column_trap_states != nullptr) &&
+            (roe->empty_traps_between_columns || (i_column == 0)) &&
+            (column_trap_states->watermark_volumes.size() > 0))
+            trap_manager_manager.load_trap_states(*column_trap_states);
+
+        trap_manager_manager.set_column_density_scale(column_index);
+
+        // Monitor the traps for every transfer (express=n_rows), or just one
+        // (express=1) or a few (express=a few) then replicate their effect
+        for (int express_index = 0; express_index < roe->n_express_passes;
+             express_index++) {
+
+            print_v(2, "# # #  express_index  %d \n", express_index);
+            TraceSpan pass_span("express_pass", 2, express_index);
+
+            // Restore the trap occupancy levels, either to empty or to a saved
+            // state from a previous express pass
+            trap_manager_manager.restore_trap_states();
+
+            clock_pixels_in_express_pass(
+                image, roe, ccd, trap_manager_manager, n_rows, column_index,
+                express_index, row_start, 0, n_active_rows, prune_n_electrons,
+                prune_frequency, settings.collapse_factor * prune_n_electrons);
+        }
+
+        // Save the final trap states, e.g. for the next exposure
+        if ((column_trap_states != nullptr) &&
+            (roe->empty_traps_between_columns || (i_column == n_active_columns - 1)))
+            trap_manager_manager.save_trap_states(*column_trap_states);
+
+        // Reset the trap states to empty and/or store them for the next column
+        if (roe->empty_traps_between_columns) trap_manager_manager.reset_trap_states();
+        trap_manager_manager.store_trap_states();
+    }
+}
+
+// ========
+// Speculative clocking
+// ========
+/*
+    Set the global defaults for speculatively clocking columns that share
+    their traps' states (i.e. with empty_traps_between_columns = false) on
+    multiple threads, see clock_columns_speculatively() and ClockingSettings.
+
+    Parameters
+    ----------
+    tolerance : double
+        The maximum difference (in trapped electrons, see
+        TrapStates::difference()) between each chunk's predicted starting trap
+        states and the actual states from the previous chunk, above which the
+        chunk is clocked again. Default 0 to clock the columns in order.
+
+    n_warmup_columns : int (opt.)
+        The number of preceding columns to clock from empty traps to predict
+        each chunk's starting trap states.
+*/
+double speculative_tolerance = 0.0;
+int speculative_n_warmup_columns = 2;
+void set_speculative_columns(double tolerance, int n_warmup_columns) {
+    speculative_tolerance = tolerance;
+    speculative_n_warmup_columns = n_warmup_columns;
+}
+
+/*
+    Clock columns that share their traps' states in parallel chunks, each
+    starting from predicted trap states, then re-clock any chunks whose
+    prediction was wrong.
+
+    The traps' memory of previous columns decays as they release their charge,
+    so each chunk's starting states are predicted by clocking the few columns
+    before it starting from empty traps. All chunks are clocked concurrently.
+    Then, in each sweep, any chunk whose predicted start differs from the
+    actual end of the previous chunk by more than speculative_tolerance is
+    clocked again from that end state. This usually converges in one sweep,
+    and at worst after one sweep per chunk, i.e. the same as clocking in order.
+
+    Parameters
+    ----------
+    image : std::valarray<std::valarray<double>>&
+        The array of pixel values, updated in place.
+
+    trap_manager_manager : TrapManagerManager&
+        The set-up trap managers, with their stored states for the first column.
+
+    workspace : ClockingWorkspace*
+        The trap managers and strip images for each chunk, already reserved.
+
+    n_chunks : int
+        The number of chunks of columns.
+
+    column_start, n_active_columns : int
+        The columns to clock.
+
+    clock_strip : ClockStrip
+        The function to clock some columns of a strip image with a set of trap
+        managers, see clock_columns_in_strips().
+
+    settings : const ClockingSettings&
+        The speculative_tolerance and speculative_n_warmup_columns to use.
+*/
+template <class ClockStrip>
+static void clock_columns_speculatively(
+    std::valarray<std::valarray<double>>& image,
+    TrapManagerManager& trap_manager_manager, ClockingWorkspace* workspace,
+    int n_chunks, int column_start, int n_active_columns, ClockStrip clock_strip,
+    const ClockingSettings& settings) {
+
+    int n_rows = image.size();
+    std::vector<int> chunk_column_start(n_chunks + 1);
+    std::vector<int> n_chunk_warmup_columns(n_chunks);
+    std::vector<TrapStates> start_states(n_chunks);
+    std::vector<TrapStates> end_states(n_chunks);
+
+    for (int i_chunk = 0; i_chunk <= n_chunks; i_chunk++)
+        chunk_column_start[i_chunk] =
+            column_start + i_chunk * n_active_columns / n_chunks;
+    for (int i_chunk = 0; i_chunk < n_chunks; i_chunk++)
+        n_chunk_warmup_columns[i_chunk] = std::min(
+            std::max(settings.speculative_n_warmup_columns, 0),
+            chunk_column_start[i_chunk] - column_start);
+
+    // Copy a chunk's input columns, after any warm-up columns, into its strip
+    auto extract_chunk = [&](int i_chunk) {
+        int first_column =
+            chunk_column_start[i_chunk] - n_chunk_warmup_columns[i_chunk];
+        int n_strip_columns = chunk_column_start[i_chunk + 1] - first_column;
+        std::valarray<std::valarray<double>>& strip_image =
+            workspace->strip_images[i_chunk];
+
+        if ((strip_image.size() != n_rows) ||
+            (strip_image[0].size() != n_strip_columns))
+            strip_image = std::valarray<std::valarray<double>>(
+                std::valarray<double>(0.0, n_strip_columns), n_rows);
+        for (int i_row = 0; i_row < n_rows; i_row++)
+            strip_image[i_row] =
+                image[i_row][std::slice(first_column, n_strip_columns, 1)];
+    };
+
+    // Clock a chunk's columns from its starting trap states
+    auto clock_chunk = [&](int i_chunk) {
+        TraceSpan span("speculative_chunk", 1, i_chunk);
+        TrapManagerManager& chunk_trap_manager_manager =
+            workspace->trap_manager_managers[i_chunk];
+
+        chunk_trap_manager_manager.load_trap_states(start_states[i_chunk]);
+        clock_strip(
+            workspace->strip_images[i_chunk], chunk_trap_manager_manager,
+            n_chunk_warmup_columns[i_chunk],
+            chunk_column_start[i_chunk + 1] - chunk_column_start[i_chunk], nullptr);
+        chunk_trap_manager_manager.save_trap_states(end_states[i_chunk]);
+    };
+
+    // Predict each chunk's starting states, then clock them all concurrently
+    parallel_for(n_chunks, [&](int i_chunk) {
+        TrapManagerManager& chunk_trap_manager_manager =
+            workspace->trap_manager_managers[i_chunk];
+        chunk_trap_manager_manager = trap_manager_manager;
+        if (trap_manager_manager.column_density_scales != nullptr)
+            chunk_trap_manager_manager.column_density_scales +=
+                chunk_column_start[i_chunk] - n_chunk_warmup_columns[i_chunk];
+        extract_chunk(i_chunk);
+
+        if (i_chunk == 0)
+            chunk_trap_manager_manager.restore_trap_states();
+        else {
+            TraceSpan span("speculative_warmup", 1, i_chunk);
+            chunk_trap_manager_manager.reset_trap_states();
+            chunk_trap_manager_manager.store_trap_states();
+            clock_strip(
+                workspace->strip_images[i_chunk], chunk_trap_manager_manager, 0,
+                n_chunk_warmup_columns[i_chunk], nullptr);
+        }
+        chunk_trap_manager_manager.save_trap_states(start_states[i_chunk]);
+
+        clock_chunk(i_chunk);
+    });
+
+    // Re-clock any mispredicted chunks from the previous chunk's end states
+    std::vector<int> redo_chunks;
+    int n_sweeps = 0;
+    int n_redone = 0;
+    while (true) {
+        redo_chunks.clear();
+        for (int i_chunk = 1; i_chunk < n_chunks; i_chunk++)
+            if (start_states[i_chunk].difference(end_states[i_chunk - 1]) >
+                settings.speculative_tolerance)
+                redo_chunks.push_back(i_chunk);
+        if (redo_chunks.empty()) break;
+
+        // Set all the new starts first, since the previous chunks may change too
+        for (int i_redo = 0; i_redo < redo_chunks.size(); i_redo++)
+            start_states[redo_chunks[i_redo]] = end_states[redo_chunks[i_redo] - 1];
+
+        parallel_for(redo_chunks.size(), [&](int i_redo) {
+            extract_chunk(redo_chunks[i_redo]);
+            clock_chunk(redo_chunks[i_redo]);
+        });
+        n_sweeps++;
+        n_redone += redo_chunks.size();
+    }
+    print_v(
+        1, "%d speculative chunks of columns, %d re-clocked in %d sweep(s) \n",
+        n_chunks, n_redone, n_sweeps);
+
+    // Copy the clocked columns back, without the warm-up columns
+    for (int i_chunk = 0; i_chunk < n_chunks; i_chunk++) {
+        int n_chunk_columns =
+            chunk_column_start[i_chunk + 1] - chunk_column_start[i_chunk];
+
+        for (int i_row = 0; i_row < n_rows; i_row++)
+            image[i_row][std::slice(chunk_column_start[i_chunk], n_chunk_columns, 1)] =
+                workspace->strip_images[i_chunk][i_row][std::slice(
+                    n_chunk_warmup_columns[i_chunk], n_chunk_columns, 1)];
+    }
+}
+
+// ========
+// Row segments
+// ========
+/*
+    Set the global defaults for sharing the rows of each column between
+    threads, for images with fewer columns than threads, see
+    clock_column_in_row_segments() and ClockingSettings.
+
+    Parameters
+    ----------
+    tolerance : double
+        The maximum difference (in trapped electrons, see
+        TrapStates::difference()) between each segment's predicted starting
+        trap states and the actual states from the previous segment, above
+        which the segment is clocked again. Default 0 to not use row segments.
+
+    n_warmup_rows : int (opt.)
+        The number of preceding rows to clock from empty traps to predict each
+        segment's starting trap states.
+*/
+double row_segment_tolerance = 0.0;
+int row_segment_n_warmup_rows = 100;
+void set_row_segments(double tolerance, int n_warmup_rows) {
+    row_segment_tolerance = tolerance;
+    row_segment_n_warmup_rows = n_warmup_rows;
+}
+
+/*
+    Whether every step and phase of the clock sequence captures from and
+    releases to only its own pixel, so the trap states are the only link
+    between neighbouring pixels in an express pass.
+*/
+static bool pixels_linked_only_by_traps(ROE* roe) {
+    if (roe->type != roe_type_standard) return false;
+
+    for (unsigned int i_step = 0; i_step < roe->n_steps; i_step++) {
+        for (unsigned int i_phase = 0; i_phase < roe->n_phases; i_phase++) {
+            ROEStepPhase* roe_step_phase = &roe->clock_sequence[i_step][i_phase];
+
+            for (int i = 0; i < roe_step_phase->n_capture_pixels; i++)
+                if (roe_step_phase->capture_from_which_pixels[i] != 0) return false;
+            for (int i = 0; i < roe_step_phase->n_release_pixels; i++)
+                if (roe_step_phase->release_to_which_pixels[i] != 0) return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+    Clock one tall column in segments of rows on multiple threads, for each
+    express pass, from predicted trap states, then re-clock any segments whose
+    prediction was wrong.
+
+    Within an express pass, each pixel's charge only interacts with the traps,
+    so its trail into the following pixels is carried entirely by the trap
+    states, see pixels_linked_only_by_traps(). Each segment's incoming states
+    are predicted by clocking the row_segment_n_warmup_rows rows before it
+    from empty traps (or from the pass's starting states if the warm-up reaches
+    the first row), then all segments are clocked concurrently. Sweeps then
+    fix up the seams by re-clocking any segment whose predicted start differs
+    from the actual end of the previous segment by more than
+    row_segment_tolerance, from the pass's input pixels, until they all match.
+
+    Parameters
+    ----------
+    trap_manager_manager : TrapManagerManager&
+        The set-up trap managers, with their stored states for this column,
+        which are updated for the next column as in clock_charge_columns().
+
+    workspace : ClockingWorkspace*
+        The trap managers and scratch columns for each segment, already
+        reserved.
+
+    n_segments : int
+        The maximum number of segments of rows.
+
+    column_index : int
+        The column to clock.
+
+    Otherwise as for clock_charge_columns().
+*/
+static void clock_column_in_row_segments(
+    std::valarray<std::valarray<double>>& image, ROE* roe, CCD* ccd,
+    TrapManagerManager& trap_manager_manager, ClockingWorkspace* workspace,
+    int n_segments, int n_rows, int row_start, int n_active_rows, int column_index,
+    double prune_n_electrons, int prune_frequency, const ClockingSettings& settings) {
+
+    TraceSpan column_span("column", 2, column_index);
+    int n_pass_segments;
+    std::vector<int> i_segment_row_start(n_segments + 1);
+    std::vector<TrapStates> start_states(n_segments);
+    std::vector<TrapStates> end_states(n_segments);
+    std::vector<TrapStates> stored_states(n_segments);
+    std::vector<char> segment_stored(n_segments);
+    std::valarray<double> pass_input(0.0, n_active_rows);
+    TrapStates pass_start_states;
+    TrapStates final_states;
+    std::vector<int> redo_segments;
+    double collapse_threshold = settings.collapse_factor * prune_n_electrons;
+
+    // Each express pass starts from the stored trap states
+    trap_manager_manager.set_column_density_scale(column_index);
+    trap_manager_manager.restore_trap_states();
+    trap_manager_manager.save_trap_states(pass_start_states);
+    final_states = pass_start_states;
+
+    // Clock a segment of rows from its starting trap states, and save its end
+    // and any stored states for the next express pass
+    auto clock_segment = [&](int express_index, int i_segment) {
+        TraceSpan span("row_segment", 2, i_segment);
+        TrapManagerManager& segment_trap_manager_manager =
+            workspace->trap_manager_managers[i_segment];
+
+        for (int i_row = i_segment_row_start[i_segment];
+             i_row < i_segment_row_start[i_segment + 1]; i_row++)
+            image[row_start + i_row][column_index] = pass_input[i_row];
+
+        segment_trap_manager_manager.load_trap_states(start_states[i_segment]);
+        segment_stored[i_segment] = clock_pixels_in_express_pass(
+            image, roe, ccd, segment_trap_manager_manager, n_rows, column_index,
+            express_index, row_start, i_segment_row_start[i_segment],
+            i_segment_row_start[i_segment + 1], prune_n_electrons, prune_frequency,
+            collapse_threshold);
+        segment_trap_manager_manager.save_trap_states(end_states[i_segment]);
+
+        if (segment_stored[i_segment]) {
+            segment_trap_manager_manager.restore_trap_states();
+            segment_trap_manager_manager.save_trap_states(stored_states[i_segment]);
+        }
+    };
+
+    for (int express_index = 0; express_index < roe->n_express_passes;
+         express_index++) {
+
+        // Skip the rows before the first transfer in this pass
+        int i_row_first = 0;
+        while ((i_row_first < n_active_rows) &&
+               (roe->express_matrix[express_index * n_rows + row_start + i_row_first] ==
+                0.0))
+            i_row_first++;
+        if (i_row_first == n_active_rows) {
+            final_states = pass_start_states;
+            continue;
+        }
+
+        n_pass_segments = std::min(n_segments, n_active_rows - i_row_first);
+        for (int i_segment = 0; i_segment <= n_pass_segments; i_segment++)
+            i_segment_row_start[i_segment] =
+                i_row_first +
+                i_segment * (n_active_rows - i_row_first) / n_pass_segments;
+
+        // The input pixels for this pass, for the warm-ups and re-clocking
+        for (int i_row = 0; i_row < n_active_rows; i_row++)
+            pass_input[i_row] = image[row_start + i_row][column_index];
+
+        // Predict each segment's starting states, then clock them concurrently
+        parallel_for(n_pass_segments, [&](int i_segment) {
+            TrapManagerManager& segment_trap_manager_manager =
+                workspace->trap_manager_managers[i_segment];
+            segment_trap_manager_manager = trap_manager_manager;
+
+            if (i_segment == 0)
+                start_states[i_segment] = pass_start_states;
+            else {
+                int i_row_stop = i_segment_row_start[i_segment];
+                int i_row_warmup = std::max(
+                    i_row_first, i_row_stop - settings.row_segment_n_warmup_rows);
+
+                // Clock the warm-up rows in a scratch column
+                std::valarray<std::valarray<double>>& scratch =
+                    workspace->strip_images[i_segment];
+                if ((scratch.size() != n_rows) || (scratch[0].size() != 1))
+                    scratch = std::valarray<std::valarray<double>>(
+                        std::valarray<double>(0.0, 1), n_rows);
+                for (int i_row = i_row_warmup; i_row < i_row_stop; i_row++)
+                    scratch[row_start + i_row][0] = pass_input[i_row];
+
+                if (i_row_warmup == i_row_first)
+                    segment_trap_manager_manager.load_trap_states(pass_start_states);
+                else
+                    segment_trap_manager_manager.reset_trap_states();
+                clock_pixels_in_express_pass(
+                    scratch, roe, ccd, segment_trap_manager_manager, n_rows, 0,
+                    express_index, row_start, i_row_warmup, i_row_stop,
+                    prune_n_electrons, prune_frequency, collapse_threshold);
+                segment_trap_manager_manager.save_trap_states(start_states[i_segment]);
+            }
+
+            clock_segment(express_index, i_segment);
+        });
+
+        // Fix up the seams, re-clocking any mispredicted segments
+        while (true) {
+            redo_segments.clear();
+            for (int i_segment = 1; i_segment < n_pass_segments; i_segment++)
+                if (start_states[i_segment].difference(end_states[i_segment - 1]) >
+                    settings.row_segment_tolerance)
+                    redo_segments.push_back(i_segment);
+            if (redo_segments.empty()) break;
+
+            for (int i_redo = 0; i_redo < redo_segments.size(); i_redo++)
+                start_states[redo_segments[i_redo]] =
+                    end_states[redo_segments[i_redo] - 1];
+
+            parallel_for(redo_segments.size(), [&](int i_redo) {
+                clock_segment(express_index, redo_segments[i_redo]);
+            });
+        }
+
+        // The states at the end, and to start the next express pass
+        final_states = end_states[n_pass_segments - 1];
+        for (int i_segment = 0; i_segment < n_pass_segments; i_segment++)
+            if (segment_stored[i_segment]) pass_start_states = stored_states[i_segment];
+    }
+
+    // Reset the trap states to empty and/or store them for the next column
+    trap_manager_manager.load_trap_states(final_states);
+    if (roe->empty_traps_between_columns) trap_manager_manager.reset_trap_states();
+    trap_manager_manager.store_trap_states();
+}
+
+/*
+    Clock the columns of an image as in clock_charge_columns(), saving the trap
+    states at checkpoints, or re-clock only the changed parts of the columns
+    from the checkpoints of a previous call, see ClockingCheckpoints.
+
+    Within an express pass, each pixel's charge only interacts with the traps,
+    see pixels_linked_only_by_traps(), so the pixels before a column's first
+    changed row are unchanged in every pass. Each pass is re-clocked from the
+    last checkpoint before that row, or from the states stored by the previous
+    pass if they were stored after it. The traps must also be emptied between
+    columns, so each column is independent.
+
+    Parameters
+    ----------
+    trap_manager_manager : TrapManagerManager&
+        The set-up trap managers to copy for each strip of columns.
+
+    workspace : ClockingWorkspace*
+        The reusable trap managers for each strip.
+
+    checkpoints : ClockingCheckpoints*
+        The checkpoints from a previous call to re-clock from, if they match,
+        with the first changed row in each column. Updated for the next call.
+
+    Otherwise as for clock_charge_columns().
+*/
+static void clock_columns_with_checkpoints(
+    std::valarray<std::valarray<double>>& image, ROE* roe, CCD* ccd,
+    TrapManagerManager& trap_manager_manager, ClockingWorkspace* workspace,
+    int n_rows, int row_start, int n_active_rows, int column_start,
+    int n_active_columns, double prune_n_electrons, int prune_frequency,
+    ClockingCheckpoints* checkpoints, const ClockingSettings& settings) {
+
+    int interval = std::max(checkpoints->interval, 1);
+    int n_express_passes = roe->n_express_passes;
+
+    // The row in which each express pass stores its states for the next pass
+    std::vector<int> i_row_stored(n_express_passes, -1);
+    for (int express_index = 0; express_index < n_express_passes; express_index++)
+        for (int i_row = 0; i_row < n_active_rows; i_row++)
+            if (roe->store_trap_states_matrix
+                    [express_index * n_rows + row_start + i_row])
+                i_row_stored[express_index] = i_row;
+
+    // A re-clock only loads a pass's states at its restart row if that isn't
+    // row 0 and the previous pass didn't store its states in the re-clocked
+    // rows, so number only those checkpoints, with -1 for the others
+    int n_checkpoints;
+    std::vector<int> i_states;
+    auto number_states = [&]() {
+        n_checkpoints = (n_active_rows + interval - 1) / interval;
+        i_states.assign(n_express_passes * n_checkpoints, -1);
+        int n_states = 0;
+        for (int express_index = 0; express_index < n_express_passes;
+             express_index++)
+            for (int i_checkpoint = 1; i_checkpoint < n_checkpoints; i_checkpoint++)
+                if ((express_index == 0) ||
+                    (i_row_stored[express_index - 1] < i_checkpoint * interval))
+                    i_states[express_index * n_checkpoints + i_checkpoint] =
+                        n_states++;
+        return n_states;
+    };
+
+    // Space the checkpoints out if there'd be too many states, e.g. with many
+    // express passes, which would otherwise need ~n_rows^2 / interval states
+    int n_states = number_states();
+    if (n_states > checkpoints->max_n_states) {
+        while ((n_states > checkpoints->max_n_states) && (interval < n_active_rows)) {
+            interval *= 2;
+            n_states = number_states();
+        }
+        print_v(
+            1,
+            "Warning: %d express passes need checkpoints every %d rows to keep at "
+            "most %d trap states per column \n",
+            n_express_passes, interval, checkpoints->max_n_states);
+    }
+
+    // Whether the checkpoints are from clocking the same region
+    bool reclock = (checkpoints->first_changed_rows.size() == image[0].size()) &&
+                   (checkpoints->row_start == row_start) &&
+                   (checkpoints->n_active_rows == n_active_rows) &&
+                   (checkpoints->column_start == column_start) &&
+                   (checkpoints->n_active_columns == n_active_columns) &&
+                   (checkpoints->n_express_passes == n_express_passes) &&
+                   (checkpoints->active_interval == interval) &&
+                   (checkpoints->column_states.size() == n_active_columns) &&
+                   (checkpoints->image_out.size() == image.size()) &&
+                   (checkpoints->image_out[0].size() == image[0].size());
+    if (reclock && !checkpoints->column_states.empty() &&
+        (checkpoints->column_states[0].size() != n_states))
+        reclock = false;
+
+    // The first row to clock in each column, at a checkpoint
+    std::vector<int> i_row_restart(n_active_columns, 0);
+    if (reclock) {
+        int i_row_changed;
+        for (int i_column = 0; i_column < n_active_columns; i_column++) {
+            i_row_changed =
+                checkpoints->first_changed_rows[column_start + i_column] - row_start;
+            if (i_row_changed >= n_active_rows)
+                i_row_restart[i_column] = n_active_rows;
+            else if (i_row_changed > 0)
+                i_row_restart[i_column] = (i_row_changed / interval) * interval;
+        }
+    } else {
+        checkpoints->row_start = row_start;
+        checkpoints->n_active_rows = n_active_rows;
+        checkpoints->column_start = column_start;
+        checkpoints->n_active_columns = n_active_columns;
+        checkpoints->n_express_passes = n_express_passes;
+        checkpoints->active_interval = interval;
+        checkpoints->column_states.assign(
+            n_active_columns, std::vector<TrapStates>(n_states));
+    }
+    checkpoints->first_changed_rows.clear();
+
+    // Clock one column from its restart row
+    auto clock_column = [&](TrapManagerManager& column_trap_manager_manager,
+                            int i_column) {
+        int column_index = column_start + i_column;
+        std::vector<TrapStates>& states = checkpoints->column_states[i_column];
+
+        // The earlier pixels are the same as before
+        for (int i_row = 0; i_row < i_row_restart[i_column]; i_row++)
+            image[row_start + i_row][column_index] =
+                checkpoints->image_out[row_start + i_row][column_index];
+        if (i_row_restart[i_column] == n_active_rows) return;
+
+        TraceSpan span("column", 2, column_index);
+        column_trap_manager_manager.set_column_density_scale(column_index);
+        column_trap_manager_manager.reset_trap_states();
+        column_trap_manager_manager.store_trap_states();
+
+        // Whether the previous pass stored its states in the re-clocked rows
+        bool stored = false;
+        for (int express_index = 0; express_index < n_express_passes;
+             express_index++) {
+
+            if ((i_row_restart[i_column] == 0) || stored)
+                column_trap_manager_manager.restore_trap_states();
+            else
+                column_trap_manager_manager.load_trap_states(
+                    states[i_states
+                               [express_index * n_checkpoints +
+                                i_row_restart[i_column] / interval]]);
+
+            stored = false;
+            for (int i_row = i_row_restart[i_column]; i_row < n_active_rows;
+                 i_row += interval) {
+                int i_state =
+                    i_states[express_index * n_checkpoints + i_row / interval];
+                if (i_state >= 0)
+                    column_trap_manager_manager.save_trap_states(states[i_state]);
+                if (clock_pixels_in_express_pass(
+                        image, roe, ccd, column_trap_manager_manager, n_rows,
+                        column_index, express_index, row_start, i_row,
+                        std::min(i_row + interval, n_active_rows), prune_n_electrons,
+                        prune_frequency, settings.collapse_factor * prune_n_electrons))
+                    stored = true;
+            }
+        }
+    };
+
+    int n_strips = std::min(n_active_columns, 4 * get_n_threads());
+    workspace->reserve(n_strips);
+    parallel_for(n_strips, [&](int i_strip) {
+        TraceSpan span(
+            "strip", 1, column_start + i_strip * n_active_columns / n_strips);
+        TrapManagerManager& strip_trap_manager_manager =
+            workspace->trap_manager_managers[i_strip];
+        strip_trap_manager_manager = trap_manager_manager;
+
+        for (int i_column = i_strip * n_active_columns / n_strips;
+             i_column < (i_strip + 1) * n_active_columns / n_strips; i_column++)
+            clock_column(strip_trap_manager_manager, i_column);
+    });
+
+    int n_reclocked = 0;
+    for (int i_column = 0; i_column < n_active_columns; i_column++)
+        if (i_row_restart[i_column] < n_active_rows) n_reclocked++;
+    print_v(
+        1, "%d of %d column(s) clocked from checkpoints \n", reclock ? n_reclocked : 0,
+        n_active_columns);
+
+    checkpoints->image_out = image;
+}
+
+/*
+    Clock the columns of an image, with clock_charge_columns() or
+    clock_charge_injection_columns(), shared between threads in strips of
+    neighbouring columns if the traps are emptied between columns.
+
+    Each strip uses its own copy of the trap managers, so the output doesn't
+    depend on the number of threads. In NUMA mode, see set_numa_mode(), each
+    strip's trap managers are copied by the pinned thread that clocks it, so
+    they're in memory on that thread's node. The strips' pixels are clocked in
+    place: each row of the image spans every strip, so they can't be placed on
+    one node without copying the strip in and out, which costs more than the
+    sequential, prefetched accesses to them save.
+
+    Parameters
+    ----------
+    trap_manager_manager : TrapManagerManager&
+        The set-up trap managers to copy for each strip.
+
+    is_temporary : bool
+        Whether trap_manager_manager is only for this call, so can be used
+        directly instead of copied if there's only one strip and no workspace.
+
+    workspace : ClockingWorkspace*
+        The reusable trap managers and strip images, or nullptr.
+
+    trap_states : TrapStates*
+        The trap states to start from and to replace with the final states, see
+        clock_charge_columns(), or nullptr. If provided, then columns that share
+        their traps' states are clocked in order, without row segments.
+
+    Otherwise as for clock_charge_columns().
+*/
+static void clock_columns_in_strips(
+    std::valarray<std::valarray<double>>& image, ROE* roe, CCD* ccd,
+    TrapManagerManager& trap_manager_manager, bool is_temporary,
+    ClockingWorkspace* workspace, int n_rows, int row_start, int n_active_rows,
+    int column_start, int n_active_columns, double prune_n_electrons,
+    int prune_frequency, TrapStates* trap_states, const ClockingSettings& settings) {
+
+    // Clock one strip of columns with the given trap managers
+    auto clock_strip = [&](std::valarray<std::valarray<double>>& strip_image,
+                           TrapManagerManager& strip_trap_manager_manager,
+                           int strip_column_start, int n_strip_columns,
+                           TrapStates* strip_trap_states) {
+        TraceSpan span("strip", 1, strip_column_start);
+        if (roe->type == roe_type_charge_injection)
+            clock_charge_injection_columns(
+                strip_image, roe, ccd, strip_trap_manager_manager, row_start,
+                n_active_rows, strip_column_start, n_strip_columns,
+                prune_n_electrons, prune_frequency);
+        else
+            clock_charge_columns(
+                strip_image, roe, ccd, strip_trap_manager_manager, n_rows, row_start,
+                n_active_rows, strip_column_start, n_strip_columns, prune_n_electrons,
+                prune_frequency, strip_trap_states, settings);
+    };
+
+    // Columns that share their traps' states must be clocked in order, unless
+    // speculatively in one chunk per thread
+    int n_strips = 1;
+    if (roe->empty_traps_between_columns)
+        n_strips = std::min(n_active_columns, 4 * get_n_threads());
+    else if ((settings.speculative_tolerance > 0.0) && (trap_states == nullptr))
+        n_strips = std::min(n_active_columns, get_n_threads());
+
+    // Unless there are fewer columns than threads, so share their rows instead
+    bool use_row_segments =
+        (settings.row_segment_tolerance > 0.0) &&
+        (n_active_columns < get_n_threads()) &&
+        pixels_linked_only_by_traps(roe) && (trap_states == nullptr);
+
+    if ((n_strips <= 1) && is_temporary && (workspace == nullptr) &&
+        !use_row_segments) {
+        clock_strip(
+            image, trap_manager_manager, column_start, n_active_columns, trap_states);
+        return;
+    }
+
+    // Copy the trap managers into the workspace, which doesn't reallocate
+    // them if they're the same shape as in a previous call
+    ClockingWorkspace local_workspace;
+    if (workspace == nullptr) workspace = &local_workspace;
+
+    if (use_row_segments) {
+        int n_segments = std::min(get_n_threads(), n_active_rows);
+        print_v(2, "%d segments of rows \n", n_segments);
+
+        workspace->reserve(n_segments + 1);
+        TrapManagerManager& column_trap_manager_manager =
+            workspace->trap_manager_managers[n_segments];
+        column_trap_manager_manager = trap_manager_manager;
+        for (int i_column = 0; i_column < n_active_columns; i_column++)
+            clock_column_in_row_segments(
+                image, roe, ccd, column_trap_manager_manager, workspace, n_segments,
+                n_rows, row_start, n_active_rows, column_start + i_column,
+                prune_n_electrons, prune_frequency, settings);
+        return;
+    }
+
+    workspace->reserve(n_strips);
+
+    if (n_strips <= 1) {
+        workspace->trap_manager_managers[0] = trap_manager_manager;
+        clock_strip(
+            image, workspace->trap_manager_managers[0], column_start,
+            n_active_columns, trap_states);
+        return;
+    }
+
+    if (!roe->empty_traps_between_columns) {
+        clock_columns_speculatively(
+            image, trap_manager_manager, workspace, n_strips, column_start,
+            n_active_columns, clock_strip, settings);
+        return;
+    }
+
+    print_v(2, "%d strips of columns \n", n_strips);
+
+    parallel_for_numa(n_strips, [&](int i_strip) {
+        int strip_column_start = column_start + i_strip * n_active_columns / n_strips;
+        int n_strip_columns =
+            column_start + (i_strip + 1) * n_active_columns / n_strips -
+            strip_column_start;
+
+        // The traps start each strip as they would after the previous column
+        TrapManagerManager& strip_trap_manager_manager =
+            workspace->trap_manager_managers[i_strip];
+        strip_trap_manager_manager = trap_manager_manager;
+        if (i_strip > 0) {
+            strip_trap_manager_manager.reset_trap_states();
+            strip_trap_manager_manager.store_trap_states();
+        }
+        TrapStates* strip_trap_states =
+            (trap_states == nullptr) ? nullptr
+                                     : trap_states + strip_column_start - column_start;
+
+        clock_strip(
+            image, strip_trap_manager_manager, strip_column_start, n_strip_columns,
+            strip_trap_states);
+    });
+}
+
 /*
     Add CTI trails to an image by trapping, releasing, and moving electrons
     along their independent columns.
@@ -56,6 +1389,48 @@
         Whether or not to print the model inputs. Defaults to True if
         verbosity >= 1.
 
+    trap_manager_manager_in : TrapManagerManager* (opt.)
+        A prepared (unused) set of trap managers for the same traps, CCD, and
+        dwell times to copy, instead of building new ones, e.g. to skip setting
+        up the continuum tables for repeated calls. Must have been made for at
+        least as many transfers as required here.
+
+    workspace : ClockingWorkspace* (opt.)
+        Reusable storage for the working copies of the trap managers, so that
+        repeated calls with the same prepared trap managers don't allocate new
+        ones. See ClockingWorkspace.
+
+    checkpoints : ClockingCheckpoints* (opt.)
+        If provided, save the trap states at checkpoints in each column, or if
+        they're from a previous call on the same region, only re-clock the
+        columns from before their first changed rows. Ignored (and cleared)
+        unless the traps are emptied between columns and each clock step
+        captures and releases only in its own pixel.
+
+    column_density_scales : std::valarray<double>* (opt.)
+        If provided, the factor to multiply the trap densities by in each
+        column, for non-uniform radiation damage, e.g. from
+        density_scales_from_map(). Must be positive, with one per column of
+        the image. If the traps aren't emptied between columns, then the same
+        fractions of the traps stay filled from one column to the next.
+
+    trap_states : std::vector<TrapStates>* (opt.)
+        If provided, the trap states to start from, which are replaced by the
+        final trap states. e.g. To carry the persistent charge in slow traps
+        from the end of one exposure's readout to the start of the next,
+        without clocking the previous exposure again. See also
+        TrapStates::to_array() to save them in between.
+
+        One set of states for each active column if the traps are emptied
+        between columns, otherwise a single set for the start of the first
+        column and the end of the last, the same as if the columns were all
+        clocked in one call. If empty, then the traps start empty and it is
+        filled with the final states. Checkpoints are ignored in this mode.
+
+    settings : ClockingSettings* (opt.)
+        The optional speedups, e.g. from a ClockingModel, or nullptr (default)
+        for the global defaults. See ClockingSettings.
+
     Returns
     -------
     image : std::valarray<std::valarray<double>>
@@ -72,7 +1447,14 @@ std::valarray<std::valarray<double>> clock_charge_in_one_direction(
     int column_start, int column_stop, 
     int time_start, int time_stop, 
     double prune_n_electrons, int prune_frequency,
-    int print_inputs) {
+    int print_inputs, TrapManagerManager* trap_manager_manager_in,
+    ClockingWorkspace* workspace, ClockingCheckpoints* checkpoints,
+    std::valarray<double>* column_density_scales,
+    std::vector<TrapStates>* trap_states, ClockingSettings* settings) {
+
+    TraceSpan span("clock_charge_in_one_direction", 1);
+    ClockingSettings default_settings;
+    if (settings == nullptr) settings = &default_settings;
 
     // Initialise the output image as a copy of the input image
     std::valarray<std::valarray<double>> image = image_in;
@@ -96,8 +1478,8 @@ std::valarray<std::valarray<double>> clock_charge_in_one_direction(
     // Checks for non-standard modes
     if ((roe->type == roe_type_trap_pumping) && (n_active_rows != 1))
         error(
-            "TrapSlowCapture pumping currently requires the number of active rows (%d) "
-            "to be 1",
+            "Trap pumping currently requires the number of active rows (%d) to be 1, "
+            "see pump_charge_in_all_pixels() for multiple pixels",
             n_active_rows);
 
     // Set up the readout electronics and express arrays
@@ -114,6 +1496,19 @@ std::valarray<std::valarray<double>> clock_charge_in_one_direction(
         // need to be tracked if the traps are never reset
         max_n_transfers *= n_columns;
     }
+    if (roe->type == roe_type_trap_pumping) {
+        // Account for the watermarks from every pump back and forth
+        max_n_transfers *= roe->n_pumps;
+    }
+    if (trap_states != nullptr) {
+        // Account for the watermarks already in the starting trap states
+        int max_n_loaded_watermarks = 0;
+        for (const TrapStates& states : *trap_states)
+            for (const std::valarray<double>& volumes : states.watermark_volumes)
+                max_n_loaded_watermarks =
+                    std::max(max_n_loaded_watermarks, (int)volumes.size());
+        max_n_transfers += max_n_loaded_watermarks;
+    }
 
     // Set empty arrays for nullptr trap lists
     std::valarray<TrapInstantCapture> no_traps_ic = {};
@@ -133,19 +1528,50 @@ std::valarray<std::valarray<double>> clock_charge_in_one_direction(
         traps_sc_co = &no_traps_sc_co;
     }
 
-    // Set up the trap managers
-    TrapManagerManager trap_manager_manager(
-        *traps_ic, *traps_sc, *traps_ic_co, *traps_sc_co, max_n_transfers, *ccd,
-        roe->dwell_times);
+    // Set up the trap managers, or use the prepared ones
+    if ((trap_manager_manager_in != nullptr) &&
+        (trap_manager_manager_in->max_n_transfers <
+         max_n_transfers * roe->dwell_times.size()))
+        error(
+            "Prepared trap managers' max_n_transfers (%d) is too small (%d)",
+            trap_manager_manager_in->max_n_transfers,
+            (int)(max_n_transfers * roe->dwell_times.size()));
+    if (column_density_scales != nullptr) {
+        if (column_density_scales->size() != n_columns)
+            error(
+                "Number of trap density scales (%d) doesn't match the columns (%d)",
+                (int)column_density_scales->size(), n_columns);
+        if (column_density_scales->min() <= 0.0)
+            error("Trap density scales must be positive");
+    }
+    if (trap_states != nullptr) {
+        if (roe->type == roe_type_charge_injection)
+            error("Can't carry trap states between charge injection images");
+        int n_trap_states = roe->empty_traps_between_columns ? n_active_columns : 1;
+        if (trap_states->size() == 0)
+            trap_states->resize(n_trap_states);
+        else if (trap_states->size() != n_trap_states)
+            error(
+                "Number of trap states (%d) doesn't match the expected (%d)",
+                (int)trap_states->size(), n_trap_states);
+    }
+    TrapManagerManager new_trap_manager_manager;
+    if (trap_manager_manager_in == nullptr)
+        new_trap_manager_manager = TrapManagerManager(
+            *traps_ic, *traps_sc, *traps_ic_co, *traps_sc_co, max_n_transfers, *ccd,
+            roe->dwell_times, settings->continuum_table_tolerance);
+    else if (column_density_scales != nullptr) {
+        // Rescale a copy, since the prepared ones may be shared with other calls
+        new_trap_manager_manager = *trap_manager_manager_in;
+        trap_manager_manager_in = nullptr;
+    }
+    TrapManagerManager& trap_manager_manager = (trap_manager_manager_in == nullptr)
+                                                   ? new_trap_manager_manager
+                                                   : *trap_manager_manager_in;
 
-    unsigned int column_index;
-    unsigned int row_index;
-    unsigned int row_read;
-    unsigned int row_write;
-    double n_free_electrons;
-    double n_electrons_released_and_captured;
-    double express_multiplier;
-    ROEStepPhase* roe_step_phase;
+    // Rescale the trap densities in each column
+    if (column_density_scales != nullptr)
+        trap_manager_manager.column_density_scales = &(*column_density_scales)[0];
 
     // Print model inputs
     if (print_inputs == -1) print_inputs = verbosity >= 1;
@@ -275,193 +1701,500 @@ std::valarray<std::valarray<double>> clock_charge_in_one_direction(
     double wall_time_elapsed;
     gettimeofday(&wall_time_start, nullptr);
 
+    // Checkpoints need independent columns with pixels linked only by traps,
+    // starting from empty traps
+    if ((checkpoints != nullptr) &&
+        (!(roe->empty_traps_between_columns && pixels_linked_only_by_traps(roe)) ||
+         (trap_states != nullptr))) {
+        checkpoints->clear();
+        checkpoints = nullptr;
+    }
 
+    // Clock the columns, shared between threads if they're independent
+    if (checkpoints != nullptr) {
+        ClockingWorkspace local_workspace;
+        clock_columns_with_checkpoints(
+            image, roe, ccd, trap_manager_manager,
+            (workspace == nullptr) ? &local_workspace : workspace, n_rows, row_start,
+            n_active_rows, column_start, n_active_columns, prune_n_electrons,
+            prune_frequency, checkpoints, *settings);
+    } else
+        clock_columns_in_strips(
+            image, roe, ccd, trap_manager_manager, trap_manager_manager_in == nullptr,
+            workspace, n_rows, row_start, n_active_rows, column_start,
+            n_active_columns, prune_n_electrons, prune_frequency,
+            (trap_states == nullptr) ? nullptr : trap_states->data(), *settings);
 
-/*    
-    // Print express matrix
-    print_array_2D(roe->express_matrix, roe->n_express_passes);
-    for (unsigned int i_column = 0; i_column < n_active_columns; i_column++) {
-        column_index = column_start + i_column;
-        print_v(0, "express_multiplier \n", express_multiplier);
-        for (unsigned int express_index = 0; express_index < roe->n_express_passes;
-             express_index++) {
-            // Each pixel
-            for (unsigned int i_row = 0; i_row < n_active_rows; i_row++) {
-                row_index = row_start + i_row;
-                express_multiplier =
-                    roe->express_matrix[express_index * n_rows + row_index];
-                print_v(0, "%g", express_multiplier);
+    // Time taken
+    gettimeofday(&wall_time_end, nullptr);
+    wall_time_elapsed = gettimelapsed(wall_time_start, wall_time_end);
+    print_v(1, "Wall-clock time elapsed: %.4g s \n", wall_time_elapsed);
+
+    return image;
+}
+
+/*
+    Clock a window of rows in one column of an image through the traps, in
+    place, with the readout electronics and trap managers already set up.
+
+    Unlike clock_charge_in_one_direction(), nothing is prepared or copied for
+    each call, so this is for clocking many small windows with the same model,
+    e.g. the segments of sparse events in add_cti_sparse().
+
+    Parameters
+    ----------
+    image : std::valarray<std::valarray<double>>&
+        The array of pixel values, modified in place.
+
+    roe : ROE*
+        The readout electronics, with the clock sequence and express and
+        store-trap-states matrices set for the full image's rows, as in
+        clock_charge_in_one_direction().
+
+    ccd : CCD*
+        The CCD.
+
+    trap_manager_manager : TrapManagerManager&
+        The set-up trap managers, made for enough transfers for the window,
+        with their stored states empty. Left with empty stored states if the
+        traps are emptied between columns.
+
+    row_start, n_active_rows : int
+        The window of rows to clock.
+
+    column_index : int
+        The column to clock.
+
+    prune_n_electrons, prune_frequency : double, int
+        See add_cti().
+*/
+void clock_column_window(
+    std::valarray<std::valarray<double>>& image, ROE* roe, CCD* ccd,
+    TrapManagerManager& trap_manager_manager, int row_start, int n_active_rows,
+    int column_index, double prune_n_electrons, int prune_frequency) {
+
+    clock_charge_columns(
+        image, roe, ccd, trap_manager_manager, image.size(), row_start,
+        n_active_rows, column_index, 1, prune_n_electrons, prune_frequency, nullptr,
+        ClockingSettings());
+}
+
+/*
+    Make the per-column trap density scales for clock_charge_in_one_direction()
+    from a coarse 2D map of the relative trap density across the image.
+
+    Each map pixel covers an equal block of the image's columns (and rows). The
+    charge in every row of a column is clocked past the same traps in the
+    model, so each column's scale is the mean over the map's rows of its block.
+
+    Parameters
+    ----------
+    density_map : std::valarray<std::valarray<double>>&
+        The (n_map_rows x n_map_columns) relative trap densities, with no more
+        columns than the image. e.g. One row for a scale per block of columns.
+        For serial clocking, use the transposed map.
+
+    n_columns : int
+        The number of columns in the image.
+
+    Returns
+    -------
+    column_density_scales : std::valarray<double>
+        The trap density scale for each column.
+*/
+std::valarray<double> density_scales_from_map(
+    std::valarray<std::valarray<double>>& density_map, int n_columns) {
+
+    int n_map_rows = density_map.size();
+    int n_map_columns = (n_map_rows > 0) ? density_map[0].size() : 0;
+    if ((n_map_columns == 0) || (n_map_columns > n_columns))
+        error(
+            "Trap density map's columns (%d) must be 1 to the image's (%d)",
+            n_map_columns, n_columns);
+
+    std::valarray<double> column_density_scales(0.0, n_columns);
+    int i_map_column;
+    for (int column_index = 0; column_index < n_columns; column_index++) {
+        i_map_column = column_index * n_map_columns / n_columns;
+        for (int i_map_row = 0; i_map_row < n_map_rows; i_map_row++)
+            column_density_scales[column_index] += density_map[i_map_row][i_map_column];
+        column_density_scales[column_index] /= n_map_rows;
+    }
+
+    return column_density_scales;
+}
+
+/*
+    Add CTI trails to a batch of charge-injection images, e.g. a calibration
+    sequence of injection lines, sharing the setup between them.
+
+    The ROE express multipliers, clock sequence, and trap managers (including
+    any continuum-trap interpolation tables) are prepared only once, then the
+    images are clocked independently and shared between get_n_threads()
+    threads, see set_n_threads().
+
+    Parameters
+    ----------
+    images : std::valarray<std::valarray<std::valarray<double>>>
+        The input images, which must all have the same shape. See
+        clock_charge_in_one_direction() for each image.
+
+    roe : ROE*
+        The charge-injection ROE, i.e. an ROEChargeInjection object.
+
+    ccd : CCD*
+    traps_ic : std::valarray<TrapInstantCapture>*
+    traps_sc : std::valarray<TrapSlowCapture>*
+    traps_ic_co : std::valarray<TrapInstantCaptureContinuum>*
+    traps_sc_co : std::valarray<TrapSlowCaptureContinuum>*
+    express : int (opt.)
+    row_offset : int (opt.)
+    row_start, row_stop : int (opt.)
+    column_start, column_stop : int (opt.)
+    prune_n_electrons, prune_frequency : double, int (opt.)
+        See clock_charge_in_one_direction().
+
+    Returns
+    -------
+    images_out : std::valarray<std::valarray<std::valarray<double>>>
+        The output images.
+*/
+std::valarray<std::valarray<std::valarray<double>>> clock_charge_injection_batch(
+    std::valarray<std::valarray<std::valarray<double>>>& images, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int express, int row_offset,
+    int row_start, int row_stop, int column_start, int column_stop,
+    double prune_n_electrons, int prune_frequency) {
+
+    std::valarray<std::valarray<std::valarray<double>>> images_out = images;
+    int n_images = images.size();
+    if (n_images == 0) return images_out;
+
+    // Image shape
+    int n_rows = images[0].size();
+    int n_columns = images[0][0].size();
+    for (int i_image = 1; i_image < n_images; i_image++) {
+        if (((int)images[i_image].size() != n_rows) ||
+            ((int)images[i_image][0].size() != n_columns))
+            error("Batch image %d has a different shape to the first", i_image);
+    }
+
+    // Defaults
+    if (row_stop == -1) row_stop = n_rows;
+    if (column_stop == -1) column_stop = n_columns;
+
+    // Number of active rows and columns
+    int n_active_rows = row_stop - row_start;
+    int n_active_columns = column_stop - column_start;
+    int max_n_transfers = n_active_rows + row_offset;
+    print_v(
+        1, "%d image(s), %d column(s) [%d to %d], %d row(s) [%d to %d] \n", n_images,
+        n_active_columns, column_start, column_stop, n_active_rows, row_start,
+        row_stop);
+
+    // Checks
+    if (roe->type != roe_type_charge_injection)
+        error("Batch clocking requires a charge-injection ROE (type %d)", roe->type);
+    if (ccd->n_phases != roe->n_phases)
+        error(
+            "Number of CCD phases (%d) and ROE phases (%d) don't match.", ccd->n_phases,
+            roe->n_phases);
+
+    // Set up the readout electronics and express arrays, shared by all images
+    roe->set_clock_sequence();
+    int offset = row_offset + roe->prescan_offset;
+    roe->set_express_matrix_from_rows_and_express(n_rows, express, offset);
+    roe->set_store_trap_states_matrix();
+    if (!roe->empty_traps_between_columns) max_n_transfers *= n_columns;
+
+    // Set empty arrays for nullptr trap lists
+    std::valarray<TrapInstantCapture> no_traps_ic = {};
+    if (traps_ic == nullptr) traps_ic = &no_traps_ic;
+    std::valarray<TrapSlowCapture> no_traps_sc = {};
+    if (traps_sc == nullptr) traps_sc = &no_traps_sc;
+    std::valarray<TrapInstantCaptureContinuum> no_traps_ic_co = {};
+    if (traps_ic_co == nullptr) traps_ic_co = &no_traps_ic_co;
+    std::valarray<TrapSlowCaptureContinuum> no_traps_sc_co = {};
+    if (traps_sc_co == nullptr) traps_sc_co = &no_traps_sc_co;
+
+    // Set up the trap managers once, to be copied for each image
+    TrapManagerManager trap_manager_manager(
+        *traps_ic, *traps_sc, *traps_ic_co, *traps_sc_co, max_n_transfers, *ccd,
+        roe->dwell_times);
+
+    // Measure wall-clock time taken for the primary loop
+    struct timeval wall_time_start;
+    struct timeval wall_time_end;
+    gettimeofday(&wall_time_start, nullptr);
+
+    // Clock each image
+    parallel_for(n_images, [&](int i_image) {
+        TrapManagerManager image_trap_manager_manager = trap_manager_manager;
+
+        clock_charge_injection_columns(
+            images_out[i_image], roe, ccd, image_trap_manager_manager, row_start,
+            n_active_rows, column_start, n_active_columns, prune_n_electrons,
+            prune_frequency);
+    });
+
+    // Time taken
+    gettimeofday(&wall_time_end, nullptr);
+    print_v(
+        1, "Wall-clock time elapsed: %.4g s \n",
+        gettimelapsed(wall_time_start, wall_time_end));
+
+    return images_out;
+}
+
+/*
+    Model trap pumping for every pixel in a region of an image at once.
+
+    For trap pumping, the ROETrapPumping clock sequence moves charge back and
+    forth between each pixel and its neighbours n_pumps times, so that traps in
+    the pumped pixel's phases capture charge from and release it into the
+    neighbouring pixel(s). Unlike clock_charge_in_one_direction(), which
+    requires a single active row and simulates every pump (or express-scaled
+    pump) in turn, this treats each pixel in the region as independently
+    containing traps and sums their effects on the input image. The pixels are
+    shared between get_n_threads() threads, see set_n_threads().
+
+    The pump cycle is periodic, so after the traps have settled the charge
+    exchanged by each pump barely changes from one to the next. Once the
+    change between consecutive pumps in all affected pixels is below the
+    steady-state tolerance (relative to the charge exchanged by that pump),
+    the remaining pumps are extrapolated from the last one instead of being
+    simulated, so the cost is not linear in n_pumps.
+
+    Parameters
+    ----------
+    image_in : std::valarray<std::valarray<double>>
+        The input array of pixel values, see clock_charge_in_one_direction().
+
+    roe : ROE*
+        The trap-pumping readout electronics, i.e. an ROETrapPumping object.
+
+    ccd : CCD*
+    traps_ic : std::valarray<TrapInstantCapture>*
+    traps_sc : std::valarray<TrapSlowCapture>*
+    traps_ic_co : std::valarray<TrapInstantCaptureContinuum>*
+    traps_sc_co : std::valarray<TrapSlowCaptureContinuum>*
+        See clock_charge_in_one_direction().
+
+    row_start, row_stop : int (opt.)
+    column_start, column_stop : int (opt.)
+        The region of pixels that contain traps and are pumped. Defaults to
+        the full image. The neighbouring pixels that receive charge must be
+        within the image.
 
-                if (roe->store_trap_states_matrix[express_index * n_rows + row_index]) {
-                    trap_manager_manager.store_trap_states();
+    steady_state_tolerance : double (opt.)
+        The relative change in the charge exchanged by consecutive pumps below
+        which the remaining pumps are extrapolated. Default 1e-6. Set to 0 to
+        simulate every pump explicitly.
 
-                    print_v(0, "*");
-                }
-            }
-            print_v(0, "\n");
-        }
-    }    
+    prune_n_electrons : double (opt.)
+    prune_frequency : int (opt.)
+        See add_cti(). Here, the frequency is in units of pumps.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The output array of pixel values.
 */
+std::valarray<std::valarray<double>> pump_charge_in_all_pixels(
+    std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int row_start, int row_stop,
+    int column_start, int column_stop, double steady_state_tolerance,
+    double prune_n_electrons, int prune_frequency) {
 
-    // ========
-    // Clock each column of pixels through the column of traps
-    // ========
-    // Print express matrix
-    //print_array_2D(roe->express_matrix, n_active_rows);
-    //print_array_2D((int)roe->store_trap_states_matrix, n_active_rows);
-    // Loop over:
-    //   Columns > Express passes > Rows > Clock-sequence steps > Pixel phases
-    for (unsigned int i_column = 0; i_column < n_active_columns; i_column++) {
-        column_index = column_start + i_column;
+    // Image shape
+    int n_rows = image_in.size();
+    int n_columns = image_in[0].size();
 
-        print_v(
-            2, "# # # #  i_column, column_index  %d,  %d \n", i_column, column_index);
+    // Defaults
+    if (row_stop == -1) row_stop = n_rows;
+    if (column_stop == -1) column_stop = n_columns;
 
-        // Monitor the traps for every transfer (express=n_rows), or just one
-        // (express=1) or a few (express=a few) then replicate their effect
-        for (unsigned int express_index = 0; express_index < roe->n_express_passes;
-             express_index++) {
+    // Number of active rows and columns
+    int n_active_rows = row_stop - row_start;
+    int n_active_columns = column_stop - column_start;
+    print_v(
+        1, "%d column(s) [%d to %d], %d row(s) [%d to %d] pumped \n", n_active_columns,
+        column_start, column_stop, n_active_rows, row_start, row_stop);
 
-            print_v(2, "# # #  express_index  %d \n", express_index);
+    // Checks
+    if (roe->type != roe_type_trap_pumping)
+        error("Pumping all pixels requires a trap-pumping ROE (type %d)", roe->type);
+    if (ccd->n_phases != roe->n_phases)
+        error(
+            "Number of CCD phases (%d) and ROE phases (%d) don't match.", ccd->n_phases,
+            roe->n_phases);
 
-            // Restore the trap occupancy levels, either to empty or to a saved
-            // state from a previous express pass
-            trap_manager_manager.restore_trap_states();
+    // Set up the clock sequence
+    roe->set_clock_sequence();
 
-            // Each pixel
-            for (unsigned int i_row = 0; i_row < n_active_rows; i_row++) {
-                row_index = row_start + i_row;
+    // The range of neighbouring pixels that charge can move to or from
+    int min_pixel_offset = 0;
+    int max_pixel_offset = 0;
+    for (int i_step = 0; i_step < roe->n_steps; i_step++) {
+        for (int i_phase = 0; i_phase < ccd->n_phases; i_phase++) {
+            ROEStepPhase* roe_step_phase = &roe->clock_sequence[i_step][i_phase];
+            for (int i = 0; i < roe_step_phase->n_capture_pixels; i++) {
+                min_pixel_offset = std::min(
+                    min_pixel_offset, roe_step_phase->capture_from_which_pixels[i]);
+                max_pixel_offset = std::max(
+                    max_pixel_offset, roe_step_phase->capture_from_which_pixels[i]);
+            }
+            for (int i = 0; i < roe_step_phase->n_release_pixels; i++) {
+                min_pixel_offset = std::min(
+                    min_pixel_offset, roe_step_phase->release_to_which_pixels[i]);
+                max_pixel_offset = std::max(
+                    max_pixel_offset, roe_step_phase->release_to_which_pixels[i]);
+            }
+        }
+    }
+    int n_local_pixels = max_pixel_offset - min_pixel_offset + 1;
+    if ((row_start + min_pixel_offset < 0) || (row_stop + max_pixel_offset > n_rows))
+        error(
+            "Pumped rows [%d to %d] need neighbouring rows [%d to %d] in the image",
+            row_start, row_stop, row_start + min_pixel_offset,
+            row_stop + max_pixel_offset);
 
-                print_v(2, "# #  i_row, row_index  %d,  %d \n", i_row, row_index);
+    // Set empty arrays for nullptr trap lists
+    std::valarray<TrapInstantCapture> no_traps_ic = {};
+    if (traps_ic == nullptr) traps_ic = &no_traps_ic;
+    std::valarray<TrapSlowCapture> no_traps_sc = {};
+    if (traps_sc == nullptr) traps_sc = &no_traps_sc;
+    std::valarray<TrapInstantCaptureContinuum> no_traps_ic_co = {};
+    if (traps_ic_co == nullptr) traps_ic_co = &no_traps_ic_co;
+    std::valarray<TrapSlowCaptureContinuum> no_traps_sc_co = {};
+    if (traps_sc_co == nullptr) traps_sc_co = &no_traps_sc_co;
 
-                express_multiplier =
-                    roe->express_matrix[express_index * n_rows + row_index];
-                if (express_multiplier == 0) continue;
+    // The change to each local pixel from pumping each pixel
+    int n_pixels = n_active_rows * n_active_columns;
+    std::valarray<double> local_changes(0.0, n_pixels * n_local_pixels);
 
-                print_v(2, "express_multiplier  %g \n", express_multiplier);
+    // Share the pixels between blocks that each reuse one set of trap managers
+    int n_blocks = std::min(n_pixels, 4 * get_n_threads());
+    int n_pixels_per_block = (n_pixels + n_blocks - 1) / n_blocks;
 
-                // Each step in the clock sequence
-                for (unsigned int i_step = 0; i_step < roe->n_steps; i_step++) {
+    // Measure wall-clock time taken for the primary loop
+    struct timeval wall_time_start;
+    struct timeval wall_time_end;
+    gettimeofday(&wall_time_start, nullptr);
 
-                    // Each phase in the pixel
-                    for (unsigned int i_phase = 0; i_phase < ccd->n_phases; i_phase++) {
+    // ========
+    // Pump each pixel independently
+    // ========
+    parallel_for(n_blocks, [&](int i_block) {
+        // Set up the trap managers, with room for watermarks from every pump
+        TrapManagerManager trap_manager_manager(
+            *traps_ic, *traps_sc, *traps_ic_co, *traps_sc_co, roe->n_pumps, *ccd,
+            roe->dwell_times);
+
+        std::valarray<double> local_pixels(n_local_pixels);
+        std::valarray<double> local_pixels_in(n_local_pixels);
+        std::valarray<double> local_pixels_before_pump(n_local_pixels);
+        std::valarray<double> pump_change(n_local_pixels);
+        std::valarray<double> previous_pump_change(n_local_pixels);
+        double n_free_electrons;
+        double n_electrons_released_and_captured;
+        ROEStepPhase* roe_step_phase;
+
+        for (int i_pixel = i_block * n_pixels_per_block;
+             i_pixel < std::min((i_block + 1) * n_pixels_per_block, n_pixels);
+             i_pixel++) {
+            int row_index = row_start + i_pixel / n_active_columns;
+            int column_index = column_start + i_pixel % n_active_columns;
+
+            // Start with empty traps
+            trap_manager_manager.reset_trap_states();
+
+            // The pixel and its neighbours
+            for (int i = 0; i < n_local_pixels; i++)
+                local_pixels[i] =
+                    image_in[row_index + min_pixel_offset + i][column_index];
+            local_pixels_in = local_pixels;
+            previous_pump_change = 0.0;
+
+            for (int i_pump = 0; i_pump < roe->n_pumps; i_pump++) {
+                local_pixels_before_pump = local_pixels;
 
-                        if ((roe->n_steps > 1) || (ccd->n_phases > 1))
-                            print_v(
-                                2, "#  i_step, i_phase  %d,  %d \n", i_step, i_phase);
+                // Each step in the clock sequence
+                for (int i_step = 0; i_step < roe->n_steps; i_step++) {
 
-                        // State of the ROE in this step and phase of the sequence
+                    // Each phase in the pixel
+                    for (int i_phase = 0; i_phase < ccd->n_phases; i_phase++) {
                         roe_step_phase = &roe->clock_sequence[i_step][i_phase];
 
                         // Get the initial charge from the relevant pixel(s)
-                        n_free_electrons = 0;
-                        for (int i = 0; i < roe_step_phase->n_capture_pixels; i++) {
-                            row_read = row_index +
-                                       roe_step_phase->capture_from_which_pixels[i];
-
-                            n_free_electrons += image[row_read][column_index];
-                        }
-
-                        print_v(2, "row_read  %d \n", row_read);
-                        print_v(2, "n_free_electrons  %g \n", n_free_electrons);
-
-                        // Release and capture electrons with the traps in this
-                        // pixel/phase, for each type of traps
-                        n_electrons_released_and_captured = 0;
-                        if (trap_manager_manager.n_traps_ic > 0)
-                            n_electrons_released_and_captured +=
-                                trap_manager_manager.trap_managers_ic[i_phase]
-                                    .n_electrons_released_and_captured(
-                                        n_free_electrons +
-                                        n_electrons_released_and_captured);
-                        if (trap_manager_manager.n_traps_sc > 0)
-                            n_electrons_released_and_captured +=
-                                trap_manager_manager.trap_managers_sc[i_phase]
-                                    .n_electrons_released_and_captured(
-                                        n_free_electrons +
-                                        n_electrons_released_and_captured);
-                        if (trap_manager_manager.n_traps_ic_co > 0)
-                            n_electrons_released_and_captured +=
-                                trap_manager_manager.trap_managers_ic_co[i_phase]
-                                    .n_electrons_released_and_captured(
-                                        n_free_electrons +
-                                        n_electrons_released_and_captured);
-                        if (trap_manager_manager.n_traps_sc_co > 0)
-                            n_electrons_released_and_captured +=
-                                trap_manager_manager.trap_managers_sc_co[i_phase]
-                                    .n_electrons_released_and_captured(
-                                        n_free_electrons +
-                                        n_electrons_released_and_captured);
-
-                      
-/*                        print_v(
-                            0, "%d ",
-                            trap_manager_manager.trap_managers_ic[i_phase]
-                                    .n_active_watermarks);
-                        print_array(
-                            trap_manager_manager.trap_managers_ic[i_phase]
-                                    .watermark_volumes);
-                        print_array(
-                            trap_manager_manager.trap_managers_ic[i_phase]
-                                    .watermark_fills);
-*/                      
-                        print_v(
-                            2, "n_electrons_released_and_captured  %g \n",
-                            n_electrons_released_and_captured);
-
-                        print_v(
-                           2, "n_trapped_electrons_from_watermarks  %g \n",
-                            trap_manager_manager.trap_managers_ic[i_phase].n_trapped_electrons_from_watermarks(trap_manager_manager.trap_managers_ic[i_phase].watermark_volumes,trap_manager_manager.trap_managers_ic[i_phase].watermark_fills));
-
-                        print_v(2, "n_free_electrons  %g \n", n_free_electrons);
+                        n_free_electrons = 0.0;
+                        for (int i = 0; i < roe_step_phase->n_capture_pixels; i++)
+                            n_free_electrons += local_pixels
+                                [roe_step_phase->capture_from_which_pixels[i] -
+                                 min_pixel_offset];
 
+                        n_electrons_released_and_captured =
+                            trap_manager_manager.n_electrons_released_and_captured(
+                                i_phase, n_free_electrons);
 
                         // Return the charge to the relevant pixel(s)
                         for (int i = 0; i < roe_step_phase->n_release_pixels; i++) {
-                            row_write =
-                                row_index + roe_step_phase->release_to_which_pixels[i];
+                            double& local_pixel = local_pixels
+                                [roe_step_phase->release_to_which_pixels[i] -
+                                 min_pixel_offset];
 
-                            image[row_write][column_index] +=
-                                n_electrons_released_and_captured * express_multiplier *
+                            local_pixel +=
+                                n_electrons_released_and_captured *
                                 roe_step_phase->release_fraction_to_pixels[i];
 
-                            // Make sure image counts don't go negative, which
-                            // could happen with a too-large express multiplier
-                            if (image[row_write][column_index] < 0.0)
-                                image[row_write][column_index] = 0.0;
-
-                            print_v(2, "row_write  %d \n", row_write);
-                            print_v(
-                                2, "image[%d][%d]  %g \n", row_write, column_index,
-                                image[row_write][column_index]);
+                            // Make sure image counts don't go negative
+                            if (local_pixel < 0.0) local_pixel = 0.0;
                         }
                     }
                 }
 
-                // Absorb really small watermarks  into others, for speed
-                if (prune_frequency > 0) {
-                    if (((i_row + 1) % prune_frequency) == 0) {
-                        trap_manager_manager.prune_watermarks(prune_n_electrons);
-                    }
-                }
-                
-                // Store the trap states if needed for the next express pass
-                if (roe->store_trap_states_matrix[express_index * n_rows + row_index]) {
-                    print_v(2, "store_trap_states \n");
-                    trap_manager_manager.store_trap_states();
+                // Absorb really small watermarks into others, for speed
+                if ((prune_frequency > 0) && (((i_pump + 1) % prune_frequency) == 0))
+                    trap_manager_manager.prune_watermarks(prune_n_electrons);
+
+                // Extrapolate the remaining pumps once in a steady state
+                pump_change = local_pixels - local_pixels_before_pump;
+                if ((steady_state_tolerance > 0.0) && (i_pump > 0) &&
+                    (abs(pump_change - previous_pump_change).max() <=
+                     steady_state_tolerance * abs(pump_change).max())) {
+                    local_pixels += (double)(roe->n_pumps - i_pump - 1) * pump_change;
+                    local_pixels[local_pixels < 0.0] = 0.0;
+                    break;
                 }
+                previous_pump_change = pump_change;
             }
+
+            local_changes[std::slice(i_pixel * n_local_pixels, n_local_pixels, 1)] =
+                local_pixels - local_pixels_in;
         }
+    });
 
-        // Reset the trap states to empty and/or store them for the next column
-        if (roe->empty_traps_between_columns) trap_manager_manager.reset_trap_states();
-        trap_manager_manager.store_trap_states();
+    // Add the changes from pumping each pixel to the image
+    std::valarray<std::valarray<double>> image = image_in;
+    for (int i_pixel = 0; i_pixel < n_pixels; i_pixel++) {
+        int row_index = row_start + i_pixel / n_active_columns;
+        int column_index = column_start + i_pixel % n_active_columns;
+
+        for (int i = 0; i < n_local_pixels; i++)
+            image[row_index + min_pixel_offset + i][column_index] +=
+                local_changes[i_pixel * n_local_pixels + i];
     }
 
     // Time taken
     gettimeofday(&wall_time_end, nullptr);
-    wall_time_elapsed = gettimelapsed(wall_time_start, wall_time_end);
-    print_v(1, "Wall-clock time elapsed: %.4g s \n", wall_time_elapsed);
+    print_v(
+        1, "Wall-clock time elapsed: %.4g s \n",
+        gettimelapsed(wall_time_start, wall_time_end));
 
     return image;
 }
@@ -552,6 +2285,33 @@ std::valarray<std::valarray<double>> clock_charge_in_one_direction(
         The interation when being called by remove_cti(), default 0 otherwise.
         Only used to control printing.
 
+    parallel_density_scales : std::valarray<double>* (opt.)
+        The factor to multiply the parallel trap densities by in each column,
+        for non-uniform radiation damage, see clock_charge_in_one_direction()
+        and density_scales_from_map(). Default nullptr for uniform densities.
+
+    serial_density_scales : std::valarray<double>* (opt.)
+        The same, for the serial trap densities in each row.
+
+    parallel_trap_states : std::vector<TrapStates>* (opt.)
+        The parallel trap states to start from, which are replaced by the final
+        states, e.g. to model the persistence from one exposure's readout into
+        the next in a sequence, see clock_charge_in_one_direction(). Default
+        nullptr to start from empty traps.
+
+    serial_trap_states : std::vector<TrapStates>* (opt.)
+        The same, for the serial traps.
+
+    parallel_express_extrapolate, serial_express_extrapolate : bool (opt.)
+        If true, clock with express and 2 * express and extrapolate to cancel
+        the leading express error, see
+        clock_charge_in_one_direction_extrapolated_express(). Not with windows,
+        time ranges, or trap states. Default false.
+
+    error_estimate : double* (opt.)
+        If provided, set to the sum of the extrapolated express error estimates
+        of both directions, or to 0 without extrapolated express.
+
     Returns
     -------
     image : std::valarray<std::valarray<double>>
@@ -579,7 +2339,11 @@ std::valarray<std::valarray<double>> add_cti(
     int serial_window_start, int serial_window_stop, 
     int serial_time_start, int serial_time_stop,
     double serial_prune_n_electrons, int serial_prune_frequency,
-    int verbosity, int iteration) {
+    int verbosity, int iteration, std::valarray<double>* parallel_density_scales,
+    std::valarray<double>* serial_density_scales,
+    std::vector<TrapStates>* parallel_trap_states,
+    std::vector<TrapStates>* serial_trap_states, bool parallel_express_extrapolate,
+    bool serial_express_extrapolate, double* error_estimate) {
     
  
     // Print unless being called by remove_cti()
@@ -588,22 +2352,44 @@ std::valarray<std::valarray<double>> add_cti(
     // Don't print model inputs every iteration
     int print_inputs = (iteration > 1) ? 0 : verbosity >= 1;
 
+    // The extrapolated express clocks every pixel from empty traps
+    bool is_windowed = (parallel_window_start != 0) || (parallel_window_stop != -1) ||
+                       (serial_window_start != 0) || (serial_window_stop != -1);
+    if (parallel_express_extrapolate &&
+        (is_windowed || (parallel_time_start != 0) || (parallel_time_stop != -1) ||
+         (parallel_trap_states != nullptr)))
+        error("Parallel express_extrapolate can't be used with windows, time ranges, "
+              "or trap states");
+    if (serial_express_extrapolate &&
+        (is_windowed || (serial_time_start != 0) || (serial_time_stop != -1) ||
+         (serial_trap_states != nullptr)))
+        error("Serial express_extrapolate can't be used with windows, time ranges, "
+              "or trap states");
+
     // Initialise the output image as a copy of the input image
     std::valarray<std::valarray<double>> image = image_in;
+    double parallel_error_estimate = 0.0;
+    double serial_error_estimate = 0.0;
 
     // Parallel clocking along columns, transfer charge towards row 0
     if (parallel_traps_ic || parallel_traps_sc || parallel_traps_ic_co ||
         parallel_traps_sc_co) {
         print_v(1, "Parallel: ");
-        image = clock_charge_in_one_direction(
-            image, parallel_roe, parallel_ccd, parallel_traps_ic, parallel_traps_sc,
-            parallel_traps_ic_co, parallel_traps_sc_co, 
-            parallel_express, parallel_offset, 
-            parallel_window_start, parallel_window_stop,
-            serial_window_start, serial_window_stop, 
-            parallel_time_start, parallel_time_stop,
-            parallel_prune_n_electrons, parallel_prune_frequency,
-            print_inputs);
+        if (parallel_express_extrapolate)
+            image = clock_charge_in_one_direction_extrapolated_express(
+                image, parallel_roe, parallel_ccd, parallel_traps_ic, parallel_traps_sc,
+                parallel_traps_ic_co, parallel_traps_sc_co, parallel_express,
+                parallel_offset, parallel_prune_n_electrons, parallel_prune_frequency,
+                &parallel_error_estimate, nullptr, nullptr, parallel_density_scales);
+        else
+            image = clock_charge_in_one_direction(
+                image, parallel_roe, parallel_ccd, parallel_traps_ic,
+                parallel_traps_sc, parallel_traps_ic_co, parallel_traps_sc_co,
+                parallel_express, parallel_offset, parallel_window_start,
+                parallel_window_stop, serial_window_start, serial_window_stop,
+                parallel_time_start, parallel_time_stop, parallel_prune_n_electrons,
+                parallel_prune_frequency, print_inputs, nullptr, nullptr, nullptr,
+                parallel_density_scales, parallel_trap_states);
     }
 
     // Serial clocking along rows, transfer charge towards column 0
@@ -612,19 +2398,27 @@ std::valarray<std::valarray<double>> add_cti(
 
         print_v(1, "Serial: ");
         image = transpose(image);
-        image = clock_charge_in_one_direction(
-            image, serial_roe, serial_ccd, serial_traps_ic, serial_traps_sc,
-            serial_traps_ic_co, serial_traps_sc_co, 
-            serial_express, serial_offset,
-            serial_window_start, serial_window_stop, 
-            parallel_window_start, parallel_window_stop, 
-            serial_time_start, serial_time_stop,
-            serial_prune_n_electrons, serial_prune_frequency,
-            print_inputs);
+        if (serial_express_extrapolate)
+            image = clock_charge_in_one_direction_extrapolated_express(
+                image, serial_roe, serial_ccd, serial_traps_ic, serial_traps_sc,
+                serial_traps_ic_co, serial_traps_sc_co, serial_express, serial_offset,
+                serial_prune_n_electrons, serial_prune_frequency,
+                &serial_error_estimate, nullptr, nullptr, serial_density_scales);
+        else
+            image = clock_charge_in_one_direction(
+                image, serial_roe, serial_ccd, serial_traps_ic, serial_traps_sc,
+                serial_traps_ic_co, serial_traps_sc_co, serial_express, serial_offset,
+                serial_window_start, serial_window_stop, parallel_window_start,
+                parallel_window_stop, serial_time_start, serial_time_stop,
+                serial_prune_n_electrons, serial_prune_frequency, print_inputs,
+                nullptr, nullptr, nullptr, serial_density_scales, serial_trap_states);
 
         image = transpose(image);
     }
 
+    if (error_estimate != nullptr)
+        *error_estimate = parallel_error_estimate + serial_error_estimate;
+
     return image;
 }
 
@@ -646,6 +2440,26 @@ std::valarray<std::valarray<double>> add_cti(
         cost of longer runtime. In practice, two or three iterations are often
         sufficient.
 
+    image_estimate : std::valarray<std::valarray<double>>* (opt.)
+        If provided, the first estimate of the image with CTI removed, instead
+        of the input image, so that fewer iterations are needed. e.g. From the
+        fast estimate_remove_cti_linearised(), or the input image times the
+        ratio of the corrected to uncorrected pixels of a similar frame.
+
+    parallel_density_scales, serial_density_scales : std::valarray<double>*
+        (opt.) See add_cti().
+
+    parallel_trap_states, serial_trap_states : std::vector<TrapStates>* (opt.)
+        See add_cti(). Each iteration's model starts from the same given
+        states, which are replaced by the final states from the last one.
+
+    parallel_express_extrapolate, serial_express_extrapolate : bool (opt.)
+        See add_cti().
+
+    error_estimate : double* (opt.)
+        If provided, set to the extrapolated express error estimate of the last
+        iteration's added CTI, see add_cti().
+
     Returns
     -------
     image : std::valarray<std::valarray<double>>
@@ -672,19 +2486,48 @@ std::valarray<std::valarray<double>> remove_cti(
     int serial_express, int serial_offset, 
     int serial_window_start, int serial_window_stop,
     int serial_time_start, int serial_time_stop,
-    double serial_prune_n_electrons, int serial_prune_frequency) {
+    double serial_prune_n_electrons, int serial_prune_frequency,
+    std::valarray<std::valarray<double>>* image_estimate,
+    std::valarray<double>* parallel_density_scales,
+    std::valarray<double>* serial_density_scales,
+    std::vector<TrapStates>* parallel_trap_states,
+    std::vector<TrapStates>* serial_trap_states, bool parallel_express_extrapolate,
+    bool serial_express_extrapolate, double* error_estimate) {
 
     print_version();
+    if (error_estimate != nullptr) *error_estimate = 0.0;
 
-    // Initialise the output image as a copy of the input image
-    std::valarray<std::valarray<double>> image_remove_cti = image_in;
+    int n_rows = image_in.size();
+    if ((image_estimate != nullptr) &&
+        ((image_estimate->size() != n_rows) ||
+         ((*image_estimate)[0].size() != image_in[0].size())))
+        error(
+            "Estimated image shape (%d x %d) doesn't match the input (%d x %d)",
+            (int)image_estimate->size(), (int)(*image_estimate)[0].size(), n_rows,
+            (int)image_in[0].size());
+
+    // Initialise the output image as a copy of the input image, or the estimate
+    std::valarray<std::valarray<double>> image_remove_cti =
+        (image_estimate == nullptr) ? image_in : *image_estimate;
     std::valarray<std::valarray<double>> image_add_cti;
 
-    int n_rows = image_in.size();
+    // Start every iteration's model from the same trap states
+    std::vector<TrapStates> parallel_trap_states_in;
+    std::vector<TrapStates> serial_trap_states_in;
+    if (parallel_trap_states != nullptr)
+        parallel_trap_states_in = *parallel_trap_states;
+    if (serial_trap_states != nullptr) serial_trap_states_in = *serial_trap_states;
 
     // Estimate the image with removed CTI more accurately each iteration
     for (int iteration = 1; iteration <= n_iterations; iteration++) {
         print_v(1, "Iter %d: ", iteration);
+        TraceSpan span("remove_cti_iteration", 1, iteration);
+        if (iteration > 1) {
+            if (parallel_trap_states != nullptr)
+                *parallel_trap_states = parallel_trap_states_in;
+            if (serial_trap_states != nullptr)
+                *serial_trap_states = serial_trap_states_in;
+        }
 
         // Model the effect of adding CTI trails
         image_add_cti = add_cti(
@@ -698,8 +2541,10 @@ std::valarray<std::valarray<double>> remove_cti(
             serial_traps_sc, serial_traps_ic_co, serial_traps_sc_co, serial_express,
             serial_offset, serial_window_start, serial_window_stop, 
             serial_time_start, serial_time_stop, 
-            serial_prune_n_electrons, serial_prune_frequency,
-            iteration);
+            serial_prune_n_electrons, serial_prune_frequency, verbosity,
+            iteration, parallel_density_scales, serial_density_scales,
+            parallel_trap_states, serial_trap_states, parallel_express_extrapolate,
+            serial_express_extrapolate, error_estimate);
 
         // Improve the estimate of the image with CTI trails removed
         image_remove_cti += image_in - image_add_cti;
@@ -712,3 +2557,248 @@ std::valarray<std::valarray<double>> remove_cti(
 
     return image_remove_cti;
 }
+
+/*
+    Add CTI trails to an image along its columns, as for
+    clock_charge_in_one_direction(), and also track the derivatives of the
+    output image with respect to each trap species' density and release
+    timescale, using forward-mode dual numbers.
+
+    Only instant-capture traps with uniform distributions are supported.
+    Watermarks are not pruned in this mode, so the resulting image matches
+    clock_charge_in_one_direction() with prune_frequency = 0.
+
+    Parameters
+    ----------
+    image_in : std::valarray<std::valarray<double>>
+    roe : ROE*
+    ccd : CCD*
+    traps_ic : std::valarray<TrapInstantCapture>*
+    express : int (opt.)
+    row_offset : int (opt.)
+    row_start, row_stop : int (opt.)
+    column_start, column_stop : int (opt.)
+        See clock_charge_in_one_direction().
+
+    derivatives : std::valarray<std::valarray<std::valarray<double>>>&
+        The derivatives of each pixel value of the input image with respect to
+        each parameter, indexed [parameter][row][column]. Updated in place to
+        the derivatives of the output image.
+
+        If empty, then it is initialised to zeros for 2 parameters per trap
+        species, i.e. for the density then release timescale of each.
+
+    i_first_derivative : int (opt.)
+        The index in derivatives of the first trap's density derivative, for
+        the trap species used in this clocking, e.g. to chain parallel and
+        serial clocking with different traps. Default 0.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The output array of pixel values.
+*/
+std::valarray<std::valarray<double>> clock_charge_in_one_direction_derivatives(
+    std::valarray<std::valarray<double>>& image_in,
+    std::valarray<std::valarray<std::valarray<double>>>& derivatives, ROE* roe,
+    CCD* ccd, std::valarray<TrapInstantCapture>* traps_ic, int express,
+    int row_offset, int row_start, int row_stop, int column_start,
+    int column_stop, int i_first_derivative) {
+
+    // Initialise the output image as a copy of the input image
+    std::valarray<std::valarray<double>> image = image_in;
+
+    // Image shape
+    unsigned int n_rows = image.size();
+    unsigned int n_columns = image[0].size();
+
+    // Defaults
+    if (row_stop == -1) row_stop = n_rows;
+    if (column_stop == -1) column_stop = n_columns;
+
+    // Number of active rows and columns
+    unsigned int n_active_rows = row_stop - row_start;
+    unsigned int n_active_columns = column_stop - column_start;
+    unsigned int max_n_transfers = n_active_rows + row_offset;
+
+    // Set empty arrays for nullptr trap lists
+    std::valarray<TrapInstantCapture> no_traps_ic = {};
+    if (traps_ic == nullptr) {
+        traps_ic = &no_traps_ic;
+    }
+    int n_traps_ic = traps_ic->size();
+
+    // Initialise the derivatives if needed
+    if (derivatives.size() == 0)
+        derivatives = std::valarray<std::valarray<std::valarray<double>>>(
+            std::valarray<std::valarray<double>>(
+                std::valarray<double>(0.0, n_columns), n_rows),
+            2 * n_traps_ic);
+    int n_derivatives = derivatives.size();
+
+    // Checks
+    if ((roe->type == roe_type_trap_pumping) && (n_active_rows != 1))
+        error(
+            "Trap pumping currently requires the number of active rows (%d) to be 1, "
+            "see pump_charge_in_all_pixels() for multiple pixels",
+            n_active_rows);
+    if ((derivatives[0].size() != n_rows) || (derivatives[0][0].size() != n_columns))
+        error("Derivatives and image shapes don't match");
+
+    // Set up the readout electronics and express arrays
+    roe->set_clock_sequence();
+    int offset = row_offset + roe->prescan_offset;
+    roe->set_express_matrix_from_rows_and_express(n_rows, express, offset);
+    roe->set_store_trap_states_matrix();
+    if (ccd->n_phases != roe->n_phases)
+        error(
+            "Number of CCD phases (%d) and ROE phases (%d) don't match.", ccd->n_phases,
+            roe->n_phases);
+    if (!roe->empty_traps_between_columns) {
+        // Account for the complete set of capture/release events that might
+        // need to be tracked if the traps are never reset
+        max_n_transfers *= n_columns;
+    }
+    if (roe->type == roe_type_trap_pumping) {
+        // Account for the watermarks from every pump back and forth
+        max_n_transfers *= roe->n_pumps;
+    }
+
+    // Set up the trap managers, see TrapManagerManager
+    TrapManagerManagerDual trap_manager_manager(
+        *traps_ic, max_n_transfers, *ccd, roe->dwell_times, n_derivatives,
+        i_first_derivative);
+
+    unsigned int column_index;
+    std::valarray<double> pixel_derivatives(n_derivatives);
+
+    // The pixel values and derivatives of the current column, as a one-column
+    // image for clock_pixels_in_express_pass()
+    std::valarray<std::valarray<Dual>> column(std::valarray<Dual>(1), n_rows);
+
+    // ========
+    // Clock each column of pixels through the column of traps
+    // ========
+    for (unsigned int i_column = 0; i_column < n_active_columns; i_column++) {
+        column_index = column_start + i_column;
+
+        for (unsigned int i_row = 0; i_row < n_rows; i_row++) {
+            for (int i_deriv = 0; i_deriv < n_derivatives; i_deriv++)
+                pixel_derivatives[i_deriv] = derivatives[i_deriv][i_row][column_index];
+            column[i_row][0] = Dual(image[i_row][column_index], pixel_derivatives);
+        }
+
+        for (unsigned int express_index = 0; express_index < roe->n_express_passes;
+             express_index++) {
+
+            // Restore the trap occupancy levels
+            trap_manager_manager.restore_trap_states();
+
+            // Watermarks are never pruned, see TrapManagerInstantCaptureDual
+            clock_pixels_in_express_pass(
+                column, roe, ccd, trap_manager_manager, n_rows, 0, express_index,
+                row_start, 0, n_active_rows, 0.0, 0, 0.0);
+        }
+
+        // Reset the trap states to empty and/or store them for the next column
+        if (roe->empty_traps_between_columns) trap_manager_manager.reset_trap_states();
+        trap_manager_manager.store_trap_states();
+
+        // Copy the column back to the image and derivatives
+        for (unsigned int i_row = 0; i_row < n_rows; i_row++) {
+            image[i_row][column_index] = column[i_row][0].value;
+            for (int i_deriv = 0; i_deriv < n_derivatives; i_deriv++)
+                derivatives[i_deriv][i_row][column_index] =
+                    column[i_row][0].derivative(i_deriv);
+        }
+    }
+
+    return image;
+}
+
+/*
+    Add CTI trails to an image, as for add_cti(), and also compute the
+    derivatives of the output image with respect to the trap parameters.
+
+    This allows e.g. gradient-based fitting of the trap model to data such as
+    trails behind warm pixels, without the many extra add_cti() calls and
+    step-size tuning required by finite differences.
+
+    Only instant-capture traps with uniform distributions are supported, and
+    watermarks are not pruned (equivalent to prune_frequency = 0).
+
+    Parameters
+    ----------
+    image_in : std::valarray<std::valarray<double>>
+    parallel_roe : ROE* (opt.)
+    parallel_ccd : CCD* (opt.)
+    parallel_traps_ic : std::valarray<TrapInstantCapture>* (opt.)
+    parallel_express, parallel_offset : int (opt.)
+    parallel_window_start, parallel_window_stop : int (opt.)
+    serial_* : * (opt.)
+        See add_cti().
+
+    derivatives : std::valarray<std::valarray<std::valarray<double>>>&
+        Output array of the derivatives of each output pixel value, indexed
+        [parameter][row][column]. The parameters are, for each parallel then
+        each serial trap species in order: its density then release timescale.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The output array of pixel values with CTI added.
+*/
+std::valarray<std::valarray<double>> add_cti_derivatives(
+    std::valarray<std::valarray<double>>& image_in,
+    std::valarray<std::valarray<std::valarray<double>>>& derivatives,
+    // Parallel
+    ROE* parallel_roe, CCD* parallel_ccd,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic, int parallel_express,
+    int parallel_offset, int parallel_window_start, int parallel_window_stop,
+    // Serial
+    ROE* serial_roe, CCD* serial_ccd,
+    std::valarray<TrapInstantCapture>* serial_traps_ic, int serial_express,
+    int serial_offset, int serial_window_start, int serial_window_stop) {
+
+    // Initialise the output image as a copy of the input image
+    std::valarray<std::valarray<double>> image = image_in;
+
+    unsigned int n_rows = image.size();
+    unsigned int n_columns = image[0].size();
+    int n_parallel_traps = (parallel_traps_ic) ? parallel_traps_ic->size() : 0;
+    int n_serial_traps = (serial_traps_ic) ? serial_traps_ic->size() : 0;
+
+    // Initialise the derivatives of the input image to zero
+    derivatives = std::valarray<std::valarray<std::valarray<double>>>(
+        std::valarray<std::valarray<double>>(
+            std::valarray<double>(0.0, n_columns), n_rows),
+        2 * (n_parallel_traps + n_serial_traps));
+
+    // Parallel clocking along columns, transfer charge towards row 0
+    if (parallel_traps_ic) {
+        print_v(1, "Parallel: ");
+        image = clock_charge_in_one_direction_derivatives(
+            image, derivatives, parallel_roe, parallel_ccd, parallel_traps_ic,
+            parallel_express, parallel_offset, parallel_window_start,
+            parallel_window_stop, serial_window_start, serial_window_stop, 0);
+    }
+
+    // Serial clocking along rows, transfer charge towards column 0
+    if (serial_traps_ic) {
+        print_v(1, "Serial: ");
+        image = transpose(image);
+        for (unsigned int i_deriv = 0; i_deriv < derivatives.size(); i_deriv++)
+            derivatives[i_deriv] = transpose(derivatives[i_deriv]);
+
+        image = clock_charge_in_one_direction_derivatives(
+            image, derivatives, serial_roe, serial_ccd, serial_traps_ic,
+            serial_express, serial_offset, serial_window_start, serial_window_stop,
+            parallel_window_start, parallel_window_stop, 2 * n_parallel_traps);
+
+        image = transpose(image);
+        for (unsigned int i_deriv = 0; i_deriv < derivatives.size(); i_deriv++)
+            derivatives[i_deriv] = transpose(derivatives[i_deriv]);
+    }
+
+    return image;
+}
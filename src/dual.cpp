@@ -0,0 +1,187 @@
+
+#include "dual.hpp"
+
+#include <math.h>
+
+#include <valarray>
+
+#include "util.hpp"
+
+// ========
+// Dual::
+// ========
+/*
+    Class Dual.
+
+    A forward-mode dual number: a value and its partial derivatives with respect
+    to a set of model parameters, which are propagated through each arithmetic
+    operation by the chain rule. Used to compute the derivatives of the output
+    image with respect to e.g. the trap parameters in a single clocking pass.
+
+    A dual with no derivatives is treated as a constant, i.e. all its
+    derivatives are zero, so plain doubles can be mixed in freely. The
+    derivatives are held inline rather than in a heap array, since a new dual is
+    made by nearly every arithmetic operation in the clocking loop.
+
+    Parameters
+    ----------
+    value : double
+        The value of the number.
+
+    n_derivatives : int
+    i_derivative : int
+        For a seeded input parameter: the total number of parameters, and the
+        index of the parameter that this number is, such that its derivative is
+        1 with respect to itself and 0 with respect to all others.
+
+    derivatives : std::valarray<double>
+        Alternatively, the array of partial derivatives to set directly.
+*/
+Dual::Dual(double value, int n_derivatives, int i_derivative)
+    : value(value), n_derivatives(n_derivatives) {
+
+    if ((n_derivatives < 0) || (n_derivatives > max_n_derivatives))
+        error(
+            "Number of derivatives (%d) outside 0 to the maximum (%d)", n_derivatives,
+            max_n_derivatives);
+    if ((i_derivative < 0) || (i_derivative >= n_derivatives))
+        error(
+            "Derivative index (%d) outside the number of derivatives (%d)",
+            i_derivative, n_derivatives);
+
+    for (int i = 0; i < n_derivatives; i++) derivatives[i] = 0.0;
+    derivatives[i_derivative] = 1.0;
+}
+
+Dual::Dual(double value, const std::valarray<double>& derivatives)
+    : value(value), n_derivatives(derivatives.size()) {
+
+    if (n_derivatives > max_n_derivatives)
+        error(
+            "Number of derivatives (%d) above the maximum (%d)", n_derivatives,
+            max_n_derivatives);
+
+    for (int i = 0; i < n_derivatives; i++) this->derivatives[i] = derivatives[i];
+}
+
+/*
+    The partial derivative with respect to one parameter, or 0 for constants.
+*/
+double Dual::derivative(int i_derivative) const {
+    if (i_derivative >= n_derivatives) return 0.0;
+
+    return derivatives[i_derivative];
+}
+
+/*
+    Add a multiple of one dual's derivatives to another's, allowing for either
+    to be a constant or to track fewer derivatives.
+*/
+static void add_scaled_derivatives(Dual& result, const Dual& other, double factor) {
+    if (other.n_derivatives > result.n_derivatives) {
+        for (int i = result.n_derivatives; i < other.n_derivatives; i++)
+            result.derivatives[i] = 0.0;
+        result.n_derivatives = other.n_derivatives;
+    }
+
+    for (int i = 0; i < other.n_derivatives; i++)
+        result.derivatives[i] += factor * other.derivatives[i];
+}
+
+/*
+    Multiply all of a dual's derivatives by a factor.
+*/
+static void scale_derivatives(Dual& result, double factor) {
+    for (int i = 0; i < result.n_derivatives; i++) result.derivatives[i] *= factor;
+}
+
+Dual& Dual::operator+=(const Dual& other) {
+    add_scaled_derivatives(*this, other, 1.0);
+    value += other.value;
+
+    return *this;
+}
+
+Dual& Dual::operator-=(const Dual& other) {
+    add_scaled_derivatives(*this, other, -1.0);
+    value -= other.value;
+
+    return *this;
+}
+
+Dual& Dual::operator*=(const Dual& other) {
+    // d(ab) = a db + b da
+    if (&other == this) {
+        Dual copy = other;
+        return *this *= copy;
+    }
+    scale_derivatives(*this, other.value);
+    add_scaled_derivatives(*this, other, value);
+    value *= other.value;
+
+    return *this;
+}
+
+Dual& Dual::operator*=(double factor) {
+    scale_derivatives(*this, factor);
+    value *= factor;
+
+    return *this;
+}
+
+// ========
+// Operators and functions
+// ========
+Dual operator-(const Dual& a) {
+    Dual result(-a.value);
+    add_scaled_derivatives(result, a, -1.0);
+
+    return result;
+}
+
+Dual operator+(const Dual& a, const Dual& b) {
+    Dual result = a;
+    result += b;
+
+    return result;
+}
+
+Dual operator-(const Dual& a, const Dual& b) {
+    Dual result = a;
+    result -= b;
+
+    return result;
+}
+
+Dual operator*(const Dual& a, const Dual& b) {
+    Dual result = a;
+    result *= b;
+
+    return result;
+}
+
+Dual operator/(const Dual& a, const Dual& b) {
+    // d(a/b) = da / b - a db / b^2
+    Dual result(a.value / b.value);
+    add_scaled_derivatives(result, a, 1.0 / b.value);
+    add_scaled_derivatives(result, b, -a.value / (b.value * b.value));
+
+    return result;
+}
+
+Dual exp(const Dual& a) {
+    Dual result(exp(a.value));
+    add_scaled_derivatives(result, a, result.value);
+
+    return result;
+}
+
+Dual pow(const Dual& a, double power) {
+    Dual result(pow(a.value, power));
+
+    // Avoid an infinite gradient at zero for fractional powers
+    if (a.value != 0.0)
+        add_scaled_derivatives(result, a, power * result.value / a.value);
+
+    return result;
+}
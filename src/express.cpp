@@ -0,0 +1,271 @@
+
+#include "express.hpp"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <valarray>
+#include <vector>
+
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "roe.hpp"
+#include "trap_managers.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+/*
+    Copy a subset of columns of the image into a new, narrower image.
+*/
+static std::valarray<std::valarray<double>> gather_columns(
+    std::valarray<std::valarray<double>>& image, std::vector<int>& columns) {
+
+    int n_rows = image.size();
+    int n_columns = columns.size();
+    std::valarray<std::valarray<double>> image_columns(
+        std::valarray<double>(0.0, n_columns), n_rows);
+
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        for (int i_column = 0; i_column < n_columns; i_column++)
+            image_columns[row_index][i_column] = image[row_index][columns[i_column]];
+
+    return image_columns;
+}
+
+/*
+    Clock the image with each column using the smallest express that meets an
+    error tolerance, instead of the same express for every column.
+
+    The effect of express on the output depends on the column's content, e.g.
+    bright sources with steep edges need a higher express than faint sky. Each
+    column's sensitivity is found by a ladder of cheap pilot runs: all columns
+    are clocked with express = 1 and 2, then any columns whose outputs still
+    differ by more than the tolerance in any pixel are clocked again with
+    express = 4, compared with the express = 2 output, and so on, doubling
+    until max_express. The output of the higher express of the first pair that
+    agrees is kept, so the total cost tracks the image content.
+
+    The difference between successive express values estimates the error of
+    the lower one, so it's not a strict bound, but the kept output should be at
+    least as accurate. (Low express values can agree with each other but not
+    with the full express by a small amount, e.g. ~1e-4 of the background
+    level for the first few pixels of a uniform image.) The traps must be
+    emptied between columns, so that columns can be clocked independently.
+
+    Parameters
+    ----------
+    image_in, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co,
+    row_offset, prune_n_electrons, prune_frequency, trap_manager_manager_in,
+    settings
+        As for clock_charge_in_one_direction(). Only the full image is modelled,
+        i.e. no windows.
+
+    express_tolerance : double
+        The maximum change in any pixel (electrons) between successive express
+        values for a column to stop. 0 to use max_express for every column.
+
+    max_express : int (opt.)
+        The highest express to use, or 0 (default) for all transfers, i.e. the
+        same as express = 0 in clock_charge_in_one_direction().
+
+    column_express : std::valarray<int>* (opt.)
+        If provided, set to the express used for each column.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The output array of pixel values.
+*/
+std::valarray<std::valarray<double>> clock_charge_in_one_direction_adaptive_express(
+    std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, double express_tolerance,
+    int max_express, int row_offset, double prune_n_electrons, int prune_frequency,
+    std::valarray<int>* column_express, TrapManagerManager* trap_manager_manager_in,
+    ClockingSettings* settings) {
+
+    if (!roe->empty_traps_between_columns)
+        error("Adaptive express requires the traps to be emptied between columns");
+    if (express_tolerance < 0.0)
+        error("Express tolerance (%g) can't be negative", express_tolerance);
+
+    std::valarray<std::valarray<double>> image = image_in;
+    int n_rows = image_in.size();
+    int n_columns = image_in[0].size();
+
+    // Express values above the number of transfers are the same as all of them
+    int n_transfers = n_rows + row_offset + roe->prescan_offset;
+    if ((max_express <= 0) || (max_express > n_transfers)) max_express = n_transfers;
+
+    if (column_express != nullptr) column_express->resize(n_columns, max_express);
+
+    if (express_tolerance == 0.0)
+        return clock_charge_in_one_direction(
+            image_in, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co,
+            max_express, row_offset, 0, -1, 0, -1, 0, -1, prune_n_electrons,
+            prune_frequency, 0, trap_manager_manager_in, nullptr, nullptr, nullptr,
+            nullptr, settings);
+
+    // All columns start as pending
+    std::vector<int> columns(n_columns);
+    for (int column_index = 0; column_index < n_columns; column_index++)
+        columns[column_index] = column_index;
+
+    std::valarray<std::valarray<double>> image_columns =
+        gather_columns(image, columns);
+    int express = 1;
+    std::valarray<std::valarray<double>> image_previous = clock_charge_in_one_direction(
+        image_columns, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, express,
+        row_offset, 0, -1, 0, -1, 0, -1, prune_n_electrons, prune_frequency, 0,
+        trap_manager_manager_in, nullptr, nullptr, nullptr, nullptr, settings);
+    std::valarray<std::valarray<double>> image_next;
+
+    while (columns.size() > 0) {
+        express = std::min(2 * express, max_express);
+        bool is_last = (express == max_express);
+        int n_pending = columns.size();
+
+        image_next = clock_charge_in_one_direction(
+            image_columns, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co,
+            express, row_offset, 0, -1, 0, -1, 0, -1, prune_n_electrons,
+            prune_frequency, 0, trap_manager_manager_in, nullptr, nullptr, nullptr,
+            nullptr, settings);
+
+        // Keep the columns that have converged, and the rest for the next step
+        std::vector<int> columns_remaining;
+        std::vector<int> i_columns_remaining;
+        for (int i_column = 0; i_column < n_pending; i_column++) {
+            double max_change = 0.0;
+            for (int row_index = 0; row_index < n_rows; row_index++)
+                max_change = std::max(
+                    max_change, fabs(
+                                    image_next[row_index][i_column] -
+                                    image_previous[row_index][i_column]));
+
+            if (is_last || (max_change <= express_tolerance)) {
+                for (int row_index = 0; row_index < n_rows; row_index++)
+                    image[row_index][columns[i_column]] =
+                        image_next[row_index][i_column];
+                if (column_express != nullptr)
+                    (*column_express)[columns[i_column]] = express;
+            } else {
+                columns_remaining.push_back(columns[i_column]);
+                i_columns_remaining.push_back(i_column);
+            }
+        }
+        print_v(
+            1, "Express %d: %d of %d column(s) converged \n", express,
+            n_pending - (int)columns_remaining.size(), n_pending);
+
+        if (columns_remaining.size() > 0) {
+            image_columns = gather_columns(image_in, columns_remaining);
+            image_previous = gather_columns(image_next, i_columns_remaining);
+        }
+        columns = columns_remaining;
+    }
+
+    return image;
+}
+
+/*
+    Clock the image with two low express values, express and 2 * express, and
+    combine them to cancel the leading error term (Richardson extrapolation),
+    for much of the accuracy of the full express at a small fraction of the
+    cost.
+
+    The error from express shrinks roughly in proportion to 1 / express, e.g.
+    for a column's bright pixels, as each pass approximates the transfers of
+    (n_transfers / express) rows with the same trap states. So each output
+    pixel is taken as 2 * image_2k - image_k, clamped at 0 like the clocked
+    pixels. The extrapolated output doesn't conserve charge exactly, and the
+    remaining error is from the higher-order terms, e.g. typically ~10x smaller
+    than that of 2 * express alone for express ~ 4--8, but more than that of
+    much higher express values.
+
+    Parameters
+    ----------
+    image_in, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co,
+    row_offset, prune_n_electrons, prune_frequency, trap_manager_manager_in,
+    workspace, column_density_scales, settings
+        As for clock_charge_in_one_direction(). Only the full image is modelled,
+        i.e. no windows.
+
+    express : int
+        The lower express value. If 0, or if 2 * express is at least the
+        number of transfers, then the image is just clocked with the full
+        express, with an error estimate of 0.
+
+    error_estimate : double* (opt.)
+        If provided, set to the maximum change in any pixel (electrons) from
+        the express to the 2 * express output, i.e. the estimated error of the
+        2 * express output, not of the returned extrapolated output. Not a
+        strict bound, but since the extrapolated output is typically more
+        accurate, a conservative check that it is at least as accurate as
+        needed.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The output array of pixel values.
+*/
+std::valarray<std::valarray<double>> clock_charge_in_one_direction_extrapolated_express(
+    std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int express,
+    int row_offset, double prune_n_electrons, int prune_frequency,
+    double* error_estimate, TrapManagerManager* trap_manager_manager_in,
+    ClockingWorkspace* workspace, std::valarray<double>* column_density_scales,
+    ClockingSettings* settings) {
+
+    if (express < 0) error("Express (%d) can't be negative", express);
+
+    int n_rows = image_in.size();
+    int n_columns = image_in[0].size();
+    if (error_estimate != nullptr) *error_estimate = 0.0;
+
+    // Nothing to gain over the full express
+    int n_transfers = n_rows + row_offset + roe->prescan_offset;
+    if ((express == 0) || (2 * express >= n_transfers))
+        return clock_charge_in_one_direction(
+            image_in, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, 0,
+            row_offset, 0, -1, 0, -1, 0, -1, prune_n_electrons, prune_frequency, 0,
+            trap_manager_manager_in, workspace, nullptr, column_density_scales, nullptr,
+            settings);
+
+    std::valarray<std::valarray<double>> image_k = clock_charge_in_one_direction(
+        image_in, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, express,
+        row_offset, 0, -1, 0, -1, 0, -1, prune_n_electrons, prune_frequency, 0,
+        trap_manager_manager_in, workspace, nullptr, column_density_scales, nullptr,
+        settings);
+    std::valarray<std::valarray<double>> image = clock_charge_in_one_direction(
+        image_in, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co,
+        2 * express, row_offset, 0, -1, 0, -1, 0, -1, prune_n_electrons,
+        prune_frequency, 0, trap_manager_manager_in, workspace, nullptr,
+        column_density_scales, nullptr, settings);
+
+    double max_change = 0.0;
+    for (int row_index = 0; row_index < n_rows; row_index++) {
+        for (int column_index = 0; column_index < n_columns; column_index++) {
+            double change =
+                image[row_index][column_index] - image_k[row_index][column_index];
+            max_change = std::max(max_change, fabs(change));
+            image[row_index][column_index] += change;
+
+            // Make sure image counts don't go negative, which could happen
+            // for faint pixels where the 2 * express output is much lower
+            if (image[row_index][column_index] < 0.0)
+                image[row_index][column_index] = 0.0;
+        }
+    }
+    print_v(
+        1, "Express %d and %d extrapolated, estimated error %g \n", express,
+        2 * express, max_change);
+    if (error_estimate != nullptr) *error_estimate = max_change;
+
+    return image;
+}
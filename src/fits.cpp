@@ -0,0 +1,1418 @@
+
+#include "fits.hpp"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+#include <valarray>
+#include <vector>
+
+#include "util.hpp"
+
+// ========
+// Settings
+// ========
+/*
+    Set the global compression for saving FITS images with save_image_to_file():
+
+    fits_auto (-1)  Rice for *.fz files, otherwise none (default).
+    fits_none (0)   An uncompressed image.
+    fits_rice (1)   Rice tiles of the values quantised to fits_quantize_step.
+    fits_gzip (2)   GZIP tiles of the exact values.
+*/
+int fits_compression = fits_auto;
+void set_fits_compression(int compression) {
+    if ((compression < fits_auto) || (compression > fits_gzip))
+        error("Invalid FITS compression %d", compression);
+    fits_compression = compression;
+}
+
+/*
+    Set the global quantisation step for saving Rice-compressed FITS images, in
+    the image's units (e.g. electrons). Each value is then saved to within half
+    a step, with subtractive dithering so that the errors average out.
+*/
+double fits_quantize_step = 0.01;
+void set_fits_quantize_step(double step) {
+    if (!(step > 0.0)) error("Invalid FITS quantisation step %g", step);
+    fits_quantize_step = step;
+}
+
+/*
+    Whether a file name has a FITS extension: .fits, .fit, .fts, or .fz (e.g.
+    image.fits.fz for a tile-compressed image), in any case.
+*/
+bool is_fits_filename(const std::string& filename) {
+    size_t i_dot = filename.rfind('.');
+    if (i_dot == std::string::npos) return false;
+    std::string extension = filename.substr(i_dot + 1);
+    for (char& c : extension) c = tolower(c);
+
+    return (extension == "fits") || (extension == "fit") || (extension == "fts") ||
+           (extension == "fz");
+}
+
+// ========
+// Headers
+// ========
+static const long fits_block_size = 2880;
+static const int fits_card_size = 80;
+
+/*
+    The keywords and values of a FITS header, with the quotes and trailing
+    spaces removed from string values.
+*/
+class FitsHeader {
+   public:
+    FitsHeader(){};
+    ~FitsHeader(){};
+
+    std::map<std::string, std::string> values;
+
+    bool has(const std::string& keyword) const { return values.count(keyword) > 0; }
+
+    std::string get_string(
+        const std::string& keyword, const std::string& fallback = "") const {
+        auto it = values.find(keyword);
+        return (it == values.end()) ? fallback : it->second;
+    }
+
+    long long get_int(const std::string& keyword, long long fallback = 0) const {
+        auto it = values.find(keyword);
+        if (it == values.end()) return fallback;
+        return strtoll(it->second.c_str(), nullptr, 10);
+    }
+
+    double get_double(const std::string& keyword, double fallback = 0.0) const {
+        auto it = values.find(keyword);
+        if (it == values.end()) return fallback;
+        // Fortran-style exponents, e.g. 1.0D+02
+        std::string value = it->second;
+        std::replace(value.begin(), value.end(), 'D', 'E');
+        return strtod(value.c_str(), nullptr);
+    }
+
+    bool get_logical(const std::string& keyword) const {
+        return get_string(keyword) == "T";
+    }
+};
+
+/*
+    The value from a header card's value (and comment) field.
+*/
+static std::string parse_fits_value(const std::string& text) {
+    size_t i = text.find_first_not_of(' ');
+    if (i == std::string::npos) return "";
+
+    std::string value;
+    if (text[i] == '\'') {
+        // Quoted string, with '' for a quote
+        for (i++; i < text.size(); i++) {
+            if (text[i] != '\'')
+                value += text[i];
+            else if ((i + 1 < text.size()) && (text[i + 1] == '\'')) {
+                value += '\'';
+                i++;
+            } else
+                break;
+        }
+    } else {
+        value = text.substr(i, text.find('/', i) - i);
+    }
+
+    return value.substr(0, value.find_last_not_of(' ') + 1);
+}
+
+/*
+    Parse the header that starts at offset in a FITS file, and advance the
+    offset to the start of the header's data.
+*/
+static FitsHeader parse_fits_header(
+    const std::vector<unsigned char>& file, long& offset, const char* filename) {
+    FitsHeader header;
+
+    bool found_end = false;
+    while (!found_end) {
+        if (offset + fits_block_size > (long)file.size())
+            error("Truncated FITS header in '%s'", filename);
+
+        for (int i_card = 0; i_card < fits_block_size / fits_card_size; i_card++) {
+            const char* card = (const char*)&file[offset + i_card * fits_card_size];
+            std::string keyword(card, 8);
+            keyword = keyword.substr(0, keyword.find_last_not_of(' ') + 1);
+
+            if (keyword == "END") {
+                found_end = true;
+                break;
+            }
+            if (strncmp(card + 8, "= ", 2) == 0)
+                header.values[keyword] =
+                    parse_fits_value(std::string(card + 10, fits_card_size - 10));
+        }
+        offset += fits_block_size;
+    }
+
+    return header;
+}
+
+/*
+    The number of bytes of data (excluding the padding) after a header.
+*/
+static long fits_data_size(const FitsHeader& header, const char* filename) {
+    long long n_axes = header.get_int("NAXIS");
+    if ((n_axes < 0) || (n_axes > 999)) error("Invalid NAXIS in '%s'", filename);
+    if (n_axes == 0) return 0;
+
+    // Check each size before multiplying, so a corrupt header can't overflow
+    long long max_n_bytes = std::numeric_limits<long>::max() / 8;
+    long long n_values = 1;
+    for (int i_axis = 1; i_axis <= n_axes; i_axis++) {
+        long long n_axis = header.get_int("NAXIS" + std::to_string(i_axis));
+        if ((n_axis < 0) || ((n_axis > 0) && (n_values > max_n_bytes / n_axis)))
+            error("Invalid NAXIS%d in '%s'", i_axis, filename);
+        n_values *= n_axis;
+    }
+    long long n_params = header.get_int("PCOUNT", 0);
+    long long n_groups = header.get_int("GCOUNT", 1);
+    if ((n_params < 0) || (n_params > max_n_bytes - n_values))
+        error("Invalid PCOUNT in '%s'", filename);
+    if ((n_groups < 0) ||
+        ((n_groups > 0) && (n_params + n_values > max_n_bytes / n_groups)))
+        error("Invalid GCOUNT in '%s'", filename);
+
+    return std::abs(header.get_int("BITPIX")) / 8 * n_groups * (n_params + n_values);
+}
+
+static long fits_padded_size(long n_bytes) {
+    return (n_bytes + fits_block_size - 1) / fits_block_size * fits_block_size;
+}
+
+static void add_card(std::string& header, const char* keyword, const char* value) {
+    char card[fits_card_size + 1];
+    snprintf(card, sizeof(card), "%-8.8s= %-70.70s", keyword, value);
+    header += card;
+}
+
+static void add_card_int(std::string& header, const char* keyword, long long value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%20lld", value);
+    add_card(header, keyword, text);
+}
+
+static void add_card_logical(std::string& header, const char* keyword, bool value) {
+    add_card(header, keyword, value ? "                   T" : "                   F");
+}
+
+static void add_card_string(
+    std::string& header, const char* keyword, const std::string& value) {
+    char text[fits_card_size + 1];
+    snprintf(text, sizeof(text), "'%-8s'", value.c_str());
+    add_card(header, keyword, text);
+}
+
+// Finish a header with END, padded with spaces to a whole block
+static void end_header(std::string& header) {
+    header += "END";
+    header.resize(fits_padded_size(header.size()), ' ');
+}
+
+// ========
+// Pixels
+// ========
+static inline unsigned long long read_big_endian(const unsigned char* bytes, int n) {
+    unsigned long long value = 0;
+    for (int i = 0; i < n; i++) value = (value << 8) | bytes[i];
+    return value;
+}
+
+static inline void write_big_endian(
+    unsigned char* bytes, unsigned long long value, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        bytes[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+/*
+    Whether an image's shape from its header can be held, i.e. non-negative and
+    within int, as the valarray indices.
+*/
+static bool is_valid_image_shape(long long n_rows, long long n_columns) {
+    return (n_rows >= 0) && (n_columns >= 0) &&
+           (n_rows <= std::numeric_limits<int>::max()) &&
+           (n_columns <= std::numeric_limits<int>::max());
+}
+
+static bool is_valid_bitpix(int bitpix) {
+    return (bitpix == 8) || (bitpix == 16) || (bitpix == 32) || (bitpix == 64) ||
+           (bitpix == -32) || (bitpix == -64);
+}
+
+/*
+    The value of a big-endian pixel with this BITPIX (8 is unsigned, other
+    positive values are signed integers, -32 and -64 are floating point).
+*/
+static inline double read_fits_pixel(const unsigned char* bytes, int bitpix) {
+    switch (bitpix) {
+        case 8:
+            return bytes[0];
+        case 16:
+            return (int16_t)read_big_endian(bytes, 2);
+        case 32:
+            return (int32_t)read_big_endian(bytes, 4);
+        case 64:
+            return (double)(int64_t)read_big_endian(bytes, 8);
+        case -32: {
+            uint32_t bits = read_big_endian(bytes, 4);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        default: {
+            uint64_t bits = read_big_endian(bytes, 8);
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+    }
+}
+
+static inline void write_fits_double(unsigned char* bytes, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    write_big_endian(bytes, bits, 8);
+}
+
+// ========
+// Rice
+// ========
+/*
+    The Rice coding parameters for each number of bytes per value: the bits
+    for each block's code, the code for uncompressed blocks, and the bits per
+    value.
+*/
+static void rice_parameters(int bytepix, int& fs_bits, int& fs_max, int& n_bits_value) {
+    if (bytepix == 1) {
+        fs_bits = 3;
+        fs_max = 6;
+    } else if (bytepix == 2) {
+        fs_bits = 4;
+        fs_max = 14;
+    } else if (bytepix == 4) {
+        fs_bits = 5;
+        fs_max = 25;
+    } else
+        error("Invalid Rice bytes per value %d", bytepix);
+    n_bits_value = 8 * bytepix;
+}
+
+/*
+    Append bits to a byte array, most significant first.
+*/
+class BitWriter {
+   public:
+    BitWriter(std::vector<unsigned char>& bytes) : bytes(bytes), buffer(0), n_bits(0){};
+    ~BitWriter(){};
+
+    std::vector<unsigned char>& bytes;
+    unsigned long long buffer;
+    int n_bits;
+
+    // Append the lowest n (<= 32) bits of value
+    inline void write(unsigned int value, int n) {
+        buffer = (buffer << n) | (value & (unsigned int)((1ULL << n) - 1));
+        n_bits += n;
+        while (n_bits >= 8) {
+            n_bits -= 8;
+            bytes.push_back((buffer >> n_bits) & 0xff);
+        }
+        buffer &= (1ULL << n_bits) - 1;
+    }
+
+    inline void write_zeros(unsigned int n) {
+        for (; n > 24; n -= 24) write(0, 24);
+        write(0, n);
+    }
+
+    // Pad the last byte with zeros
+    void flush() {
+        if (n_bits > 0) bytes.push_back((buffer << (8 - n_bits)) & 0xff);
+        buffer = 0;
+        n_bits = 0;
+    }
+};
+
+/*
+    Compress integers with the Rice algorithm of the FITS tiled image convention
+    (RICE_1), as in CFITSIO's fits_rcomp().
+
+    The first value is stored as is, then each block of differences between
+    consecutive values is mapped to non-negative integers and coded with the
+    number of low bits (fs) that best suits the block's mean: each difference's
+    high bits in unary then its fs low bits. Blocks of no change are a single
+    code, and blocks of noise are stored uncompressed.
+
+    Parameters
+    ----------
+    values : const int*
+        The values to compress, wrapped to bytepix bytes, i.e. unsigned for 1
+        byte or signed for 2 and 4 bytes.
+
+    n_values : int
+        The number of values.
+
+    bytepix : int (opt.)
+        The number of bytes per value: 1, 2, or 4.
+
+    blocksize : int (opt.)
+        The number of values per coded block.
+
+    Returns
+    -------
+    bytes : std::vector<unsigned char>
+        The compressed bytes.
+*/
+std::vector<unsigned char> rice_compress(
+    const int* values, int n_values, int bytepix, int blocksize) {
+    int fs_bits, fs_max, n_bits_value;
+    rice_parameters(bytepix, fs_bits, fs_max, n_bits_value);
+    const unsigned int value_mask = (unsigned int)((1ULL << n_bits_value) - 1);
+
+    std::vector<unsigned char> bytes;
+    if (n_values <= 0) return bytes;
+    bytes.reserve(n_values * bytepix / 2 + 16);
+    BitWriter writer(bytes);
+    std::vector<unsigned int> diffs(blocksize);
+
+    unsigned int last_value = (unsigned int)values[0] & value_mask;
+    writer.write(last_value, n_bits_value);
+
+    for (int i_start = 0; i_start < n_values; i_start += blocksize) {
+        int n_block = std::min(blocksize, n_values - i_start);
+
+        // Differences mapped to non-negative: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+        double sum = 0.0;
+        for (int j = 0; j < n_block; j++) {
+            unsigned int value = (unsigned int)values[i_start + j] & value_mask;
+            unsigned int diff = (value - last_value) & value_mask;
+            if ((diff >> (n_bits_value - 1)) & 1)
+                diffs[j] = ~(diff << 1) & value_mask;
+            else
+                diffs[j] = (diff << 1) & value_mask;
+            sum += diffs[j];
+            last_value = value;
+        }
+
+        // The number of low bits to store directly, from the mean
+        double mean = (sum - (n_block / 2) - 1) / n_block;
+        if (mean < 0.0) mean = 0.0;
+        unsigned int p_sum = ((unsigned int)mean) >> 1;
+        int fs;
+        for (fs = 0; p_sum > 0; fs++) p_sum >>= 1;
+
+        if (fs >= fs_max) {
+            // High entropy: store the differences uncompressed
+            writer.write(fs_max + 1, fs_bits);
+            for (int j = 0; j < n_block; j++) writer.write(diffs[j], n_bits_value);
+        } else if ((fs == 0) && (sum == 0.0)) {
+            // Low entropy: all the same value
+            writer.write(0, fs_bits);
+        } else {
+            writer.write(fs + 1, fs_bits);
+            for (int j = 0; j < n_block; j++) {
+                writer.write_zeros(diffs[j] >> fs);
+                writer.write(1, 1);
+                if (fs > 0) writer.write(diffs[j], fs);
+            }
+        }
+    }
+    writer.flush();
+
+    return bytes;
+}
+
+/*
+    Decompress integers from the Rice algorithm, see rice_compress().
+
+    Parameters
+    ----------
+    bytes : const unsigned char*
+        The compressed bytes.
+
+    n_bytes : long
+        The number of compressed bytes.
+
+    values : int*
+        The array to fill with the decompressed values, unsigned for 1 byte or
+        signed for 2 and 4 bytes.
+
+    n_values : int
+        The number of values to decompress.
+
+    bytepix, blocksize : int (opt.)
+        As for rice_compress().
+
+    Returns
+    -------
+    status : int
+        0 for success, or 1 if the bytes ran out first.
+*/
+int rice_decompress(
+    const unsigned char* bytes, long n_bytes, int* values, int n_values, int bytepix,
+    int blocksize) {
+    int fs_bits, fs_max, n_bits_value;
+    rice_parameters(bytepix, fs_bits, fs_max, n_bits_value);
+    const unsigned int value_mask = (unsigned int)((1ULL << n_bits_value) - 1);
+
+    long i_byte = 0;
+    bool overrun = false;
+    auto next_byte = [&]() -> unsigned int {
+        if (i_byte >= n_bytes) {
+            overrun = true;
+            return 0;
+        }
+        return bytes[i_byte++];
+    };
+    // Store a value with the sign for its number of bytes
+    auto to_int = [&](unsigned int value) -> int {
+        if (bytepix == 1)
+            return value;
+        else if (bytepix == 2)
+            return (int16_t)value;
+        else
+            return (int32_t)value;
+    };
+
+    unsigned int last_value = 0;
+    for (int i = 0; i < bytepix; i++) last_value = (last_value << 8) | next_byte();
+
+    // The next n_bits unread bits are the lowest bits of buffer
+    unsigned long long buffer = next_byte();
+    int n_bits = 8;
+    int i_value = 0;
+    while (i_value < n_values) {
+        n_bits -= fs_bits;
+        while (n_bits < 0) {
+            buffer = (buffer << 8) | next_byte();
+            n_bits += 8;
+        }
+        int fs = (int)(buffer >> n_bits) - 1;
+        buffer &= (1ULL << n_bits) - 1;
+        int i_end = std::min(i_value + blocksize, n_values);
+
+        if (fs < 0) {
+            for (; i_value < i_end; i_value++) values[i_value] = to_int(last_value);
+        } else if (fs == fs_max) {
+            for (; i_value < i_end; i_value++) {
+                while (n_bits < n_bits_value) {
+                    buffer = (buffer << 8) | next_byte();
+                    n_bits += 8;
+                }
+                n_bits -= n_bits_value;
+                unsigned int diff = (unsigned int)(buffer >> n_bits);
+                buffer &= (1ULL << n_bits) - 1;
+
+                diff = (diff & 1) ? ~(diff >> 1) : (diff >> 1);
+                last_value = (last_value + diff) & value_mask;
+                values[i_value] = to_int(last_value);
+            }
+        } else {
+            for (; i_value < i_end; i_value++) {
+                // Count the zeros before the next one bit
+                while (buffer == 0) {
+                    if (overrun) return 1;
+                    n_bits += 8;
+                    buffer = next_byte();
+                }
+                int n_zeros = n_bits - (64 - __builtin_clzll(buffer));
+                n_bits -= n_zeros + 1;
+                buffer ^= 1ULL << n_bits;
+
+                n_bits -= fs;
+                while (n_bits < 0) {
+                    buffer = (buffer << 8) | next_byte();
+                    n_bits += 8;
+                }
+                unsigned int diff =
+                    ((unsigned int)n_zeros << fs) | (unsigned int)(buffer >> n_bits);
+                buffer &= (1ULL << n_bits) - 1;
+
+                diff = (diff & 1) ? ~(diff >> 1) : (diff >> 1);
+                last_value = (last_value + diff) & value_mask;
+                values[i_value] = to_int(last_value);
+            }
+        }
+        if (overrun) return 1;
+    }
+
+    return 0;
+}
+
+// ========
+// GZIP
+// ========
+/*
+    Reorder the bytes of n values of n_bytes_value bytes each so that the first
+    bytes of every value come first, then the second bytes, etc. (GZIP_2).
+*/
+static void shuffle_bytes(
+    const unsigned char* bytes, unsigned char* shuffled, int n, int n_bytes_value) {
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n_bytes_value; j++)
+            shuffled[j * n + i] = bytes[i * n_bytes_value + j];
+}
+
+static void unshuffle_bytes(
+    const unsigned char* shuffled, unsigned char* bytes, int n, int n_bytes_value) {
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n_bytes_value; j++)
+            bytes[i * n_bytes_value + j] = shuffled[j * n + i];
+}
+
+static std::vector<unsigned char> gzip_compress(
+    const std::vector<unsigned char>& data) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // Fastest level, with a gzip header
+    int status =
+        deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    if (status != Z_OK) error("Failed to initialise zlib");
+
+    std::vector<unsigned char> bytes(deflateBound(&stream, data.size()));
+    stream.next_in = (Bytef*)data.data();
+    stream.avail_in = data.size();
+    stream.next_out = bytes.data();
+    stream.avail_out = bytes.size();
+    status = deflate(&stream, Z_FINISH);
+    bytes.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (status != Z_STREAM_END) error("Failed to compress a GZIP tile");
+
+    return bytes;
+}
+
+// Returns 0 for success, or 1 if the data are invalid or not exactly n_out bytes
+static int gzip_decompress(
+    const unsigned char* bytes, long n_bytes, unsigned char* out, long n_out) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // Detect a gzip or zlib header
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) error("Failed to initialise zlib");
+
+    stream.next_in = (Bytef*)bytes;
+    stream.avail_in = n_bytes;
+    stream.next_out = out;
+    stream.avail_out = n_out;
+    int status = inflate(&stream, Z_FINISH);
+    long n_decompressed = stream.total_out;
+    inflateEnd(&stream);
+
+    return ((status == Z_STREAM_END) && (n_decompressed == n_out)) ? 0 : 1;
+}
+
+// ========
+// Quantisation
+// ========
+static const int n_dither_values = 10000;
+static const int quantized_null = -2147483647;
+static const int quantized_zero = -2147483646;
+
+/*
+    The FITS standard's sequence of pseudo-random values in [0, 1) for
+    subtractive dithering, so that any reader can undo it.
+*/
+static const std::vector<double>& dither_values() {
+    static const std::vector<double> values = []() {
+        std::vector<double> values(n_dither_values);
+        double a = 16807.0;
+        double m = 2147483647.0;
+        double seed = 1.0;
+        for (int i = 0; i < n_dither_values; i++) {
+            double temp = a * seed;
+            seed = temp - m * (double)(int)(temp / m);
+            values[i] = seed / m;
+        }
+        return values;
+    }();
+
+    return values;
+}
+
+/*
+    The dither values for each pixel in turn of a tile.
+*/
+class DitherSequence {
+   public:
+    DitherSequence(long i_tile, long dither_seed) : values(dither_values()) {
+        i_seed = (i_tile + dither_seed - 1) % n_dither_values;
+        i_next = (int)(values[i_seed] * 500.0);
+    };
+    ~DitherSequence(){};
+
+    const std::vector<double>& values;
+    int i_seed;
+    int i_next;
+
+    inline double next() {
+        double value = values[i_next];
+        i_next++;
+        if (i_next == n_dither_values) {
+            i_seed = (i_seed + 1) % n_dither_values;
+            i_next = (int)(values[i_seed] * 500.0);
+        }
+        return value;
+    }
+};
+
+// ========
+// Loading
+// ========
+/*
+    A column of a binary table, from its TFORM.
+*/
+class FitsColumn {
+   public:
+    FitsColumn() : offset(-1), type(' '), element_type(' '){};
+    ~FitsColumn(){};
+
+    long offset;
+    char type;
+    char element_type;
+
+    bool exists() const { return offset >= 0; }
+
+    /*
+        The heap bytes of a variable-length array (P or Q) column in a row, or
+        nullptr (with n_bytes = 0) if the column doesn't exist or the
+        descriptor is invalid.
+    */
+    const unsigned char* array(
+        const unsigned char* row, const unsigned char* heap, long heap_size,
+        long& n_bytes) const {
+        n_bytes = 0;
+        if (!exists()) return nullptr;
+
+        long n_elements;
+        long heap_offset;
+        if (type == 'P') {
+            n_elements = (int32_t)read_big_endian(row + offset, 4);
+            heap_offset = (int32_t)read_big_endian(row + offset + 4, 4);
+        } else {
+            n_elements = (int64_t)read_big_endian(row + offset, 8);
+            heap_offset = (int64_t)read_big_endian(row + offset + 8, 8);
+        }
+        n_bytes = n_elements * fits_type_size(element_type);
+        if ((n_elements < 0) || (heap_offset < 0) ||
+            (heap_offset + n_bytes > heap_size)) {
+            n_bytes = 0;
+            return nullptr;
+        }
+        return heap + heap_offset;
+    }
+
+    double read_double(const unsigned char* row) const {
+        return read_fits_pixel(row + offset, (type == 'E') ? -32 : -64);
+    }
+
+    long long read_int(const unsigned char* row) const {
+        if (type == 'I') return (int16_t)read_big_endian(row + offset, 2);
+        if (type == 'K') return (int64_t)read_big_endian(row + offset, 8);
+        return (int32_t)read_big_endian(row + offset, 4);
+    }
+
+    static int fits_type_size(char type) {
+        switch (type) {
+            case 'L':
+            case 'B':
+            case 'A':
+                return 1;
+            case 'I':
+                return 2;
+            case 'J':
+            case 'E':
+                return 4;
+            case 'K':
+            case 'D':
+            case 'C':
+            case 'P':
+                return 8;
+            case 'M':
+            case 'Q':
+                return 16;
+            default:
+                return 0;
+        }
+    }
+
+    // The BITPIX of this column's (array) elements, or 0 if not numeric
+    int element_bitpix() const {
+        switch ((type == 'P') || (type == 'Q') ? element_type : type) {
+            case 'B':
+                return 8;
+            case 'I':
+                return 16;
+            case 'J':
+                return 32;
+            case 'K':
+                return 64;
+            case 'E':
+                return -32;
+            case 'D':
+                return -64;
+            default:
+                return 0;
+        }
+    }
+};
+
+/*
+    Find the columns of a binary table by name, with their offsets in each row.
+*/
+static std::map<std::string, FitsColumn> parse_fits_columns(
+    const FitsHeader& header, const char* filename) {
+    std::map<std::string, FitsColumn> columns;
+    long offset = 0;
+
+    int n_fields = header.get_int("TFIELDS");
+    for (int i_field = 1; i_field <= n_fields; i_field++) {
+        std::string form = header.get_string("TFORM" + std::to_string(i_field));
+
+        // E.g. 1PB(1234), 1D, or 16A
+        size_t i_type = form.find_first_not_of("0123456789");
+        if (i_type == std::string::npos)
+            error("Invalid TFORM%d '%s' in '%s'", i_field, form.c_str(), filename);
+        long repeat = (i_type == 0) ? 1 : atol(form.substr(0, i_type).c_str());
+
+        FitsColumn column;
+        column.offset = offset;
+        column.type = form[i_type];
+        bool is_array = (column.type == 'P') || (column.type == 'Q');
+        if (is_array && (i_type + 1 < form.size()))
+            column.element_type = form[i_type + 1];
+
+        if (column.type == 'X')
+            offset += (repeat + 7) / 8;
+        else
+            offset += repeat * FitsColumn::fits_type_size(column.type);
+
+        std::string name = header.get_string("TTYPE" + std::to_string(i_field));
+        if (!name.empty()) columns[name] = column;
+    }
+    if (offset != header.get_int("NAXIS1"))
+        error("Binary table columns don't match NAXIS1 in '%s'", filename);
+
+    return columns;
+}
+
+/*
+    Load an uncompressed image HDU, converting the rows in parallel.
+*/
+static std::valarray<std::valarray<double>> load_fits_image_hdu(
+    const FitsHeader& header, const unsigned char* data, const char* filename) {
+    int bitpix = header.get_int("BITPIX");
+    if (!is_valid_bitpix(bitpix))
+        error("Invalid BITPIX %d in '%s'", bitpix, filename);
+    int n_axes = header.get_int("NAXIS");
+    long long n_columns_header = header.get_int("NAXIS1");
+    long long n_rows_header = (n_axes >= 2) ? header.get_int("NAXIS2") : 1;
+    if (!is_valid_image_shape(n_rows_header, n_columns_header))
+        error("Invalid image shape in '%s'", filename);
+    int n_columns = n_columns_header;
+    int n_rows = n_rows_header;
+    for (int i_axis = 3; i_axis <= n_axes; i_axis++) {
+        if (header.get_int("NAXIS" + std::to_string(i_axis)) != 1)
+            error("Image in '%s' has more than 2 dimensions", filename);
+    }
+
+    double scale = header.get_double("BSCALE", 1.0);
+    double zero = header.get_double("BZERO", 0.0);
+    bool has_blank = (bitpix > 0) && header.has("BLANK");
+    double blank = header.get_int("BLANK");
+    int n_bytes_pixel = std::abs(bitpix) / 8;
+
+    std::valarray<std::valarray<double>> image(
+        std::valarray<double>(0.0, n_columns), n_rows);
+
+    parallel_for(n_rows, [&](int i_row) {
+        const unsigned char* row = data + (long)i_row * n_columns * n_bytes_pixel;
+        for (int i_col = 0; i_col < n_columns; i_col++) {
+            double value = read_fits_pixel(row + i_col * n_bytes_pixel, bitpix);
+            if (has_blank && (value == blank))
+                image[i_row][i_col] = NAN;
+            else
+                image[i_row][i_col] = value * scale + zero;
+        }
+    });
+
+    return image;
+}
+
+/*
+    Load a tile-compressed image from its binary table HDU, decoding the tiles
+    in parallel directly into the image.
+*/
+static std::valarray<std::valarray<double>> load_fits_compressed_hdu(
+    const FitsHeader& header, const unsigned char* data, long n_bytes_data,
+    const char* filename) {
+    // Image
+    int bitpix = header.get_int("ZBITPIX");
+    if (!is_valid_bitpix(bitpix))
+        error("Invalid ZBITPIX %d in '%s'", bitpix, filename);
+    int n_axes = header.get_int("ZNAXIS");
+    long long n_columns_header = header.get_int("ZNAXIS1");
+    long long n_rows_header = (n_axes >= 2) ? header.get_int("ZNAXIS2") : 1;
+    if (!is_valid_image_shape(n_rows_header, n_columns_header))
+        error("Invalid image shape in '%s'", filename);
+    int n_columns = n_columns_header;
+    int n_rows = n_rows_header;
+    for (int i_axis = 3; i_axis <= n_axes; i_axis++) {
+        if (header.get_int("ZNAXIS" + std::to_string(i_axis)) != 1)
+            error("Image in '%s' has more than 2 dimensions", filename);
+    }
+    int tile_columns = header.get_int("ZTILE1", n_columns);
+    int tile_rows = (n_axes >= 2) ? header.get_int("ZTILE2", 1) : 1;
+    if ((tile_columns <= 0) || (tile_rows <= 0))
+        error("Invalid tile shape in '%s'", filename);
+    int n_tiles_x = (n_columns + tile_columns - 1) / tile_columns;
+    int n_tiles = n_tiles_x * ((n_rows + tile_rows - 1) / tile_rows);
+
+    // Compression
+    std::string algorithm = header.get_string("ZCMPTYPE");
+    if (algorithm == "RICE_ONE") algorithm = "RICE_1";
+    if ((algorithm != "RICE_1") && (algorithm != "GZIP_1") && (algorithm != "GZIP_2"))
+        error(
+            "Unsupported tile compression '%s' in '%s'", algorithm.c_str(), filename);
+    int blocksize = 32;
+    int bytepix = 4;
+    for (int i_param = 1; header.has("ZNAME" + std::to_string(i_param)); i_param++) {
+        std::string name = header.get_string("ZNAME" + std::to_string(i_param));
+        int value = header.get_int("ZVAL" + std::to_string(i_param));
+        if (name == "BLOCKSIZE")
+            blocksize = value;
+        else if (name == "BYTEPIX")
+            bytepix = value;
+    }
+
+    // Table
+    std::map<std::string, FitsColumn> columns = parse_fits_columns(header, filename);
+    FitsColumn column_data = columns["COMPRESSED_DATA"];
+    FitsColumn column_gzip = columns["GZIP_COMPRESSED_DATA"];
+    FitsColumn column_raw = columns["UNCOMPRESSED_DATA"];
+    FitsColumn column_scale = columns["ZSCALE"];
+    FitsColumn column_zero = columns["ZZERO"];
+    FitsColumn column_blank = columns["ZBLANK"];
+    if (!column_data.exists()) error("No COMPRESSED_DATA column in '%s'", filename);
+    long row_size = header.get_int("NAXIS1");
+    if (header.get_int("NAXIS2") != n_tiles)
+        error(
+            "Expected %d tiles but found %lld in '%s'", n_tiles,
+            header.get_int("NAXIS2"), filename);
+    long heap_offset = header.get_int("THEAP", row_size * n_tiles);
+    if ((heap_offset < row_size * n_tiles) || (heap_offset > n_bytes_data))
+        error("Invalid THEAP in '%s'", filename);
+    const unsigned char* heap = data + heap_offset;
+    long heap_size = n_bytes_data - heap_offset;
+
+    // Scaling, quantisation, and null values
+    bool quantized =
+        (bitpix < 0) && (column_scale.exists() || header.has("ZSCALE"));
+    std::string quantize_method =
+        header.get_string("ZQUANTIZ", quantized ? "NO_DITHER" : "NONE");
+    bool dithered = (quantize_method == "SUBTRACTIVE_DITHER_1") ||
+                    (quantize_method == "SUBTRACTIVE_DITHER_2");
+    bool zero_exact = (quantize_method == "SUBTRACTIVE_DITHER_2");
+    long long dither_seed = header.get_int("ZDITHER0", 1);
+    if (dithered && ((dither_seed < 1) || (dither_seed > n_dither_values)))
+        error("Invalid ZDITHER0 %lld in '%s'", dither_seed, filename);
+    if (!dithered) dither_seed = 1;
+    double scale = header.get_double(quantized ? "ZSCALE" : "BSCALE", 1.0);
+    double zero = header.get_double(quantized ? "ZZERO" : "BZERO", 0.0);
+    bool has_blank = header.has("ZBLANK") || column_blank.exists();
+    long long blank = header.get_int("ZBLANK");
+    // Integers are quantised floats or the image's own integer type
+    int int_bitpix = quantized ? 32 : bitpix;
+
+    std::valarray<std::valarray<double>> image(
+        std::valarray<double>(0.0, n_columns), n_rows);
+
+    parallel_for(n_tiles, [&](int i_tile) {
+        const unsigned char* row = data + (long)i_tile * row_size;
+        int i_col_start = (i_tile % n_tiles_x) * tile_columns;
+        int i_row_start = (i_tile / n_tiles_x) * tile_rows;
+        int n_tile_columns = std::min(tile_columns, n_columns - i_col_start);
+        int n_tile_rows = std::min(tile_rows, n_rows - i_row_start);
+        int n_pixels = n_tile_columns * n_tile_rows;
+
+        double tile_scale =
+            column_scale.exists() ? column_scale.read_double(row) : scale;
+        double tile_zero = column_zero.exists() ? column_zero.read_double(row) : zero;
+        long long tile_blank =
+            column_blank.exists() ? column_blank.read_int(row) : blank;
+
+        // Decode the tile to integers, or to raw big-endian pixels of raw_bitpix
+        std::vector<int> ints;
+        std::vector<unsigned char> raw;
+        int raw_bitpix = 0;
+        long n_bytes;
+        const unsigned char* bytes =
+            column_data.array(row, heap, heap_size, n_bytes);
+        if (bytes == nullptr) error("Invalid tile %d in '%s'", i_tile, filename);
+
+        if (n_bytes == 0) {
+            // Tiles that couldn't be compressed or quantised
+            long n_bytes_gzip;
+            long n_bytes_raw;
+            const unsigned char* bytes_gzip =
+                column_gzip.array(row, heap, heap_size, n_bytes_gzip);
+            const unsigned char* bytes_raw =
+                column_raw.array(row, heap, heap_size, n_bytes_raw);
+
+            if ((bytes_gzip != nullptr) && (n_bytes_gzip > 0)) {
+                raw_bitpix = bitpix;
+                raw.resize((long)n_pixels * std::abs(raw_bitpix) / 8);
+                int status =
+                    gzip_decompress(bytes_gzip, n_bytes_gzip, raw.data(), raw.size());
+                if (status != 0)
+                    error("Invalid GZIP tile %d in '%s'", i_tile, filename);
+            } else if ((bytes_raw != nullptr) && (n_bytes_raw > 0)) {
+                raw_bitpix = column_raw.element_bitpix();
+                if ((raw_bitpix == 0) ||
+                    (n_bytes_raw != (long)n_pixels * std::abs(raw_bitpix) / 8))
+                    error("Invalid uncompressed tile %d in '%s'", i_tile, filename);
+                raw.assign(bytes_raw, bytes_raw + n_bytes_raw);
+            } else
+                error("Empty tile %d in '%s'", i_tile, filename);
+        } else if (algorithm == "RICE_1") {
+            ints.resize(n_pixels);
+            int status = rice_decompress(
+                bytes, n_bytes, ints.data(), n_pixels, bytepix, blocksize);
+            if (status != 0)
+                error("Invalid Rice tile %d in '%s'", i_tile, filename);
+        } else {
+            raw_bitpix = int_bitpix;
+            int n_bytes_pixel = std::abs(raw_bitpix) / 8;
+            raw.resize((long)n_pixels * n_bytes_pixel);
+            int status;
+            if (algorithm == "GZIP_2") {
+                std::vector<unsigned char> shuffled(raw.size());
+                status = gzip_decompress(bytes, n_bytes, shuffled.data(), raw.size());
+                unshuffle_bytes(shuffled.data(), raw.data(), n_pixels, n_bytes_pixel);
+            } else
+                status = gzip_decompress(bytes, n_bytes, raw.data(), raw.size());
+            if (status != 0) error("Invalid GZIP tile %d in '%s'", i_tile, filename);
+
+            // Quantised values
+            if ((raw_bitpix == 32) && quantized) {
+                ints.resize(n_pixels);
+                for (int i = 0; i < n_pixels; i++)
+                    ints[i] = (int32_t)read_big_endian(&raw[i * 4], 4);
+                raw_bitpix = 0;
+            }
+        }
+
+        // Store the values
+        DitherSequence dither(i_tile, dither_seed);
+        int n_bytes_raw = std::abs(raw_bitpix) / 8;
+        for (int i = 0; i < n_pixels; i++) {
+            int i_col = i_col_start + i % n_tile_columns;
+            double* row_out = &image[i_row_start + i / n_tile_columns][0];
+            double value;
+            if (raw_bitpix < 0) {
+                value = read_fits_pixel(&raw[(long)i * n_bytes_raw], raw_bitpix);
+            } else if (raw_bitpix > 0) {
+                value = read_fits_pixel(&raw[(long)i * n_bytes_raw], raw_bitpix);
+                if (has_blank && (value == tile_blank))
+                    value = NAN;
+                else if (!quantized)
+                    value = value * tile_scale + tile_zero;
+            } else if (quantized) {
+                double random = dithered ? dither.next() : 0.5;
+                if (has_blank && (ints[i] == tile_blank))
+                    value = NAN;
+                else if (zero_exact && (ints[i] == quantized_zero))
+                    value = 0.0;
+                else
+                    value = (ints[i] - random + 0.5) * tile_scale + tile_zero;
+            } else {
+                if (has_blank && (ints[i] == tile_blank))
+                    value = NAN;
+                else
+                    value = ints[i] * tile_scale + tile_zero;
+            }
+            row_out[i_col] = value;
+        }
+    });
+
+    return image;
+}
+
+/*
+    Load a 2D image from a FITS file.
+
+    The image is loaded from the first HDU with one: the primary array, an IMAGE
+    extension, or a tile-compressed image (ZIMAGE = T) in a BINTABLE extension,
+    e.g. from fpack or astropy's CompImageHDU. The compressed tiles are decoded
+    in parallel (see set_n_threads()) straight into the image, without an
+    uncompressed copy of the file.
+
+    The image rows are the FITS NAXIS2 axis and the columns NAXIS1, i.e. the
+    rows are read out towards the first (bottom) row as displayed by e.g. DS9.
+    BSCALE and BZERO are applied, and null (BLANK) pixels are set to NaN.
+
+    Supported tile compression: RICE_1 and GZIP_1/2, of integers or of floats,
+    which may be quantised with NO_DITHER or SUBTRACTIVE_DITHER_1/2.
+
+    Parameters
+    ----------
+    filename : str
+        The path to the file to load.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The loaded 2D image array.
+*/
+std::valarray<std::valarray<double>> load_image_from_fits(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) error("Failed to open image file '%s'", filename);
+
+    fseek(f, 0, SEEK_END);
+    long n_bytes = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (n_bytes < 0) {
+        fclose(f);
+        error("Failed to read image file '%s'", filename);
+    }
+    std::vector<unsigned char> file(n_bytes);
+    size_t n_read = fread(file.data(), 1, n_bytes, f);
+    fclose(f);
+    if (n_read != (size_t)n_bytes) error("Failed to read image file '%s'", filename);
+
+    if ((n_bytes < fits_card_size) ||
+        (strncmp((char*)file.data(), "SIMPLE  =", 9) != 0))
+        error("Not a FITS file '%s'", filename);
+
+    // Find the first image
+    long offset = 0;
+    while (offset < n_bytes) {
+        FitsHeader header = parse_fits_header(file, offset, filename);
+        long n_bytes_data = fits_data_size(header, filename);
+        if (offset + n_bytes_data > n_bytes)
+            error("Truncated FITS file '%s'", filename);
+        const unsigned char* data = file.data() + offset;
+
+        std::string extension = header.get_string("XTENSION");
+        if ((extension == "BINTABLE") && header.get_logical("ZIMAGE")) {
+            return load_fits_compressed_hdu(header, data, n_bytes_data, filename);
+        } else if (
+            (extension.empty() || (extension == "IMAGE")) &&
+            (header.get_int("NAXIS") > 0) && (n_bytes_data > 0)) {
+            return load_fits_image_hdu(header, data, filename);
+        }
+
+        offset += fits_padded_size(n_bytes_data);
+    }
+    error("No image found in FITS file '%s'", filename);
+}
+
+/*
+    Read the shape of the image that load_image_from_fits() would load, from
+    only the headers, skipping over the data of any other HDUs before it.
+
+    Parameters
+    ----------
+    filename : str
+        The path to the file.
+
+    n_rows, n_columns : int&
+        Set to the image shape.
+*/
+void load_image_shape_from_fits(const char* filename, int& n_rows, int& n_columns) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) error("Failed to open image file '%s'", filename);
+
+    // Close the file if an invalid header raises an error
+    bool found_image = false;
+    long long n_rows_header;
+    long long n_columns_header;
+    try {
+        std::vector<unsigned char> header_bytes;
+        std::vector<unsigned char> block(fits_block_size);
+        while (fread(block.data(), 1, fits_block_size, f) == (size_t)fits_block_size) {
+            if ((ftell(f) == fits_block_size) &&
+                (strncmp((char*)block.data(), "SIMPLE  =", 9) != 0))
+                error("Not a FITS file '%s'", filename);
+            header_bytes.insert(header_bytes.end(), block.begin(), block.end());
+
+            // Read blocks until the end of this header
+            bool found_end = false;
+            for (int i_card = 0; i_card < fits_block_size / fits_card_size; i_card++) {
+                if (strncmp((char*)&block[i_card * fits_card_size], "END     ", 8) == 0)
+                    found_end = true;
+            }
+            if (!found_end) continue;
+
+            long offset = 0;
+            FitsHeader header = parse_fits_header(header_bytes, offset, filename);
+            long n_bytes_data = fits_data_size(header, filename);
+            header_bytes.clear();
+
+            std::string extension = header.get_string("XTENSION");
+            std::string prefix;
+            if ((extension == "BINTABLE") && header.get_logical("ZIMAGE"))
+                prefix = "Z";
+            else if (
+                (extension.empty() || (extension == "IMAGE")) &&
+                (header.get_int("NAXIS") > 0) && (n_bytes_data > 0))
+                prefix = "";
+            else {
+                fseek(f, fits_padded_size(n_bytes_data), SEEK_CUR);
+                continue;
+            }
+
+            n_columns_header = header.get_int(prefix + "NAXIS1");
+            n_rows_header = (header.get_int(prefix + "NAXIS") >= 2)
+                                ? header.get_int(prefix + "NAXIS2")
+                                : 1;
+            found_image = true;
+            break;
+        }
+    } catch (...) {
+        fclose(f);
+        throw;
+    }
+    fclose(f);
+
+    if (!found_image) error("No image found in FITS file '%s'", filename);
+    if (!is_valid_image_shape(n_rows_header, n_columns_header))
+        error("Invalid image shape in '%s'", filename);
+    n_rows = n_rows_header;
+    n_columns = n_columns_header;
+}
+
+// ========
+// Saving
+// ========
+static void write_fits_bytes(
+    FILE* f, const unsigned char* bytes, long n_bytes, const char* filename) {
+    if ((n_bytes > 0) && (fwrite(bytes, 1, n_bytes, f) != (size_t)n_bytes))
+        error("Failed to write FITS file '%s'", filename);
+}
+
+// Write the data then zeros to fill the last block
+static void write_fits_data(
+    FILE* f, const unsigned char* bytes, long n_bytes, const char* filename) {
+    write_fits_bytes(f, bytes, n_bytes, filename);
+    std::vector<unsigned char> padding(fits_padded_size(n_bytes) - n_bytes, 0);
+    write_fits_bytes(f, padding.data(), padding.size(), filename);
+}
+
+/*
+    Save a 2D image to a FITS file, optionally tile-compressed.
+
+    Uncompressed images are saved as the primary array of 64-bit floats.
+    Compressed images are saved as the FITS tiled image convention's binary
+    table extension after an empty primary HDU (as from fpack), with one tile
+    per row. The tiles are compressed in parallel.
+
+    Rice compression is lossy: each tile's values are quantised to integers
+    with steps of quantize_step above the tile's minimum, with the standard
+    subtractive dithering so that the errors (at most half a step) average
+    out. The step is widened for any tile with a range of more than 1e9 steps.
+    GZIP compression is lossless, of the byte-shuffled 64-bit floats.
+
+    Non-finite values are saved as NaN (null) by compressed images.
+
+    Parameters
+    ----------
+    filename : str
+        The path to the file to save.
+
+    image : std::valarray<std::valarray<double>>
+        The 2D image array to save, see load_image_from_fits() for the axes.
+
+    compression : int (opt.)
+        The compression, see FitsCompression. Default Rice for *.fz files,
+        otherwise none.
+
+    quantize_step : double (opt.)
+        The quantisation step for Rice compression.
+*/
+void save_image_to_fits(
+    const char* filename, std::valarray<std::valarray<double>>& image,
+    int compression, double quantize_step) {
+    int n_rows = image.size();
+    int n_columns = (n_rows > 0) ? image[0].size() : 0;
+    if (compression == fits_auto) {
+        std::string name(filename);
+        compression = ((name.size() >= 3) && (name.substr(name.size() - 3) == ".fz"))
+                          ? fits_rice
+                          : fits_none;
+    }
+    if ((compression == fits_rice) && !(quantize_step > 0.0))
+        error("Invalid FITS quantisation step %g", quantize_step);
+
+    FILE* f = fopen(filename, "wb");
+    if (!f) error("Failed to open file '%s'", filename);
+
+    std::string header;
+    if (compression == fits_none) {
+        add_card_logical(header, "SIMPLE", true);
+        add_card_int(header, "BITPIX", -64);
+        add_card_int(header, "NAXIS", 2);
+        add_card_int(header, "NAXIS1", n_columns);
+        add_card_int(header, "NAXIS2", n_rows);
+        end_header(header);
+        write_fits_bytes(f, (unsigned char*)header.data(), header.size(), filename);
+
+        std::vector<unsigned char> data((long)n_rows * n_columns * 8);
+        parallel_for(n_rows, [&](int i_row) {
+            unsigned char* row = &data[(long)i_row * n_columns * 8];
+            for (int i_col = 0; i_col < n_columns; i_col++)
+                write_fits_double(row + i_col * 8, image[i_row][i_col]);
+        });
+        write_fits_data(f, data.data(), data.size(), filename);
+
+        fclose(f);
+        return;
+    }
+
+    // Compress each row's tile
+    std::vector<std::vector<unsigned char>> tiles(n_rows);
+    std::vector<double> tile_scales(n_rows, 1.0);
+    std::vector<double> tile_zeros(n_rows, 0.0);
+    parallel_for(n_rows, [&](int i_row) {
+        std::valarray<double>& values = image[i_row];
+
+        if (compression == fits_gzip) {
+            std::vector<unsigned char> bytes((long)n_columns * 8);
+            std::vector<unsigned char> shuffled(bytes.size());
+            for (int i_col = 0; i_col < n_columns; i_col++)
+                write_fits_double(&bytes[i_col * 8], values[i_col]);
+            shuffle_bytes(bytes.data(), shuffled.data(), n_columns, 8);
+            tiles[i_row] = gzip_compress(shuffled);
+            return;
+        }
+
+        // Quantise above the minimum
+        double minimum = INFINITY;
+        double maximum = -INFINITY;
+        for (int i_col = 0; i_col < n_columns; i_col++) {
+            if (!std::isfinite(values[i_col])) continue;
+            minimum = std::min(minimum, values[i_col]);
+            maximum = std::max(maximum, values[i_col]);
+        }
+        double zero = (minimum <= maximum) ? minimum : 0.0;
+        double scale = quantize_step;
+        if ((minimum <= maximum) && ((maximum - zero) / scale > 1e9))
+            scale = (maximum - zero) / 1e9;
+        tile_scales[i_row] = scale;
+        tile_zeros[i_row] = zero;
+
+        std::vector<int> ints(n_columns);
+        DitherSequence dither(i_row, 1);
+        for (int i_col = 0; i_col < n_columns; i_col++) {
+            double random = dither.next();
+            if (std::isfinite(values[i_col]))
+                ints[i_col] = (int)floor((values[i_col] - zero) / scale + random);
+            else
+                ints[i_col] = quantized_null;
+        }
+        tiles[i_row] = rice_compress(ints.data(), n_columns);
+    });
+
+    // The table of descriptors for each tile's bytes in the heap
+    long heap_size = 0;
+    long max_tile_size = 0;
+    for (auto& tile : tiles) {
+        heap_size += tile.size();
+        max_tile_size = std::max(max_tile_size, (long)tile.size());
+    }
+    bool long_descriptors = (heap_size > INT32_MAX);
+    int descriptor_size = long_descriptors ? 16 : 8;
+    bool quantized = (compression == fits_rice);
+    long row_size = descriptor_size + (quantized ? 16 : 0);
+
+    std::vector<unsigned char> data(row_size * n_rows + heap_size);
+    long heap_offset = 0;
+    for (int i_row = 0; i_row < n_rows; i_row++) {
+        unsigned char* row = &data[row_size * i_row];
+        long n_bytes = tiles[i_row].size();
+        if (long_descriptors) {
+            write_big_endian(row, n_bytes, 8);
+            write_big_endian(row + 8, heap_offset, 8);
+        } else {
+            write_big_endian(row, n_bytes, 4);
+            write_big_endian(row + 4, heap_offset, 4);
+        }
+        if (quantized) {
+            write_fits_double(row + descriptor_size, tile_scales[i_row]);
+            write_fits_double(row + descriptor_size + 8, tile_zeros[i_row]);
+        }
+        if (n_bytes > 0)
+            memcpy(
+                &data[row_size * n_rows + heap_offset], tiles[i_row].data(), n_bytes);
+        heap_offset += n_bytes;
+    }
+
+    // Empty primary HDU
+    add_card_logical(header, "SIMPLE", true);
+    add_card_int(header, "BITPIX", 8);
+    add_card_int(header, "NAXIS", 0);
+    add_card_logical(header, "EXTEND", true);
+    end_header(header);
+
+    // Compressed image HDU
+    std::string form = std::string(long_descriptors ? "1QB(" : "1PB(") +
+                       std::to_string(max_tile_size) + ")";
+    add_card_string(header, "XTENSION", "BINTABLE");
+    add_card_int(header, "BITPIX", 8);
+    add_card_int(header, "NAXIS", 2);
+    add_card_int(header, "NAXIS1", row_size);
+    add_card_int(header, "NAXIS2", n_rows);
+    add_card_int(header, "PCOUNT", heap_size);
+    add_card_int(header, "GCOUNT", 1);
+    add_card_int(header, "TFIELDS", quantized ? 3 : 1);
+    add_card_string(header, "TTYPE1", "COMPRESSED_DATA");
+    add_card_string(header, "TFORM1", form);
+    if (quantized) {
+        add_card_string(header, "TTYPE2", "ZSCALE");
+        add_card_string(header, "TFORM2", "1D");
+        add_card_string(header, "TTYPE3", "ZZERO");
+        add_card_string(header, "TFORM3", "1D");
+    }
+    add_card_logical(header, "ZIMAGE", true);
+    add_card_int(header, "ZBITPIX", -64);
+    add_card_int(header, "ZNAXIS", 2);
+    add_card_int(header, "ZNAXIS1", n_columns);
+    add_card_int(header, "ZNAXIS2", n_rows);
+    add_card_int(header, "ZTILE1", n_columns);
+    add_card_int(header, "ZTILE2", 1);
+    if (quantized) {
+        add_card_string(header, "ZCMPTYPE", "RICE_1");
+        add_card_string(header, "ZNAME1", "BLOCKSIZE");
+        add_card_int(header, "ZVAL1", 32);
+        add_card_string(header, "ZNAME2", "BYTEPIX");
+        add_card_int(header, "ZVAL2", 4);
+        add_card_string(header, "ZQUANTIZ", "SUBTRACTIVE_DITHER_1");
+        add_card_int(header, "ZDITHER0", 1);
+        add_card_int(header, "ZBLANK", quantized_null);
+    } else
+        add_card_string(header, "ZCMPTYPE", "GZIP_2");
+    add_card_string(header, "EXTNAME", "COMPRESSED_IMAGE");
+    end_header(header);
+
+    write_fits_bytes(f, (unsigned char*)header.data(), header.size(), filename);
+    write_fits_data(f, data.data(), data.size(), filename);
+
+    fclose(f);
+}
@@ -0,0 +1,310 @@
+
+#include "geometry.hpp"
+
+#include <stdio.h>
+
+#include <memory>
+#include <valarray>
+#include <vector>
+
+#include "model.hpp"
+#include "util.hpp"
+
+// ========
+// ReadoutRegion::
+// ========
+/*
+    Class ReadoutRegion.
+
+    The part of an image that is read out through one amplifier, and the CTI
+    model for it.
+
+    Charge is transferred towards row 0 and column 0 of the region by default,
+    as for add_cti(). Otherwise the region is flipped to match, so e.g. the
+    quadrants of a four-amplifier CCD can be described without flipping the
+    image first.
+
+    Parameters
+    ----------
+    model : CTIModel*
+        The parallel and serial CTI model for this amplifier.
+
+    row_start, row_stop, column_start, column_stop : int (opt.)
+        The region of the image, with -1 for the stops to include the last
+        row or column of the image.
+
+    readout_at_row_stop : bool (opt.)
+        Whether the charge is transferred towards row_stop - 1 instead of
+        row_start in parallel clocking.
+
+    readout_at_column_stop : bool (opt.)
+        Whether the charge is transferred towards column_stop - 1 instead of
+        column_start in serial clocking.
+*/
+ReadoutRegion::ReadoutRegion(
+    CTIModel* model, int row_start, int row_stop, int column_start, int column_stop,
+    bool readout_at_row_stop, bool readout_at_column_stop)
+    : model(model),
+      row_start(row_start),
+      row_stop(row_stop),
+      column_start(column_start),
+      column_stop(column_stop),
+      readout_at_row_stop(readout_at_row_stop),
+      readout_at_column_stop(readout_at_column_stop) {}
+
+/*
+    Copy the region out of the full image, oriented so that its readout is at
+    row 0 and column 0.
+*/
+std::valarray<std::valarray<double>> ReadoutRegion::extract(
+    std::valarray<std::valarray<double>>& image) {
+
+    int n_rows = row_stop - row_start;
+    int n_columns = column_stop - column_start;
+    int row_index;
+
+    std::valarray<std::valarray<double>> region_image(
+        std::valarray<double>(0.0, n_columns), n_rows);
+
+    for (int i_row = 0; i_row < n_rows; i_row++) {
+        row_index = readout_at_row_stop ? row_stop - 1 - i_row : row_start + i_row;
+
+        if (readout_at_column_stop) {
+            for (int i_column = 0; i_column < n_columns; i_column++)
+                region_image[i_row][i_column] =
+                    image[row_index][column_stop - 1 - i_column];
+        } else
+            region_image[i_row] =
+                image[row_index][std::slice(column_start, n_columns, 1)];
+    }
+
+    return region_image;
+}
+
+/*
+    Copy an oriented region image back into its place in the full image.
+*/
+void ReadoutRegion::insert(
+    std::valarray<std::valarray<double>>& image,
+    std::valarray<std::valarray<double>>& region_image) {
+
+    int n_rows = row_stop - row_start;
+    int n_columns = column_stop - column_start;
+    int row_index;
+
+    for (int i_row = 0; i_row < n_rows; i_row++) {
+        row_index = readout_at_row_stop ? row_stop - 1 - i_row : row_start + i_row;
+
+        if (readout_at_column_stop) {
+            for (int i_column = 0; i_column < n_columns; i_column++)
+                image[row_index][column_stop - 1 - i_column] =
+                    region_image[i_row][i_column];
+        } else
+            image[row_index][std::slice(column_start, n_columns, 1)] =
+                region_image[i_row];
+    }
+}
+
+// ========
+// ReadoutGeometry::
+// ========
+/*
+    Class ReadoutGeometry.
+
+    The set of non-overlapping amplifier regions of a CCD, each with its own
+    readout directions and CTI model. Any pixels outside the regions are left
+    unchanged by add_cti() and remove_cti().
+
+    Parameters
+    ----------
+    regions : std::vector<ReadoutRegion>
+        The amplifier regions.
+*/
+void ReadoutGeometry::add_region(ReadoutRegion region) { regions.push_back(region); }
+
+/*
+    The regions with their default stops set for this image shape, checked to
+    be inside the image and not overlapping.
+*/
+std::vector<ReadoutRegion> ReadoutGeometry::resolve(int n_rows, int n_columns) {
+    std::vector<ReadoutRegion> resolved = regions;
+
+    for (int i_region = 0; i_region < resolved.size(); i_region++) {
+        ReadoutRegion* region = &resolved[i_region];
+
+        if (region->row_stop == -1) region->row_stop = n_rows;
+        if (region->column_stop == -1) region->column_stop = n_columns;
+
+        if ((region->row_start < 0) || (region->row_stop > n_rows) ||
+            (region->row_start >= region->row_stop) || (region->column_start < 0) ||
+            (region->column_stop > n_columns) ||
+            (region->column_start >= region->column_stop))
+            error(
+                "Region %d [%d:%d, %d:%d] is empty or outside the image (%d x %d)",
+                i_region, region->row_start, region->row_stop, region->column_start,
+                region->column_stop, n_rows, n_columns);
+        if (region->model == nullptr) error("Region %d has no model", i_region);
+
+        for (int j_region = 0; j_region < i_region; j_region++) {
+            if ((region->row_start < resolved[j_region].row_stop) &&
+                (resolved[j_region].row_start < region->row_stop) &&
+                (region->column_start < resolved[j_region].column_stop) &&
+                (resolved[j_region].column_start < region->column_stop))
+                error("Regions %d and %d overlap", j_region, i_region);
+        }
+    }
+
+    return resolved;
+}
+
+/*
+    The standard geometry for a CCD read out through an amplifier in each
+    corner, with the image split into quadrants at its middle row and column.
+
+    Quadrant A is read out towards row 0 and column 0, B towards row 0 and the
+    last column, C towards the last row and column 0, and D towards the last
+    row and column.
+
+    Parameters
+    ----------
+    n_rows, n_columns : int
+        The full image shape.
+
+    model_a, model_b, model_c, model_d : CTIModel*
+        The CTI model for each quadrant's amplifier. Any omitted models are the
+        same as model_a.
+*/
+ReadoutGeometry quadrant_geometry(
+    int n_rows, int n_columns, CTIModel* model_a, CTIModel* model_b,
+    CTIModel* model_c, CTIModel* model_d) {
+
+    if (model_b == nullptr) model_b = model_a;
+    if (model_c == nullptr) model_c = model_a;
+    if (model_d == nullptr) model_d = model_a;
+
+    int row_middle = n_rows / 2;
+    int column_middle = n_columns / 2;
+
+    ReadoutGeometry geometry;
+    geometry.add_region(
+        ReadoutRegion(model_a, 0, row_middle, 0, column_middle, false, false));
+    geometry.add_region(
+        ReadoutRegion(model_b, 0, row_middle, column_middle, n_columns, false, true));
+    geometry.add_region(
+        ReadoutRegion(model_c, row_middle, n_rows, 0, column_middle, true, false));
+    geometry.add_region(ReadoutRegion(
+        model_d, row_middle, n_rows, column_middle, n_columns, true, true));
+
+    return geometry;
+}
+
+// ========
+// Add and remove CTI
+// ========
+/*
+    Add or remove CTI from each region of the image concurrently.
+
+    A model only keeps its trap managers prepared for one image shape, so a
+    model shared by regions of different shapes, e.g. the quadrants of an image
+    with an odd number of rows or columns, is prepared for the first one and
+    copied and prepared for each other shape.
+*/
+static std::valarray<std::valarray<double>> process_regions(
+    std::valarray<std::valarray<double>>& image_in, ReadoutGeometry& geometry,
+    bool add, int n_iterations) {
+
+    std::valarray<std::valarray<double>> image = image_in;
+    std::vector<ReadoutRegion> regions =
+        geometry.resolve(image_in.size(), image_in[0].size());
+    int n_regions = regions.size();
+
+    // Prepare the models first, since they may be shared between regions
+    std::vector<std::unique_ptr<CTIModel>> model_copies;
+    for (int i_region = 0; i_region < n_regions; i_region++) {
+        ReadoutRegion* region = &regions[i_region];
+        int n_rows = region->row_stop - region->row_start;
+        int n_columns = region->column_stop - region->column_start;
+        CTIModel* original_model = geometry.regions[i_region].model;
+        bool is_shared = false;
+
+        for (int j_region = 0; j_region < i_region; j_region++) {
+            if (geometry.regions[j_region].model != original_model) continue;
+            is_shared = true;
+            if ((regions[j_region].row_stop - regions[j_region].row_start == n_rows) &&
+                (regions[j_region].column_stop - regions[j_region].column_start ==
+                 n_columns)) {
+                region->model = regions[j_region].model;
+                break;
+            }
+        }
+        if (region->model != original_model) continue;
+
+        if (is_shared) {
+            model_copies.push_back(
+                std::unique_ptr<CTIModel>(new CTIModel(*original_model)));
+            region->model = model_copies.back().get();
+        }
+        region->model->prepare(n_rows, n_columns);
+    }
+
+    print_v(1, "%d readout region(s) \n", n_regions);
+
+    // The regions don't overlap, so each can be written back independently,
+    // with its share of the threads for its own strips of columns
+    parallel_for(
+        n_regions,
+        [&](int i_region) {
+            ReadoutRegion* region = &regions[i_region];
+            std::valarray<std::valarray<double>> region_image =
+                region->extract(image_in);
+
+            if (add)
+                region_image = region->model->add_cti(region_image);
+            else
+                region_image = region->model->remove_cti(region_image, n_iterations);
+
+            region->insert(image, region_image);
+        },
+        true);
+
+    return image;
+}
+
+/*
+    Add CTI trails to an image with multiple readout amplifiers, as for
+    add_cti() for each region of the readout geometry. The regions are
+    processed concurrently, each with its share of the threads, see
+    set_n_threads().
+
+    Parameters
+    ----------
+    image_in : std::valarray<std::valarray<double>>&
+        The input array of pixel values, assumed to be in units of electrons.
+
+    geometry : ReadoutGeometry&
+        The amplifier regions, their readout directions, and their CTI models.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The output array of pixel values.
+*/
+std::valarray<std::valarray<double>> add_cti(
+    std::valarray<std::valarray<double>>& image_in, ReadoutGeometry& geometry) {
+
+    return process_regions(image_in, geometry, true, -1);
+}
+
+/*
+    Remove CTI trails from an image with multiple readout amplifiers, as for
+    remove_cti() for each region of the readout geometry. See add_cti().
+
+    n_iterations : int
+        The number of iterations, or -1 to use each model's value.
+*/
+std::valarray<std::valarray<double>> remove_cti(
+    std::valarray<std::valarray<double>>& image_in, int n_iterations,
+    ReadoutGeometry& geometry) {
+
+    return process_regions(image_in, geometry, false, n_iterations);
+}
@@ -0,0 +1,297 @@
+
+#include "jobs.hpp"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <string>
+#include <valarray>
+#include <vector>
+
+#include "model.hpp"
+#include "server.hpp"
+#include "util.hpp"
+
+// ========
+// JobQueue::
+// ========
+/*
+    Class JobQueue.
+
+    Add or remove CTI from images asynchronously, on a pool of worker threads,
+    so that the caller can carry on with other work.
+
+    Each submitted job gets a handle, to poll() or wait() for its result, or to
+    cancel() it if it hasn't started yet. Alternatively, either pass a callback
+    to submit(), which is called by the worker thread when the job finishes,
+    or use wait_any() as a completion queue to get the handle of each job as
+    it finishes, so no extra thread is needed per job in an event loop.
+
+    A job that hits an error finishes as job_failed with its error message,
+    instead of exiting, see ThrowErrors.
+
+    Prepare each job's model for its image shape before submitting, see
+    CTIModel::prepare(), so that all its jobs reuse the same trap managers and
+    the model's pool of clocking workspaces. A model must not be re-prepared
+    while it has unfinished jobs.
+
+    Parameters
+    ----------
+    n_workers : int
+        The number of worker threads, or 0 for get_n_threads(). Each job is
+        clocked on its share of the threads between the running jobs, see
+        ThreadPool.
+*/
+JobQueue::JobQueue(int n_workers)
+    : next_handle(1), n_unfinished(0), pool(new ThreadPool(n_workers)) {}
+
+/*
+    Cancel any jobs that haven't started, and wait for running ones to finish.
+*/
+JobQueue::~JobQueue() {
+    std::vector<long> handles;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = jobs.begin(); it != jobs.end(); it++)
+            if (it->second->status == job_queued) handles.push_back(it->first);
+    }
+    for (int i_handle = 0; i_handle < handles.size(); i_handle++)
+        cancel(handles[i_handle]);
+
+    pool.reset();
+}
+
+/*
+    Queue a job to be run by the next free worker.
+
+    Parameters
+    ----------
+    job : CTIJob
+        The model, input image, whether to add (or remove) CTI, and the number
+        of iterations to remove CTI (-1 for the model's value).
+
+    callback : JobCallback (opt.)
+        If provided, called with the job's handle, final status, and output
+        image (or input image if cancelled) when the job finishes. This is
+        called from the worker thread (or the cancelling thread), so it should
+        be quick and thread safe, and it may take the image with std::move.
+        The job is then forgotten, so its handle can't be waited on and isn't
+        returned by wait_any(). Use error_message() in the callback for the
+        reason a job failed.
+
+    Returns
+    -------
+    handle : long
+        The job's handle, unique for this queue.
+*/
+long JobQueue::submit(CTIJob job, JobCallback callback) {
+    std::shared_ptr<JobState> state(new JobState(job, callback));
+    long handle;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        handle = next_handle++;
+        jobs[handle] = state;
+        n_unfinished++;
+    }
+
+    pool->submit([this, handle, state]() { run_job(handle, state); });
+
+    return handle;
+}
+
+/*
+    Run a job unless it was cancelled while queued, recording any error as a
+    failed job instead of exiting.
+*/
+void JobQueue::run_job(long handle, std::shared_ptr<JobState> state) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (state->status != job_queued) return;
+        state->status = job_running;
+    }
+
+    CTIJob* job = &state->job;
+    JobStatus status = job_done;
+    try {
+        ThrowErrors throw_errors;
+        if (job->add)
+            job->image = job->model->add_cti(job->image);
+        else
+            job->image = job->model->remove_cti(job->image, job->n_iterations);
+    } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        state->error_message = e.what();
+        status = job_failed;
+    }
+
+    finish_job(handle, state, status);
+}
+
+/*
+    Mark a job as finished, then either call its callback and forget it, or
+    add it to the completion queue for wait() and wait_any().
+*/
+void JobQueue::finish_job(
+    long handle, std::shared_ptr<JobState> state, JobStatus status) {
+    if (state->callback) {
+        state->callback(handle, status, state->job.image);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        state->status = status;
+        jobs.erase(handle);
+        n_unfinished--;
+    } else {
+        std::lock_guard<std::mutex> lock(mutex);
+        state->status = status;
+        completed.push_back(handle);
+        n_unfinished--;
+    }
+
+    finished.notify_all();
+}
+
+/*
+    The status of a job without waiting, or job_unknown if the handle is
+    invalid or the job has already been collected by wait() or had a callback.
+*/
+JobStatus JobQueue::poll(long handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = jobs.find(handle);
+    if (it == jobs.end()) return job_unknown;
+
+    return it->second->status;
+}
+
+/*
+    Wait for a job to finish, collect its output image, and forget the job.
+
+    Parameters
+    ----------
+    handle : long
+        The job's handle from submit().
+
+    image_out : std::valarray<std::valarray<double>>* (opt.)
+        If provided, set to the output image, or to the input image if the
+        job was cancelled or failed.
+
+    error_message_out : std::string* (opt.)
+        If provided, set to the error message if the job failed, or empty.
+
+    Returns
+    -------
+    status : JobStatus
+        job_done, job_cancelled, job_failed, or job_unknown if the handle is
+        invalid or the job has already been collected or had a callback.
+*/
+JobStatus JobQueue::wait(
+    long handle, std::valarray<std::valarray<double>>* image_out,
+    std::string* error_message_out) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    auto it = jobs.find(handle);
+    if (it == jobs.end()) return job_unknown;
+    std::shared_ptr<JobState> state = it->second;
+
+    finished.wait(lock, [&state] {
+        return (state->status == job_done) || (state->status == job_cancelled) ||
+               (state->status == job_failed);
+    });
+
+    if (image_out != nullptr) *image_out = std::move(state->job.image);
+    if (error_message_out != nullptr) *error_message_out = state->error_message;
+    jobs.erase(handle);
+
+    return state->status;
+}
+
+/*
+    The error message of a failed job that hasn't been collected yet, e.g.
+    from its callback, or empty.
+*/
+std::string JobQueue::error_message(long handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = jobs.find(handle);
+    if (it == jobs.end()) return "";
+
+    return it->second->error_message;
+}
+
+/*
+    Cancel a job if it hasn't started running yet.
+
+    Returns
+    -------
+    cancelled : bool
+        Whether the job was cancelled. A running or finished job is unaffected.
+*/
+bool JobQueue::cancel(long handle) {
+    std::shared_ptr<JobState> state;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = jobs.find(handle);
+        if ((it == jobs.end()) || (it->second->status != job_queued)) return false;
+        state = it->second;
+
+        // Stop a worker from starting it before it is marked as finished
+        state->status = job_running;
+    }
+
+    finish_job(handle, state, job_cancelled);
+
+    return true;
+}
+
+/*
+    Wait for the next job to finish, in order of completion, as a completion
+    queue for jobs submitted without a callback. Collect the job's output with
+    wait(), which then returns immediately.
+
+    Parameters
+    ----------
+    timeout : double (opt.)
+        The maximum time to wait (s), or negative (default) to wait until a job
+        finishes.
+
+    Returns
+    -------
+    handle : long
+        The handle of a finished job, or -1 if the timeout was reached, or if
+        no unfinished jobs remain to wait for.
+*/
+long JobQueue::wait_any(double timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Skip any jobs that were already collected by wait()
+    auto is_ready = [this] {
+        while (!completed.empty() && (jobs.find(completed.front()) == jobs.end()))
+            completed.pop_front();
+        return !completed.empty() || (n_unfinished == 0);
+    };
+
+    if (timeout < 0.0)
+        finished.wait(lock, is_ready);
+    else
+        finished.wait_for(
+            lock, std::chrono::duration<double>(timeout), is_ready);
+
+    if (!is_ready() || completed.empty()) return -1;
+
+    long handle = completed.front();
+    completed.pop_front();
+
+    return handle;
+}
+
+/*
+    The number of submitted jobs that haven't finished yet.
+*/
+int JobQueue::n_pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return n_unfinished;
+}
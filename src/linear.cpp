@@ -0,0 +1,766 @@
+
+#include "linear.hpp"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <valarray>
+#include <vector>
+
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "roe.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+// ========
+// TrailKernels::
+// ========
+/*
+    Class TrailKernels.
+
+    The linear response of a column to one pixel of charge, i.e. the change in
+    each pixel (the lost charge and the trail) per electron in the source
+    pixel, depending on how far the source is from the readout and how much
+    charge it has.
+
+    For faint pixels the CTI is close to linear, so the trails of a whole
+    column can be approximated by the sum of these kernels scaled by each
+    pixel's charge, ignoring the interactions between the pixels' trails.
+
+    The kernels are measured with the full clocking model for a single pixel
+    at each of n_kernels rows spread evenly along the column, and at each of
+    n_flux_levels charges a factor of 2 apart up to reference_n_electrons. The
+    response per electron changes with the charge unless the well_fill_power
+    is 1, e.g. fainter pixels lose a larger fraction of their charge for a
+    lower power, so each source pixel's kernel is interpolated linearly
+    between the rows either side and in log charge between the levels either
+    side, see kernel_weights(). Pixels outside the range of levels use the
+    nearest level. The kernels are also measured half way (in log charge)
+    between the levels and at half the lowest level, to estimate the error of
+    the interpolation.
+
+    Parameters
+    ----------
+    n_rows : int
+        The number of rows in the columns.
+
+    roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, express,
+    row_offset
+        As for clock_charge_in_one_direction(). The traps must be emptied
+        between columns.
+
+    reference_n_electrons : double (opt.)
+        The charge of the brightest flux level to measure the kernels with,
+        i.e. the typical or maximum charge of the pixels they will be used for.
+
+    n_kernels : int (opt.)
+        The number of source rows to measure the kernels at.
+
+    n_flux_levels : int (opt.)
+        The number of charges to measure the kernels at, from
+        reference_n_electrons down by factors of 2.
+
+    kernel_tolerance : double (opt.)
+        The kernels are truncated where all are smaller than this (per electron).
+
+    Attributes
+    ----------
+    kernel_rows : std::valarray<int>
+        The source rows of each kernel.
+
+    flux_levels : std::valarray<double>
+        The source charges of each kernel, in increasing order.
+
+    d_min, d_max : int
+        The range of offsets from the source row covered by the kernels.
+
+    kernels : std::valarray<std::valarray<double>>
+        The change in each pixel per electron in the source pixel, for each
+        flux level then each source row, i.e. kernel i_level * n_kernels +
+        i_kernel, at offsets d_min to d_max.
+
+    nonlinearity : double
+        The maximum total absolute error of an interpolated kernel (per
+        electron), from the kernels measured between the flux levels, and at
+        half the lowest level compared with the lowest.
+
+    trail_fraction : double
+        The maximum total absolute change of a kernel (per electron), which also
+        limits how much the trails of different pixels can affect each other.
+*/
+TrailKernels::TrailKernels(
+    int n_rows, ROE* roe, CCD* ccd, std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int express, int row_offset,
+    double reference_n_electrons, int n_kernels, int n_flux_levels,
+    double kernel_tolerance)
+    : n_rows(n_rows),
+      n_kernels(n_kernels),
+      n_flux_levels(n_flux_levels),
+      nonlinearity(0.0),
+      trail_fraction(0.0) {
+
+    if (!roe->empty_traps_between_columns)
+        error("Trail kernels require the traps to be emptied between columns");
+    if (reference_n_electrons <= 0.0)
+        error("Reference n_electrons (%g) must be positive", reference_n_electrons);
+
+    // Source rows, spread evenly along the column
+    this->n_kernels = std::max(1, std::min(n_kernels, n_rows));
+    n_kernels = this->n_kernels;
+    kernel_rows.resize(n_kernels);
+    for (int i_kernel = 0; i_kernel < n_kernels; i_kernel++)
+        kernel_rows[i_kernel] =
+            (n_kernels == 1) ? 0
+                             : (int)round(
+                                   (double)i_kernel * (n_rows - 1) / (n_kernels - 1));
+
+    // Source charges, a factor of 2 apart, then the charges to check the
+    // interpolation at, half way between each pair and below the lowest
+    this->n_flux_levels = std::max(1, n_flux_levels);
+    n_flux_levels = this->n_flux_levels;
+    flux_levels.resize(n_flux_levels);
+    for (int i_level = 0; i_level < n_flux_levels; i_level++)
+        flux_levels[i_level] =
+            reference_n_electrons * pow(2.0, i_level - (n_flux_levels - 1));
+    std::valarray<double> check_levels(n_flux_levels);
+    for (int i_level = 0; i_level < n_flux_levels - 1; i_level++)
+        check_levels[i_level] = flux_levels[i_level] * sqrt(2.0);
+    check_levels[n_flux_levels - 1] = 0.5 * flux_levels[0];
+
+    // Clock a single source pixel in each column, for each source row and
+    // charge, then each check charge
+    int n_measured = n_flux_levels * n_kernels;
+    std::valarray<double> source_n_electrons(2 * n_measured);
+    std::valarray<std::valarray<double>> image(
+        std::valarray<double>(0.0, 2 * n_measured), n_rows);
+    for (int i_level = 0; i_level < n_flux_levels; i_level++) {
+        for (int i_kernel = 0; i_kernel < n_kernels; i_kernel++) {
+            int i_column = i_level * n_kernels + i_kernel;
+            source_n_electrons[i_column] = flux_levels[i_level];
+            source_n_electrons[n_measured + i_column] = check_levels[i_level];
+            image[kernel_rows[i_kernel]][i_column] = flux_levels[i_level];
+            image[kernel_rows[i_kernel]][n_measured + i_column] = check_levels[i_level];
+        }
+    }
+    std::valarray<std::valarray<double>> image_out = clock_charge_in_one_direction(
+        image, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, express,
+        row_offset, 0, -1, 0, -1, 0, -1, 1e-10, 20, 0);
+
+    // Response per electron
+    image_out -= image;
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        image_out[row_index] /= source_n_electrons;
+
+    // Range of offsets with non-negligible trails
+    d_min = n_rows;
+    d_max = -n_rows;
+    for (int i_column = 0; i_column < n_measured; i_column++) {
+        int source_row = kernel_rows[i_column % n_kernels];
+        for (int row_index = 0; row_index < n_rows; row_index++) {
+            if (fabs(image_out[row_index][i_column]) > kernel_tolerance) {
+                d_min = std::min(d_min, row_index - source_row);
+                d_max = std::max(d_max, row_index - source_row);
+            }
+        }
+    }
+    if (d_max < d_min) {
+        d_min = 0;
+        d_max = -1;
+    }
+
+    // Store the kernels and their size
+    int row_index;
+    double total;
+    kernels.resize(n_measured);
+    for (int i_column = 0; i_column < n_measured; i_column++) {
+        int source_row = kernel_rows[i_column % n_kernels];
+        kernels[i_column].resize(d_max - d_min + 1, 0.0);
+        for (int d = d_min; d <= d_max; d++) {
+            row_index = source_row + d;
+            if ((row_index >= 0) && (row_index < n_rows))
+                kernels[i_column][d - d_min] = image_out[row_index][i_column];
+        }
+
+        total = 0.0;
+        for (row_index = 0; row_index < n_rows; row_index++)
+            total += fabs(image_out[row_index][i_column]);
+        trail_fraction = std::max(trail_fraction, total);
+    }
+
+    // Compare the checks with the interpolated (or nearest) kernels
+    double difference;
+    double interpolated;
+    for (int i_level = 0; i_level < n_flux_levels; i_level++) {
+        for (int i_kernel = 0; i_kernel < n_kernels; i_kernel++) {
+            int i_column = i_level * n_kernels + i_kernel;
+            int i_column_above =
+                (i_level < n_flux_levels - 1) ? i_column + n_kernels : -1;
+            int i_column_check = n_measured + i_column;
+            if (i_level == n_flux_levels - 1) i_column = i_kernel;
+
+            difference = 0.0;
+            for (row_index = 0; row_index < n_rows; row_index++) {
+                interpolated = image_out[row_index][i_column];
+                if (i_column_above >= 0)
+                    interpolated =
+                        0.5 * (interpolated + image_out[row_index][i_column_above]);
+                difference += fabs(image_out[row_index][i_column_check] - interpolated);
+            }
+            nonlinearity = std::max(nonlinearity, difference);
+        }
+    }
+}
+
+/*
+    The kernels to interpolate between for a source pixel, and their weights.
+
+    Interpolated linearly between the kernel rows either side of the source
+    row, and in log charge between the flux levels either side of the source
+    charge, using the nearest level outside their range.
+
+    Parameters
+    ----------
+    source_row : int
+        The row of the source pixel.
+
+    n_electrons : double
+        The charge of the source pixel. Negative values use their magnitude.
+
+    i_kernels : int*
+        Set to the indices of the four kernels, see kernels.
+
+    weights : double*
+        Set to the four kernels' weights, which sum to 1.
+*/
+void TrailKernels::kernel_weights(
+    int source_row, double n_electrons, int* i_kernels, double* weights) {
+
+    // Rows either side
+    int i_kernel = 0;
+    double row_weight = 0.0;
+    if (n_kernels > 1) {
+        i_kernel = std::upper_bound(
+                       std::begin(kernel_rows), std::end(kernel_rows), source_row) -
+                   std::begin(kernel_rows) - 1;
+        i_kernel = std::max(0, std::min(i_kernel, n_kernels - 2));
+        row_weight = (double)(source_row - kernel_rows[i_kernel]) /
+                     (kernel_rows[i_kernel + 1] - kernel_rows[i_kernel]);
+    }
+    int i_kernel_next = std::min(i_kernel + 1, n_kernels - 1);
+
+    // Flux levels either side, a factor of 2 apart
+    int i_level = 0;
+    double level_weight = 0.0;
+    if ((n_flux_levels > 1) && (n_electrons != 0.0)) {
+        double position = log2(fabs(n_electrons) / flux_levels[0]);
+        position = std::max(0.0, std::min(position, n_flux_levels - 1.0));
+        i_level = std::min((int)position, n_flux_levels - 2);
+        level_weight = position - i_level;
+    }
+    int i_level_next = std::min(i_level + 1, n_flux_levels - 1);
+
+    i_kernels[0] = i_level * n_kernels + i_kernel;
+    i_kernels[1] = i_level * n_kernels + i_kernel_next;
+    i_kernels[2] = i_level_next * n_kernels + i_kernel;
+    i_kernels[3] = i_level_next * n_kernels + i_kernel_next;
+    weights[0] = (1.0 - level_weight) * (1.0 - row_weight);
+    weights[1] = (1.0 - level_weight) * row_weight;
+    weights[2] = level_weight * (1.0 - row_weight);
+    weights[3] = level_weight * row_weight;
+}
+
+/*
+    Add the linearised trails of one column of the input image to the output.
+
+    Parameters
+    ----------
+    image_in : std::valarray<std::valarray<double>>&
+        The source pixels.
+
+    image_out : std::valarray<std::valarray<double>>&
+        The image to add the trails (and lost charge) to, which may be a copy
+        of image_in.
+
+    column_index : int
+        The column to use.
+
+    scale : double (opt.)
+        A factor to multiply the trails by, e.g. -1 to subtract them.
+*/
+void TrailKernels::add_trails(
+    std::valarray<std::valarray<double>>& image_in,
+    std::valarray<std::valarray<double>>& image_out, int column_index, double scale) {
+
+    int d_start;
+    int d_stop;
+    int i_kernels[4];
+    double weights[4];
+    double n_electrons;
+
+    for (int row_index = 0; row_index < n_rows; row_index++) {
+        n_electrons = image_in[row_index][column_index];
+        if (n_electrons == 0.0) continue;
+
+        // Interpolate between the kernels for this row and charge
+        kernel_weights(row_index, n_electrons, i_kernels, weights);
+        n_electrons *= scale;
+
+        d_start = std::max(d_min, -row_index);
+        d_stop = std::min(d_max, n_rows - 1 - row_index);
+        for (int d = d_start; d <= d_stop; d++)
+            image_out[row_index + d][column_index] +=
+                n_electrons * (weights[0] * kernels[i_kernels[0]][d - d_min] +
+                               weights[1] * kernels[i_kernels[1]][d - d_min] +
+                               weights[2] * kernels[i_kernels[2]][d - d_min] +
+                               weights[3] * kernels[i_kernels[3]][d - d_min]);
+    }
+}
+
+/*
+    Remove the linearised trails from one column, i.e. solve for the source
+    pixels whose trails, as for add_trails(), would give the input column.
+
+    Each pixel only depends on the source pixels at or before it (for offsets
+    d_min >= 0, i.e. the usual trails behind each pixel), so this is solved
+    exactly by substituting forwards along the column, iterating for each
+    pixel's own charge since its kernel depends on it. Any kernel offsets
+    before the source use the input pixels as the estimate of the later
+    source pixels.
+
+    Parameters
+    ----------
+    image_in : std::valarray<std::valarray<double>>&
+        The pixels with trails.
+
+    image_out : std::valarray<std::valarray<double>>&
+        The image to set the source pixels of this column in, which must not
+        be image_in.
+
+    column_index : int
+        The column to use.
+*/
+void TrailKernels::remove_trails(
+    std::valarray<std::valarray<double>>& image_in,
+    std::valarray<std::valarray<double>>& image_out, int column_index) {
+
+    int i_kernels[4];
+    double weights[4];
+
+    // The change in a pixel per electron in the source row, at offset d, for
+    // the source's charge
+    auto kernel_at = [&](int source_row, double source_n_electrons, int d) {
+        kernel_weights(source_row, source_n_electrons, i_kernels, weights);
+        return weights[0] * kernels[i_kernels[0]][d - d_min] +
+               weights[1] * kernels[i_kernels[1]][d - d_min] +
+               weights[2] * kernels[i_kernels[2]][d - d_min] +
+               weights[3] * kernels[i_kernels[3]][d - d_min];
+    };
+
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        image_out[row_index][column_index] = image_in[row_index][column_index];
+    if (d_max < d_min) return;
+
+    double n_electrons;
+    double source_n_electrons;
+    double self_response;
+    const int max_self_iterations = 20;
+    for (int row_index = 0; row_index < n_rows; row_index++) {
+        n_electrons = image_in[row_index][column_index];
+
+        // Subtract the trails into this pixel from the other source pixels
+        for (int d = std::max(d_min, row_index - n_rows + 1);
+             d <= std::min(d_max, row_index); d++) {
+            if (d != 0)
+                n_electrons -=
+                    image_out[row_index - d][column_index] *
+                    kernel_at(row_index - d, image_out[row_index - d][column_index], d);
+        }
+
+        // Divide by the pixel's own response, including its lost charge, which
+        // depends on the source charge being solved for
+        if ((d_min > 0) || (d_max < 0)) {
+            image_out[row_index][column_index] = n_electrons;
+            continue;
+        }
+        source_n_electrons = n_electrons;
+        for (int iteration = 0; iteration < max_self_iterations; iteration++) {
+            self_response = 1.0 + kernel_at(row_index, source_n_electrons, 0);
+            if (self_response <= 0.0) break;
+            if (n_electrons / self_response == source_n_electrons) break;
+            source_n_electrons = n_electrons / self_response;
+        }
+        if (self_response > 0.0)
+            image_out[row_index][column_index] = source_n_electrons;
+    }
+}
+
+// ========
+// Clocking
+// ========
+/*
+    Add CTI trails to an image, as for clock_charge_in_one_direction(), but
+    with the fast linearised approximation for faint columns.
+
+    Columns with no pixels above flux_threshold are modelled as the sum of the
+    trails from each pixel, using TrailKernels measured at charges from the
+    threshold down, and interpolated for each pixel's charge. The other
+    columns are clocked with the full model as usual.
+
+    The runtime of the linearised columns scales with the kernel length
+    instead of the number of express passes and watermarks, so this is much
+    faster for faint images with short trails. The approximation ignores how
+    the trails of nearby pixels affect each other, so it is only appropriate
+    for faint pixels with well separated trails or a low trap density.
+
+    Only the full image is modelled, i.e. no windows.
+
+    Parameters
+    ----------
+    image_in, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, express,
+    row_offset, prune_n_electrons, prune_frequency
+        As for clock_charge_in_one_direction().
+
+    flux_threshold : double (opt.)
+        The maximum charge of any pixel in a column for it to be linearised.
+
+    n_kernels : int (opt.)
+        The number of source rows to measure the kernels at, see TrailKernels.
+
+    error_bound : double* (opt.)
+        If provided, set to an estimated bound on the total absolute error of
+        any linearised column, i.e. the column's total charge times the sum of
+        the kernels' non-linearity with charge and their trail fraction, since
+        the neglected interactions between trails can't exceed the trails
+        themselves. 0 if no columns were linearised.
+
+    column_error_bounds : std::valarray<double>* (opt.)
+        If provided, set to the estimated bound for each column, as for
+        error_bound, or 0 for the columns clocked with the full model.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The output array of pixel values.
+*/
+std::valarray<std::valarray<double>> clock_charge_in_one_direction_linearised(
+    std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int express, int row_offset,
+    double flux_threshold, int n_kernels, double* error_bound,
+    double prune_n_electrons, int prune_frequency,
+    std::valarray<double>* column_error_bounds) {
+
+    std::valarray<std::valarray<double>> image = image_in;
+    int n_rows = image_in.size();
+    int n_columns = image_in[0].size();
+    if (column_error_bounds != nullptr) column_error_bounds->resize(n_columns, 0.0);
+
+    // Sort the columns by their maximum charge
+    std::vector<int> linear_columns;
+    std::vector<int> exact_columns;
+    for (int column_index = 0; column_index < n_columns; column_index++) {
+        bool is_faint = true;
+        for (int row_index = 0; row_index < n_rows; row_index++) {
+            if (image_in[row_index][column_index] > flux_threshold) {
+                is_faint = false;
+                break;
+            }
+        }
+        if (is_faint)
+            linear_columns.push_back(column_index);
+        else
+            exact_columns.push_back(column_index);
+    }
+    print_v(
+        1, "%d linearised column(s), %d exact column(s) \n", (int)linear_columns.size(),
+        (int)exact_columns.size());
+
+    // Linearised columns
+    double max_error = 0.0;
+    if (linear_columns.size() > 0) {
+        TrailKernels trail_kernels(
+            n_rows, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, express,
+            row_offset, flux_threshold, n_kernels);
+
+        for (int i_column = 0; i_column < linear_columns.size(); i_column++) {
+            int column_index = linear_columns[i_column];
+            double n_electrons_column = 0.0;
+
+            trail_kernels.add_trails(image_in, image, column_index);
+
+            for (int row_index = 0; row_index < n_rows; row_index++)
+                n_electrons_column += fabs(image_in[row_index][column_index]);
+            double column_error =
+                (trail_kernels.nonlinearity + trail_kernels.trail_fraction) *
+                n_electrons_column;
+            max_error = std::max(max_error, column_error);
+            if (column_error_bounds != nullptr)
+                (*column_error_bounds)[column_index] = column_error;
+        }
+    }
+    if (error_bound != nullptr) *error_bound = max_error;
+
+    // Exact columns, gathered into one image
+    int n_exact_columns = exact_columns.size();
+    if (n_exact_columns > 0) {
+        std::valarray<std::valarray<double>> image_exact(
+            std::valarray<double>(0.0, n_exact_columns), n_rows);
+        for (int row_index = 0; row_index < n_rows; row_index++)
+            for (int i_column = 0; i_column < n_exact_columns; i_column++)
+                image_exact[row_index][i_column] =
+                    image_in[row_index][exact_columns[i_column]];
+
+        image_exact = clock_charge_in_one_direction(
+            image_exact, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co,
+            express, row_offset, 0, -1, 0, -1, 0, -1, prune_n_electrons,
+            prune_frequency, 0);
+
+        for (int row_index = 0; row_index < n_rows; row_index++)
+            for (int i_column = 0; i_column < n_exact_columns; i_column++)
+                image[row_index][exact_columns[i_column]] =
+                    image_exact[row_index][i_column];
+    }
+
+    return image;
+}
+
+/*
+    Add CTI trails to an image, as for add_cti(), but with the fast linearised
+    approximation for faint columns (and rows, for serial clocking). See
+    clock_charge_in_one_direction_linearised().
+
+    Parameters
+    ----------
+    As for add_cti(), except:
+
+    flux_threshold, n_kernels : (opt.)
+        See clock_charge_in_one_direction_linearised(), the same for both
+        directions.
+
+    error_bound : double* (opt.)
+        If provided, set to the sum of the parallel and serial error bounds.
+*/
+std::valarray<std::valarray<double>> add_cti_linearised(
+    std::valarray<std::valarray<double>>& image_in,
+    // Parallel
+    ROE* parallel_roe, CCD* parallel_ccd,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co,
+    int parallel_express, int parallel_offset,
+    // Serial
+    ROE* serial_roe, CCD* serial_ccd,
+    std::valarray<TrapInstantCapture>* serial_traps_ic,
+    std::valarray<TrapSlowCapture>* serial_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co, int serial_express,
+    int serial_offset,
+    // Linearisation
+    double flux_threshold, int n_kernels, double* error_bound) {
+
+    std::valarray<std::valarray<double>> image = image_in;
+    double parallel_error_bound = 0.0;
+    double serial_error_bound = 0.0;
+
+    // Parallel clocking along columns, transfer charge towards row 0
+    if (parallel_traps_ic || parallel_traps_sc || parallel_traps_ic_co ||
+        parallel_traps_sc_co) {
+        print_v(1, "Parallel: ");
+        image = clock_charge_in_one_direction_linearised(
+            image, parallel_roe, parallel_ccd, parallel_traps_ic, parallel_traps_sc,
+            parallel_traps_ic_co, parallel_traps_sc_co, parallel_express,
+            parallel_offset, flux_threshold, n_kernels, &parallel_error_bound);
+    }
+
+    // Serial clocking along rows, transfer charge towards column 0
+    if (serial_traps_ic || serial_traps_sc || serial_traps_ic_co ||
+        serial_traps_sc_co) {
+        print_v(1, "Serial: ");
+        image = transpose(image);
+        image = clock_charge_in_one_direction_linearised(
+            image, serial_roe, serial_ccd, serial_traps_ic, serial_traps_sc,
+            serial_traps_ic_co, serial_traps_sc_co, serial_express, serial_offset,
+            flux_threshold, n_kernels, &serial_error_bound);
+        image = transpose(image);
+    }
+
+    if (error_bound != nullptr)
+        *error_bound = parallel_error_bound + serial_error_bound;
+
+    return image;
+}
+
+/*
+    Remove CTI trails from an image, as for remove_cti(), but with the fast
+    linearised approximation for faint columns. See add_cti_linearised().
+
+    error_bound : double* (opt.)
+        If provided, set to the largest error bound of the forward modelling in
+        any iteration.
+*/
+std::valarray<std::valarray<double>> remove_cti_linearised(
+    std::valarray<std::valarray<double>>& image_in, int n_iterations,
+    // Parallel
+    ROE* parallel_roe, CCD* parallel_ccd,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co,
+    int parallel_express, int parallel_offset,
+    // Serial
+    ROE* serial_roe, CCD* serial_ccd,
+    std::valarray<TrapInstantCapture>* serial_traps_ic,
+    std::valarray<TrapSlowCapture>* serial_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co, int serial_express,
+    int serial_offset,
+    // Linearisation
+    double flux_threshold, int n_kernels, double* error_bound) {
+
+    std::valarray<std::valarray<double>> image_remove_cti = image_in;
+    std::valarray<std::valarray<double>> image_add_cti;
+    double iteration_error_bound;
+    double max_error_bound = 0.0;
+
+    int n_rows = image_in.size();
+
+    // Estimate the image with removed CTI more accurately each iteration
+    for (int iteration = 1; iteration <= n_iterations; iteration++) {
+        print_v(1, "Iter %d: ", iteration);
+
+        // Model the effect of adding CTI trails
+        image_add_cti = add_cti_linearised(
+            image_remove_cti, parallel_roe, parallel_ccd, parallel_traps_ic,
+            parallel_traps_sc, parallel_traps_ic_co, parallel_traps_sc_co,
+            parallel_express, parallel_offset, serial_roe, serial_ccd, serial_traps_ic,
+            serial_traps_sc, serial_traps_ic_co, serial_traps_sc_co, serial_express,
+            serial_offset, flux_threshold, n_kernels, &iteration_error_bound);
+        max_error_bound = std::max(max_error_bound, iteration_error_bound);
+
+        // Improve the estimate of the image with CTI trails removed
+        image_remove_cti += image_in - image_add_cti;
+
+        // Prevent negative image values
+        for (int row_index = 0; row_index < n_rows; row_index++) {
+            image_remove_cti[row_index][image_remove_cti[row_index] < 0.0] = 0.0;
+        }
+    }
+
+    if (error_bound != nullptr) *error_bound = max_error_bound;
+
+    return image_remove_cti;
+}
+
+/*
+    Remove the linearised trails from every column of an image, see
+    estimate_remove_cti_linearised(). Columns with traps that aren't emptied
+    between them are left unchanged.
+*/
+static std::valarray<std::valarray<double>> remove_trails_in_one_direction(
+    std::valarray<std::valarray<double>>& image_in, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int express, int row_offset,
+    double reference_n_electrons, int n_kernels) {
+
+    std::valarray<std::valarray<double>> image = image_in;
+    if (!roe->empty_traps_between_columns) return image;
+
+    int n_rows = image_in.size();
+    int n_columns = image_in[0].size();
+    TrailKernels trail_kernels(
+        n_rows, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, express,
+        row_offset, reference_n_electrons, n_kernels);
+
+    parallel_for(n_columns, [&](int column_index) {
+        trail_kernels.remove_trails(image_in, image, column_index);
+    });
+
+    return image;
+}
+
+/*
+    Quickly estimate an image with CTI trails removed, by removing the
+    linearised trails of each column (and row, for serial clocking), e.g. as
+    the starting estimate for remove_cti() instead of the input image, so that
+    fewer iterations of the full model are needed for the same accuracy.
+
+    The serial trails are removed first, then the parallel trails, reversing
+    add_cti(). Every pixel's trail is interpolated from TrailKernels measured
+    at charges up to reference_n_electrons, so the estimate is best for pixels
+    with no more than that much charge, and it ignores how the trails of
+    nearby pixels interact, see clock_charge_in_one_direction_linearised().
+    Directions whose traps aren't emptied between columns (or rows) are left
+    as they are.
+
+    Parameters
+    ----------
+    As for add_cti_linearised(), except:
+
+    reference_n_electrons : double (opt.)
+        The charge to measure the kernels with, e.g. the image's typical
+        source brightness.
+
+    n_kernels : int (opt.)
+        The number of source rows to measure the kernels at, see TrailKernels.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The estimated image without CTI trails, with no negative pixels.
+*/
+std::valarray<std::valarray<double>> estimate_remove_cti_linearised(
+    std::valarray<std::valarray<double>>& image_in,
+    // Parallel
+    ROE* parallel_roe, CCD* parallel_ccd,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co,
+    int parallel_express, int parallel_offset,
+    // Serial
+    ROE* serial_roe, CCD* serial_ccd,
+    std::valarray<TrapInstantCapture>* serial_traps_ic,
+    std::valarray<TrapSlowCapture>* serial_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co, int serial_express,
+    int serial_offset,
+    // Linearisation
+    double reference_n_electrons, int n_kernels) {
+
+    std::valarray<std::valarray<double>> image = image_in;
+    int n_rows = image_in.size();
+
+    // Serial trails along rows
+    if (serial_traps_ic || serial_traps_sc || serial_traps_ic_co ||
+        serial_traps_sc_co) {
+        image = transpose(image);
+        image = remove_trails_in_one_direction(
+            image, serial_roe, serial_ccd, serial_traps_ic, serial_traps_sc,
+            serial_traps_ic_co, serial_traps_sc_co, serial_express, serial_offset,
+            reference_n_electrons, n_kernels);
+        image = transpose(image);
+    }
+
+    // Parallel trails along columns
+    if (parallel_traps_ic || parallel_traps_sc || parallel_traps_ic_co ||
+        parallel_traps_sc_co)
+        image = remove_trails_in_one_direction(
+            image, parallel_roe, parallel_ccd, parallel_traps_ic, parallel_traps_sc,
+            parallel_traps_ic_co, parallel_traps_sc_co, parallel_express,
+            parallel_offset, reference_n_electrons, n_kernels);
+
+    // Prevent negative image values
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        image[row_index][image[row_index] < 0.0] = 0.0;
+
+    return image;
+}
@@ -2,16 +2,45 @@
 #include <getopt.h>
 #include <stdio.h>
 
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <valarray>
+#include <vector>
 
+#include "batch.hpp"
 #include "cti.hpp"
+#include "fits.hpp"
+#include "model.hpp"
+#include "resources.hpp"
 #include "roe.hpp"
+#include "server.hpp"
+#include "trace.hpp"
+#include "tune.hpp"
 #include "trap_managers.hpp"
 #include "traps.hpp"
 #include "util.hpp"
 
 static bool demo_mode = false;
 static bool benchmark_mode = false;
+static bool serve_mode = false;
+static const char* socket_path = "/tmp/arctic.sock";
+static int cache_size = 8;
+static bool batch_mode = false;
+static std::vector<std::string> batch_filenames;
+static const char* model_path = nullptr;
+static bool batch_add = false;
+static int n_iterations = -1;
+static int queue_depth = 2;
+static double memory_budget_mb = 1024;
+static bool tune_mode = false;
+static const char* tune_image_path = nullptr;
+static double target_error = 0.01;
+static const char* output_path = nullptr;
+static bool estimate_mode = false;
+static std::vector<int> estimate_shape;
+static const char* trace_path = nullptr;
+static int trace_detail = 2;
 
 /*
     Run arctic with --demo or -d to execute this editable demo code.
@@ -134,6 +163,86 @@ int run_benchmark() {
     return 0;
 }
 
+/*
+    Load the --model=<path> file, returning its text.
+*/
+std::string load_model_file(CTIModel& model) {
+    if (model_path == nullptr) error("This mode requires --model=<path>");
+
+    std::ifstream file(model_path);
+    if (!file) error("Failed to open model file '%s'", model_path);
+    std::stringstream text;
+    text << file.rdbuf();
+
+    std::string message;
+    if (load_model_from_text(text.str(), model, message) != 0)
+        error("Invalid model file '%s': %s", model_path, message.c_str());
+
+    return text.str();
+}
+
+/*
+    Run arctic with batch --model=<path> <files...> to add or remove CTI from a
+    batch of image files, see run_batch().
+*/
+int run_batch_files() {
+    CTIModel model;
+    load_model_file(model);
+
+    return run_batch(
+        batch_filenames, model, batch_add, n_iterations, queue_depth,
+        memory_budget_mb);
+}
+
+/*
+    Run arctic with tune --model=<path> <image> to find the fastest express and
+    pruning settings for a target error, see autotune(). The tuned settings are
+    printed, or saved with the original model to --output=<path>.
+*/
+int run_tune() {
+    if (tune_image_path == nullptr) error("Tune mode requires an image file");
+
+    CTIModel model;
+    std::string model_text = load_model_file(model);
+    std::valarray<std::valarray<double>> image = load_image_from_file(tune_image_path);
+
+    TuneResult result = autotune(image, model, target_error);
+    std::string tuned_text = result.to_text();
+
+    if (output_path == nullptr) {
+        printf("%s", tuned_text.c_str());
+        return 0;
+    }
+
+    std::ofstream file(output_path);
+    if (!file) error("Failed to open output file '%s'", output_path);
+    file << model_text;
+    if ((model_text.size() > 0) && (model_text.back() != '\n')) file << "\n";
+    file << tuned_text;
+    print_v(1, "Saved %s \n", output_path);
+
+    return 0;
+}
+
+/*
+    Run arctic with estimate --model=<path> <n_rows> <n_columns> to predict the
+    peak memory and runtime for an image shape, see estimate_resources().
+*/
+int run_estimate() {
+    if (estimate_shape.size() != 2)
+        error("Estimate mode requires the image shape: <n_rows> <n_columns>");
+
+    CTIModel model;
+    load_model_file(model);
+
+    ResourceEstimate estimate = estimate_resources(
+        estimate_shape[0], estimate_shape[1], model,
+        (n_iterations == -1) ? 0 : n_iterations);
+    printf("%s", estimate.to_text().c_str());
+
+    return 0;
+}
+
 /*
     Print help information.
 */
@@ -160,6 +269,85 @@ void print_help() {
         "    wrappers. The demo version adds then removes CTI from a test image. \n"
         "-b, --benchmark \n"
         "    Execute the run_benchmark() function in main.cpp, e.g. for profiling. \n"
+        "-t <int>, --threads=<int> \n"
+        "    The number of threads to use, default 0 for all available. \n"
+        "-n <int>, --numa=<int> \n"
+        "    The NUMA mode for sharing columns between threads: 0 off (default), \n"
+        "    -1 to pin threads and place memory on the system's NUMA nodes, or n \n"
+        "    to split the CPUs into n pseudo-nodes, e.g. for testing. \n"
+        "-p <float>, --speculative=<float> \n"
+        "    If positive, clock columns whose traps aren't emptied between them \n"
+        "    in parallel chunks from predicted trap states, re-clocking chunks \n"
+        "    whose predicted states differ by more than this many electrons. \n"
+        "-r <float>, --row-segments=<float> \n"
+        "    If positive, clock images with fewer columns than threads in parallel \n"
+        "    segments of rows, re-clocking segments whose predicted starting trap \n"
+        "    states differ by more than this many electrons. \n"
+        "--collapse=<float> \n"
+        "    If positive, empty the traps once they hold fewer than this many \n"
+        "    times prune_n_electrons in total, e.g. in the sky after a bright \n"
+        "    source. \n"
+        "--table-tolerance=<float> \n"
+        "    If positive, place the continuum traps' interpolation table values \n"
+        "    adaptively until the fill fractions are interpolated to within this \n"
+        "    error, instead of at 1000 log-uniform times. \n"
+        "-T <path>, --trace=<path> \n"
+        "    Record a timeline of the run's stages and columns on each thread and \n"
+        "    save it to this JSON file, to view in chrome://tracing or \n"
+        "    ui.perfetto.dev. \n"
+        "--trace-level=<int> \n"
+        "    The trace's level of detail: 1 for setup, iterations, and strips of \n"
+        "    columns, 2 also for each column and express pass (default), or 3 \n"
+        "    also for watermark pruning and trap-state store/restore. \n"
+        "\n"
+        "serve \n"
+        "    Run as a server that accepts add/remove CTI jobs over a Unix socket, \n"
+        "    keeping the prepared models in a cache. See run_server() in \n"
+        "    server.cpp for the requests. \n"
+        "    --socket=<path> \n"
+        "        The socket file, default /tmp/arctic.sock. \n"
+        "    --cache=<int> \n"
+        "        The number of prepared models to keep, default 8. \n"
+        "\n"
+        "batch --model=<path> <files...> \n"
+        "    Remove (or add) CTI from each image txt or FITS file, saving the \n"
+        "    results to <name>_cti_removed.<ext> (or _cti_added), with the loading \n"
+        "    and saving overlapped with the clocking. FITS images may be Rice or \n"
+        "    GZIP tile-compressed, e.g. .fits.fz files. The model file format is \n"
+        "    described by load_model_from_text() in model.cpp. See run_batch() in \n"
+        "    batch.cpp. \n"
+        "    --add \n"
+        "        Add CTI instead of removing it. \n"
+        "    --iterations=<int> \n"
+        "        The number of iterations for removing CTI, default from the model. \n"
+        "    --queue=<int> \n"
+        "        The maximum images waiting between each stage, default 2. \n"
+        "    --memory=<MB> \n"
+        "        The maximum memory for images in flight, default 1024. \n"
+        "    --compress=<none|rice|gzip> \n"
+        "        The tile compression for saving FITS images, default rice for \n"
+        "        .fz files and none otherwise. Rice is lossy (see --quantize) and \n"
+        "        gzip is lossless. \n"
+        "    --quantize=<float> \n"
+        "        The quantisation step for Rice compression, default 0.01, so \n"
+        "        each value is saved to within half this step. \n"
+        "\n"
+        "tune --model=<path> <file> \n"
+        "    Find the fastest express and pruning settings that meet a target \n"
+        "    error for a representative image txt or FITS file. See autotune() in \n"
+        "    tune.cpp. \n"
+        "    --error=<float> \n"
+        "        The target maximum error in any pixel (electrons), default 0.01. \n"
+        "    --output=<path> \n"
+        "        Save the model with the tuned settings to this file, instead of \n"
+        "        printing only the tuned settings. \n"
+        "\n"
+        "estimate --model=<path> <n_rows> <n_columns> \n"
+        "    Predict the peak memory (bytes, by component) and the runtime (s) \n"
+        "    for adding CTI to an image of this shape, printed as name = value \n"
+        "    lines. See estimate_resources() in resources.cpp. \n"
+        "    --iterations=<int> \n"
+        "        Estimate for removing CTI with this many iterations instead. \n"
         "\n"
         "See README.md for more information.  https://github.com/jkeger/arctic \n\n");
 }
@@ -169,13 +357,32 @@ void print_help() {
 */
 void parse_parameters(int argc, char** argv) {
     // Short options
-    const char* const short_opts = ":hv:db";
+    const char* const short_opts = ":hv:dbt:n:p:r:T:";
     // Full options
     const option long_opts[] = {
         {"help", no_argument, nullptr, 'h'},
         {"verbosity", required_argument, nullptr, 'v'},
         {"demo", no_argument, nullptr, 'd'},
         {"benchmark", no_argument, nullptr, 'b'},
+        {"threads", required_argument, nullptr, 't'},
+        {"numa", required_argument, nullptr, 'n'},
+        {"speculative", required_argument, nullptr, 'p'},
+        {"row-segments", required_argument, nullptr, 'r'},
+        {"collapse", required_argument, nullptr, 'C'},
+        {"table-tolerance", required_argument, nullptr, 'K'},
+        {"trace", required_argument, nullptr, 'T'},
+        {"trace-level", required_argument, nullptr, 'L'},
+        {"socket", required_argument, nullptr, 's'},
+        {"cache", required_argument, nullptr, 'c'},
+        {"model", required_argument, nullptr, 'm'},
+        {"add", no_argument, nullptr, 'a'},
+        {"iterations", required_argument, nullptr, 'i'},
+        {"queue", required_argument, nullptr, 'q'},
+        {"memory", required_argument, nullptr, 'M'},
+        {"compress", required_argument, nullptr, 'Z'},
+        {"quantize", required_argument, nullptr, 'Q'},
+        {"error", required_argument, nullptr, 'e'},
+        {"output", required_argument, nullptr, 'o'},
         {0, 0, 0, 0}};
 
     // Parse options
@@ -197,6 +404,75 @@ void parse_parameters(int argc, char** argv) {
             case 'b':
                 benchmark_mode = true;
                 break;
+            case 't':
+                set_n_threads(atoi(optarg));
+                break;
+            case 'n':
+                set_numa_mode(atoi(optarg));
+                break;
+            case 'p':
+                set_speculative_columns(atof(optarg));
+                break;
+            case 'r':
+                set_row_segments(atof(optarg));
+                break;
+            case 'C':
+                set_collapse_trap_states(atof(optarg));
+                break;
+            case 'K':
+                set_continuum_table_tolerance(atof(optarg));
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            case 'L':
+                trace_detail = atoi(optarg);
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'c':
+                cache_size = atoi(optarg);
+                break;
+            case 'm':
+                model_path = optarg;
+                break;
+            case 'a':
+                batch_add = true;
+                break;
+            case 'i':
+                n_iterations = atoi(optarg);
+                break;
+            case 'q':
+                queue_depth = atoi(optarg);
+                break;
+            case 'M':
+                memory_budget_mb = atof(optarg);
+                break;
+            case 'Z':
+                if (strcmp(optarg, "none") == 0)
+                    set_fits_compression(fits_none);
+                else if (strcmp(optarg, "rice") == 0)
+                    set_fits_compression(fits_rice);
+                else if (strcmp(optarg, "gzip") == 0)
+                    set_fits_compression(fits_gzip);
+                else {
+                    printf(
+                        "Error: Unknown compression %s, expected none, rice, or gzip. "
+                        "\n",
+                        optarg);
+                    exit(1);
+                }
+                break;
+            case 'Q':
+                set_fits_quantize_step(atof(optarg));
+                break;
+            case 'e':
+                target_error = atof(optarg);
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
             case ':':
                 printf(
                     "Error: Option %s requires a value. Run with -h for help. \n",
@@ -210,9 +486,24 @@ void parse_parameters(int argc, char** argv) {
         }
     }
 
-    // Other parameters (currently unused)
+    // Commands
     for (; optind < argc; optind++) {
-        printf("Unparsed parameter: %s \n", argv[optind]);
+        if (strcmp(argv[optind], "serve") == 0)
+            serve_mode = true;
+        else if (strcmp(argv[optind], "batch") == 0)
+            batch_mode = true;
+        else if (strcmp(argv[optind], "tune") == 0)
+            tune_mode = true;
+        else if (strcmp(argv[optind], "estimate") == 0)
+            estimate_mode = true;
+        else if (batch_mode)
+            batch_filenames.push_back(argv[optind]);
+        else if (tune_mode && (tune_image_path == nullptr))
+            tune_image_path = argv[optind];
+        else if (estimate_mode)
+            estimate_shape.push_back(atoi(argv[optind]));
+        else
+            printf("Unparsed parameter: %s \n", argv[optind]);
     }
 }
 
@@ -237,19 +528,83 @@ void parse_parameters(int argc, char** argv) {
 
     -b, --benchmark
         Execute the run_benchmark() function above, e.g. for profiling.
+
+    -t <int>, --threads=<int>
+        The number of threads to use, see set_n_threads().
+
+    -n <int>, --numa=<int>
+        The NUMA mode for multi-threaded clocking, see set_numa_mode().
+
+    -p <float>, --speculative=<float>
+        The default tolerance for speculatively clocking columns that share
+        their traps' states, see set_speculative_columns().
+
+    -r <float>, --row-segments=<float>
+        The default tolerance for clocking the rows of tall columns in parallel
+        segments, see set_row_segments().
+
+    --collapse=<float>
+        The default multiple of prune_n_electrons below which to empty the
+        traps, see set_collapse_trap_states().
+
+    --table-tolerance=<float>
+        The default tolerance for adaptively placing the values of the continuum
+        traps' interpolation tables, see set_continuum_table_tolerance().
+
+    -T <path>, --trace=<path>
+        Record a timeline of spans for the run's stages and columns and save it
+        in the Chrome trace-event format, see start_trace() and save_trace().
+
+    --trace-level=<int>
+        The trace's level of detail, default 2, see trace_level.
+
+    serve [--socket=<path>] [--cache=<int>]
+        Run as a server for add/remove CTI jobs, see run_server().
+
+    batch --model=<path> [--add] [--iterations=<int>] [--queue=<int>]
+          [--memory=<MB>] [--compress=<none|rice|gzip>] [--quantize=<float>]
+          <files...>
+        Add or remove CTI from a batch of image files, see run_batch(). The
+        FITS output compression is set by set_fits_compression() and
+        set_fits_quantize_step().
+
+    tune --model=<path> [--error=<float>] [--output=<path>] <file>
+        Tune the express and pruning settings for an image, see autotune().
+
+    estimate --model=<path> [--iterations=<int>] <n_rows> <n_columns>
+        Predict the memory and runtime for an image shape, see
+        estimate_resources().
 */
 int main(int argc, char** argv) {
 
     parse_parameters(argc, argv);
 
+    if (trace_path != nullptr) start_trace(trace_detail);
+
+    int status = 0;
     if (demo_mode) {
         print_v(1, "# Running demo code! \n");
-        return run_demo();
-    }
-    if (benchmark_mode) {
+        status = run_demo();
+    } else if (benchmark_mode) {
         print_v(1, "# Running benchmark code \n");
-        return run_benchmark();
+        status = run_benchmark();
+    } else if (serve_mode) {
+        status = run_server(socket_path, cache_size);
+    } else if (batch_mode) {
+        status = run_batch_files();
+    } else if (tune_mode) {
+        status = run_tune();
+    } else if (estimate_mode) {
+        status = run_estimate();
     }
 
-    return 0;
+    if (trace_path != nullptr) {
+        stop_trace();
+        if (save_trace(trace_path) != 0) {
+            printf("Error: Failed to save the trace to %s \n", trace_path);
+            if (status == 0) status = 1;
+        }
+    }
+
+    return status;
 }
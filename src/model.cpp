@@ -0,0 +1,827 @@
+
+#include "model.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <valarray>
+#include <vector>
+
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "express.hpp"
+#include "linear.hpp"
+#include "roe.hpp"
+#include "trace.hpp"
+#include "trap_managers.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+// ========
+// ClockingModel::
+// ========
+/*
+    Class ClockingModel.
+
+    The complete set of model parameters for clocking in one direction, i.e.
+    the inputs for the parallel_* or serial_* arguments of add_cti(), with the
+    trap managers prepared once for a given image shape so that repeated calls
+    skip their setup (e.g. the continuum tables).
+
+    A fresh ROE and CCD are made from the parameters for each call, so the
+    same prepared model can be used by multiple threads at once. Each call
+    takes a ClockingWorkspace from the model's pool (shared with any copies of
+    the model), so repeated calls reuse the working trap managers' memory.
+
+    Parameters
+    ----------
+    See ROE, ROEChargeInjection, CCDPhase, CCD, the trap classes, and
+    add_cti(). Set from text by load_model_from_text().
+
+    charge_injection : bool
+        Whether to use an ROEChargeInjection instead of a standard ROE.
+
+    full_well_depth, well_notch_depth, well_fill_power : double
+        The parameters for every CCDPhase, one for each dwell time.
+
+    fraction_of_traps_per_phase : std::valarray<double>
+        As for CCD, or empty (default) to divide the traps equally.
+
+    express_tolerance : double
+        If positive, choose the express for each column adaptively up to a
+        maximum of express, see clock_charge_in_one_direction_adaptive_express().
+        Default 0 to use express for every column.
+
+    express_extrapolate : bool
+        If true, extrapolate from express and 2 * express for most of the
+        accuracy of the full express, see
+        clock_charge_in_one_direction_extrapolated_express(). Default false.
+
+    density_scales : std::valarray<double>
+        The relative trap densities in equal blocks of columns across the
+        image, for non-uniform radiation damage, see density_scales_from_map().
+        Default empty for uniform densities.
+
+    settings : ClockingSettings
+        The optional speedups, starting from the global defaults (e.g. from the
+        command-line options), set from text by their names, e.g.
+        collapse_factor, see ClockingSettings.
+*/
+ClockingModel::ClockingModel()
+    : dwell_times({1.0}),
+      charge_injection(false),
+      prescan_offset(0),
+      overscan_start(-1),
+      empty_traps_between_columns(true),
+      empty_traps_for_first_transfers(false),
+      force_release_away_from_readout(true),
+      use_integer_express_matrix(false),
+      full_well_depth(1e4),
+      well_notch_depth(0.0),
+      well_fill_power(1.0),
+      express(0),
+      express_tolerance(0.0),
+      express_extrapolate(false),
+      window_offset(0),
+      prune_n_electrons(1e-10),
+      prune_frequency(20),
+      n_rows_prepared(-1),
+      n_columns_prepared(-1),
+      workspace_pool(new ClockingWorkspacePool()) {}
+
+/*
+    Whether there are any traps, otherwise no clocking is needed.
+*/
+bool ClockingModel::has_traps() {
+    return (traps_ic.size() + traps_sc.size() + traps_ic_co.size() +
+            traps_sc_co.size()) > 0;
+}
+
+/*
+    Make the CCD, with the same phase parameters for each dwell time.
+*/
+CCD ClockingModel::make_ccd() {
+    int n_phases = dwell_times.size();
+    std::valarray<CCDPhase> phases(
+        CCDPhase(full_well_depth, well_notch_depth, well_fill_power), n_phases);
+    std::valarray<double> fractions = fraction_of_traps_per_phase;
+    if (fractions.size() == 0)
+        fractions = std::valarray<double>(1.0 / n_phases, n_phases);
+
+    return CCD(phases, fractions);
+}
+
+/*
+    Append an item to a valarray of a type with no default constructor.
+*/
+template <class T>
+static void append(std::valarray<T>& array, T item) {
+    std::vector<T> items(std::begin(array), std::end(array));
+    items.push_back(item);
+    std::valarray<T> array_new(items.data(), items.size());
+    array.swap(array_new);
+}
+
+/*
+    Parse a list of numbers separated by commas and/or spaces.
+*/
+static std::valarray<double> parse_values(std::string& value) {
+    std::vector<double> values;
+    double number;
+
+    for (int i = 0; i < value.size(); i++) {
+        if (value[i] == ',') value[i] = ' ';
+    }
+    std::istringstream stream(value);
+    while (stream >> number) values.push_back(number);
+    if (!stream.eof()) values.clear();
+
+    return std::valarray<double>(values.data(), values.size());
+}
+
+/*
+    Set one parameter from its name (without the parallel_ or serial_ prefix)
+    and value(s) as text.
+
+    Each trap_* parameter adds one trap, with the values for the trap's
+    constructor, e.g. "trap_ic = 10.0, 0.8" for a TrapInstantCapture with a
+    density of 10 and a release timescale of 0.8.
+
+    Returns
+    -------
+    status : int
+        0 for success, or 1 with the reason set in message.
+*/
+int ClockingModel::set_parameter(
+    std::string& key, std::string& value, std::string& message) {
+
+    std::valarray<double> values = parse_values(value);
+    int n_values = values.size();
+
+    if (n_values == 0) {
+        message = "Invalid value for " + key;
+        return 1;
+    }
+
+    // Lists
+    if (key == "dwell_times")
+        dwell_times = values;
+    else if (key == "fraction_of_traps_per_phase")
+        fraction_of_traps_per_phase = values;
+    else if (key == "density_scales")
+        density_scales = values;
+    else if (key == "trap_ic") {
+        if (n_values == 2)
+            append(traps_ic, TrapInstantCapture(values[0], values[1]));
+        else if (n_values == 4)
+            append(
+                traps_ic,
+                TrapInstantCapture(values[0], values[1], values[2], values[3]));
+        else {
+            message = "trap_ic requires 2 or 4 values";
+            return 1;
+        }
+    } else if (key == "trap_sc") {
+        if (n_values != 3) {
+            message = "trap_sc requires 3 values";
+            return 1;
+        }
+        append(traps_sc, TrapSlowCapture(values[0], values[1], values[2]));
+    } else if (key == "trap_ic_co") {
+        if (n_values != 3) {
+            message = "trap_ic_co requires 3 values";
+            return 1;
+        }
+        append(
+            traps_ic_co, TrapInstantCaptureContinuum(values[0], values[1], values[2]));
+    } else if (key == "trap_sc_co") {
+        if (n_values != 4) {
+            message = "trap_sc_co requires 4 values";
+            return 1;
+        }
+        append(
+            traps_sc_co,
+            TrapSlowCaptureContinuum(values[0], values[1], values[2], values[3]));
+    }
+    // Single values
+    else if (n_values != 1) {
+        message = key + " requires a single value";
+        return 1;
+    } else if (key == "charge_injection")
+        charge_injection = values[0];
+    else if (key == "prescan_offset")
+        prescan_offset = values[0];
+    else if (key == "overscan_start")
+        overscan_start = values[0];
+    else if (key == "empty_traps_between_columns")
+        empty_traps_between_columns = values[0];
+    else if (key == "empty_traps_for_first_transfers")
+        empty_traps_for_first_transfers = values[0];
+    else if (key == "force_release_away_from_readout")
+        force_release_away_from_readout = values[0];
+    else if (key == "use_integer_express_matrix")
+        use_integer_express_matrix = values[0];
+    else if (key == "full_well_depth")
+        full_well_depth = values[0];
+    else if (key == "well_notch_depth")
+        well_notch_depth = values[0];
+    else if (key == "well_fill_power")
+        well_fill_power = values[0];
+    else if (key == "express")
+        express = values[0];
+    else if (key == "express_tolerance")
+        express_tolerance = values[0];
+    else if (key == "express_extrapolate")
+        express_extrapolate = values[0];
+    else if (key == "window_offset")
+        window_offset = values[0];
+    else if (key == "prune_n_electrons")
+        prune_n_electrons = values[0];
+    else if (key == "prune_frequency")
+        prune_frequency = values[0];
+    else if (key == "collapse_factor")
+        settings.collapse_factor = values[0];
+    else if (key == "speculative_tolerance")
+        settings.speculative_tolerance = values[0];
+    else if (key == "speculative_n_warmup_columns")
+        settings.speculative_n_warmup_columns = values[0];
+    else if (key == "row_segment_tolerance")
+        settings.row_segment_tolerance = values[0];
+    else if (key == "row_segment_n_warmup_rows")
+        settings.row_segment_n_warmup_rows = values[0];
+    else if (key == "continuum_table_tolerance")
+        settings.continuum_table_tolerance = values[0];
+    else {
+        message = "Unknown parameter " + key;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+    Check the parameters are consistent, before anything that would exit with
+    an error() instead.
+
+    Returns
+    -------
+    status : int
+        0 for success, or 1 with the reason set in message.
+*/
+int ClockingModel::check(std::string& message) {
+    if (dwell_times.size() == 0) {
+        message = "No dwell_times";
+        return 1;
+    }
+    if ((fraction_of_traps_per_phase.size() != 0) &&
+        (fraction_of_traps_per_phase.size() != dwell_times.size())) {
+        message = "Sizes of dwell_times and fraction_of_traps_per_phase don't match";
+        return 1;
+    }
+    if (full_well_depth <= well_notch_depth) {
+        message = "full_well_depth must be greater than well_notch_depth";
+        return 1;
+    }
+    if ((express < 0) || (window_offset < 0) || (prune_frequency < 0)) {
+        message = "express, window_offset, and prune_frequency can't be negative";
+        return 1;
+    }
+    if (express_tolerance < 0.0) {
+        message = "express_tolerance can't be negative";
+        return 1;
+    }
+    if (settings.collapse_factor < 0.0) {
+        message = "collapse_factor can't be negative";
+        return 1;
+    }
+    if ((settings.speculative_tolerance < 0.0) ||
+        (settings.speculative_n_warmup_columns < 0)) {
+        message = "speculative_tolerance and speculative_n_warmup_columns can't be "
+                  "negative";
+        return 1;
+    }
+    if ((settings.row_segment_tolerance < 0.0) ||
+        (settings.row_segment_n_warmup_rows < 0)) {
+        message = "row_segment_tolerance and row_segment_n_warmup_rows can't be "
+                  "negative";
+        return 1;
+    }
+    if (settings.continuum_table_tolerance < 0.0) {
+        message = "continuum_table_tolerance can't be negative";
+        return 1;
+    }
+    if ((express_tolerance > 0.0) && !empty_traps_between_columns) {
+        message = "express_tolerance requires empty_traps_between_columns";
+        return 1;
+    }
+    if ((express_tolerance > 0.0) && express_extrapolate) {
+        message = "express_tolerance can't be used with express_extrapolate";
+        return 1;
+    }
+    if ((density_scales.size() != 0) && (density_scales.min() <= 0.0)) {
+        message = "density_scales must be positive";
+        return 1;
+    }
+    if ((density_scales.size() != 0) && (express_tolerance > 0.0)) {
+        message = "density_scales can't be used with express_tolerance";
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+    Set up the trap managers for images of this shape, if not already done.
+
+    Parameters
+    ----------
+    n_rows, n_columns : int
+        The image shape, with rows along the direction of clocking.
+*/
+void ClockingModel::prepare(int n_rows, int n_columns) {
+    if ((n_rows == n_rows_prepared) && (n_columns == n_columns_prepared)) return;
+    TraceSpan span("prepare_model", 1);
+
+    // As for clock_charge_in_one_direction()
+    int max_n_transfers = n_rows + window_offset;
+    if (!empty_traps_between_columns) max_n_transfers *= n_columns;
+
+    trap_manager_manager = TrapManagerManager(
+        traps_ic, traps_sc, traps_ic_co, traps_sc_co, max_n_transfers, make_ccd(),
+        dwell_times, settings.continuum_table_tolerance);
+    n_rows_prepared = n_rows;
+    n_columns_prepared = n_columns;
+}
+
+/*
+    Clock the image in this direction, as for clock_charge_in_one_direction(),
+    using the prepared trap managers if the image has the prepared shape.
+
+    checkpoints : ClockingCheckpoints* (opt.)
+        The trap-state checkpoints to save, or to re-clock from, see
+        ClockingCheckpoints. Not used (and cleared) with adaptive or
+        extrapolated express.
+
+    error_estimate : double* (opt.)
+        If provided, set to the estimated error of the extrapolated express,
+        see clock_charge_in_one_direction_extrapolated_express(), or to 0
+        without express_extrapolate.
+*/
+std::valarray<std::valarray<double>> ClockingModel::clock_charge(
+    std::valarray<std::valarray<double>>& image, ClockingCheckpoints* checkpoints,
+    double* error_estimate) {
+
+    std::valarray<double> roe_dwell_times = dwell_times;
+    ROE roe_standard(
+        roe_dwell_times, prescan_offset, overscan_start, empty_traps_between_columns,
+        empty_traps_for_first_transfers, force_release_away_from_readout,
+        use_integer_express_matrix);
+    ROEChargeInjection roe_charge_injection(
+        roe_dwell_times, prescan_offset, overscan_start, empty_traps_between_columns,
+        force_release_away_from_readout, use_integer_express_matrix);
+    ROE* roe = charge_injection ? &roe_charge_injection : &roe_standard;
+    CCD ccd = make_ccd();
+
+    bool prepared = (image.size() == n_rows_prepared) &&
+                    (image[0].size() == n_columns_prepared);
+
+    // The trap density scale for each column, if not uniform
+    std::valarray<double> column_density_scales;
+    if (density_scales.size() != 0) {
+        std::valarray<std::valarray<double>> density_map = {density_scales};
+        column_density_scales = density_scales_from_map(density_map, image[0].size());
+    }
+    std::valarray<double>* scales =
+        (density_scales.size() != 0) ? &column_density_scales : nullptr;
+
+    bool is_varied_express = (express_tolerance > 0.0) || express_extrapolate;
+    if (is_varied_express && (checkpoints != nullptr)) checkpoints->clear();
+    if (error_estimate != nullptr) *error_estimate = 0.0;
+    if (express_tolerance > 0.0)
+        return clock_charge_in_one_direction_adaptive_express(
+            image, roe, &ccd, &traps_ic, &traps_sc, &traps_ic_co, &traps_sc_co,
+            express_tolerance, express, window_offset, prune_n_electrons,
+            prune_frequency, nullptr, prepared ? &trap_manager_manager : nullptr,
+            &settings);
+
+    if (express_extrapolate && !prepared)
+        return clock_charge_in_one_direction_extrapolated_express(
+            image, roe, &ccd, &traps_ic, &traps_sc, &traps_ic_co, &traps_sc_co, express,
+            window_offset, prune_n_electrons, prune_frequency, error_estimate,
+            nullptr, nullptr, scales, &settings);
+
+    if (!prepared)
+        return clock_charge_in_one_direction(
+            image, roe, &ccd, &traps_ic, &traps_sc, &traps_ic_co, &traps_sc_co,
+            express, window_offset, 0, -1, 0, -1, 0, -1, prune_n_electrons,
+            prune_frequency, 0, nullptr, nullptr, checkpoints, scales, nullptr,
+            &settings);
+
+    std::unique_ptr<ClockingWorkspace> workspace = workspace_pool->acquire();
+    std::valarray<std::valarray<double>> image_out;
+    if (express_extrapolate)
+        image_out = clock_charge_in_one_direction_extrapolated_express(
+            image, roe, &ccd, &traps_ic, &traps_sc, &traps_ic_co, &traps_sc_co, express,
+            window_offset, prune_n_electrons, prune_frequency, error_estimate,
+            &trap_manager_manager, workspace.get(), scales, &settings);
+    else
+        image_out = clock_charge_in_one_direction(
+            image, roe, &ccd, &traps_ic, &traps_sc, &traps_ic_co, &traps_sc_co, express,
+            window_offset, 0, -1, 0, -1, 0, -1, prune_n_electrons, prune_frequency, 0,
+            &trap_manager_manager, workspace.get(), checkpoints, scales, nullptr,
+            &settings);
+    workspace_pool->release(std::move(workspace));
+
+    return image_out;
+}
+
+/*
+    Quickly estimate the image before it was clocked in this direction, by
+    removing the linearised trails, see estimate_remove_cti_linearised().
+*/
+std::valarray<std::valarray<double>> ClockingModel::estimate_unclocked(
+    std::valarray<std::valarray<double>>& image, double reference_n_electrons,
+    int n_kernels) {
+
+    std::valarray<double> roe_dwell_times = dwell_times;
+    ROE roe_standard(
+        roe_dwell_times, prescan_offset, overscan_start, empty_traps_between_columns,
+        empty_traps_for_first_transfers, force_release_away_from_readout,
+        use_integer_express_matrix);
+    ROEChargeInjection roe_charge_injection(
+        roe_dwell_times, prescan_offset, overscan_start, empty_traps_between_columns,
+        force_release_away_from_readout, use_integer_express_matrix);
+    ROE* roe = charge_injection ? &roe_charge_injection : &roe_standard;
+    CCD ccd = make_ccd();
+
+    return estimate_remove_cti_linearised(
+        image, roe, &ccd, &traps_ic, &traps_sc, &traps_ic_co, &traps_sc_co, express,
+        window_offset, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0,
+        reference_n_electrons, n_kernels);
+}
+
+// ========
+// CTIModel::
+// ========
+/*
+    Class CTIModel.
+
+    A complete parallel and serial CTI model, e.g. loaded from a text file and
+    cached by the server to process many images. See ClockingModel.
+
+    Parameters
+    ----------
+    parallel, serial : ClockingModel
+        The parameters for each clocking direction. Either can have no traps to
+        skip that direction.
+
+    n_iterations : int
+        The default number of iterations for remove_cti().
+*/
+
+/*
+    Set up the trap managers for both directions for images of this shape.
+*/
+void CTIModel::prepare(int n_rows, int n_columns) {
+    if (parallel.has_traps()) parallel.prepare(n_rows, n_columns);
+    if (serial.has_traps()) serial.prepare(n_columns, n_rows);
+}
+
+/*
+    Add CTI trails to an image, as for add_cti().
+
+    parallel_checkpoints, serial_checkpoints : ClockingCheckpoints* (opt.)
+        The trap-state checkpoints for each direction, see ClockingModel::
+        clock_charge(). The serial checkpoints are for the transposed image.
+
+    error_estimate : double* (opt.)
+        If provided, set to the sum of the extrapolated express error estimates
+        of both directions, see ClockingModel::clock_charge().
+*/
+std::valarray<std::valarray<double>> CTIModel::add_cti(
+    std::valarray<std::valarray<double>>& image_in,
+    ClockingCheckpoints* parallel_checkpoints, ClockingCheckpoints* serial_checkpoints,
+    double* error_estimate) {
+
+    std::valarray<std::valarray<double>> image = image_in;
+    double parallel_error_estimate = 0.0;
+    double serial_error_estimate = 0.0;
+
+    // Parallel clocking along columns, transfer charge towards row 0
+    if (parallel.has_traps())
+        image = parallel.clock_charge(
+            image, parallel_checkpoints, &parallel_error_estimate);
+
+    // Serial clocking along rows, transfer charge towards column 0
+    if (serial.has_traps()) {
+        image = transpose(image);
+        image = serial.clock_charge(image, serial_checkpoints, &serial_error_estimate);
+        image = transpose(image);
+    }
+
+    if (error_estimate != nullptr)
+        *error_estimate = parallel_error_estimate + serial_error_estimate;
+
+    return image;
+}
+
+/*
+    Remove CTI trails from an image, as for remove_cti().
+
+    n_iterations : int (opt.)
+        The number of iterations, or -1 (default) to use the model's value.
+
+    checkpoints : CTICheckpoints* (opt.)
+        If provided, keep the trap-state checkpoints of every iteration in each
+        direction, so that remove_cti_again() can correct a locally edited
+        version of the image more quickly.
+
+    image_estimate : std::valarray<std::valarray<double>>* (opt.)
+        The first estimate of the corrected image, instead of the input image,
+        e.g. from estimate_remove_cti(). Not with checkpoints, since
+        remove_cti_again() starts from the input image.
+
+    error_estimate : double* (opt.)
+        If provided, set to the extrapolated express error estimate of the last
+        iteration's added CTI, see add_cti().
+*/
+std::valarray<std::valarray<double>> CTIModel::remove_cti(
+    std::valarray<std::valarray<double>>& image_in, int n_iterations,
+    CTICheckpoints* checkpoints, std::valarray<std::valarray<double>>* image_estimate,
+    double* error_estimate) {
+
+    if (n_iterations == -1) n_iterations = this->n_iterations;
+    if (error_estimate != nullptr) *error_estimate = 0.0;
+    if ((image_estimate != nullptr) && (checkpoints != nullptr))
+        error("Can't keep checkpoints when starting from an estimated image");
+    if ((image_estimate != nullptr) &&
+        ((image_estimate->size() != image_in.size()) ||
+         ((*image_estimate)[0].size() != image_in[0].size())))
+        error("Estimated image shape doesn't match the input");
+
+    if (checkpoints != nullptr) {
+        checkpoints->parallel.resize(n_iterations);
+        checkpoints->serial.resize(n_iterations);
+        for (int iteration = 0; iteration < n_iterations; iteration++) {
+            checkpoints->parallel[iteration].interval = checkpoints->interval;
+            checkpoints->serial[iteration].interval = checkpoints->interval;
+        }
+    }
+
+    std::valarray<std::valarray<double>> image_remove_cti =
+        (image_estimate == nullptr) ? image_in : *image_estimate;
+    std::valarray<std::valarray<double>> image_add_cti;
+
+    int n_rows = image_in.size();
+
+    // Estimate the image with removed CTI more accurately each iteration
+    for (int iteration = 1; iteration <= n_iterations; iteration++) {
+        print_v(1, "Iter %d: ", iteration);
+        TraceSpan span("remove_cti_iteration", 1, iteration);
+
+        // Model the effect of adding CTI trails
+        if (checkpoints == nullptr)
+            image_add_cti = add_cti(image_remove_cti, nullptr, nullptr, error_estimate);
+        else
+            image_add_cti = add_cti(
+                image_remove_cti, &checkpoints->parallel[iteration - 1],
+                &checkpoints->serial[iteration - 1], error_estimate);
+
+        // Improve the estimate of the image with CTI trails removed
+        image_remove_cti += image_in - image_add_cti;
+
+        // Prevent negative image values
+        for (int row_index = 0; row_index < n_rows; row_index++) {
+            image_remove_cti[row_index][image_remove_cti[row_index] < 0.0] = 0.0;
+        }
+    }
+
+    return image_remove_cti;
+}
+
+/*
+    Quickly estimate an image with CTI trails removed, as the starting estimate
+    for remove_cti() so that fewer iterations are needed, by removing the
+    linearised serial then parallel trails, see
+    estimate_remove_cti_linearised().
+*/
+std::valarray<std::valarray<double>> CTIModel::estimate_remove_cti(
+    std::valarray<std::valarray<double>>& image_in, double reference_n_electrons,
+    int n_kernels) {
+
+    std::valarray<std::valarray<double>> image = image_in;
+
+    // Serial trails along rows
+    if (serial.has_traps()) {
+        image = transpose(image);
+        image = serial.estimate_unclocked(image, reference_n_electrons, n_kernels);
+        image = transpose(image);
+    }
+
+    // Parallel trails along columns
+    if (parallel.has_traps())
+        image = parallel.estimate_unclocked(image, reference_n_electrons, n_kernels);
+
+    return image;
+}
+
+/*
+    Class CTICheckpoints.
+
+    The ClockingCheckpoints of each iteration of CTIModel::remove_cti(), for
+    the parallel clocking and the (transposed) serial clocking.
+
+    Parameters
+    ----------
+    interval : int (opt.)
+        The number of rows (or columns for serial clocking) between checkpoints.
+*/
+
+/*
+    Remove CTI trails from an image that differs from the one previously
+    corrected with the same checkpoints only in a few pixels, e.g. after masking
+    cosmic rays and bad pixels, re-clocking only the parts of the image that
+    can change, see ClockingCheckpoints.
+
+    The trails of each changed pixel only reach later rows of its column in
+    parallel clocking, then later columns of those rows in serial clocking, so
+    every iteration only changes the pixels in the rows and columns at or after
+    any changed pixel. Each affected column (and row, for serial clocking) is
+    re-clocked from the last checkpoint before its first affected pixel.
+
+    Parameters
+    ----------
+    image : std::valarray<std::valarray<double>>&
+        The edited input image.
+
+    changed_pixels : std::vector<std::pair<int, int>>&
+        The (row, column) indices of the pixels that differ from the input
+        image of the previous call.
+
+    checkpoints : CTICheckpoints&
+        The checkpoints from remove_cti() (or this function) for the previous
+        image, which are updated for this one. If they're empty then the whole
+        image is corrected with the model's number of iterations.
+
+    Returns
+    -------
+    image_remove_cti : std::valarray<std::valarray<double>>
+        The corrected image, as from remove_cti() with the same number of
+        iterations as the previous call.
+*/
+std::valarray<std::valarray<double>> CTIModel::remove_cti_again(
+    std::valarray<std::valarray<double>>& image,
+    const std::vector<std::pair<int, int>>& changed_pixels,
+    CTICheckpoints& checkpoints) {
+
+    int n_iterations = checkpoints.parallel.size();
+    if (n_iterations == 0) return remove_cti(image, -1, &checkpoints);
+
+    int n_rows = image.size();
+    int n_columns = image[0].size();
+
+    // The first changed row in each column, including the trails of changes
+    // in earlier columns that reach it in serial clocking
+    std::vector<int> first_changed_rows(n_columns, n_rows);
+    for (int i_pixel = 0; i_pixel < changed_pixels.size(); i_pixel++) {
+        int row_index = changed_pixels[i_pixel].first;
+        int column_index = changed_pixels[i_pixel].second;
+        if ((row_index < 0) || (row_index >= n_rows) || (column_index < 0) ||
+            (column_index >= n_columns))
+            error(
+                "Changed pixel (%d, %d) is outside the %d x %d image", row_index,
+                column_index, n_rows, n_columns);
+
+        first_changed_rows[column_index] =
+            std::min(first_changed_rows[column_index], row_index);
+    }
+    for (int column_index = 1; column_index < n_columns; column_index++)
+        first_changed_rows[column_index] = std::min(
+            first_changed_rows[column_index], first_changed_rows[column_index - 1]);
+
+    // The same region as the first changed column in each row, for the rows of
+    // the transposed image in serial clocking
+    std::vector<int> first_changed_columns(n_rows);
+    int column_index = 0;
+    for (int row_index = n_rows - 1; row_index >= 0; row_index--) {
+        while ((column_index < n_columns) &&
+               (first_changed_rows[column_index] > row_index))
+            column_index++;
+        first_changed_columns[row_index] = column_index;
+    }
+
+    for (int iteration = 0; iteration < n_iterations; iteration++) {
+        checkpoints.parallel[iteration].first_changed_rows = first_changed_rows;
+        checkpoints.serial[iteration].first_changed_rows = first_changed_columns;
+    }
+
+    return remove_cti(image, n_iterations, &checkpoints);
+}
+
+// ========
+// Loading
+// ========
+/*
+    Load a CTI model from text, e.g. the contents of a model file.
+
+    Each line sets one parameter as "name = value(s)", with any text after a #
+    ignored. The names are those of ClockingModel's parameters with a parallel_
+    or serial_ prefix, or n_iterations. For example:
+
+        # Parallel
+        parallel_trap_ic = 10.0, 0.8
+        parallel_trap_sc = 5.0, 3.0, 0.2
+        parallel_full_well_depth = 1e4
+        parallel_express = 5
+        parallel_express_extrapolate = 1
+        parallel_density_scales = 1.0, 1.2, 1.5
+        # Serial
+        serial_trap_ic = 2.0, 1.5
+        serial_collapse_factor = 1e6
+        n_iterations = 4
+
+    Unlike most of arctic, invalid inputs don't exit the program, so that e.g.
+    the server can reject a bad model and continue.
+
+    Parameters
+    ----------
+    text : std::string
+        The model parameters.
+
+    model : CTIModel&
+        The model to set.
+
+    message : std::string&
+        Set to the reason for any failure, including the line number.
+
+    Returns
+    -------
+    status : int
+        0 for success, or 1 for an invalid model.
+*/
+int load_model_from_text(
+    const std::string& text, CTIModel& model, std::string& message) {
+    std::istringstream stream(text);
+    std::string line;
+    std::string key;
+    std::string value;
+    int line_number = 0;
+    int status;
+    size_t i_char;
+
+    while (std::getline(stream, line)) {
+        line_number++;
+
+        // Strip comments and whitespace
+        i_char = line.find('#');
+        if (i_char != std::string::npos) line = line.substr(0, i_char);
+        i_char = line.find_first_not_of(" \t\r");
+        if (i_char == std::string::npos) continue;
+        line = line.substr(i_char, line.find_last_not_of(" \t\r") + 1 - i_char);
+
+        i_char = line.find('=');
+        if (i_char == std::string::npos) {
+            message = "Line " + std::to_string(line_number) + ": expected name = value";
+            return 1;
+        }
+        key = line.substr(0, line.find_last_not_of(" \t", i_char - 1) + 1);
+        value = line.substr(i_char + 1);
+
+        // Set the parameter
+        if (key == "n_iterations") {
+            std::valarray<double> values = parse_values(value);
+            status = (values.size() != 1) || (values[0] < 1);
+            if (status) message = "n_iterations requires a single positive value";
+            else model.n_iterations = values[0];
+        } else if (key.compare(0, 9, "parallel_") == 0) {
+            key = key.substr(9);
+            status = model.parallel.set_parameter(key, value, message);
+        } else if (key.compare(0, 7, "serial_") == 0) {
+            key = key.substr(7);
+            status = model.serial.set_parameter(key, value, message);
+        } else {
+            status = 1;
+            message = "Unknown parameter " + key;
+        }
+
+        if (status) {
+            message = "Line " + std::to_string(line_number) + ": " + message;
+            return status;
+        }
+    }
+
+    // Check the complete model
+    if (model.parallel.check(message)) {
+        message = "Parallel: " + message;
+        return 1;
+    }
+    if (model.serial.check(message)) {
+        message = "Serial: " + message;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,356 @@
+
+#include "resources.hpp"
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <valarray>
+
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "model.hpp"
+#include "roe.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+// ========
+// ResourceEstimate::
+// ========
+/*
+    Class ResourceEstimate.
+
+    The predicted memory and runtime for clocking an image, see
+    estimate_resources().
+
+    Parameters
+    ----------
+    image_bytes : double
+        The input and output images.
+
+    express_setup_bytes : double
+        The temporary arrays while setting the express matrix, freed before
+        the trap managers are made.
+
+    express_bytes : double
+        The express and store-trap-states matrices.
+
+    trap_manager_bytes : double
+        The watermark volumes and fills (and their stored copies) for every
+        trap manager, i.e. for each phase and type of trap.
+
+    table_bytes : double
+        The continuum traps' interpolation tables.
+
+    peak_bytes : double
+        The predicted peak of the memory allocated by arctic.
+
+    n_pixel_transfers : double
+        The number of pixel-to-pixel transfers actually modelled, i.e. after
+        express, counting each clock step.
+
+    runtime : double
+        The estimated runtime (s), calibrated by timing a small probe with the
+        same model, or 0 if not calibrated.
+*/
+
+/*
+    The estimate as text lines of "name = value", e.g. for a job scheduler.
+*/
+std::string ResourceEstimate::to_text() {
+    std::ostringstream text;
+
+    text << "image_bytes = " << image_bytes << "\n";
+    text << "express_setup_bytes = " << express_setup_bytes << "\n";
+    text << "express_bytes = " << express_bytes << "\n";
+    text << "trap_manager_bytes = " << trap_manager_bytes << "\n";
+    text << "table_bytes = " << table_bytes << "\n";
+    text << "peak_bytes = " << peak_bytes << "\n";
+    text << "n_pixel_transfers = " << n_pixel_transfers << "\n";
+    text << "runtime = " << runtime << "\n";
+
+    return text.str();
+}
+
+// ========
+// Estimates
+// ========
+/*
+    The bytes of one trap manager's watermarks, for one phase.
+*/
+static double trap_manager_bytes(
+    int max_n_transfers, int n_watermarks_per_transfer, int n_traps) {
+
+    if (n_traps == 0) return 0.0;
+
+    // As for TrapManagerBase::initialise_trap_states()
+    double n_watermarks = (double)max_n_transfers * n_watermarks_per_transfer + 1;
+
+    // Volumes and fills, and the same again for the stored states
+    return 2.0 * sizeof(double) * n_watermarks * (1 + n_traps);
+}
+
+/*
+    Time clocking a small probe image with the same model, returning the
+    runtime per pixel transfer (s) for a single thread.
+*/
+static double calibrate_time_per_transfer(
+    int n_rows, ROE* roe, CCD* ccd, std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co) {
+
+    int n_probe_rows = std::min(n_rows, 100);
+    int n_probe_columns = 8;
+
+    // A faint background with some bright pixels
+    double full_well_depth = ccd->phases[0].full_well_depth;
+    std::valarray<std::valarray<double>> probe(
+        std::valarray<double>(0.0, n_probe_columns), n_probe_rows);
+    for (int row_index = 0; row_index < n_probe_rows; row_index++) {
+        for (int column_index = 0; column_index < n_probe_columns; column_index++) {
+            int hash = (row_index * 7919 + column_index * 104729) % 1000;
+            probe[row_index][column_index] =
+                (hash < 20) ? full_well_depth * hash / 40.0 : 1e-3 * hash;
+        }
+    }
+
+    struct timeval time_start;
+    struct timeval time_end;
+    gettimeofday(&time_start, nullptr);
+    clock_charge_in_one_direction(
+        probe, roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, 0, 0, 0, -1, 0,
+        -1, 0, -1, 1e-10, 20, 0);
+    gettimeofday(&time_end, nullptr);
+
+    // All transfers with express = 0
+    double n_pixel_transfers = (double)n_probe_columns * n_probe_rows *
+                               (n_probe_rows + 1) / 2.0 * roe->dwell_times.size();
+
+    // The probe's columns may have been shared between threads
+    int n_probe_threads = roe->empty_traps_between_columns
+                              ? std::min(get_n_threads(), n_probe_columns)
+                              : 1;
+
+    return gettimelapsed(time_start, time_end) * n_probe_threads / n_pixel_transfers;
+}
+
+/*
+    Predict the peak memory and the runtime for clocking an image in one
+    direction, as for clock_charge_in_one_direction(), without doing it.
+
+    The memory is dominated by the trap managers, which preallocate the
+    watermarks for every possible transfer: (1 + n_traps) doubles for each of
+    max_n_transfers * n_watermarks_per_transfer watermarks, for each phase and
+    type of trap, and the same again for their stored states. max_n_transfers
+    is the number of rows times the clock steps, and also times the number of
+    columns if the traps aren't emptied between columns. The express matrix is
+    express * n_rows doubles, with larger temporary arrays while it's set up.
+
+    The runtime scales with the number of transfers actually modelled, about
+    n_columns * n_rows * (express + 1) / 2 times the clock steps, but the cost
+    per transfer depends on the traps and the image content. So it's
+    calibrated by timing a small probe image with the same model, which takes
+    a fraction of a second. This is only a rough estimate, since the number of
+    watermarks (and hence the cost per transfer) also grows with the trail
+    length and the image content.
+
+    If the traps are emptied between columns, the columns are shared between
+    get_n_threads() threads, each with its own copy of the trap managers.
+
+    Parameters
+    ----------
+    n_rows, n_columns : int
+        The image shape, with rows along the direction of clocking.
+
+    roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, express,
+    row_offset
+        As for clock_charge_in_one_direction().
+
+    calibrate : bool (opt.)
+        Whether to time the probe to estimate the runtime.
+
+    Returns
+    -------
+    estimate : ResourceEstimate
+        The predicted bytes for each component, the peak, and the runtime.
+*/
+ResourceEstimate estimate_resources(
+    int n_rows, int n_columns, ROE* roe, CCD* ccd,
+    std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int express, int row_offset,
+    bool calibrate) {
+
+    ResourceEstimate estimate;
+    int n_steps = roe->dwell_times.size();
+    int n_traps_ic = (traps_ic == nullptr) ? 0 : traps_ic->size();
+    int n_traps_sc = (traps_sc == nullptr) ? 0 : traps_sc->size();
+    int n_traps_ic_co = (traps_ic_co == nullptr) ? 0 : traps_ic_co->size();
+    int n_traps_sc_co = (traps_sc_co == nullptr) ? 0 : traps_sc_co->size();
+
+    // Input and output images
+    estimate.image_bytes = 2.0 * sizeof(double) * n_rows * n_columns;
+
+    // Express matrix, as for ROE::set_express_matrix_from_rows_and_express()
+    double n_transfers = n_rows + row_offset + roe->prescan_offset;
+    double n_express =
+        ((express == 0) || (express > n_transfers)) ? n_transfers : express;
+    double n_express_passes = n_express;
+    estimate.express_setup_bytes = 2.0 * sizeof(double) * n_express * n_transfers;
+    if (roe->empty_traps_for_first_transfers && (n_express < n_transfers)) {
+        estimate.express_setup_bytes += sizeof(double) * n_transfers * n_transfers;
+        n_express_passes += 1;
+    }
+    estimate.express_bytes =
+        (sizeof(double) + sizeof(bool)) * n_express_passes * n_transfers;
+
+    // Trap managers, as for clock_charge_in_one_direction() and TrapManagerManager
+    int max_n_transfers = (n_rows + row_offset) * n_steps;
+    if (!roe->empty_traps_between_columns) max_n_transfers *= n_columns;
+    if (roe->type == roe_type_trap_pumping) max_n_transfers *= roe->n_pumps;
+    // With a copy for each thread as well as the original if multi-threaded
+    int n_threads_used = roe->empty_traps_between_columns
+                             ? std::min(get_n_threads(), n_columns)
+                             : 1;
+    int n_trap_manager_copies = (n_threads_used > 1) ? n_threads_used + 1 : 1;
+    estimate.trap_manager_bytes =
+        n_trap_manager_copies * ccd->n_phases *
+        (trap_manager_bytes(max_n_transfers, 1, n_traps_ic) +
+         trap_manager_bytes(max_n_transfers, 2, n_traps_sc) +
+         trap_manager_bytes(max_n_transfers, 1, n_traps_ic_co) +
+         trap_manager_bytes(max_n_transfers, 2, n_traps_sc_co));
+
+    // Continuum interpolation tables, of (up to) n_intp = 1000 values each
+    estimate.table_bytes =
+        ccd->n_phases * sizeof(double) * 1000.0 * (n_traps_ic_co + 2 * n_traps_sc_co);
+
+    // The express setup arrays are freed before the trap managers are made
+    estimate.peak_bytes =
+        estimate.image_bytes +
+        std::max(
+            estimate.express_setup_bytes + estimate.express_bytes,
+            estimate.express_bytes + estimate.trap_manager_bytes +
+                estimate.table_bytes);
+
+    // Transfers
+    estimate.n_pixel_transfers =
+        (double)n_columns * n_rows * (std::min(n_express, (double)n_rows) + 1) / 2.0 *
+        n_steps;
+    if (roe->type == roe_type_trap_pumping) estimate.n_pixel_transfers *= roe->n_pumps;
+
+    if (calibrate && (n_traps_ic + n_traps_sc + n_traps_ic_co + n_traps_sc_co > 0))
+        estimate.runtime = estimate.n_pixel_transfers *
+                           calibrate_time_per_transfer(
+                               n_rows, roe, ccd, traps_ic, traps_sc, traps_ic_co,
+                               traps_sc_co) /
+                           n_threads_used;
+
+    print_v(
+        1, "Estimate: peak %.4g MB, runtime %.4g s \n", estimate.peak_bytes / 1048576.0,
+        estimate.runtime);
+
+    return estimate;
+}
+
+/*
+    Predict the peak memory and the runtime for adding or removing CTI with a
+    model, as for CTIModel::add_cti() or remove_cti(), including the trap
+    managers kept by CTIModel::prepare() and the extra images.
+
+    Parameters
+    ----------
+    n_rows, n_columns : int
+        The image shape.
+
+    model : CTIModel&
+        The CTI model.
+
+    n_iterations : int (opt.)
+        The number of iterations for removing CTI, or 0 (default) for adding
+        CTI, or -1 to use the model's value.
+
+    calibrate : bool (opt.)
+        Whether to time the probes to estimate the runtime.
+*/
+ResourceEstimate estimate_resources(
+    int n_rows, int n_columns, CTIModel& model, int n_iterations, bool calibrate) {
+
+    ResourceEstimate estimate;
+    ResourceEstimate directions[2];
+    ClockingModel* models[2] = {&model.parallel, &model.serial};
+    int shapes[2][2] = {{n_rows, n_columns}, {n_columns, n_rows}};
+
+    for (int i = 0; i < 2; i++) {
+        if (!models[i]->has_traps()) continue;
+
+        std::valarray<double> dwell_times = models[i]->dwell_times;
+        ROE roe_standard(
+            dwell_times, models[i]->prescan_offset, models[i]->overscan_start,
+            models[i]->empty_traps_between_columns,
+            models[i]->empty_traps_for_first_transfers,
+            models[i]->force_release_away_from_readout,
+            models[i]->use_integer_express_matrix);
+        ROEChargeInjection roe_charge_injection(
+            dwell_times, models[i]->prescan_offset, models[i]->overscan_start,
+            models[i]->empty_traps_between_columns,
+            models[i]->force_release_away_from_readout,
+            models[i]->use_integer_express_matrix);
+        ROE* roe = models[i]->charge_injection ? &roe_charge_injection : &roe_standard;
+        CCD ccd = models[i]->make_ccd();
+
+        directions[i] = estimate_resources(
+            shapes[i][0], shapes[i][1], roe, &ccd, &models[i]->traps_ic,
+            &models[i]->traps_sc, &models[i]->traps_ic_co, &models[i]->traps_sc_co,
+            models[i]->express, models[i]->window_offset, calibrate);
+
+        // Extrapolated express also clocks with twice the express, in turn
+        int n_transfers = shapes[i][0] + models[i]->window_offset + roe->prescan_offset;
+        int express = models[i]->express;
+        if (models[i]->express_extrapolate && (express > 0) &&
+            (2 * express < n_transfers)) {
+            ResourceEstimate double_express = estimate_resources(
+                shapes[i][0], shapes[i][1], roe, &ccd, &models[i]->traps_ic,
+                &models[i]->traps_sc, &models[i]->traps_ic_co,
+                &models[i]->traps_sc_co, 2 * express, models[i]->window_offset,
+                calibrate);
+            double_express.n_pixel_transfers += directions[i].n_pixel_transfers;
+            double_express.runtime += directions[i].runtime;
+            directions[i] = double_express;
+        }
+    }
+
+    if (n_iterations == -1) n_iterations = model.n_iterations;
+    int n_add_cti = std::max(n_iterations, 1);
+
+    // The directions are clocked in turn, so only one's working memory at once
+    estimate.express_setup_bytes =
+        std::max(directions[0].express_setup_bytes, directions[1].express_setup_bytes);
+    estimate.express_bytes =
+        std::max(directions[0].express_bytes, directions[1].express_bytes);
+    estimate.table_bytes = directions[0].table_bytes + directions[1].table_bytes;
+    estimate.n_pixel_transfers =
+        n_add_cti * (directions[0].n_pixel_transfers + directions[1].n_pixel_transfers);
+    estimate.runtime = n_add_cti * (directions[0].runtime + directions[1].runtime);
+
+    // The prepared trap managers of both directions, plus a working copy
+    estimate.trap_manager_bytes =
+        directions[0].trap_manager_bytes + directions[1].trap_manager_bytes +
+        std::max(directions[0].trap_manager_bytes, directions[1].trap_manager_bytes);
+
+    // The input, output, and transposed images, and the estimate and model
+    // images while removing CTI
+    double n_bytes_image = sizeof(double) * n_rows * n_columns;
+    estimate.image_bytes = ((n_iterations > 0) ? 5.0 : 3.0) * n_bytes_image;
+
+    estimate.peak_bytes =
+        estimate.image_bytes + estimate.table_bytes +
+        std::max(
+            estimate.express_setup_bytes + estimate.express_bytes,
+            estimate.express_bytes + estimate.trap_manager_bytes);
+
+    return estimate;
+}
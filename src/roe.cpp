@@ -629,6 +629,13 @@ ROEChargeInjection::ROEChargeInjection(
 
     For charge injection, all charges are clocked the same number of times
     through all the pixels to the readout register.
+
+    Sets
+    ----
+    express_multipliers : std::valarray<double>
+        The single multiplier for all rows in each express pass, used by the
+        dedicated charge-injection clocking. The full express_matrix is also
+        set for consistency with other ROEs.
 */
 void ROEChargeInjection::set_express_matrix_from_rows_and_express(
     int n_rows, int express, int window_offset) {
@@ -659,8 +666,9 @@ void ROEChargeInjection::set_express_matrix_from_rows_and_express(
     double max_multiplier = (double)n_transfers / express;
     if (use_integer_express_matrix) max_multiplier = ceil(max_multiplier);
 
-    // Initialise an array that will become the express matrix (can't create the array itself)
-    std::valarray<double> tmp_express_matrix(max_multiplier, express * n_rows);
+    // Every row undergoes the same transfers, so only one multiplier is needed
+    // for each express pass
+    express_multipliers = std::valarray<double>(max_multiplier, express);
 
     // Adjust integer multipliers to correct the total number of transfers
     if ((use_integer_express_matrix) && (n_transfers % express != 0)) {
@@ -668,22 +676,26 @@ void ROEChargeInjection::set_express_matrix_from_rows_and_express(
         double reduced_multiplier;
 
         for (int express_index = express - 1; express_index >= 0; express_index--) {
-            // Count the current number of transfers for this pixel
+            // Count the current number of transfers
             current_n_transfers = 0.0;
             for (int i = 0; i <= express_index; i++) {
-                current_n_transfers += tmp_express_matrix[i * n_rows];
+                current_n_transfers += express_multipliers[i];
             }
 
             // Reduce the multipliers until no longer have too many transfers
             if (current_n_transfers <= n_transfers) break;
             reduced_multiplier =
                 std::max(0.0, max_multiplier + n_transfers - current_n_transfers);
-            tmp_express_matrix[std::slice(
-                express_index * n_rows, n_rows, 1)] = reduced_multiplier;
+            express_multipliers[express_index] = reduced_multiplier;
         }
     }
-    express_matrix = tmp_express_matrix;
 
+    // Copy the multipliers to every row for the full express matrix
+    express_matrix.resize(express * n_rows);
+    for (int express_index = 0; express_index < express; express_index++) {
+        express_matrix[std::slice(express_index * n_rows, n_rows, 1)] =
+            express_multipliers[express_index];
+    }
 }
 
 /*
@@ -0,0 +1,508 @@
+
+#include "server.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <valarray>
+
+#include "model.hpp"
+#include "util.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// ========
+// ThreadPool::
+// ========
+/*
+    Class ThreadPool.
+
+    A fixed set of worker threads that run submitted tasks in order of
+    submission. Any remaining tasks are completed before the destructor
+    returns.
+
+    Each task's own parallel loops are limited to its share of get_n_threads()
+    between the tasks running when it starts, so a lone large job can still use
+    every core while a full pool runs each job on one.
+
+    Parameters
+    ----------
+    n_workers : int
+        The number of worker threads, or 0 for get_n_threads().
+*/
+ThreadPool::ThreadPool(int n_workers)
+    : n_workers(n_workers), n_threads(get_n_threads()), n_busy(0), stopping(false) {
+    if (this->n_workers <= 0) this->n_workers = n_threads;
+
+    for (int i_worker = 0; i_worker < this->n_workers; i_worker++)
+        workers.push_back(std::thread(&ThreadPool::run_worker, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (int i_worker = 0; i_worker < workers.size(); i_worker++)
+        workers[i_worker].join();
+}
+
+/*
+    Queue a task to be run by the next free worker.
+*/
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(task);
+    }
+    condition.notify_one();
+}
+
+/*
+    Run tasks as they arrive, until stopping with no tasks left.
+*/
+void ThreadPool::run_worker() {
+    std::function<void()> task;
+    int n_busy_now;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return;
+
+            task = tasks.front();
+            tasks.pop();
+            n_busy_now = ++n_busy;
+        }
+
+        // Share the threads with the other running tasks
+        set_thread_limit(std::max(1, n_threads / n_busy_now));
+        task();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            n_busy--;
+        }
+    }
+}
+
+// ========
+// ModelCache::
+// ========
+/*
+    Class ModelCache.
+
+    A thread-safe least-recently-used cache of CTI models that have been loaded
+    and prepared for a given image shape, so that repeated jobs skip parsing
+    and setting up the trap managers.
+
+    Models are identified by their complete text and the image shape, so any
+    edit to a model file is picked up as a new model.
+
+    Parameters
+    ----------
+    capacity : int
+        The maximum number of models to keep.
+*/
+ModelCache::ModelCache(int capacity) : capacity(capacity), n_hits(0), n_misses(0) {}
+
+/*
+    Get the prepared model for this text and image shape, loading and adding
+    it to the cache if needed.
+
+    The mutex is not held while preparing a new model, so other jobs can
+    continue. If two jobs prepare the same new model at once then the first to
+    finish is kept.
+
+    Parameters
+    ----------
+    text : std::string
+        The model parameters, see load_model_from_text().
+
+    n_rows, n_columns : int
+        The image shape.
+
+    message : std::string&
+        Set to the reason for any failure.
+
+    Returns
+    -------
+    model : std::shared_ptr<CTIModel>
+        The prepared model, or nullptr if the text is an invalid model.
+*/
+std::shared_ptr<CTIModel> ModelCache::get(
+    const std::string& text, int n_rows, int n_columns, std::string& message) {
+
+    std::string key =
+        std::to_string(n_rows) + "x" + std::to_string(n_columns) + "\n" + text;
+
+    // Check the cache, and move a found model to the front
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            n_hits++;
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->second;
+        }
+        n_misses++;
+    }
+
+    // Load and prepare the new model
+    std::shared_ptr<CTIModel> model(new CTIModel());
+    if (load_model_from_text(text, *model, message) != 0) return nullptr;
+    model->prepare(n_rows, n_columns);
+
+    // Add to the cache, dropping the least recently used
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it != index.end()) return it->second->second;
+
+    entries.push_front(Entry(key, model));
+    index[key] = entries.begin();
+    while ((int)entries.size() > capacity) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+
+    return model;
+}
+
+/*
+    The number of models currently in the cache.
+*/
+int ModelCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+// ========
+// Requests
+// ========
+/*
+    Add or remove CTI from an image in shared memory, in place.
+*/
+static std::string process_image(
+    std::string& command, std::string& shm_name, int n_rows, int n_columns,
+    int n_iterations, std::string& model_path, ModelCache& cache) {
+
+    std::string message;
+
+    if ((n_rows <= 0) || (n_columns <= 0)) return "error Invalid image shape";
+
+    // Load the model text and get the prepared model
+    std::ifstream file(model_path.c_str());
+    if (!file) return "error Can't read model file " + model_path;
+    std::stringstream text;
+    text << file.rdbuf();
+
+    // Only log the reason for an invalid model, which may quote the file
+    std::shared_ptr<CTIModel> model = cache.get(text.str(), n_rows, n_columns, message);
+    if (model == nullptr) {
+        print_v(1, "Invalid model file %s: %s \n", model_path.c_str(), message.c_str());
+        return "error Invalid model file " + model_path;
+    }
+
+    // Map the image
+    size_t n_bytes = (size_t)n_rows * n_columns * sizeof(double);
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    if (fd < 0) return "error Can't open shared memory " + shm_name;
+    struct stat shm_stat;
+    if ((fstat(fd, &shm_stat) != 0) || ((size_t)shm_stat.st_size < n_bytes)) {
+        close(fd);
+        return "error Shared memory " + shm_name + " too small for the image";
+    }
+    double* data =
+        (double*)mmap(nullptr, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return "error Can't map shared memory " + shm_name;
+
+    // Process the image
+    struct timeval wall_time_start;
+    struct timeval wall_time_end;
+    gettimeofday(&wall_time_start, nullptr);
+
+    // The models clock std::valarray images and return a new image, so the
+    // mapped image is copied in and back out rather than clocked in place. The
+    // two copies are cheap next to the clocking itself
+    std::valarray<std::valarray<double>> image(
+        std::valarray<double>(0.0, n_columns), n_rows);
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        image[row_index] =
+            std::valarray<double>(data + row_index * n_columns, n_columns);
+
+    double error_estimate;
+    try {
+        if (command == "add")
+            image = model->add_cti(image, nullptr, nullptr, &error_estimate);
+        else
+            image = model->remove_cti(
+                image, (n_iterations > 0) ? n_iterations : -1, nullptr, nullptr,
+                &error_estimate);
+    } catch (...) {
+        munmap(data, n_bytes);
+        throw;
+    }
+
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        std::copy(
+            std::begin(image[row_index]), std::end(image[row_index]),
+            data + row_index * n_columns);
+    munmap(data, n_bytes);
+
+    gettimeofday(&wall_time_end, nullptr);
+    char reply[64];
+    snprintf(
+        reply, sizeof(reply), "ok %.6g %.6g",
+        gettimelapsed(wall_time_start, wall_time_end), error_estimate);
+
+    return reply;
+}
+
+/*
+    Process one request to the server and return the reply. See run_server()
+    for the requests.
+*/
+std::string process_server_request(const std::string& request, ModelCache& cache) {
+    std::istringstream stream(request);
+    std::string command;
+    std::string shm_name;
+    std::string model_path;
+    int n_rows;
+    int n_columns;
+    int n_iterations = 0;
+
+    stream >> command;
+
+    if (command == "ping") return "ok";
+
+    if (command == "stats") {
+        char reply[128];
+        snprintf(
+            reply, sizeof(reply), "ok hits=%d misses=%d models=%d",
+            cache.n_hits.load(), cache.n_misses.load(), cache.size());
+        return reply;
+    }
+
+    if ((command == "add") || (command == "remove")) {
+        stream >> shm_name >> n_rows >> n_columns;
+        if (command == "remove") stream >> n_iterations;
+        std::getline(stream >> std::ws, model_path);
+        if (stream.fail() || model_path.empty())
+            return "error Invalid " + command + " request";
+
+        // Reply with any error instead of exiting the server
+        ThrowErrors throw_errors;
+        try {
+            return process_image(
+                command, shm_name, n_rows, n_columns, n_iterations, model_path,
+                cache);
+        } catch (const ArcticError& e) {
+            return std::string("error ") + e.what();
+        }
+    }
+
+    return "error Unknown request " + command;
+}
+
+// ========
+// Sockets
+// ========
+/*
+    Read one newline-terminated message from a socket, without the newline.
+*/
+static bool read_line(int fd, std::string& line) {
+    char buffer[1024];
+    ssize_t n_read;
+
+    line.clear();
+    while (line.find('\n') == std::string::npos) {
+        n_read = recv(fd, buffer, sizeof(buffer), 0);
+        if (n_read <= 0) return false;
+        line.append(buffer, n_read);
+        if (line.size() > 65536) return false;
+    }
+    line = line.substr(0, line.find('\n'));
+
+    return true;
+}
+
+/*
+    Write one message to a socket, with a newline.
+*/
+static void write_line(int fd, const std::string& line) {
+    std::string message = line + "\n";
+    size_t n_sent = 0;
+    ssize_t n;
+
+    while (n_sent < message.size()) {
+        n = send(fd, message.c_str() + n_sent, message.size() - n_sent, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        n_sent += n;
+    }
+}
+
+/*
+    Connect to the server's socket, or return -1.
+*/
+static int connect_to_socket(const char* socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+    Run arctic as a long-lived server that accepts jobs over a Unix domain
+    socket, keeping the loaded and prepared CTI models in a cache so that each
+    job only needs the time for clocking.
+
+    Each connection sends one request line and receives one reply line, which
+    starts with "ok" or "error <reason>". Errors while processing a job are
+    replied instead of stopping the server, see ThrowErrors. Requests:
+
+        ping
+        stats
+            Reply with the cache's hits, misses, and number of models.
+        add <shm_name> <n_rows> <n_columns> <model_path>
+        remove <shm_name> <n_rows> <n_columns> <n_iterations> <model_path>
+            Add or remove CTI in place in an image of doubles in row-major
+            order, in the POSIX shared memory object shm_name made by the
+            client (see shm_open()). The model file's parameters are as for
+            load_model_from_text(), and n_iterations = 0 uses the model's
+            value. Replies with the processing time in seconds and the
+            extrapolated express error estimate (0 without express_extrapolate).
+        shutdown
+            Finish the current jobs and exit.
+
+    The jobs run on a pool of worker threads, so that several images can be
+    processed at once.
+
+    Parameters
+    ----------
+    socket_path : const char*
+        The path for the socket file, replacing any existing file.
+
+    cache_size : int (opt.)
+        The number of prepared models to keep.
+
+    n_workers : int (opt.)
+        The number of worker threads, or 0 for get_n_threads().
+
+    Returns
+    -------
+    status : int
+        0 after a shutdown request.
+*/
+int run_server(const char* socket_path, int cache_size, int n_workers) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+        error("Socket path too long: %s", socket_path);
+    strcpy(address.sun_path, socket_path);
+
+    // Listen on the socket
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) error("Failed to create socket (%s)", strerror(errno));
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+        error("Failed to bind socket %s (%s)", socket_path, strerror(errno));
+    if (listen(listen_fd, 128) != 0)
+        error("Failed to listen on socket %s (%s)", socket_path, strerror(errno));
+
+    ModelCache cache(cache_size);
+    std::atomic<bool> stop(false);
+    std::string socket_path_str(socket_path);
+    int fd;
+
+    {
+        ThreadPool pool(n_workers);
+        print_v(
+            1, "Serving on %s with %d worker(s) \n", socket_path, pool.n_workers);
+
+        while (!stop) {
+            fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                error("Failed to accept connection (%s)", strerror(errno));
+            }
+            if (stop) {
+                close(fd);
+                break;
+            }
+
+            pool.submit([fd, &cache, &stop, socket_path_str]() {
+                std::string request;
+                std::string reply;
+
+                if (read_line(fd, request)) {
+                    print_v(1, "Request: %s \n", request.c_str());
+                    if (request == "shutdown") {
+                        stop = true;
+                        reply = "ok";
+                    } else
+                        reply = process_server_request(request, cache);
+                    write_line(fd, reply);
+                    print_v(1, "Reply: %s \n", reply.c_str());
+                }
+                close(fd);
+
+                // Wake the accept() call so the server can exit
+                if (request == "shutdown") {
+                    int wake_fd = connect_to_socket(socket_path_str.c_str());
+                    if (wake_fd >= 0) close(wake_fd);
+                }
+            });
+        }
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    return 0;
+}
+
+/*
+    Send one request to a server and return its reply. See run_server().
+*/
+std::string send_server_request(const char* socket_path, const std::string& request) {
+    std::string reply;
+
+    int fd = connect_to_socket(socket_path);
+    if (fd < 0) return "error Can't connect to " + std::string(socket_path);
+
+    write_line(fd, request);
+    if (!read_line(fd, reply)) reply = "error No reply";
+    close(fd);
+
+    return reply;
+}
@@ -0,0 +1,574 @@
+
+#include "sparse.hpp"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <valarray>
+#include <vector>
+
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "roe.hpp"
+#include "trap_managers.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+// ========
+// Conversions
+// ========
+/*
+    Convert a list of events into a dense image, summing any duplicate pixels.
+
+    Parameters
+    ----------
+    events : std::valarray<PixelEvent>&
+        The sparse list of non-zero pixels.
+
+    n_rows, n_columns : int
+        The shape of the full image.
+
+    Returns
+    -------
+    image : std::valarray<std::valarray<double>>
+        The dense array of pixel values.
+*/
+std::valarray<std::valarray<double>> image_from_events(
+    std::valarray<PixelEvent>& events, int n_rows, int n_columns) {
+
+    std::valarray<std::valarray<double>> image(
+        std::valarray<double>(0.0, n_columns), n_rows);
+
+    for (int i_event = 0; i_event < events.size(); i_event++) {
+        if ((events[i_event].row < 0) || (events[i_event].row >= n_rows) ||
+            (events[i_event].column < 0) || (events[i_event].column >= n_columns))
+            error(
+                "Event (%d, %d) outside the image (%d x %d)", events[i_event].row,
+                events[i_event].column, n_rows, n_columns);
+
+        image[events[i_event].row][events[i_event].column] +=
+            events[i_event].n_electrons;
+    }
+
+    return image;
+}
+
+/*
+    Convert a dense image into a list of the pixels above a threshold, in order
+    of row then column.
+
+    Parameters
+    ----------
+    image : std::valarray<std::valarray<double>>&
+        The dense array of pixel values.
+
+    threshold : double (opt.)
+        Only pixels with more than this many electrons are included.
+
+    Returns
+    -------
+    events : std::valarray<PixelEvent>
+        The sparse list of pixels.
+*/
+std::valarray<PixelEvent> events_from_image(
+    std::valarray<std::valarray<double>>& image, double threshold) {
+
+    std::vector<PixelEvent> events;
+
+    for (int row_index = 0; row_index < image.size(); row_index++) {
+        for (int column_index = 0; column_index < image[row_index].size();
+             column_index++) {
+            if (image[row_index][column_index] > threshold)
+                events.push_back(PixelEvent(
+                    row_index, column_index, image[row_index][column_index]));
+        }
+    }
+
+    return std::valarray<PixelEvent>(events.data(), events.size());
+}
+
+/*
+    Sort a list of events into column-major order and sum any duplicates, for
+    clocking along the columns.
+*/
+static std::vector<PixelEvent> sorted_events_by_column(
+    std::valarray<PixelEvent>& events, int n_rows, int n_columns) {
+
+    std::map<std::pair<int, int>, double> pixels;
+
+    for (int i_event = 0; i_event < events.size(); i_event++) {
+        if ((events[i_event].row < 0) || (events[i_event].row >= n_rows) ||
+            (events[i_event].column < 0) || (events[i_event].column >= n_columns))
+            error(
+                "Event (%d, %d) outside the image (%d x %d)", events[i_event].row,
+                events[i_event].column, n_rows, n_columns);
+
+        pixels[std::make_pair(events[i_event].column, events[i_event].row)] +=
+            events[i_event].n_electrons;
+    }
+
+    std::vector<PixelEvent> sorted_events;
+    sorted_events.reserve(pixels.size());
+    for (std::map<std::pair<int, int>, double>::iterator it = pixels.begin();
+         it != pixels.end(); it++)
+        sorted_events.push_back(
+            PixelEvent(it->first.second, it->first.first, it->second));
+
+    return sorted_events;
+}
+
+/*
+    Swap the rows and columns of a list of events, as for transpose().
+*/
+static std::valarray<PixelEvent> transpose_events(std::valarray<PixelEvent>& events) {
+    std::valarray<PixelEvent> events_transposed(events.size());
+
+    for (int i_event = 0; i_event < events.size(); i_event++)
+        events_transposed[i_event] = PixelEvent(
+            events[i_event].column, events[i_event].row, events[i_event].n_electrons);
+
+    return events_transposed;
+}
+
+// ========
+// Clocking
+// ========
+/*
+    The number of rows behind an event after which its trail has fallen below
+    min_event_n_electrons, from the slowest release of the traps.
+
+    The traps in a pixel can't hold more than their total density, and release
+    at least a fraction 1 - exp(-dwell_time / release_timescale) of it each
+    transfer. For continuum traps, the release timescale is taken as 5 sigma
+    above the mean.
+
+    Parameters
+    ----------
+    roe, traps_ic, traps_sc, traps_ic_co, traps_sc_co
+        As for clock_events_in_one_direction().
+
+    min_event_n_electrons : double
+        The smallest number of electrons to keep in the trail.
+
+    n_rows : int
+        The maximum length, e.g. the number of rows in the image, which is used
+        if min_event_n_electrons isn't positive.
+
+    Returns
+    -------
+    trail_length : int
+        The number of rows behind an event to clock.
+*/
+static int trail_length_from_traps(
+    ROE* roe, std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co,
+    double min_event_n_electrons, int n_rows) {
+
+    if (min_event_n_electrons <= 0.0) return n_rows;
+
+    double total_density = 0.0;
+    double max_release_timescale = 0.0;
+    for (const TrapInstantCapture& trap : *traps_ic) {
+        total_density += trap.density;
+        max_release_timescale = std::max(max_release_timescale, trap.release_timescale);
+    }
+    for (const TrapSlowCapture& trap : *traps_sc) {
+        total_density += trap.density;
+        max_release_timescale = std::max(max_release_timescale, trap.release_timescale);
+    }
+    for (const TrapInstantCaptureContinuum& trap : *traps_ic_co) {
+        total_density += trap.density;
+        max_release_timescale = std::max(
+            max_release_timescale,
+            trap.release_timescale + 5.0 * trap.release_timescale_sigma);
+    }
+    for (const TrapSlowCaptureContinuum& trap : *traps_sc_co) {
+        total_density += trap.density;
+        max_release_timescale = std::max(
+            max_release_timescale,
+            trap.release_timescale + 5.0 * trap.release_timescale_sigma);
+    }
+    if (total_density <= min_event_n_electrons) return 0;
+
+    double transfer_time = roe->dwell_times.sum();
+    double trail_length = ceil(
+        max_release_timescale / transfer_time *
+        log(total_density / min_event_n_electrons));
+
+    return (trail_length < n_rows) ? (int)trail_length : n_rows;
+}
+
+/*
+    Add CTI trails to a sparse list of events by clocking only the parts of
+    the columns that contain events, as for clock_charge_in_one_direction().
+
+    Charge only ever moves towards row 0, so the trap states (and output) in
+    each pixel depend only on the pixels closer to the readout. The empty rows
+    before the first event in each column can therefore be skipped exactly,
+    as can every column with no events.
+
+    The events in each column are grouped into segments that run from their
+    first event to max_trail_length rows past their last event. Events
+    separated by longer gaps start new segments, fast-forwarding over the empty
+    span in between. Each segment is clocked as a window of a single column,
+    so only the rows in the segment are modelled, with the same express passes
+    as the full image. The readout electronics and trap managers are set up
+    once for all segments. Only the pixels in the segments with more than
+    min_event_n_electrons are kept, so the runtime and the number of output
+    events scale with the number of input events instead of the image size.
+
+    Parameters
+    ----------
+    events : std::valarray<PixelEvent>&
+        The input list of non-zero pixels.
+
+    n_rows, n_columns : int
+        The shape of the full image.
+
+    roe, ccd, traps_ic, traps_sc, traps_ic_co, traps_sc_co, express,
+    row_offset, prune_n_electrons, prune_frequency
+        As for clock_charge_in_one_direction().
+
+    max_trail_length : int
+        The number of rows past the last event in each segment to clock, or -1
+        for the length after which the trails fall below min_event_n_electrons,
+        see trail_length_from_traps(). Shorter lengths truncate the trails and
+        assume the traps have emptied across longer gaps between events. With
+        n_rows and min_event_n_electrons = 0, the output matches the dense
+        result for express = 0.
+
+    min_event_n_electrons : double
+        Only output pixels with more than this many electrons are kept.
+
+    Returns
+    -------
+    events : std::valarray<PixelEvent>
+        The output list of all non-zero pixels, in column-major order.
+*/
+static std::valarray<PixelEvent> clock_events_in_one_direction(
+    std::valarray<PixelEvent>& events_in, int n_rows, int n_columns, ROE* roe,
+    CCD* ccd, std::valarray<TrapInstantCapture>* traps_ic,
+    std::valarray<TrapSlowCapture>* traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* traps_sc_co, int express,
+    int row_offset, int max_trail_length, double prune_n_electrons,
+    int prune_frequency, double min_event_n_electrons) {
+
+    if (roe->type != roe_type_standard)
+        error("Sparse clocking currently requires a standard ROE (%d)", roe->type);
+    if (!roe->empty_traps_between_columns)
+        error(
+            "Sparse clocking requires empty_traps_between_columns, since the "
+            "skipped columns would otherwise affect the trap states");
+
+    if (ccd->n_phases != roe->n_phases)
+        error(
+            "Number of CCD phases (%d) and ROE phases (%d) don't match.", ccd->n_phases,
+            roe->n_phases);
+
+    std::vector<PixelEvent> events =
+        sorted_events_by_column(events_in, n_rows, n_columns);
+    std::vector<PixelEvent> events_out;
+
+    int n_events = events.size();
+    int n_segments = 0;
+    int n_clocked_rows = 0;
+    int i_event = 0;
+    int i_event_last;
+    int column_index;
+    int segment_start;
+    int segment_stop;
+
+    // A single column to hold each segment in turn, so that the express
+    // passes are the same as for the full image
+    std::valarray<std::valarray<double>> column(std::valarray<double>(0.0, 1), n_rows);
+
+    // Set up the readout electronics and express arrays, shared by all segments
+    roe->set_clock_sequence();
+    roe->set_express_matrix_from_rows_and_express(
+        n_rows, express, row_offset + roe->prescan_offset);
+    roe->set_store_trap_states_matrix();
+
+    // Set empty arrays for nullptr trap lists
+    std::valarray<TrapInstantCapture> no_traps_ic = {};
+    if (traps_ic == nullptr) traps_ic = &no_traps_ic;
+    std::valarray<TrapSlowCapture> no_traps_sc = {};
+    if (traps_sc == nullptr) traps_sc = &no_traps_sc;
+    std::valarray<TrapInstantCaptureContinuum> no_traps_ic_co = {};
+    if (traps_ic_co == nullptr) traps_ic_co = &no_traps_ic_co;
+    std::valarray<TrapSlowCaptureContinuum> no_traps_sc_co = {};
+    if (traps_sc_co == nullptr) traps_sc_co = &no_traps_sc_co;
+
+    if (max_trail_length < 0)
+        max_trail_length = trail_length_from_traps(
+            roe, traps_ic, traps_sc, traps_ic_co, traps_sc_co, min_event_n_electrons,
+            n_rows);
+
+    // Set up the trap managers once, for the longest possible segment
+    TrapManagerManager trap_manager_manager(
+        *traps_ic, *traps_sc, *traps_ic_co, *traps_sc_co, n_rows + row_offset, *ccd,
+        roe->dwell_times);
+
+    while (i_event < n_events) {
+        column_index = events[i_event].column;
+        segment_start = events[i_event].row;
+
+        // Extend the segment over all events within reach of its trails
+        i_event_last = i_event;
+        while ((i_event_last + 1 < n_events) &&
+               (events[i_event_last + 1].column == column_index) &&
+               (events[i_event_last + 1].row <=
+                events[i_event_last].row + max_trail_length))
+            i_event_last++;
+        segment_stop =
+            std::min(n_rows, events[i_event_last].row + max_trail_length + 1);
+
+        // Clock the segment as a window of a single-column image
+        for (int i = i_event; i <= i_event_last; i++)
+            column[events[i].row][0] = events[i].n_electrons;
+
+        clock_column_window(
+            column, roe, ccd, trap_manager_manager, segment_start,
+            segment_stop - segment_start, 0, prune_n_electrons, prune_frequency);
+
+        for (int row_index = segment_start; row_index < segment_stop; row_index++) {
+            if (fabs(column[row_index][0]) > min_event_n_electrons)
+                events_out.push_back(
+                    PixelEvent(row_index, column_index, column[row_index][0]));
+            column[row_index][0] = 0.0;
+        }
+
+        n_segments++;
+        n_clocked_rows += segment_stop - segment_start;
+        i_event = i_event_last + 1;
+    }
+
+    print_v(
+        1, "%d event(s), %d segment(s), %d row(s) clocked, %d event(s) out \n",
+        n_events, n_segments, n_clocked_rows, (int)events_out.size());
+
+    return std::valarray<PixelEvent>(events_out.data(), events_out.size());
+}
+
+/*
+    Add CTI trails to a sparse list of events, e.g. from a photon-counting or
+    X-ray frame, instead of a dense image.
+
+    Equivalent to add_cti() on image_from_events(events, n_rows, n_columns),
+    but only the columns (and rows, for serial clocking) that contain events
+    are clocked. See clock_events_in_one_direction() for the skipping of empty
+    spans, which is exact with max_trail_length = n_rows (or n_columns),
+    min_event_n_electrons = 0, and express = 0.
+
+    Only standard ROE clocking of the full image is currently supported, with
+    the traps emptied between columns.
+
+    Parameters
+    ----------
+    events : std::valarray<PixelEvent>&
+        The input list of non-zero pixels, assumed to be in units of electrons.
+        Any duplicate pixels are summed.
+
+    n_rows, n_columns : int
+        The shape of the full image.
+
+    parallel_roe, parallel_ccd, parallel_traps_ic, parallel_traps_sc,
+    parallel_traps_ic_co, parallel_traps_sc_co, parallel_express,
+    parallel_window_offset, parallel_prune_n_electrons, parallel_prune_frequency
+    serial_* (as above)
+        As for add_cti().
+
+    parallel_max_trail_length, serial_max_trail_length : int (opt.)
+        The maximum length of the trails to model behind each event, or -1
+        (default) for the length after which they fall below
+        min_event_n_electrons. Events further apart than this are assumed to
+        see empty traps. See clock_events_in_one_direction().
+
+    threshold : double (opt.)
+        Only output pixels with more than this many electrons are returned. Use
+        image_from_events() to convert the output into a dense image.
+
+    min_event_n_electrons : double (opt.)
+        Only the trail pixels with more than this many electrons are kept after
+        each direction of clocking, so the serial clocking only needs to model
+        the rows of significant parallel trails. Default 1e-3.
+
+    Returns
+    -------
+    events : std::valarray<PixelEvent>
+        The output list of pixels with CTI trails added, in order of row then
+        column.
+*/
+std::valarray<PixelEvent> add_cti_sparse(
+    std::valarray<PixelEvent>& events_in, int n_rows, int n_columns,
+    // Parallel
+    ROE* parallel_roe, CCD* parallel_ccd,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co,
+    int parallel_express, int parallel_offset, int parallel_max_trail_length,
+    double parallel_prune_n_electrons, int parallel_prune_frequency,
+    // Serial
+    ROE* serial_roe, CCD* serial_ccd,
+    std::valarray<TrapInstantCapture>* serial_traps_ic,
+    std::valarray<TrapSlowCapture>* serial_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co, int serial_express,
+    int serial_offset, int serial_max_trail_length, double serial_prune_n_electrons,
+    int serial_prune_frequency,
+    // Output
+    double threshold, double min_event_n_electrons) {
+
+    std::valarray<PixelEvent> events = events_in;
+
+    // Parallel clocking along columns, transfer charge towards row 0
+    if (parallel_traps_ic || parallel_traps_sc || parallel_traps_ic_co ||
+        parallel_traps_sc_co) {
+        print_v(1, "Parallel: ");
+        events = clock_events_in_one_direction(
+            events, n_rows, n_columns, parallel_roe, parallel_ccd, parallel_traps_ic,
+            parallel_traps_sc, parallel_traps_ic_co, parallel_traps_sc_co,
+            parallel_express, parallel_offset, parallel_max_trail_length,
+            parallel_prune_n_electrons, parallel_prune_frequency,
+            min_event_n_electrons);
+    }
+
+    // Serial clocking along rows, transfer charge towards column 0
+    if (serial_traps_ic || serial_traps_sc || serial_traps_ic_co ||
+        serial_traps_sc_co) {
+        print_v(1, "Serial: ");
+        events = transpose_events(events);
+        events = clock_events_in_one_direction(
+            events, n_columns, n_rows, serial_roe, serial_ccd, serial_traps_ic,
+            serial_traps_sc, serial_traps_ic_co, serial_traps_sc_co, serial_express,
+            serial_offset, serial_max_trail_length, serial_prune_n_electrons,
+            serial_prune_frequency, min_event_n_electrons);
+        events = transpose_events(events);
+    }
+
+    // Select the output pixels in row-major order
+    std::vector<PixelEvent> events_out;
+    for (int i_event = 0; i_event < events.size(); i_event++) {
+        if (events[i_event].n_electrons > threshold)
+            events_out.push_back(events[i_event]);
+    }
+    std::sort(
+        events_out.begin(), events_out.end(),
+        [](const PixelEvent& a, const PixelEvent& b) {
+            return (a.row < b.row) || ((a.row == b.row) && (a.column < b.column));
+        });
+
+    return std::valarray<PixelEvent>(events_out.data(), events_out.size());
+}
+
+/*
+    Remove CTI trails from a sparse list of events by first modelling the
+    addition of CTI, as for remove_cti().
+
+    The corrected pixels are never negative, so only the pixels in the input
+    list can be non-zero in the output.
+
+    Parameters
+    ----------
+    All parameters are identical to those of add_cti_sparse() as described in
+    its documentation, with the exception of:
+
+    n_iterations : int
+        As for remove_cti().
+
+    Returns
+    -------
+    events : std::valarray<PixelEvent>
+        The output list of pixels with CTI removed, in order of row then column.
+*/
+std::valarray<PixelEvent> remove_cti_sparse(
+    std::valarray<PixelEvent>& events_in, int n_iterations, int n_rows,
+    int n_columns,
+    // Parallel
+    ROE* parallel_roe, CCD* parallel_ccd,
+    std::valarray<TrapInstantCapture>* parallel_traps_ic,
+    std::valarray<TrapSlowCapture>* parallel_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* parallel_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* parallel_traps_sc_co,
+    int parallel_express, int parallel_offset, int parallel_max_trail_length,
+    double parallel_prune_n_electrons, int parallel_prune_frequency,
+    // Serial
+    ROE* serial_roe, CCD* serial_ccd,
+    std::valarray<TrapInstantCapture>* serial_traps_ic,
+    std::valarray<TrapSlowCapture>* serial_traps_sc,
+    std::valarray<TrapInstantCaptureContinuum>* serial_traps_ic_co,
+    std::valarray<TrapSlowCaptureContinuum>* serial_traps_sc_co, int serial_express,
+    int serial_offset, int serial_max_trail_length, double serial_prune_n_electrons,
+    int serial_prune_frequency,
+    // Output
+    double threshold, double min_event_n_electrons) {
+
+    print_version();
+
+    // The input pixels in row-major order, with duplicates summed
+    std::valarray<PixelEvent> events_transposed = transpose_events(events_in);
+    std::vector<PixelEvent> sorted_events =
+        sorted_events_by_column(events_transposed, n_columns, n_rows);
+    int n_events = sorted_events.size();
+    std::valarray<PixelEvent> events_remove_cti(n_events);
+    for (int i_event = 0; i_event < n_events; i_event++)
+        events_remove_cti[i_event] = PixelEvent(
+            sorted_events[i_event].column, sorted_events[i_event].row,
+            sorted_events[i_event].n_electrons);
+    std::valarray<PixelEvent> events_data = events_remove_cti;
+    std::valarray<PixelEvent> events_add_cti;
+
+    // Estimate the events with removed CTI more accurately each iteration
+    for (int iteration = 1; iteration <= n_iterations; iteration++) {
+        print_v(1, "Iter %d: ", iteration);
+
+        // Model the effect of adding CTI trails
+        events_add_cti = add_cti_sparse(
+            events_remove_cti, n_rows, n_columns, parallel_roe, parallel_ccd,
+            parallel_traps_ic, parallel_traps_sc, parallel_traps_ic_co,
+            parallel_traps_sc_co, parallel_express, parallel_offset,
+            parallel_max_trail_length, parallel_prune_n_electrons,
+            parallel_prune_frequency, serial_roe, serial_ccd, serial_traps_ic,
+            serial_traps_sc, serial_traps_ic_co, serial_traps_sc_co, serial_express,
+            serial_offset, serial_max_trail_length, serial_prune_n_electrons,
+            serial_prune_frequency, -1.0e300, min_event_n_electrons);
+
+        // Improve the estimate at the input pixels, matching up the model's
+        // row-major list (which also includes the trails outside them)
+        int i_model = 0;
+        for (int i_event = 0; i_event < n_events; i_event++) {
+            while ((i_model < events_add_cti.size()) &&
+                   ((events_add_cti[i_model].row < events_data[i_event].row) ||
+                    ((events_add_cti[i_model].row == events_data[i_event].row) &&
+                     (events_add_cti[i_model].column < events_data[i_event].column))))
+                i_model++;
+
+            double n_electrons_model = 0.0;
+            if ((i_model < events_add_cti.size()) &&
+                (events_add_cti[i_model].row == events_data[i_event].row) &&
+                (events_add_cti[i_model].column == events_data[i_event].column))
+                n_electrons_model = events_add_cti[i_model].n_electrons;
+
+            events_remove_cti[i_event].n_electrons +=
+                events_data[i_event].n_electrons - n_electrons_model;
+
+            // Prevent negative values
+            if (events_remove_cti[i_event].n_electrons < 0.0)
+                events_remove_cti[i_event].n_electrons = 0.0;
+        }
+    }
+
+    // Select the output pixels
+    std::vector<PixelEvent> events_out;
+    for (int i_event = 0; i_event < n_events; i_event++) {
+        if (events_remove_cti[i_event].n_electrons > threshold)
+            events_out.push_back(events_remove_cti[i_event]);
+    }
+
+    return std::valarray<PixelEvent>(events_out.data(), events_out.size());
+}
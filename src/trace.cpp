@@ -0,0 +1,224 @@
+
+#include "trace.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+// ========
+// Tracing
+// ========
+/*
+    An opt-in timeline of where the time goes, e.g. to find the columns or
+    stages responsible for an unusually slow image, or load imbalance between
+    threads. Spans are recorded by TraceSpan objects for the lifetime of their
+    scope, then saved in the Chrome trace-event JSON format to view in
+    chrome://tracing or ui.perfetto.dev.
+
+    Each thread appends to its own buffer of events, so recording doesn't
+    contend between threads. A buffer is reused by later threads once its
+    thread finishes, so each timeline track is one of at most as many
+    concurrent threads as were used, rather than one per short-lived thread.
+    With tracing off, each span costs only an atomic load and comparison of the
+    trace level.
+*/
+std::atomic<int> trace_level(0);
+
+class TraceBuffer {
+   public:
+    TraceBuffer(int tid) : tid(tid), in_use(true){};
+
+    int tid;
+    bool in_use;
+    std::vector<TraceEvent> events;
+};
+
+static std::mutex trace_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> trace_buffers;
+static std::chrono::steady_clock::time_point trace_start =
+    std::chrono::steady_clock::now();
+
+// Each thread's buffer, released for reuse when the thread exits
+class ThreadTraceHandle {
+   public:
+    ThreadTraceHandle() : buffer(nullptr){};
+    ~ThreadTraceHandle() {
+        if (buffer == nullptr) return;
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        buffer->in_use = false;
+    };
+
+    TraceBuffer* buffer;
+};
+static thread_local ThreadTraceHandle thread_trace_handle;
+
+static TraceBuffer* get_thread_buffer() {
+    if (thread_trace_handle.buffer != nullptr) return thread_trace_handle.buffer;
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    for (auto& buffer : trace_buffers) {
+        if (!buffer->in_use) {
+            buffer->in_use = true;
+            thread_trace_handle.buffer = buffer.get();
+            return buffer.get();
+        }
+    }
+    trace_buffers.push_back(
+        std::unique_ptr<TraceBuffer>(new TraceBuffer(trace_buffers.size())));
+    thread_trace_handle.buffer = trace_buffers.back().get();
+    return thread_trace_handle.buffer;
+}
+
+/*
+    Start recording trace spans, relative to now, discarding any previous ones.
+
+    Parameters
+    ----------
+    level : int (opt.)
+        The level of detail, see trace_level. Higher levels record many more
+        spans, e.g. level 3 records every watermark pruning.
+*/
+void start_trace(int level) {
+    clear_trace();
+    trace_start = std::chrono::steady_clock::now();
+    // Set last, to publish the new start time to the recording threads
+    trace_level.store(level);
+}
+
+/*
+    Stop recording trace spans, keeping the recorded ones.
+*/
+void stop_trace() { trace_level.store(0); }
+
+/*
+    Discard all recorded trace spans. Must not be called while any threads are
+    recording spans, nor get_trace_events() or save_trace().
+*/
+void clear_trace() {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    for (auto& buffer : trace_buffers) buffer->events.clear();
+}
+
+/*
+    Record a finished span, see TraceSpan.
+
+    Parameters
+    ----------
+    name : const char*
+        The span's name, which must be a string literal (or otherwise outlive
+        the trace).
+
+    start : std::chrono::steady_clock::time_point
+        The time the span started. It ends now.
+
+    index : int
+        E.g. the column index, or -1 for none.
+*/
+void record_trace_event(
+    const char* name, std::chrono::steady_clock::time_point start, int index) {
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    TraceBuffer* buffer = get_thread_buffer();
+
+    TraceEvent event;
+    event.name = name;
+    event.tid = buffer->tid;
+    event.start_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(start - trace_start)
+            .count();
+    event.duration_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    event.index = index;
+    buffer->events.push_back(event);
+}
+
+/*
+    Copy all the recorded trace spans from every thread, in order of their start
+    times.
+*/
+std::vector<TraceEvent> get_trace_events() {
+    std::vector<TraceEvent> events;
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    for (auto& buffer : trace_buffers)
+        events.insert(events.end(), buffer->events.begin(), buffer->events.end());
+    std::stable_sort(
+        events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) {
+            return a.start_ns < b.start_ns;
+        });
+
+    return events;
+}
+
+/*
+    Format trace spans as Chrome trace-event JSON, with a complete ("X") event
+    for each span and a name for each thread's track. Times are in
+    microseconds.
+*/
+std::string trace_events_to_json(const std::vector<TraceEvent>& events) {
+    std::string json = "{\"traceEvents\": [\n";
+    char line[256];
+    int n_tids = 0;
+
+    for (const TraceEvent& event : events) {
+        if (event.index >= 0)
+            snprintf(
+                line, sizeof(line),
+                "{\"name\": \"%s\", \"cat\": \"arctic\", \"ph\": \"X\", \"ts\": %.3f, "
+                "\"dur\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {\"index\": %d}},\n",
+                event.name, event.start_ns * 1e-3, event.duration_ns * 1e-3, event.tid,
+                event.index);
+        else
+            snprintf(
+                line, sizeof(line),
+                "{\"name\": \"%s\", \"cat\": \"arctic\", \"ph\": \"X\", \"ts\": %.3f, "
+                "\"dur\": %.3f, \"pid\": 1, \"tid\": %d},\n",
+                event.name, event.start_ns * 1e-3, event.duration_ns * 1e-3,
+                event.tid);
+        json += line;
+        n_tids = std::max(n_tids, event.tid + 1);
+    }
+
+    for (int tid = 0; tid < n_tids; tid++) {
+        snprintf(
+            line, sizeof(line),
+            "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+            "\"args\": {\"name\": \"arctic thread %d\"}},\n",
+            tid, tid);
+        json += line;
+    }
+    json +=
+        "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": "
+        "\"arctic\"}}\n"
+        "], \"displayTimeUnit\": \"ms\"}\n";
+
+    return json;
+}
+
+/*
+    Save the recorded trace spans to a JSON file, see trace_events_to_json().
+
+    Returns
+    -------
+    status : int
+        0 for success, or 1 if the file couldn't be written.
+*/
+int save_trace(const char* filename) {
+    std::vector<TraceEvent> events = get_trace_events();
+
+    std::ofstream file(filename);
+    if (!file) return 1;
+    file << trace_events_to_json(events);
+    if (!file) return 1;
+    print_v(1, "Saved %d trace events to %s \n", (int)events.size(), filename);
+
+    return 0;
+}
@@ -4,9 +4,13 @@
 #include <math.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <limits>
 #include <valarray>
+#include <vector>
 
 #include "ccd.hpp"
+#include "trace.hpp"
 #include "traps.hpp"
 #include "util.hpp"
 #include <iostream>
@@ -157,6 +161,67 @@ void TrapManagerBase::restore_trap_states() {
     watermark_fills = stored_watermark_fills;
 }
 
+/*
+    Copy the active watermarks, e.g. to checkpoint the trap states or to start
+    clocking another column from them. See TrapStates.
+
+    Parameters
+    ----------
+    volumes, fills : std::valarray<double>&
+        Set to the active watermarks' volumes and (n_watermarks x n_traps)
+        fills, without any unused watermarks.
+*/
+void TrapManagerBase::save_trap_state(
+    std::valarray<double>& volumes, std::valarray<double>& fills) {
+
+    if (volumes.size() != n_active_watermarks) volumes.resize(n_active_watermarks);
+    if (fills.size() != n_active_watermarks * n_traps)
+        fills.resize(n_active_watermarks * n_traps);
+
+    for (int i_wmk = 0; i_wmk < n_active_watermarks; i_wmk++) {
+        volumes[i_wmk] = watermark_volumes[i_first_active_wmk + i_wmk];
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            fills[i_wmk * n_traps + i_trap] =
+                watermark_fills[(i_first_active_wmk + i_wmk) * n_traps + i_trap];
+    }
+}
+
+/*
+    Set the watermarks from saved ones, see save_trap_state(), and store them
+    as the states to restore, as at the start of a new column.
+*/
+void TrapManagerBase::load_trap_state(
+    const std::valarray<double>& volumes, const std::valarray<double>& fills) {
+
+    int n_loaded_watermarks = volumes.size();
+    if ((n_loaded_watermarks >= n_watermarks) ||
+        (fills.size() != n_loaded_watermarks * n_traps))
+        error(
+            "Can't load %d watermarks (%d fills) into a trap manager with %d "
+            "watermarks of %d traps",
+            n_loaded_watermarks, (int)fills.size(), n_watermarks, n_traps);
+
+    reset_trap_states();
+    n_active_watermarks = n_loaded_watermarks;
+    for (int i_wmk = 0; i_wmk < n_active_watermarks; i_wmk++) {
+        watermark_volumes[i_wmk] = volumes[i_wmk];
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            watermark_fills[i_wmk * n_traps + i_trap] = fills[i_wmk * n_traps + i_trap];
+    }
+
+    store_trap_states();
+}
+
+/*
+    Multiply the trap densities by a factor, along with the current and stored
+    fills, so that the fractions of filled traps are unchanged.
+*/
+void TrapManagerBase::scale_trap_densities(double factor) {
+    trap_densities *= factor;
+    watermark_fills *= factor;
+    stored_watermark_fills *= factor;
+}
+
 /*
     Call any necessary initialisation functions, etc.
 */
@@ -174,14 +239,13 @@ void TrapManagerBase::setup() { initialise_trap_states(); }
 */
 double TrapManagerBase::n_trapped_electrons_in_watermark(int i_wmk) {
 
-    // Fill fraction * trap density (an array for each trap species)
-    std::valarray<double> fill_fractions_in_this_wmk =
-        watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)];
-    // Multiplied by volume
-    double n_trapped_electrons_in_this_wmk = 
-        fill_fractions_in_this_wmk.sum() * watermark_volumes[i_wmk];
+    // Fill fraction * trap density, summed over the trap species
+    double fill = 0.0;
+    for (int i_trap = 0; i_trap < n_traps; i_trap++)
+        fill += watermark_fills[i_wmk * n_traps + i_trap];
 
-    return n_trapped_electrons_in_this_wmk;
+    // Multiplied by volume
+    return fill * watermark_volumes[i_wmk];
 }
 
 /*
@@ -233,7 +297,40 @@ double TrapManagerBase::n_trapped_electrons_total() {
     return n_trapped_electrons;
 }
 
+/*
+    Sum the number of electrons currently held in all traps, as for
+    n_trapped_electrons_total(), but stop once the sum reaches a limit.
+
+    This is cheap enough to call for every pixel, since the first watermark
+    alone usually exceeds the limit unless the traps are almost empty.
+
+    Parameters
+    ----------
+    max_n_electrons : double
+        The limit at which to stop summing.
+
+    Returns
+    -------
+    n_trapped_electrons : double
+        The number of electrons stored in traps, or any value at least
+        max_n_electrons if there are at least that many.
+*/
+double TrapManagerBase::n_trapped_electrons_up_to(double max_n_electrons) {
+    double n_trapped_electrons = 0.0;
+    double fill;
+
+    for (int i_wmk = i_first_active_wmk;
+         i_wmk < i_first_active_wmk + n_active_watermarks; i_wmk++) {
+        fill = 0.0;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            fill += watermark_fills[i_wmk * n_traps + i_trap];
+
+        n_trapped_electrons += fill * watermark_volumes[i_wmk];
+        if (n_trapped_electrons >= max_n_electrons) break;
+    }
 
+    return n_trapped_electrons;
+}
 
 /*
     Sum the total number of electrons currently held in traps.
@@ -249,23 +346,24 @@ double TrapManagerBase::n_trapped_electrons_total() {
         The number of electrons stored in traps.
 */
 double TrapManagerBase::n_trapped_electrons_from_watermarks(
-    std::valarray<double> wmk_volumes, std::valarray<double> wmk_fills) {
+    const std::valarray<double>& wmk_volumes, const std::valarray<double>& wmk_fills) {
 
     // No watermarks
     if (n_active_watermarks == 0) return 0.0;
 
     double n_trapped_electrons_total = 0.0;
-    std::valarray<double> n_trapped_electrons_this_wmk(n_traps);
+    double fill;
 
     // Each active watermark
     for (int i_wmk = i_first_active_wmk;
          i_wmk < i_first_active_wmk + n_active_watermarks; i_wmk++) {
-        // Extract the fill fractions in a 1D array
-        n_trapped_electrons_this_wmk =
-            wmk_fills[std::slice(i_wmk * n_traps, n_traps, 1)];
+        // Sum the fill fractions
+        fill = 0.0;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            fill += wmk_fills[i_wmk * n_traps + i_trap];
 
-        // Sum the fill fractions and multiply by the fractional volume
-        n_trapped_electrons_total += n_trapped_electrons_this_wmk.sum() * wmk_volumes[i_wmk];
+        // Multiply by the fractional volume
+        n_trapped_electrons_total += fill * wmk_volumes[i_wmk];
     }
 
     return n_trapped_electrons_total;
@@ -303,10 +401,7 @@ void TrapManagerBase::prune_watermarks(double min_n_electrons) {
     if (n_trapped_electrons_in_watermark(i_first_active_wmk) <= 0) return; // Something has gone wrong to get here
     print_v(3, "prune watermarks continaing fewer than %g electrons. Watermarks: %d %d\n", min_n_electrons, i_first_active_wmk, n_active_watermarks);
 
-    // Count the total number of electrons in each watermark
     print_v(3,"\n\n Fill fractions before prune (first %d n %d)\n",i_first_active_wmk, n_active_watermarks);
-    std::valarray<double> n_trapped_electrons_per_wmk = n_trapped_electrons_per_watermark();
-    double n_trapped_electrons_start = n_trapped_electrons_per_wmk.sum();
     double n_trapped_electrons_in_this_wmk;
     double test_value;
     double test_criterion = abs(min_n_electrons);
@@ -422,6 +517,15 @@ void TrapManagerBase::prune_watermarks(double min_n_electrons) {
     }
     n_active_watermarks -= n_watermarks_pruned;
 
+    // Clear the vacated watermarks, since a new watermark above the others
+    // adds to the volume already in its slot
+    for (int i_wmk = i_first_active_wmk + n_active_watermarks;
+         i_wmk < i_first_active_wmk + n_active_watermarks + n_watermarks_pruned;
+         i_wmk++) {
+        watermark_volumes[i_wmk] = 0.0;
+        watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)] = 0.0;
+    }
+
     // Count the total number of electrons in each watermark
     print_v(3,"\n\n Fill fractions after prune (first %d n %d)\n",i_first_active_wmk, n_active_watermarks);
     
@@ -487,116 +591,63 @@ double TrapManagerBase::n_electrons_released_from_wmk_above_cloud(int i_wmk) {
 
 
 // ========
-// TrapManagerInstantCapture::
+// Instant-capture algorithms
 // ========
 /*
-    Class TrapManagerInstantCapture.
-
-    For the standard release-then-instant-capture algorithm.
-
-    Attributes
-    ----------
-    any_non_uniform_traps : double
-        Default false, set to true if any of the traps have a non-uniform
-        distribution with volume, in which case some small extra steps are
-        required in the release and capture functions.
-*/
-TrapManagerInstantCapture::TrapManagerInstantCapture(
-    std::valarray<TrapInstantCapture> traps, int max_n_transfers, CCDPhase ccd_phase,
-    double dwell_time)
-    : TrapManagerBase(max_n_transfers, ccd_phase, dwell_time), traps(traps) {
-
-    n_traps = traps.size();
-    trap_densities = std::valarray<double>(n_traps);
-    for (int i_trap = 0; i_trap < n_traps; i_trap++) {
-        trap_densities[i_trap] = traps[i_trap].density;
-    }
-
-    any_non_uniform_traps = false;
-    for (int i_trap = 0; i_trap < n_traps; i_trap++) {
-        if (traps[i_trap].fractional_volume_full_exposed > 0.0) {
-            any_non_uniform_traps = true;
-            break;
-        }
-    }
-}
-
-/*
-    Set the probabilities of traps being full after release.
+    The watermark and release-then-instant-capture functions shared by
+    TrapManagerInstantCapture and TrapManagerInstantCaptureDual, templated on
+    the Scalar type of their watermarks and trap parameters: double, or Dual to
+    also track the derivatives with respect to the trap parameters.
 
-    Sets
-    ----
-    empty_probabilities_from_release : std::valarray<double>
-        The fraction of traps that were full that become empty after release.
+    See the TrapManagerInstantCapture methods of the same names for the details.
 */
-void TrapManagerInstantCapture::set_fill_probabilities() {
-    empty_probabilities_from_release = std::valarray<double>(0.0, n_traps);
-
-    // Set probabilities for each trap species
-    for (int i_trap = 0; i_trap < n_traps; i_trap++) {
-        // Resulting empty fraction from release
-        empty_probabilities_from_release[i_trap] =
-            1.0 - exp(-traps[i_trap].release_rate * dwell_time);
-    }
+static double cloud_fractional_volume_from_electrons(
+    TrapManagerInstantCapture& manager, double n_electrons) {
+    return manager.ccd_phase.cloud_fractional_volume_from_electrons(n_electrons);
 }
 
-/*
-    Call any necessary initialisation functions, etc.
-*/
-void TrapManagerInstantCapture::setup() {
-    initialise_trap_states();
-    set_fill_probabilities();
+static Dual cloud_fractional_volume_from_electrons(
+    TrapManagerInstantCaptureDual& manager, const Dual& n_electrons) {
+    return manager.cloud_fractional_volume_from_electrons(n_electrons);
 }
 
-/*
-    Release electrons from traps and update the watermarks.
-
-    Returns
-    -------
-    n_electrons_released : double
-        The number of released electrons.
-
-    Updates
-    -------
-    watermark_volumes, watermark_fills : std::valarray<double>
-        The updated watermarks.
-*/
-double TrapManagerInstantCapture::n_electrons_released() {
-    double n_released = 0.0;
-    double n_released_this_wmk;
-    double frac_released;
-    double frac_exposed_per_volume;
+template <typename Scalar, typename Manager>
+static Scalar instant_capture_n_electrons_released(Manager& manager) {
+    std::valarray<Scalar>& watermark_volumes = manager.watermark_volumes;
+    std::valarray<Scalar>& watermark_fills = manager.watermark_fills;
+    int n_traps = manager.n_traps;
+    Scalar n_released = 0.0;
+    Scalar n_released_this_wmk;
+    Scalar frac_released;
     double cumulative_volume = 0.0;
     double next_cumulative_volume = 0.0;
 
     // Each active watermark
-    for (int i_wmk = i_first_active_wmk;
-         i_wmk < i_first_active_wmk + n_active_watermarks; i_wmk++) {
+    for (int i_wmk = manager.i_first_active_wmk;
+         i_wmk < manager.i_first_active_wmk + manager.n_active_watermarks; i_wmk++) {
         n_released_this_wmk = 0.0;
 
-        if (any_non_uniform_traps) {
+        if (manager.any_non_uniform_traps) {
             // Total volume at the bottom and top of this watermark
             cumulative_volume = next_cumulative_volume;
-            next_cumulative_volume += watermark_volumes[i_wmk];
+            next_cumulative_volume += value_of(watermark_volumes[i_wmk]);
         }
 
         // Each trap species
         for (int i_trap = 0; i_trap < n_traps; i_trap++) {
             // Fraction of released electrons
             frac_released = watermark_fills[i_wmk * n_traps + i_trap] *
-                            empty_probabilities_from_release[i_trap];
+                            manager.empty_probabilities_from_release[i_trap];
 
-            // Account for non-uniform distribution with volume
-            if (traps[i_trap].fractional_volume_full_exposed == 0.0)
-                frac_exposed_per_volume = 1.0;
+            // Number released, accounting for any non-uniform distribution
+            if (manager.traps[i_trap].fractional_volume_full_exposed == 0.0)
+                n_released_this_wmk += frac_released;
             else
-                frac_exposed_per_volume =
-                    traps[i_trap].fraction_traps_exposed_per_fractional_volume(
+                n_released_this_wmk +=
+                    frac_released *
+                    manager.traps[i_trap].fraction_traps_exposed_per_fractional_volume(
                         cumulative_volume, next_cumulative_volume);
 
-            // Number released
-            n_released_this_wmk += frac_released * frac_exposed_per_volume;
-
             // Update the watermark fill fraction
             watermark_fills[i_wmk * n_traps + i_trap] -= frac_released;
         }
@@ -608,62 +659,24 @@ double TrapManagerInstantCapture::n_electrons_released() {
     return n_released;
 }
 
-/*
-    How many electrons will be released from a watermark above the cloud,
-    during the next timestep.
-
-    Parameters
-    ----------
-    cloud_fractional_volume : double
-        The fractional volume the electron cloud reaches in the pixel well.
-
-    Returns
-    -------
-    i_wmk_above_cloud : int
-        The index of the first active watermark that reaches above the cloud.
-*/
-double TrapManagerInstantCapture::n_electrons_released_from_wmk_above_cloud(int i_wmk) {
-    
-    //print_v(0,"IC child version of n_electrons_released_from_wmk_above_cloud %g \n",empty_probabilities_from_release[0]);;
-
-    // Fraction of electrons released from each trap species
-    double frac_released_this_wmk = 0.0;
-    for (int i_trap = 0; i_trap < n_traps; i_trap++) {
-        // Fraction of released electrons
-        frac_released_this_wmk +=
-            watermark_fills[i_wmk * n_traps + i_trap] *
-            empty_probabilities_from_release[i_trap];
-    }
-
-    // Multiply by the watermark volume
-    return frac_released_this_wmk * watermark_volumes[i_wmk];
-}
-
-/*
-    Modify the watermarks for normal capture.
-
-    Parameters
-    ----------
-    cloud_fractional_volume : double
-        The fractional volume the electron cloud reaches in the pixel well.
-
-    i_wmk_above_cloud : int
-        The index of the first active watermark that reaches above the cloud.
+template <typename Scalar, typename Manager>
+static void instant_capture_update_watermarks_capture(
+    Manager& manager, Scalar cloud_fractional_volume, int i_wmk_above_cloud) {
+    std::valarray<Scalar>& watermark_volumes = manager.watermark_volumes;
+    std::valarray<Scalar>& watermark_fills = manager.watermark_fills;
+    std::valarray<Scalar>& trap_densities = manager.trap_densities;
+    int& n_active_watermarks = manager.n_active_watermarks;
+    int& i_first_active_wmk = manager.i_first_active_wmk;
+    int n_traps = manager.n_traps;
 
-    Updates
-    -------
-    watermark_volumes, watermark_fills : std::valarray<double>
-        The updated watermarks.
-*/
-void TrapManagerInstantCapture::update_watermarks_capture(
-    double cloud_fractional_volume, int i_wmk_above_cloud) {
     // First capture
     if (n_active_watermarks == 0) {
         // Set fractional volume
         watermark_volumes[0] = cloud_fractional_volume;
 
         // Set fill fractions for all trap species
-        watermark_fills[std::slice(0, n_traps, 1)] = trap_densities;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            watermark_fills[i_trap] = trap_densities[i_trap];
 
         // Update count of active watermarks
         n_active_watermarks++;
@@ -688,14 +701,13 @@ void TrapManagerInstantCapture::update_watermarks_capture(
         }
 
         // Update count of active watermarks
-        //print_v(0,"Adding new watermark %d\n",n_active_watermarks);
         n_active_watermarks++;
-        //print_v(2,"Added new watermark %d\n",n_active_watermarks);
 
         // New watermark
         watermark_volumes[i_first_active_wmk] = cloud_fractional_volume;
-        watermark_fills[std::slice(i_first_active_wmk * n_traps, n_traps, 1)] =
-            trap_densities;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            watermark_fills[i_first_active_wmk * n_traps + i_trap] =
+                trap_densities[i_trap];
 
         // Update fractional volume of the partially overwritten watermark above
         watermark_volumes[i_first_active_wmk + 1] -= cloud_fractional_volume;
@@ -708,18 +720,19 @@ void TrapManagerInstantCapture::update_watermarks_capture(
 
         // New first watermark
         watermark_volumes[i_first_active_wmk] = cloud_fractional_volume;
-        watermark_fills[std::slice(i_first_active_wmk * n_traps, n_traps, 1)] =
-            trap_densities;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            watermark_fills[i_first_active_wmk * n_traps + i_trap] =
+                trap_densities[i_trap];
 
         // Update count of active watermarks
-        print_v(2,"Resetting watermarks");
+        print_v(2, "Resetting watermarks");
         n_active_watermarks = 1;
     }
 
     // Cloud between current watermarks
     else {
         // Update fractional volume of the partially overwritten watermark
-        double previous_total_volume = 0.0;
+        Scalar previous_total_volume = 0.0;
         for (int i_wmk = i_first_active_wmk; i_wmk <= i_wmk_above_cloud; i_wmk++) {
             previous_total_volume += watermark_volumes[i_wmk];
         }
@@ -734,50 +747,32 @@ void TrapManagerInstantCapture::update_watermarks_capture(
 
         // New first watermark
         watermark_volumes[i_first_active_wmk] = cloud_fractional_volume;
-        watermark_fills[std::slice(i_first_active_wmk * n_traps, n_traps, 1)] =
-            trap_densities;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            watermark_fills[i_first_active_wmk * n_traps + i_trap] =
+                trap_densities[i_trap];
     }
-
-    return;
 }
 
-/*
-    Modify the watermarks for capture when not enough electrons are available.
-
-    Each watermark is partially filled a fraction (`enough`) of the way to full,
-    such that the resulting number of captured electrons is restricted to the
-    number actually available for capture.
-
-    This only becomes relevant for tiny numbers of electrons, where the cloud
-    can reach a disproportionately large volume in the pixel (reaching
-    correspondingly many traps) for the small amount of charge.
-
-    Parameters
-    ----------
-    cloud_fractional_volume : double
-        The fractional volume the electron cloud reaches in the pixel well.
-
-    i_wmk_above_cloud : int
-        The index of the first active watermark that reaches above the cloud.
-
-    enough : double
-        The amount of electrons available as a fraction of the number that
-        could be captured by the watermarks reached by the cloud volume.
+template <typename Scalar, typename Manager>
+static void instant_capture_update_watermarks_capture_not_enough(
+    Manager& manager, Scalar cloud_fractional_volume, int i_wmk_above_cloud,
+    Scalar enough) {
+    std::valarray<Scalar>& watermark_volumes = manager.watermark_volumes;
+    std::valarray<Scalar>& watermark_fills = manager.watermark_fills;
+    std::valarray<Scalar>& trap_densities = manager.trap_densities;
+    int& n_active_watermarks = manager.n_active_watermarks;
+    int& i_first_active_wmk = manager.i_first_active_wmk;
+    int n_traps = manager.n_traps;
+    Scalar not_enough = 1.0 - enough;
 
-    Updates
-    -------
-    watermark_volumes, watermark_fills : std::valarray<double>
-        The updated watermarks.
-*/
-void TrapManagerInstantCapture::update_watermarks_capture_not_enough(
-    double cloud_fractional_volume, int i_wmk_above_cloud, double enough) {
     // First capture
     if (n_active_watermarks == 0) {
         // Set fractional volume
         watermark_volumes[0] = cloud_fractional_volume;
 
         // Set fill fractions for all trap species
-        watermark_fills[std::slice(0, n_traps, 1)] = trap_densities * enough;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            watermark_fills[i_trap] = trap_densities[i_trap] * enough;
 
         // Update count of active watermarks
         n_active_watermarks++;
@@ -806,11 +801,10 @@ void TrapManagerInstantCapture::update_watermarks_capture_not_enough(
 
         // New watermark
         watermark_volumes[i_first_active_wmk] = cloud_fractional_volume;
-        watermark_fills[std::slice(i_first_active_wmk * n_traps, n_traps, 1)] =
-            (std::valarray<double>)watermark_fills[std::slice(
-                i_first_active_wmk * n_traps, n_traps, 1)] *
-                (1.0 - enough) +
-            enough * trap_densities;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            watermark_fills[i_first_active_wmk * n_traps + i_trap] =
+                watermark_fills[i_first_active_wmk * n_traps + i_trap] * not_enough +
+                enough * trap_densities[i_trap];
 
         // Update fractional volume of the partially overwritten watermark above
         watermark_volumes[i_first_active_wmk + 1] -= cloud_fractional_volume;
@@ -819,26 +813,24 @@ void TrapManagerInstantCapture::update_watermarks_capture_not_enough(
     // Cloud above all current watermarks
     else if (i_wmk_above_cloud == i_first_active_wmk + n_active_watermarks) {
         // Cumulative volume of the watermark just below the new one
-        double volume_below = 0.0;
+        Scalar volume_below = 0.0;
         for (int i_wmk = i_first_active_wmk; i_wmk < i_wmk_above_cloud; i_wmk++) {
             volume_below += watermark_volumes[i_wmk];
         }
 
         // New watermark
         watermark_volumes[i_wmk_above_cloud] = cloud_fractional_volume - volume_below;
-        //print_v(0,"Above cloud notenough. i %d wv %g cfv %g vb %g\n",i_wmk_above_cloud,watermark_volumes[i_wmk_above_cloud],cloud_fractional_volume,volume_below);
-        watermark_fills[std::slice(
-            (i_first_active_wmk + n_active_watermarks) * n_traps, n_traps, 1)] =
-            enough * trap_densities;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            watermark_fills[i_wmk_above_cloud * n_traps + i_trap] =
+                enough * trap_densities[i_trap];
 
         // Update all other watermarks part-way to full
         for (int i_wmk = i_first_active_wmk;
              i_wmk < i_first_active_wmk + n_active_watermarks; i_wmk++) {
-            watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)] =
-                (std::valarray<double>)
-                        watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)] *
-                    (1.0 - enough) +
-                enough * trap_densities;
+            for (int i_trap = 0; i_trap < n_traps; i_trap++)
+                watermark_fills[i_wmk * n_traps + i_trap] =
+                    watermark_fills[i_wmk * n_traps + i_trap] * not_enough +
+                    enough * trap_densities[i_trap];
         }
 
         // Update count of active watermarks
@@ -858,7 +850,7 @@ void TrapManagerInstantCapture::update_watermarks_capture_not_enough(
         }
 
         // Cumulative volume of the watermark just below the new one
-        double volume_below = 0.0;
+        Scalar volume_below = 0.0;
         for (int i_wmk = i_first_active_wmk; i_wmk < i_wmk_above_cloud; i_wmk++) {
             volume_below += watermark_volumes[i_wmk];
         }
@@ -867,66 +859,51 @@ void TrapManagerInstantCapture::update_watermarks_capture_not_enough(
         watermark_volumes[i_wmk_above_cloud] = cloud_fractional_volume - volume_below;
 
         // Update volume of the partially overwritten watermark
-        //print_v(0,"wmv %g %g\n",watermark_volumes[i_wmk_above_cloud + 1],watermark_volumes[i_wmk_above_cloud + 1]-watermark_volumes[i_wmk_above_cloud]);
         watermark_volumes[i_wmk_above_cloud + 1] -=
             watermark_volumes[i_wmk_above_cloud];
 
         // Update all watermarks, including the new one, part-way to full
         for (int i_wmk = i_first_active_wmk; i_wmk <= i_wmk_above_cloud; i_wmk++) {
-            watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)] =
-                (std::valarray<double>)
-                        watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)] *
-                    (1.0 - enough) +
-                enough * trap_densities;
+            for (int i_trap = 0; i_trap < n_traps; i_trap++)
+                watermark_fills[i_wmk * n_traps + i_trap] =
+                    watermark_fills[i_wmk * n_traps + i_trap] * not_enough +
+                    enough * trap_densities[i_trap];
         }
 
         // Update count of active watermarks
         n_active_watermarks++;
     }
-
-    return;
 }
 
-/*
-    Capture electrons in traps and update the watermarks.
-
-    Parameters
-    ----------
-    n_free_electrons : double
-        The number of available electrons for trapping.
-
-    Returns
-    -------
-    n_electrons_captured : double
-        The number of captured electrons.
+template <typename Scalar, typename Manager>
+static Scalar instant_capture_n_electrons_captured(
+    Manager& manager, Scalar n_free_electrons) {
+    std::valarray<Scalar>& watermark_volumes = manager.watermark_volumes;
+    std::valarray<Scalar>& watermark_fills = manager.watermark_fills;
+    std::valarray<Scalar>& trap_densities = manager.trap_densities;
+    int n_traps = manager.n_traps;
 
-    Updates
-    -------
-    watermark_volumes, watermark_fills : std::valarray<double>
-        The updated watermarks.
-*/
-double TrapManagerInstantCapture::n_electrons_captured(double n_free_electrons) {
     // The fractional volume the electron cloud reaches in the pixel well
-    double cloud_fractional_volume =
-        ccd_phase.cloud_fractional_volume_from_electrons(n_free_electrons);
+    Scalar cloud_fractional_volume =
+        cloud_fractional_volume_from_electrons(manager, n_free_electrons);
 
     // No capture
-    if (cloud_fractional_volume == 0.0) return 0.0;
+    if (value_of(cloud_fractional_volume) == 0.0) return 0.0;
 
     // ========
     // Count the number of electrons that can be captured by each watermark
     // ========
-    double n_captured = 0.0;
-    double n_captured_this_wmk;
-    double cumulative_volume = 0.0;
-    double next_cumulative_volume = 0.0;
-    double volume_top;
-    double frac_exposed_per_volume;
+    Scalar n_captured = 0.0;
+    Scalar n_captured_this_wmk;
+    Scalar cumulative_volume = 0.0;
+    Scalar next_cumulative_volume = 0.0;
+    Scalar volume_top;
 
-    int i_wmk_above_cloud = watermark_index_above_cloud(cloud_fractional_volume);
+    int i_wmk_above_cloud =
+        manager.watermark_index_above_cloud(value_of(cloud_fractional_volume));
 
     // Each active watermark
-    for (int i_wmk = i_first_active_wmk; i_wmk <= i_wmk_above_cloud; i_wmk++) {
+    for (int i_wmk = manager.i_first_active_wmk; i_wmk <= i_wmk_above_cloud; i_wmk++) {
         n_captured_this_wmk = 0.0;
 
         // Total volume at the bottom and top of this watermark
@@ -942,19 +919,17 @@ double TrapManagerInstantCapture::n_electrons_captured(double n_free_electrons)
             volume_top = next_cumulative_volume;
         }
 
-        // Each trap species
+        // Each trap species, accounting for any non-uniform distribution
         for (int i_trap = 0; i_trap < n_traps; i_trap++) {
-            // Account for non-uniform distribution with volume
-            if (traps[i_trap].fractional_volume_full_exposed == 0.0)
-                frac_exposed_per_volume = 1.0;
+            if (manager.traps[i_trap].fractional_volume_full_exposed == 0.0)
+                n_captured_this_wmk +=
+                    trap_densities[i_trap] - watermark_fills[i_wmk * n_traps + i_trap];
             else
-                frac_exposed_per_volume =
-                    traps[i_trap].fraction_traps_exposed_per_fractional_volume(
-                        cumulative_volume, volume_top);
-
-            n_captured_this_wmk +=
-                (trap_densities[i_trap] - watermark_fills[i_wmk * n_traps + i_trap]) *
-                frac_exposed_per_volume;
+                n_captured_this_wmk +=
+                    (trap_densities[i_trap] -
+                     watermark_fills[i_wmk * n_traps + i_trap]) *
+                    manager.traps[i_trap].fraction_traps_exposed_per_fractional_volume(
+                        value_of(cumulative_volume), value_of(volume_top));
         }
 
         // Capture from the bottom to the top of the watermark
@@ -965,16 +940,17 @@ double TrapManagerInstantCapture::n_electrons_captured(double n_free_electrons)
     // Update the watermarks
     // ========
     // Check enough available electrons to capture
-    double enough = n_free_electrons / n_captured;
+    Scalar enough = n_free_electrons / n_captured;
 
     // Normal full capture
-    if (enough >= 1.0) {
-        update_watermarks_capture(cloud_fractional_volume, i_wmk_above_cloud);
+    if (value_of(enough) >= 1.0) {
+        instant_capture_update_watermarks_capture(
+            manager, cloud_fractional_volume, i_wmk_above_cloud);
     }
     // Partial capture
     else {
-        update_watermarks_capture_not_enough(
-            cloud_fractional_volume, i_wmk_above_cloud, enough);
+        instant_capture_update_watermarks_capture_not_enough(
+            manager, cloud_fractional_volume, i_wmk_above_cloud, enough);
 
         n_captured *= enough;
     }
@@ -982,14 +958,216 @@ double TrapManagerInstantCapture::n_electrons_captured(double n_free_electrons)
     return n_captured;
 }
 
-/*
-    Release and capture electrons and update the trap watermarks.
+template <typename Scalar, typename Manager>
+static Scalar instant_capture_n_electrons_released_and_captured(
+    Manager& manager, Scalar n_free_electrons) {
 
-    The interaction between traps and the charge cloud during its dwell time in
-    this pixel (and phase) is modelled as follows:
-    + First the previously filled traps release charge.
-    + This may update the number of free electrons in the cloud that are
-        available for capture.
+    Scalar n_released = instant_capture_n_electrons_released<Scalar>(manager);
+    print_v(2, "n_electrons_released  %g \n", value_of(n_released));
+
+    Scalar n_captured =
+        instant_capture_n_electrons_captured(manager, n_free_electrons + n_released);
+    print_v(2, "n_electrons_captured  %g \n", value_of(n_captured));
+
+    return n_released - n_captured;
+}
+
+// ========
+// TrapManagerInstantCapture::
+// ========
+/*
+    Class TrapManagerInstantCapture.
+
+    For the standard release-then-instant-capture algorithm.
+
+    Attributes
+    ----------
+    any_non_uniform_traps : double
+        Default false, set to true if any of the traps have a non-uniform
+        distribution with volume, in which case some small extra steps are
+        required in the release and capture functions.
+*/
+TrapManagerInstantCapture::TrapManagerInstantCapture(
+    std::valarray<TrapInstantCapture> traps, int max_n_transfers, CCDPhase ccd_phase,
+    double dwell_time)
+    : TrapManagerBase(max_n_transfers, ccd_phase, dwell_time), traps(traps) {
+
+    n_traps = traps.size();
+    trap_densities = std::valarray<double>(n_traps);
+    for (int i_trap = 0; i_trap < n_traps; i_trap++) {
+        trap_densities[i_trap] = traps[i_trap].density;
+    }
+
+    any_non_uniform_traps = false;
+    for (int i_trap = 0; i_trap < n_traps; i_trap++) {
+        if (traps[i_trap].fractional_volume_full_exposed > 0.0) {
+            any_non_uniform_traps = true;
+            break;
+        }
+    }
+}
+
+/*
+    Set the probabilities of traps being full after release.
+
+    Sets
+    ----
+    empty_probabilities_from_release : std::valarray<double>
+        The fraction of traps that were full that become empty after release.
+*/
+void TrapManagerInstantCapture::set_fill_probabilities() {
+    empty_probabilities_from_release = std::valarray<double>(0.0, n_traps);
+
+    // Set probabilities for each trap species
+    for (int i_trap = 0; i_trap < n_traps; i_trap++) {
+        // Resulting empty fraction from release
+        empty_probabilities_from_release[i_trap] =
+            1.0 - exp(-traps[i_trap].release_rate * dwell_time);
+    }
+}
+
+/*
+    Call any necessary initialisation functions, etc.
+*/
+void TrapManagerInstantCapture::setup() {
+    initialise_trap_states();
+    set_fill_probabilities();
+}
+
+/*
+    Release electrons from traps and update the watermarks.
+
+    Returns
+    -------
+    n_electrons_released : double
+        The number of released electrons.
+
+    Updates
+    -------
+    watermark_volumes, watermark_fills : std::valarray<double>
+        The updated watermarks.
+*/
+double TrapManagerInstantCapture::n_electrons_released() {
+    return instant_capture_n_electrons_released<double>(*this);
+}
+
+/*
+    How many electrons will be released from a watermark above the cloud,
+    during the next timestep.
+
+    Parameters
+    ----------
+    cloud_fractional_volume : double
+        The fractional volume the electron cloud reaches in the pixel well.
+
+    Returns
+    -------
+    i_wmk_above_cloud : int
+        The index of the first active watermark that reaches above the cloud.
+*/
+double TrapManagerInstantCapture::n_electrons_released_from_wmk_above_cloud(int i_wmk) {
+    
+    //print_v(0,"IC child version of n_electrons_released_from_wmk_above_cloud %g \n",empty_probabilities_from_release[0]);;
+
+    // Fraction of electrons released from each trap species
+    double frac_released_this_wmk = 0.0;
+    for (int i_trap = 0; i_trap < n_traps; i_trap++) {
+        // Fraction of released electrons
+        frac_released_this_wmk +=
+            watermark_fills[i_wmk * n_traps + i_trap] *
+            empty_probabilities_from_release[i_trap];
+    }
+
+    // Multiply by the watermark volume
+    return frac_released_this_wmk * watermark_volumes[i_wmk];
+}
+
+/*
+    Modify the watermarks for normal capture.
+
+    Parameters
+    ----------
+    cloud_fractional_volume : double
+        The fractional volume the electron cloud reaches in the pixel well.
+
+    i_wmk_above_cloud : int
+        The index of the first active watermark that reaches above the cloud.
+
+    Updates
+    -------
+    watermark_volumes, watermark_fills : std::valarray<double>
+        The updated watermarks.
+*/
+void TrapManagerInstantCapture::update_watermarks_capture(
+    double cloud_fractional_volume, int i_wmk_above_cloud) {
+    instant_capture_update_watermarks_capture(
+        *this, cloud_fractional_volume, i_wmk_above_cloud);
+}
+
+/*
+    Modify the watermarks for capture when not enough electrons are available.
+
+    Each watermark is partially filled a fraction (`enough`) of the way to full,
+    such that the resulting number of captured electrons is restricted to the
+    number actually available for capture.
+
+    This only becomes relevant for tiny numbers of electrons, where the cloud
+    can reach a disproportionately large volume in the pixel (reaching
+    correspondingly many traps) for the small amount of charge.
+
+    Parameters
+    ----------
+    cloud_fractional_volume : double
+        The fractional volume the electron cloud reaches in the pixel well.
+
+    i_wmk_above_cloud : int
+        The index of the first active watermark that reaches above the cloud.
+
+    enough : double
+        The amount of electrons available as a fraction of the number that
+        could be captured by the watermarks reached by the cloud volume.
+
+    Updates
+    -------
+    watermark_volumes, watermark_fills : std::valarray<double>
+        The updated watermarks.
+*/
+void TrapManagerInstantCapture::update_watermarks_capture_not_enough(
+    double cloud_fractional_volume, int i_wmk_above_cloud, double enough) {
+    instant_capture_update_watermarks_capture_not_enough(
+        *this, cloud_fractional_volume, i_wmk_above_cloud, enough);
+}
+
+/*
+    Capture electrons in traps and update the watermarks.
+
+    Parameters
+    ----------
+    n_free_electrons : double
+        The number of available electrons for trapping.
+
+    Returns
+    -------
+    n_electrons_captured : double
+        The number of captured electrons.
+
+    Updates
+    -------
+    watermark_volumes, watermark_fills : std::valarray<double>
+        The updated watermarks.
+*/
+double TrapManagerInstantCapture::n_electrons_captured(double n_free_electrons) {
+    return instant_capture_n_electrons_captured(*this, n_free_electrons);
+}
+
+/*
+    Release and capture electrons and update the trap watermarks.
+
+    The interaction between traps and the charge cloud during its dwell time in
+    this pixel (and phase) is modelled as follows:
+    + First the previously filled traps release charge.
+    + This may update the number of free electrons in the cloud that are
+        available for capture.
     + Then any unfilled traps within the cloud volume capture charge.
     + In the rare case that not enough electrons are available for capture,
         all traps within the cloud capture proportionally less charge to match.
@@ -1011,14 +1189,7 @@ double TrapManagerInstantCapture::n_electrons_captured(double n_free_electrons)
 */
 double TrapManagerInstantCapture::n_electrons_released_and_captured(
     double n_free_electrons) {
-
-    double n_released = n_electrons_released();
-    print_v(2, "n_electrons_released  %g \n", n_released);
-
-    double n_captured = n_electrons_captured(n_free_electrons + n_released);
-    print_v(2, "n_electrons_captured  %g \n", n_captured);
-
-    return n_released - n_captured;
+    return instant_capture_n_electrons_released_and_captured(*this, n_free_electrons);
 }
 
 // ========
@@ -1371,6 +1542,24 @@ double TrapManagerSlowCapture::n_electrons_released_and_captured(
 // ========
 // TrapManagerInstantCaptureContinuum::
 // ========
+/*
+    Set the global default tolerance for the continuum traps' interpolation
+    tables of trap managers made from now on, see also ClockingSettings.
+
+    Parameters
+    ----------
+    tolerance : double
+        If positive, the maximum error (in fill fraction) of linear
+        interpolation in the tables, with their times placed adaptively, see
+        prep_adaptive_table() in traps.cpp. Most species then need far fewer
+        than n_intp values. Default 0 for n_intp log-uniform values.
+*/
+double continuum_table_tolerance = 0.0;
+void set_continuum_table_tolerance(double tolerance) {
+    if (tolerance < 0.0) error("Table tolerance (%g) can't be negative", tolerance);
+    continuum_table_tolerance = tolerance;
+}
+
 /*
     Class TrapManagerInstantCaptureContinuum.
 
@@ -1392,6 +1581,11 @@ double TrapManagerSlowCapture::n_electrons_released_and_captured(
     n_intp : int
         The number of interpolation values in the arrays. Currently set here
         manually. See prep_fill_fraction_and_time_elapsed_tables().
+
+    table_tolerance : double
+        The interpolation tables' tolerance, from continuum_table_tolerance
+        when made unless set by the TrapManagerManager. See
+        set_continuum_table_tolerance().
 */
 TrapManagerInstantCaptureContinuum::TrapManagerInstantCaptureContinuum(
     std::valarray<TrapInstantCaptureContinuum> traps, int max_n_transfers,
@@ -1407,6 +1601,7 @@ TrapManagerInstantCaptureContinuum::TrapManagerInstantCaptureContinuum(
     time_min = dwell_time;
     time_max = max_n_transfers * dwell_time;
     n_intp = 1000;
+    table_tolerance = continuum_table_tolerance;
 }
 
 /*
@@ -1416,10 +1611,12 @@ TrapManagerInstantCaptureContinuum::TrapManagerInstantCaptureContinuum(
     See TrapInstantCaptureContinuum.prep_fill_fraction_and_time_elapsed_tables().
 */
 void TrapManagerInstantCaptureContinuum::prepare_interpolation_tables() {
+    TraceSpan span("prepare_interpolation_tables", 1);
+
     // Prepare interpolation tables for each trap species
     for (int i_trap = 0; i_trap < n_traps; i_trap++) {
         traps[i_trap].prep_fill_fraction_and_time_elapsed_tables(
-            time_min, time_max, n_intp);
+            time_min, time_max, n_intp, table_tolerance);
     }
 }
 
@@ -1639,11 +1836,11 @@ void TrapManagerInstantCaptureContinuum::update_watermarks_capture_not_enough(
 
         // New watermark
         watermark_volumes[i_first_active_wmk] = cloud_fractional_volume;
-        watermark_fills[std::slice(i_first_active_wmk * n_traps, n_traps, 1)] =
-            (std::valarray<double>)watermark_fills[std::slice(
-                i_first_active_wmk * n_traps, n_traps, 1)] *
-                (1.0 - enough) +
-            enough * trap_densities;
+        for (int i_trap = 0; i_trap < n_traps; i_trap++)
+            watermark_fills[i_first_active_wmk * n_traps + i_trap] =
+                watermark_fills[i_first_active_wmk * n_traps + i_trap] *
+                    (1.0 - enough) +
+                enough * trap_densities[i_trap];
 
         // Update fractional volume of the partially overwritten watermark above
         watermark_volumes[i_first_active_wmk + 1] -= cloud_fractional_volume;
@@ -1666,11 +1863,10 @@ void TrapManagerInstantCaptureContinuum::update_watermarks_capture_not_enough(
         // Update all other watermarks part-way to full
         for (int i_wmk = i_first_active_wmk;
              i_wmk < i_first_active_wmk + n_active_watermarks; i_wmk++) {
-            watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)] =
-                (std::valarray<double>)
-                        watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)] *
-                    (1.0 - enough) +
-                enough * trap_densities;
+            for (int i_trap = 0; i_trap < n_traps; i_trap++)
+                watermark_fills[i_wmk * n_traps + i_trap] =
+                    watermark_fills[i_wmk * n_traps + i_trap] * (1.0 - enough) +
+                    enough * trap_densities[i_trap];
         }
 
         // Update count of active watermarks
@@ -1704,11 +1900,10 @@ void TrapManagerInstantCaptureContinuum::update_watermarks_capture_not_enough(
 
         // Update all watermarks, including the new one, part-way to full
         for (int i_wmk = i_first_active_wmk; i_wmk <= i_wmk_above_cloud; i_wmk++) {
-            watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)] =
-                (std::valarray<double>)
-                        watermark_fills[std::slice(i_wmk * n_traps, n_traps, 1)] *
-                    (1.0 - enough) +
-                enough * trap_densities;
+            for (int i_trap = 0; i_trap < n_traps; i_trap++)
+                watermark_fills[i_wmk * n_traps + i_trap] =
+                    watermark_fills[i_wmk * n_traps + i_trap] * (1.0 - enough) +
+                    enough * trap_densities[i_trap];
         }
 
         // Update count of active watermarks
@@ -1834,6 +2029,7 @@ TrapManagerSlowCaptureContinuum::TrapManagerSlowCaptureContinuum(
     time_min = dwell_time / 30;
     time_max = max_n_transfers * dwell_time;
     n_intp = 1000;
+    table_tolerance = continuum_table_tolerance;
 
     // Overwrite default parameter values
     n_watermarks_per_transfer = 2;
@@ -1847,12 +2043,14 @@ TrapManagerSlowCaptureContinuum::TrapManagerSlowCaptureContinuum(
     and prep_fill_fraction_after_slow_capture_tables().
 */
 void TrapManagerSlowCaptureContinuum::prepare_interpolation_tables() {
+    TraceSpan span("prepare_interpolation_tables", 1);
+
     // Prepare interpolation tables for each trap species
     for (int i_trap = 0; i_trap < n_traps; i_trap++) {
         traps[i_trap].prep_fill_fraction_and_time_elapsed_tables(
-            time_min, time_max, n_intp);
+            time_min, time_max, n_intp, table_tolerance);
         traps[i_trap].prep_fill_fraction_after_slow_capture_tables(
-            dwell_time, time_min, time_max, n_intp);
+            dwell_time, time_min, time_max, n_intp, table_tolerance);
     }
 }
 
@@ -2133,49 +2331,220 @@ double TrapManagerSlowCaptureContinuum::n_electrons_released_and_captured(
 }
 
 // ========
-// TrapManagerManager::
+// TrapStates::
 // ========
 /*
-    Class TrapManagerManager.
-
-    Handles the one or multiple trap managers required for models with a mix of
-    trap species and/or multiphase clocking.
-
-    Each individual trap manager tracks the states of one or more trap species.
-    A different trap manager is required for any traps of different types, and
-    separate trap managers are also required for each phase in multiphase
-    clocking, which corresponds to an independent population of traps.
-
-    On declaration, automatically creates the trap managers for each phase
-    and/or watermark type and initialises their watermark arrays. The trap
-    managers of each type are held in the trap_managers_* arrays, each
-    containing one manager of that type for each phase.
+    Class TrapStates.
 
-    Also, if relevant, modifies the trap managers' trap densities to account for
-    the fraction of traps in different CCD pixel phases.
+    A compact copy of the watermarks of all the trap managers in a
+    TrapManagerManager, without their traps, tables, or unused watermarks,
+    e.g. to checkpoint or predict the trap states between columns. See
+    TrapManagerManager::save_trap_states() and load_trap_states().
 
-    Parameters
+    Attributes
     ----------
-    traps_ic : std::valarray<TrapInstantCapture>
-    traps_sc : std::valarray<TrapSlowCapture>
-    traps_ic_co : std::valarray<TrapInstantCaptureContinuum>
-    traps_sc_co : std::valarray<TrapSlowCaptureContinuum>
-        The arrays of trap species, one for each type (which can be empty).
+    watermark_volumes, watermark_fills : std::valarray<std::valarray<double>>
+        The active watermarks of each trap manager, in the order of
+        TrapManagerManager::all_trap_managers(), see
+        TrapManagerBase::save_trap_state().
 
-    max_n_transfers : int
-        Same as TrapManagerBase. Is modified internally to include any extra
-        intra-pixel transfers for multiphase clocking.
+    density_scale : double
+        The trap managers' density scale that the fills are for, see
+        TrapManagerManager::set_density_scale().
 
-    ccd : CCD
-        Parameters to describe how electrons fill the volume inside (all phases
-        of) a pixel in a CCD detector.
+    See to_array() for a flat serialised form, e.g. to save the states at the
+    end of one exposure's readout to start the next.
+*/
 
-    dwell_times : std::valarray<double>
-        The time between steps in the clocking sequence, as stored by an ROE
-        object.
+/*
+    The difference between two sets of trap states, as the number of trapped
+    electrons that differ between them.
 
-        Note: currently assumes the dwell time in each phase is the same for all
-        steps, which might not be true in sequences with n_steps > n_phases.
+    i.e. For each trap manager and trap species, the integral over the
+    fractional volume of the absolute difference between the fills.
+*/
+double TrapStates::difference(const TrapStates& other) const {
+    int n_managers = watermark_volumes.size();
+    if (other.watermark_volumes.size() != n_managers)
+        error(
+            "Can't compare trap states of %d and %d trap managers", n_managers,
+            (int)other.watermark_volumes.size());
+
+    const double no_watermark = std::numeric_limits<double>::infinity();
+    double difference = 0.0;
+
+    for (int i_manager = 0; i_manager < n_managers; i_manager++) {
+        const std::valarray<double>& volumes_a = watermark_volumes[i_manager];
+        const std::valarray<double>& fills_a = watermark_fills[i_manager];
+        const std::valarray<double>& volumes_b = other.watermark_volumes[i_manager];
+        const std::valarray<double>& fills_b = other.watermark_fills[i_manager];
+        int n_wmk_a = volumes_a.size();
+        int n_wmk_b = volumes_b.size();
+        int n_traps = 0;
+        if (n_wmk_a > 0)
+            n_traps = fills_a.size() / n_wmk_a;
+        else if (n_wmk_b > 0)
+            n_traps = fills_b.size() / n_wmk_b;
+
+        // Step up through the watermarks of both, in order of height
+        int i_wmk_a = 0;
+        int i_wmk_b = 0;
+        double height = 0.0;
+        double top_a = (n_wmk_a > 0) ? volumes_a[0] : no_watermark;
+        double top_b = (n_wmk_b > 0) ? volumes_b[0] : no_watermark;
+        double top;
+        double fill_a;
+        double fill_b;
+
+        while ((i_wmk_a < n_wmk_a) || (i_wmk_b < n_wmk_b)) {
+            top = std::min(top_a, top_b);
+
+            for (int i_trap = 0; i_trap < n_traps; i_trap++) {
+                fill_a =
+                    (i_wmk_a < n_wmk_a) ? fills_a[i_wmk_a * n_traps + i_trap] : 0.0;
+                fill_b =
+                    (i_wmk_b < n_wmk_b) ? fills_b[i_wmk_b * n_traps + i_trap] : 0.0;
+                difference += fabs(fill_a - fill_b) * (top - height);
+            }
+            height = top;
+
+            if (top_a <= top) {
+                i_wmk_a++;
+                top_a = (i_wmk_a < n_wmk_a) ? top_a + volumes_a[i_wmk_a] : no_watermark;
+            }
+            if (top_b <= top) {
+                i_wmk_b++;
+                top_b = (i_wmk_b < n_wmk_b) ? top_b + volumes_b[i_wmk_b] : no_watermark;
+            }
+        }
+    }
+
+    return difference;
+}
+
+/*
+    Serialise the trap states into a single flat array, see from_array().
+
+    Returns
+    -------
+    array : std::valarray<double>
+        The density scale and the number of trap managers, then for each trap
+        manager the number of active watermarks and of fill values, followed
+        by the watermark volumes and fills, i.e.:
+            [density_scale, n_managers,
+             n_wmk_0, n_fills_0, volumes_0..., fills_0...,
+             n_wmk_1, ...]
+*/
+std::valarray<double> TrapStates::to_array() const {
+    int n_managers = watermark_volumes.size();
+    int n_values = 2;
+    for (int i_manager = 0; i_manager < n_managers; i_manager++)
+        n_values += 2 + watermark_volumes[i_manager].size() +
+                    watermark_fills[i_manager].size();
+
+    std::valarray<double> array(n_values);
+    int i_value = 0;
+    array[i_value++] = density_scale;
+    array[i_value++] = n_managers;
+    for (int i_manager = 0; i_manager < n_managers; i_manager++) {
+        const std::valarray<double>& volumes = watermark_volumes[i_manager];
+        const std::valarray<double>& fills = watermark_fills[i_manager];
+        array[i_value++] = volumes.size();
+        array[i_value++] = fills.size();
+        for (int i = 0; i < volumes.size(); i++) array[i_value++] = volumes[i];
+        for (int i = 0; i < fills.size(); i++) array[i_value++] = fills[i];
+    }
+
+    return array;
+}
+
+/*
+    Set the trap states from a flat array made by to_array().
+
+    Parameters
+    ----------
+    array : std::valarray<double>
+        The serialised trap states.
+*/
+void TrapStates::from_array(const std::valarray<double>& array) {
+    int n_values = array.size();
+    if (n_values < 2) error("Serialised trap states array too short (%d)", n_values);
+
+    int i_value = 0;
+    density_scale = array[i_value++];
+    int n_managers = (int)array[i_value++];
+    watermark_volumes.resize(n_managers);
+    watermark_fills.resize(n_managers);
+    for (int i_manager = 0; i_manager < n_managers; i_manager++) {
+        if (i_value + 2 > n_values)
+            error("Serialised trap states array too short (%d)", n_values);
+        int n_wmk = (int)array[i_value++];
+        int n_fills = (int)array[i_value++];
+        if (i_value + n_wmk + n_fills > n_values)
+            error("Serialised trap states array too short (%d)", n_values);
+
+        watermark_volumes[i_manager] =
+            std::valarray<double>(array[std::slice(i_value, n_wmk, 1)]);
+        i_value += n_wmk;
+        watermark_fills[i_manager] =
+            std::valarray<double>(array[std::slice(i_value, n_fills, 1)]);
+        i_value += n_fills;
+    }
+    if (i_value != n_values)
+        error(
+            "Serialised trap states array has %d values, expected %d", n_values,
+            i_value);
+}
+
+// ========
+// TrapManagerManager::
+// ========
+/*
+    Class TrapManagerManager.
+
+    Handles the one or multiple trap managers required for models with a mix of
+    trap species and/or multiphase clocking.
+
+    Each individual trap manager tracks the states of one or more trap species.
+    A different trap manager is required for any traps of different types, and
+    separate trap managers are also required for each phase in multiphase
+    clocking, which corresponds to an independent population of traps.
+
+    On declaration, automatically creates the trap managers for each phase
+    and/or watermark type and initialises their watermark arrays. The trap
+    managers of each type are held in the trap_managers_* arrays, each
+    containing one manager of that type for each phase.
+
+    Also, if relevant, modifies the trap managers' trap densities to account for
+    the fraction of traps in different CCD pixel phases.
+
+    Parameters
+    ----------
+    traps_ic : std::valarray<TrapInstantCapture>
+    traps_sc : std::valarray<TrapSlowCapture>
+    traps_ic_co : std::valarray<TrapInstantCaptureContinuum>
+    traps_sc_co : std::valarray<TrapSlowCaptureContinuum>
+        The arrays of trap species, one for each type (which can be empty).
+
+    max_n_transfers : int
+        Same as TrapManagerBase. Is modified internally to include any extra
+        intra-pixel transfers for multiphase clocking.
+
+    ccd : CCD
+        Parameters to describe how electrons fill the volume inside (all phases
+        of) a pixel in a CCD detector.
+
+    dwell_times : std::valarray<double>
+        The time between steps in the clocking sequence, as stored by an ROE
+        object.
+
+        Note: currently assumes the dwell time in each phase is the same for all
+        steps, which might not be true in sequences with n_steps > n_phases.
+
+    table_tolerance : double (opt.)
+        The tolerance for the continuum traps' interpolation tables, or -1
+        (default) for the global continuum_table_tolerance. See
+        set_continuum_table_tolerance().
 
     Attributes
     ----------
@@ -2191,19 +2560,30 @@ double TrapManagerSlowCaptureContinuum::n_electrons_released_and_captured(
     trap_managers_sc_co :
    std::valarray<TrapManagerSlowCaptureContinuum> For each watermark type, the list of
    trap manager objects for each phase. Ignored if the corresponding n_*_traps is 0.
+
+    column_density_scales : const double*
+        If not nullptr, the factor to multiply the trap densities by for each
+        column index of the image being clocked, see set_column_density_scale().
+
+    density_scale : double
+        The factor that the trap densities are currently multiplied by.
 */
 TrapManagerManager::TrapManagerManager(
     std::valarray<TrapInstantCapture>& traps_ic,
     std::valarray<TrapSlowCapture>& traps_sc,
     std::valarray<TrapInstantCaptureContinuum>& traps_ic_co,
     std::valarray<TrapSlowCaptureContinuum>& traps_sc_co, int max_n_transfers, CCD ccd,
-    std::valarray<double>& dwell_times)
+    std::valarray<double>& dwell_times, double table_tolerance)
     : traps_ic(traps_ic),
       traps_sc(traps_sc),
       traps_ic_co(traps_ic_co),
       traps_sc_co(traps_sc_co),
       max_n_transfers(max_n_transfers),
-      ccd(ccd) {
+      ccd(ccd),
+      column_density_scales(nullptr),
+      density_scale(1.0) {
+
+    TraceSpan span("trap_manager_setup", 1);
 
     // The number of trap species (if any) of each watermark type
     n_traps_ic = traps_ic.size();
@@ -2265,6 +2645,8 @@ TrapManagerManager::TrapManagerManager(
             trap_managers_ic_co[phase_index].trap_densities *=
                 ccd.fraction_of_traps_per_phase[phase_index];
 
+            if (table_tolerance >= 0.0)
+                trap_managers_ic_co[phase_index].table_tolerance = table_tolerance;
             trap_managers_ic_co[phase_index].setup();
         }
     }
@@ -2282,6 +2664,8 @@ TrapManagerManager::TrapManagerManager(
             trap_managers_sc_co[phase_index].trap_densities *=
                 ccd.fraction_of_traps_per_phase[phase_index];
 
+            if (table_tolerance >= 0.0)
+                trap_managers_sc_co[phase_index].table_tolerance = table_tolerance;
             trap_managers_sc_co[phase_index].setup();
         }
     }
@@ -2313,6 +2697,7 @@ void TrapManagerManager::reset_trap_states() {
     Store the watermark arrays to be loaded again later, for all trap managers.
 */
 void TrapManagerManager::store_trap_states() {
+    TraceSpan span("store_trap_states", 3);
     if (n_traps_ic > 0)
         for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++) {
             trap_managers_ic[phase_index].store_trap_states();
@@ -2335,6 +2720,7 @@ void TrapManagerManager::store_trap_states() {
     Restore the watermark arrays to their saved values, for all trap managers.
 */
 void TrapManagerManager::restore_trap_states() {
+    TraceSpan span("restore_trap_states", 3);
     if (n_traps_ic > 0)
         for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++) {
             trap_managers_ic[phase_index].restore_trap_states();
@@ -2353,10 +2739,173 @@ void TrapManagerManager::restore_trap_states() {
         }
 }
 
+/*
+    Reset the watermark arrays of all trap managers to empty if the total
+    number of electrons held in all their traps is negligible.
+
+    After a bright pixel, the traps release their charge over many transfers
+    and the watermarks become very faint but stay active. Collapsing them lets
+    the following faint pixels be clocked as quickly as with empty traps.
+
+    Parameters
+    ----------
+    min_n_electrons : double
+        The total number of trapped electrons below which to empty the traps.
+
+    Returns
+    -------
+    collapsed : bool
+        Whether the trap states were reset.
+*/
+bool TrapManagerManager::collapse_trap_states(double min_n_electrons) {
+    double n_trapped_electrons = 0.0;
+    int n_active_watermarks = 0;
+
+    if (n_traps_ic > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++) {
+            n_active_watermarks += trap_managers_ic[phase_index].n_active_watermarks;
+            n_trapped_electrons +=
+                trap_managers_ic[phase_index].n_trapped_electrons_up_to(
+                    min_n_electrons - n_trapped_electrons);
+        }
+    if (n_traps_sc > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++) {
+            n_active_watermarks += trap_managers_sc[phase_index].n_active_watermarks;
+            n_trapped_electrons +=
+                trap_managers_sc[phase_index].n_trapped_electrons_up_to(
+                    min_n_electrons - n_trapped_electrons);
+        }
+    if (n_traps_ic_co > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++) {
+            n_active_watermarks += trap_managers_ic_co[phase_index].n_active_watermarks;
+            n_trapped_electrons +=
+                trap_managers_ic_co[phase_index].n_trapped_electrons_up_to(
+                    min_n_electrons - n_trapped_electrons);
+        }
+    if (n_traps_sc_co > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++) {
+            n_active_watermarks += trap_managers_sc_co[phase_index].n_active_watermarks;
+            n_trapped_electrons +=
+                trap_managers_sc_co[phase_index].n_trapped_electrons_up_to(
+                    min_n_electrons - n_trapped_electrons);
+        }
+
+    // Already empty, or still holding enough charge to matter
+    if ((n_active_watermarks == 0) || (n_trapped_electrons >= min_n_electrons))
+        return false;
+
+    reset_trap_states();
+
+    return true;
+}
+
+/*
+    Pointers to all the trap managers, of each type in turn for each phase.
+*/
+std::vector<TrapManagerBase*> TrapManagerManager::all_trap_managers() {
+    std::vector<TrapManagerBase*> trap_managers;
+
+    if (n_traps_ic > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++)
+            trap_managers.push_back(&trap_managers_ic[phase_index]);
+    if (n_traps_sc > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++)
+            trap_managers.push_back(&trap_managers_sc[phase_index]);
+    if (n_traps_ic_co > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++)
+            trap_managers.push_back(&trap_managers_ic_co[phase_index]);
+    if (n_traps_sc_co > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++)
+            trap_managers.push_back(&trap_managers_sc_co[phase_index]);
+
+    return trap_managers;
+}
+
+/*
+    Copy the current watermarks of all trap managers, see TrapStates.
+*/
+void TrapManagerManager::save_trap_states(TrapStates& states) {
+    std::vector<TrapManagerBase*> trap_managers = all_trap_managers();
+    int n_managers = trap_managers.size();
+
+    if (states.watermark_volumes.size() != n_managers) {
+        states.watermark_volumes.resize(n_managers);
+        states.watermark_fills.resize(n_managers);
+    }
+    for (int i_manager = 0; i_manager < n_managers; i_manager++)
+        trap_managers[i_manager]->save_trap_state(
+            states.watermark_volumes[i_manager], states.watermark_fills[i_manager]);
+    states.density_scale = density_scale;
+}
+
+/*
+    Set the watermarks of all trap managers from saved states, and store them
+    as the states to restore for each express pass, as at the start of a new
+    column. The states must be from trap managers for the same traps and CCD.
+*/
+void TrapManagerManager::load_trap_states(const TrapStates& states) {
+    std::vector<TrapManagerBase*> trap_managers = all_trap_managers();
+    int n_managers = trap_managers.size();
+
+    if (states.watermark_volumes.size() != n_managers)
+        error(
+            "Can't load trap states for %d trap managers into %d",
+            (int)states.watermark_volumes.size(), n_managers);
+
+    // Match the densities that the fills are for, before overwriting them
+    set_density_scale(states.density_scale);
+
+    for (int i_manager = 0; i_manager < n_managers; i_manager++)
+        trap_managers[i_manager]->load_trap_state(
+            states.watermark_volumes[i_manager], states.watermark_fills[i_manager]);
+}
+
+/*
+    Set the factor to multiply the traps' original densities by, e.g. for
+    columns with more or less radiation damage than the others.
+
+    Any current and stored trap states are rescaled too, so the same fractions
+    of the traps stay filled, e.g. if the traps aren't emptied between columns.
+
+    Parameters
+    ----------
+    scale : double
+        The density scale factor, which must be positive.
+*/
+void TrapManagerManager::set_density_scale(double scale) {
+    if (scale == density_scale) return;
+    if (!(scale > 0.0)) error("Trap density scale (%g) must be positive", scale);
+
+    double factor = scale / density_scale;
+    if (n_traps_ic > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++)
+            trap_managers_ic[phase_index].scale_trap_densities(factor);
+    if (n_traps_sc > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++)
+            trap_managers_sc[phase_index].scale_trap_densities(factor);
+    if (n_traps_ic_co > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++)
+            trap_managers_ic_co[phase_index].scale_trap_densities(factor);
+    if (n_traps_sc_co > 0)
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++)
+            trap_managers_sc_co[phase_index].scale_trap_densities(factor);
+
+    density_scale = scale;
+}
+
+/*
+    Set the density scale for a column, from column_density_scales if set.
+*/
+void TrapManagerManager::set_column_density_scale(int column_index) {
+    if (column_density_scales != nullptr)
+        set_density_scale(column_density_scales[column_index]);
+}
+
 /*
     Prune redundant watermarks from watermark arrays, for all trap managers.
 */
 void TrapManagerManager::prune_watermarks(double min_n_electrons) {
+    TraceSpan span("prune_watermarks", 3);
     //print_v(0,"IC traps\n");
     if (n_traps_ic > 0)
         for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++) {
@@ -2378,3 +2927,338 @@ void TrapManagerManager::prune_watermarks(double min_n_electrons) {
             trap_managers_sc_co[phase_index].prune_watermarks(min_n_electrons);
         }
 }
+
+/*
+    Release and capture electrons with the traps of every type in one phase.
+
+    Each type of traps sees the free electrons left over from the previous
+    types, see TrapManagerInstantCapture::n_electrons_released_and_captured().
+
+    Parameters
+    ----------
+    phase_index : int
+        The pixel phase whose traps interact with the charge cloud.
+
+    n_free_electrons : double
+        The number of available electrons for trapping.
+
+    Returns
+    -------
+    n_electrons_released_and_captured : double
+        The net number of released minus captured electrons.
+*/
+double TrapManagerManager::n_electrons_released_and_captured(
+    int phase_index, double n_free_electrons) {
+    double n_released_and_captured = 0.0;
+
+    if (n_traps_ic > 0)
+        n_released_and_captured +=
+            trap_managers_ic[phase_index].n_electrons_released_and_captured(
+                n_free_electrons + n_released_and_captured);
+    if (n_traps_sc > 0)
+        n_released_and_captured +=
+            trap_managers_sc[phase_index].n_electrons_released_and_captured(
+                n_free_electrons + n_released_and_captured);
+    if (n_traps_ic_co > 0)
+        n_released_and_captured +=
+            trap_managers_ic_co[phase_index].n_electrons_released_and_captured(
+                n_free_electrons + n_released_and_captured);
+    if (n_traps_sc_co > 0)
+        n_released_and_captured +=
+            trap_managers_sc_co[phase_index].n_electrons_released_and_captured(
+                n_free_electrons + n_released_and_captured);
+
+    return n_released_and_captured;
+}
+
+// ========
+// TrapManagerInstantCaptureDual::
+// ========
+/*
+    Class TrapManagerInstantCaptureDual.
+
+    The same release-then-instant-capture algorithm as TrapManagerInstantCapture,
+    but with the watermarks and trap parameters held as Dual numbers, to track
+    the derivatives of the trapped and released charge with respect to each
+    trap species' density and release timescale in the same pass.
+
+    Only uniformly distributed traps are supported, and watermarks are never
+    pruned, since merging them is not differentiable.
+
+    Parameters
+    ----------
+    traps : std::valarray<TrapInstantCapture>
+    max_n_transfers : int
+    ccd_phase : CCDPhase
+    dwell_time : double
+        Same as TrapManagerInstantCapture.
+
+    fraction_of_traps : double
+        The fraction of the traps in this phase, see TrapManagerManager.
+
+    n_derivatives : int
+        The total number of derivatives being tracked, e.g. including those of
+        other trap managers or a previous clocking direction.
+
+    i_first_derivative : int
+        The index of the derivative with respect to the first trap's density.
+        The derivatives for the i-th trap species are then at:
+            i_first_derivative + 2 * i      d/d(density)
+            i_first_derivative + 2 * i + 1  d/d(release_timescale)
+*/
+TrapManagerInstantCaptureDual::TrapManagerInstantCaptureDual(
+    std::valarray<TrapInstantCapture> traps, int max_n_transfers, CCDPhase ccd_phase,
+    double dwell_time, double fraction_of_traps, int n_derivatives,
+    int i_first_derivative)
+    : traps(traps),
+      max_n_transfers(max_n_transfers),
+      ccd_phase(ccd_phase),
+      dwell_time(dwell_time),
+      n_derivatives(n_derivatives) {
+
+    n_traps = traps.size();
+    n_active_watermarks = 0;
+    i_first_active_wmk = 0;
+    any_non_uniform_traps = false;
+
+    if (i_first_derivative + 2 * n_traps > n_derivatives)
+        error(
+            "Not enough derivatives (%d) for %d trap species starting at %d",
+            n_derivatives, n_traps, i_first_derivative);
+
+    // Seed the trap parameters
+    trap_densities.resize(n_traps);
+    empty_probabilities_from_release.resize(n_traps);
+    for (int i_trap = 0; i_trap < n_traps; i_trap++) {
+        if (traps[i_trap].fractional_volume_full_exposed != 0.0)
+            error("Derivatives not implemented for non-uniform trap distributions");
+
+        trap_densities[i_trap] =
+            Dual(traps[i_trap].density, n_derivatives,
+                 i_first_derivative + 2 * i_trap) *
+            fraction_of_traps;
+
+        // Resulting empty fraction from release
+        Dual release_timescale(
+            traps[i_trap].release_timescale, n_derivatives,
+            i_first_derivative + 2 * i_trap + 1);
+        empty_probabilities_from_release[i_trap] =
+            1.0 - exp(-(Dual(dwell_time) / release_timescale));
+    }
+}
+
+/*
+    Initialise the watermark arrays. See TrapManagerBase.
+*/
+void TrapManagerInstantCaptureDual::initialise_trap_states() {
+    n_watermarks = max_n_transfers + 1;
+
+    watermark_volumes = std::valarray<Dual>(Dual(0.0), n_watermarks);
+    watermark_fills = std::valarray<Dual>(Dual(0.0), n_traps * n_watermarks);
+
+    store_trap_states();
+}
+
+/*
+    Reset the watermark arrays to empty.
+*/
+void TrapManagerInstantCaptureDual::reset_trap_states() {
+    n_active_watermarks = 0;
+    i_first_active_wmk = 0;
+    watermark_volumes = Dual(0.0);
+    watermark_fills = Dual(0.0);
+}
+
+/*
+    Store the watermark arrays to be loaded again later.
+*/
+void TrapManagerInstantCaptureDual::store_trap_states() {
+    stored_n_active_watermarks = n_active_watermarks;
+    stored_i_first_active_wmk = i_first_active_wmk;
+    stored_watermark_volumes = watermark_volumes;
+    stored_watermark_fills = watermark_fills;
+}
+
+/*
+    Restore the watermark arrays to their saved values.
+*/
+void TrapManagerInstantCaptureDual::restore_trap_states() {
+    n_active_watermarks = stored_n_active_watermarks;
+    i_first_active_wmk = stored_i_first_active_wmk;
+    watermark_volumes = stored_watermark_volumes;
+    watermark_fills = stored_watermark_fills;
+}
+
+/*
+    Call any necessary initialisation functions, etc.
+*/
+void TrapManagerInstantCaptureDual::setup() { initialise_trap_states(); }
+
+/*
+    See CCDPhase::cloud_fractional_volume_from_electrons().
+*/
+Dual TrapManagerInstantCaptureDual::cloud_fractional_volume_from_electrons(
+    Dual n_electrons) {
+    if (n_electrons.value == 0.0) return Dual(0.0);
+
+    Dual fraction = (n_electrons - ccd_phase.well_notch_depth) /
+                    Dual(ccd_phase.full_well_depth);
+
+    // Clamped values don't change with the parameters
+    if (fraction.value <= 0.0)
+        return Dual(0.0);
+    else if (fraction.value >= 1.0)
+        return Dual(1.0);
+
+    return pow(fraction, ccd_phase.well_fill_power);
+}
+
+/*
+    See TrapManagerBase::watermark_index_above_cloud().
+*/
+int TrapManagerInstantCaptureDual::watermark_index_above_cloud(
+    double cloud_fractional_volume) {
+    double cumulative_volume = 0.0;
+    for (int i_wmk = i_first_active_wmk;
+         i_wmk < i_first_active_wmk + n_active_watermarks; i_wmk++) {
+        cumulative_volume += watermark_volumes[i_wmk].value;
+
+        if (cumulative_volume > cloud_fractional_volume) return i_wmk;
+    }
+
+    return i_first_active_wmk + n_active_watermarks;
+}
+
+/*
+    See TrapManagerInstantCapture::n_electrons_released().
+*/
+Dual TrapManagerInstantCaptureDual::n_electrons_released() {
+    return instant_capture_n_electrons_released<Dual>(*this);
+}
+
+/*
+    See TrapManagerInstantCapture::update_watermarks_capture().
+*/
+void TrapManagerInstantCaptureDual::update_watermarks_capture(
+    Dual cloud_fractional_volume, int i_wmk_above_cloud) {
+    instant_capture_update_watermarks_capture(
+        *this, cloud_fractional_volume, i_wmk_above_cloud);
+}
+
+/*
+    See TrapManagerInstantCapture::update_watermarks_capture_not_enough().
+*/
+void TrapManagerInstantCaptureDual::update_watermarks_capture_not_enough(
+    Dual cloud_fractional_volume, int i_wmk_above_cloud, Dual enough) {
+    instant_capture_update_watermarks_capture_not_enough(
+        *this, cloud_fractional_volume, i_wmk_above_cloud, enough);
+}
+
+/*
+    See TrapManagerInstantCapture::n_electrons_captured().
+*/
+Dual TrapManagerInstantCaptureDual::n_electrons_captured(Dual n_free_electrons) {
+    return instant_capture_n_electrons_captured(*this, n_free_electrons);
+}
+
+/*
+    See TrapManagerInstantCapture::n_electrons_released_and_captured().
+*/
+Dual TrapManagerInstantCaptureDual::n_electrons_released_and_captured(
+    Dual n_free_electrons) {
+    return instant_capture_n_electrons_released_and_captured(*this, n_free_electrons);
+}
+
+// ========
+// TrapManagerManagerDual::
+// ========
+/*
+    Class TrapManagerManagerDual.
+
+    The equivalent of TrapManagerManager for TrapManagerInstantCaptureDual, to
+    clock Dual pixel values with the same loop as for plain doubles, see
+    clock_charge_in_one_direction_derivatives().
+
+    Parameters
+    ----------
+    traps_ic : std::valarray<TrapInstantCapture>
+    max_n_transfers : int
+    ccd : CCD
+    dwell_times : std::valarray<double>
+        Same as TrapManagerManager.
+
+    n_derivatives, i_first_derivative : int
+        Same as TrapManagerInstantCaptureDual.
+*/
+TrapManagerManagerDual::TrapManagerManagerDual(
+    std::valarray<TrapInstantCapture>& traps_ic, int max_n_transfers, CCD ccd,
+    std::valarray<double>& dwell_times, int n_derivatives, int i_first_derivative)
+    : max_n_transfers(max_n_transfers), ccd(ccd) {
+
+    n_traps_ic = traps_ic.size();
+
+    // Account for the number of clock-sequence steps for the maximum transfers
+    max_n_transfers *= dwell_times.size();
+    this->max_n_transfers = max_n_transfers;
+
+    if (n_traps_ic > 0) {
+        trap_managers_ic.resize(ccd.n_phases);
+
+        // Initialise manager and watermarks for each phase
+        for (int phase_index = 0; phase_index < ccd.n_phases; phase_index++) {
+            trap_managers_ic[phase_index] = TrapManagerInstantCaptureDual(
+                traps_ic, max_n_transfers, ccd.phases[phase_index],
+                dwell_times[phase_index], ccd.fraction_of_traps_per_phase[phase_index],
+                n_derivatives, i_first_derivative);
+            trap_managers_ic[phase_index].setup();
+        }
+    }
+}
+
+/*
+    Reset the watermark arrays to empty, for all trap managers.
+*/
+void TrapManagerManagerDual::reset_trap_states() {
+    for (int i_phase = 0; i_phase < (int)trap_managers_ic.size(); i_phase++)
+        trap_managers_ic[i_phase].reset_trap_states();
+}
+
+/*
+    Store the watermark arrays to be loaded again later, for all trap managers.
+*/
+void TrapManagerManagerDual::store_trap_states() {
+    for (int i_phase = 0; i_phase < (int)trap_managers_ic.size(); i_phase++)
+        trap_managers_ic[i_phase].store_trap_states();
+}
+
+/*
+    Restore the watermark arrays to their saved values, for all trap managers.
+*/
+void TrapManagerManagerDual::restore_trap_states() {
+    for (int i_phase = 0; i_phase < (int)trap_managers_ic.size(); i_phase++)
+        trap_managers_ic[i_phase].restore_trap_states();
+}
+
+/*
+    Watermarks are never pruned or collapsed with derivatives, since merging
+    them is not differentiable, so these are only for the shared clocking loop.
+*/
+void TrapManagerManagerDual::prune_watermarks(double min_n_electrons) {
+    error("Watermark pruning not implemented for derivatives");
+}
+
+bool TrapManagerManagerDual::collapse_trap_states(double min_n_electrons) {
+    error("Trap-state collapsing not implemented for derivatives");
+}
+
+/*
+    Release and capture electrons in one phase, see
+    TrapManagerManager::n_electrons_released_and_captured().
+*/
+Dual TrapManagerManagerDual::n_electrons_released_and_captured(
+    int phase_index, Dual n_free_electrons) {
+    if (n_traps_ic == 0) return Dual(0.0);
+
+    return trap_managers_ic[phase_index].n_electrons_released_and_captured(
+        n_free_electrons);
+}
@@ -7,7 +7,10 @@
 #include <gsl/gsl_roots.h>
 #include <math.h>
 
+#include <algorithm>
+#include <functional>
 #include <valarray>
+#include <vector>
 
 #include "util.hpp"
 
@@ -176,6 +179,176 @@ TrapSlowCapture::TrapSlowCapture(
         capture_rate = 0.0;
 }
 
+// ========
+// Adaptive interpolation tables
+// ========
+/*
+    Estimate the error of linear interpolation between each pair of knots,
+    from the curvature given by the knot either side, i.e. h^2 |f''| / 8.
+*/
+static std::vector<double> estimate_interpolation_errors(
+    std::vector<double>& log_times, std::vector<double>& values) {
+
+    int n_knots = log_times.size();
+    std::vector<double> curvatures(n_knots, 0.0);
+    for (int i = 1; i < n_knots - 1; i++) {
+        double slope_lo =
+            (values[i] - values[i - 1]) / (log_times[i] - log_times[i - 1]);
+        double slope_hi =
+            (values[i + 1] - values[i]) / (log_times[i + 1] - log_times[i]);
+        curvatures[i] =
+            2.0 * fabs(slope_hi - slope_lo) / (log_times[i + 1] - log_times[i - 1]);
+    }
+    curvatures[0] = curvatures[1];
+    curvatures[n_knots - 1] = curvatures[n_knots - 2];
+
+    std::vector<double> errors(n_knots - 1);
+    for (int i = 0; i < n_knots - 1; i++) {
+        double width = log_times[i + 1] - log_times[i];
+        errors[i] = width * width * std::max(curvatures[i], curvatures[i + 1]) / 8.0;
+    }
+
+    return errors;
+}
+
+/*
+    Prepare an interpolation table with non-uniform knots in log(time), placed
+    where the function bends, instead of the same log-uniform spacing
+    everywhere.
+
+    Starting from a few uniform knots, each pass splits in half every interval
+    whose estimated error of linear interpolation is above the tolerance (or
+    the worst ones if the table would be too full), until none are. The error
+    is estimated from the curvature at the neighbouring knots, so each new knot
+    costs only one evaluation of the function. Flat regions, e.g. the tails of
+    a fill fraction near 0 and 1, need very few knots, and smooth functions
+    like the fill fraction after slow capture need only a few tens in total,
+    compared with e.g. 1000 log-uniform ones, so the setup needs far fewer
+    integrations and the tables are small.
+
+    For fast lookups, a uniform index in log(time) gives the first knot of
+    each of (n_knots - 1) equal bins, so finding a time's knot needs only a
+    short scan from there, see find_adaptive_table_knot().
+
+    Parameters
+    ----------
+    value_from_time : std::function<double(double)>
+        The function to tabulate, of the elapsed time.
+
+    time_min, time_max : double
+        The minimum and maximum elapsed times to set the table limits.
+
+    max_n_knots : int
+        The maximum number of knots.
+
+    tolerance : double
+        The maximum estimated error of linear interpolation.
+
+    Sets
+    ----
+    log_time_table, value_table : std::valarray<double>
+        The knots' log(time) values, decreasing from log(time_max) to
+        log(time_min), and the corresponding function values.
+
+    knot_index_table : std::valarray<int>
+        The index of the knot at or before the start of each uniform bin.
+
+    d_log_index : double
+        The log(time) width of each uniform bin.
+*/
+static void prep_adaptive_table(
+    std::function<double(double)> value_from_time, double time_min, double time_max,
+    int max_n_knots, double tolerance, std::valarray<double>& log_time_table,
+    std::valarray<double>& value_table, std::valarray<int>& knot_index_table,
+    double& d_log_index) {
+
+    if (max_n_knots < 3) error("Adaptive tables need at least 3 knots");
+
+    // Initial uniform knots, by increasing log(time)
+    int n_knots = std::min(max_n_knots, 17);
+    double log_time_min = log(time_min);
+    double log_time_max = log(time_max);
+    std::vector<double> log_times(n_knots);
+    std::vector<double> values(n_knots);
+    for (int i = 0; i < n_knots; i++) {
+        log_times[i] = log_time_min + i * (log_time_max - log_time_min) / (n_knots - 1);
+        values[i] = value_from_time(exp(log_times[i]));
+    }
+
+    // Split the intervals above the tolerance, worst first if the table fills
+    while (n_knots < max_n_knots) {
+        std::vector<double> errors = estimate_interpolation_errors(log_times, values);
+        std::vector<double> errors_sorted = errors;
+        std::sort(errors_sorted.begin(), errors_sorted.end(), std::greater<double>());
+        int n_split = std::upper_bound(
+                          errors_sorted.begin(), errors_sorted.end(), tolerance,
+                          std::greater<double>()) -
+                      errors_sorted.begin();
+        if (n_split == 0) break;
+        n_split = std::min(n_split, max_n_knots - n_knots);
+        double error_min = errors_sorted[n_split - 1];
+
+        std::vector<double> log_times_new;
+        std::vector<double> values_new;
+        for (int i = 0; i < n_knots; i++) {
+            log_times_new.push_back(log_times[i]);
+            values_new.push_back(values[i]);
+            if ((i < n_knots - 1) && (errors[i] >= error_min) && (n_split > 0)) {
+                double log_time_mid = 0.5 * (log_times[i] + log_times[i + 1]);
+                log_times_new.push_back(log_time_mid);
+                values_new.push_back(value_from_time(exp(log_time_mid)));
+                n_split--;
+            }
+        }
+        log_times.swap(log_times_new);
+        values.swap(values_new);
+        n_knots = log_times.size();
+    }
+
+    // Tabulate in order of decreasing time
+    log_time_table = std::valarray<double>(0.0, n_knots);
+    value_table = std::valarray<double>(0.0, n_knots);
+    for (int i_knot = 0; i_knot < n_knots; i_knot++) {
+        log_time_table[i_knot] = log_times[n_knots - 1 - i_knot];
+        value_table[i_knot] = values[n_knots - 1 - i_knot];
+    }
+
+    // Uniform index into the knots
+    d_log_index = (log_time_max - log_time_min) / (n_knots - 1);
+    knot_index_table = std::valarray<int>(0, n_knots - 1);
+    int i_knot = 0;
+    for (int i_bin = 0; i_bin < n_knots - 1; i_bin++) {
+        double log_time_bin = log_time_max - i_bin * d_log_index;
+        while ((i_knot < n_knots - 2) && (log_time_table[i_knot + 1] >= log_time_bin))
+            i_knot++;
+        knot_index_table[i_bin] = i_knot;
+    }
+}
+
+/*
+    Find the knot of an adaptive table before a time, and the interpolation
+    factor to the next knot, extrapolating beyond either end of the table. See
+    prep_adaptive_table().
+*/
+static void find_adaptive_table_knot(
+    double log_time, std::valarray<double>& log_time_table,
+    std::valarray<int>& knot_index_table, double d_log_index, int& idx,
+    double& intp) {
+
+    int n_knots = log_time_table.size();
+    double bin = (log_time_table[0] - log_time) / d_log_index;
+    if (!(bin > 0.0))
+        idx = 0;
+    else if (bin >= n_knots - 2)
+        idx = knot_index_table[n_knots - 2];
+    else
+        idx = knot_index_table[(int)bin];
+
+    while ((idx < n_knots - 2) && (log_time < log_time_table[idx + 1])) idx++;
+    intp = (log_time_table[idx] - log_time) /
+           (log_time_table[idx] - log_time_table[idx + 1]);
+}
+
 // ========
 // TrapInstantCaptureContinuum::
 // ========
@@ -393,7 +566,13 @@ double TrapInstantCaptureContinuum::time_elapsed_from_fill_fraction(
         single dwell time and the cumulative dwell time over all transfers.
 
     n_intp : int
-        The number of interpolation values in the arrays.
+        The number of interpolation values in the arrays, or the maximum number
+        with a tolerance.
+
+    tolerance : double (opt.)
+        If positive, place the table's times adaptively where the fill fraction
+        bends, until the error of linear interpolation is below this, instead
+        of uniformly, see prep_adaptive_table(). Default 0 for uniform times.
 
     Sets
     ----
@@ -406,9 +585,15 @@ double TrapInstantCaptureContinuum::time_elapsed_from_fill_fraction(
 
     d_log_time : double
         The logarithmic interval between successive (decreasing) times.
+
+    log_time_table : std::valarray<double>
+    knot_index_table : std::valarray<int>
+    d_log_index : double
+        With a tolerance, the times of the table values and the index into
+        them. Otherwise log_time_table is empty.
 */
 void TrapInstantCaptureContinuum::prep_fill_fraction_and_time_elapsed_tables(
-    double time_min, double time_max, int n_intp) {
+    double time_min, double time_max, int n_intp, double tolerance) {
 
     // Prep for the GSL integration
     const int limit = 100;
@@ -424,6 +609,20 @@ void TrapInstantCaptureContinuum::prep_fill_fraction_and_time_elapsed_tables(
     d_log_time = (log(time_max) - log(time_min)) / (n_intp - 1);
     double time_i;
 
+    // Tabulate the values at adaptively placed times
+    if (tolerance > 0.0) {
+        prep_adaptive_table(
+            [&](double time) {
+                return fill_fraction_from_time_elapsed(time, workspace);
+            },
+            time_min, time_max, n_intp, tolerance, log_time_table, fill_fraction_table,
+            knot_index_table, d_log_index);
+        this->n_intp = fill_fraction_table.size();
+        gsl_integration_workspace_free(workspace);
+        return;
+    }
+    log_time_table.resize(0);
+
     // Tabulate the values corresponding to the equally log-spaced inputs
     for (int i = 0; i < n_intp; i++) {
         time_i = exp(log(time_max) - i * d_log_time);
@@ -457,17 +656,25 @@ double TrapInstantCaptureContinuum::fill_fraction_from_time_elapsed_table(
         return 0.0;
 
     // Get the index and interpolation factor
-    double intp = (log(time_max) - log(time_elapsed)) / d_log_time;
-    int idx = (int)std::floor(intp);
-    intp = intp - idx;
-
-    // Extrapolate if outside the table
-    if (idx < 0) {
-        intp += idx;
-        idx = 0;
-    } else if (idx >= n_intp - 1) {
-        intp += idx - (n_intp - 2);
-        idx = n_intp - 2;
+    double intp;
+    int idx;
+    if (log_time_table.size() > 0) {
+        find_adaptive_table_knot(
+            log(time_elapsed), log_time_table, knot_index_table, d_log_index, idx,
+            intp);
+    } else {
+        intp = (log(time_max) - log(time_elapsed)) / d_log_time;
+        idx = (int)std::floor(intp);
+        intp = intp - idx;
+
+        // Extrapolate if outside the table
+        if (idx < 0) {
+            intp += idx;
+            idx = 0;
+        } else if (idx >= n_intp - 1) {
+            intp += idx - (n_intp - 2);
+            idx = n_intp - 2;
+        }
     }
 
     // Interpolate
@@ -519,6 +726,10 @@ double TrapInstantCaptureContinuum::time_elapsed_from_fill_fraction_table(
                   (fill_fraction_table[idx + 1] - fill_fraction_table[idx]);
 
     // Interpolate
+    if (log_time_table.size() > 0)
+        return exp(
+            log_time_table[idx] +
+            intp * (log_time_table[idx + 1] - log_time_table[idx]));
     return exp(log(time_max) - (idx + intp) * d_log_time);
 }
 
@@ -688,7 +899,7 @@ double TrapSlowCaptureContinuum::time_elapsed_from_fill_fraction(
     Same as TrapInstantCaptureContinuum
 */
 void TrapSlowCaptureContinuum::prep_fill_fraction_and_time_elapsed_tables(
-    double time_min, double time_max, int n_intp) {
+    double time_min, double time_max, int n_intp, double tolerance) {
 
     // Prep for the GSL integration
     const int limit = 100;
@@ -704,6 +915,20 @@ void TrapSlowCaptureContinuum::prep_fill_fraction_and_time_elapsed_tables(
     d_log_time = (log(time_max) - log(time_min)) / (n_intp - 1);
     double time_i;
 
+    // Tabulate the values at adaptively placed times
+    if (tolerance > 0.0) {
+        prep_adaptive_table(
+            [&](double time) {
+                return fill_fraction_from_time_elapsed(time, workspace);
+            },
+            time_min, time_max, n_intp, tolerance, log_time_table, fill_fraction_table,
+            knot_index_table, d_log_index);
+        this->n_intp = fill_fraction_table.size();
+        gsl_integration_workspace_free(workspace);
+        return;
+    }
+    log_time_table.resize(0);
+
     // Tabulate the values corresponding to the equally log-spaced inputs
     for (int i = 0; i < n_intp; i++) {
         time_i = exp(log(time_max) - i * d_log_time);
@@ -725,17 +950,25 @@ double TrapSlowCaptureContinuum::fill_fraction_from_time_elapsed_table(
         return 0.0;
 
     // Get the index and interpolation factor
-    double intp = (log(time_max) - log(time_elapsed)) / d_log_time;
-    int idx = (int)std::floor(intp);
-    intp = intp - idx;
-
-    // Extrapolate if outside the table
-    if (idx < 0) {
-        intp += idx;
-        idx = 0;
-    } else if (idx >= n_intp - 1) {
-        intp += idx - (n_intp - 2);
-        idx = n_intp - 2;
+    double intp;
+    int idx;
+    if (log_time_table.size() > 0) {
+        find_adaptive_table_knot(
+            log(time_elapsed), log_time_table, knot_index_table, d_log_index, idx,
+            intp);
+    } else {
+        intp = (log(time_max) - log(time_elapsed)) / d_log_time;
+        idx = (int)std::floor(intp);
+        intp = intp - idx;
+
+        // Extrapolate if outside the table
+        if (idx < 0) {
+            intp += idx;
+            idx = 0;
+        } else if (idx >= n_intp - 1) {
+            intp += idx - (n_intp - 2);
+            idx = n_intp - 2;
+        }
     }
 
     // Interpolate
@@ -775,6 +1008,10 @@ double TrapSlowCaptureContinuum::time_elapsed_from_fill_fraction_table(
                   (fill_fraction_table[idx + 1] - fill_fraction_table[idx]);
 
     // Interpolate
+    if (log_time_table.size() > 0)
+        return exp(
+            log_time_table[idx] +
+            intp * (log_time_table[idx + 1] - log_time_table[idx]));
     return exp(log(time_max) - (idx + intp) * d_log_time);
 }
 
@@ -898,25 +1135,38 @@ double TrapSlowCaptureContinuum::fill_fraction_after_slow_capture(
         single dwell time and the cumulative dwell time over all transfers.
 
     n_intp : int
-        The number of interpolation values in the arrays.
+        The number of interpolation values in the arrays, or the maximum number
+        with a tolerance.
+
+    tolerance : double (opt.)
+        If positive, place the table's times adaptively, as for
+        prep_fill_fraction_and_time_elapsed_tables(), but independently of
+        that table's times. Default 0 for uniform times.
 
     Sets
     ----
     fill_fraction_capture_table : std::valarray<double>
         The array of fill fractions.
 
+    log_time_capture_table : std::valarray<double>
+    knot_index_capture_table : std::valarray<int>
+    d_log_index_capture : double
+        With a tolerance, the times of the table values and the index into
+        them. Otherwise log_time_capture_table is empty.
+
     fill_capture_long_time : double
         The should-be-converged fill fraction from a very long elapsed time.
 */
 void TrapSlowCaptureContinuum::prep_fill_fraction_after_slow_capture_tables(
-    double dwell_time, double time_min, double time_max, int n_intp) {
+    double dwell_time, double time_min, double time_max, int n_intp,
+    double tolerance) {
     // Prep for the GSL integration
     const int limit = 100;
     gsl_integration_workspace* workspace = gsl_integration_workspace_alloc(limit);
 
-    // Set up the arrays and limits
+    // Set up the arrays and limits, keeping any adaptive fill-fraction table's size
     fill_fraction_capture_table = std::valarray<double>(0.0, n_intp);
-    this->n_intp = n_intp;
+    if (log_time_table.size() == 0) this->n_intp = n_intp;
     this->time_min = time_min;
     this->time_max = time_max;
     fill_capture_min =
@@ -928,6 +1178,20 @@ void TrapSlowCaptureContinuum::prep_fill_fraction_after_slow_capture_tables(
     d_log_time = (log(time_max) - log(time_min)) / (n_intp - 1);
     double time_i;
 
+    // Tabulate the values at adaptively placed times
+    if (tolerance > 0.0) {
+        prep_adaptive_table(
+            [&](double time) {
+                return fill_fraction_after_slow_capture(time, dwell_time, workspace);
+            },
+            time_min, time_max, n_intp, tolerance, log_time_capture_table,
+            fill_fraction_capture_table, knot_index_capture_table,
+            d_log_index_capture);
+        gsl_integration_workspace_free(workspace);
+        return;
+    }
+    log_time_capture_table.resize(0);
+
     // Tabulate the values corresponding to the equally log-spaced inputs
     for (int i = 0; i < n_intp; i++) {
         time_i = exp(log(time_max) - i * d_log_time);
@@ -960,17 +1224,26 @@ double TrapSlowCaptureContinuum::fill_fraction_after_slow_capture_table(
         return 0.0;
 
     // Get the index and interpolation factor
-    double intp = (log(time_max) - log(time_elapsed)) / d_log_time;
-    int idx = (int)std::floor(intp);
-    intp = intp - idx;
-
-    // Extrapolate if outside the table
-    if (idx < 0) {
-        intp += idx;
-        idx = 0;
-    } else if (idx >= n_intp - 1) {
-        intp += idx - (n_intp - 2);
-        idx = n_intp - 2;
+    double intp;
+    int idx;
+    if (log_time_capture_table.size() > 0) {
+        find_adaptive_table_knot(
+            log(time_elapsed), log_time_capture_table, knot_index_capture_table,
+            d_log_index_capture, idx, intp);
+    } else {
+        int n_intp_capture = fill_fraction_capture_table.size();
+        intp = (log(time_max) - log(time_elapsed)) / d_log_time;
+        idx = (int)std::floor(intp);
+        intp = intp - idx;
+
+        // Extrapolate if outside the table
+        if (idx < 0) {
+            intp += idx;
+            idx = 0;
+        } else if (idx >= n_intp_capture - 1) {
+            intp += idx - (n_intp_capture - 2);
+            idx = n_intp_capture - 2;
+        }
     }
 
     // Interpolate
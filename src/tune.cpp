@@ -0,0 +1,389 @@
+
+#include "tune.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <valarray>
+#include <vector>
+
+#include "model.hpp"
+#include "util.hpp"
+
+// ========
+// TuneSettings::, TuneResult::
+// ========
+/*
+    Class TuneSettings.
+
+    The tuned clocking settings for one direction, with their estimated error
+    and runtime.
+
+    Parameters
+    ----------
+    is_tuned : bool
+        Whether the settings were tuned, i.e. false if there are no traps.
+
+    express, prune_n_electrons, prune_frequency : int, double, int
+        The fastest settings found that meet the target error.
+
+    max_error : double
+        The maximum absolute difference in any pixel of the probe image between
+        these settings and the reference of express = 0 (electrons).
+
+    time, time_reference : double
+        The estimated runtime (s) to clock the full image with these settings
+        and the reference settings.
+*/
+
+/*
+    Class TuneResult.
+
+    The tuned settings for both directions, see autotune().
+
+    Parameters
+    ----------
+    target_error : double
+        The target maximum error in any pixel.
+
+    parallel, serial : TuneSettings
+        The tuned settings for each direction.
+*/
+
+/*
+    The tuned settings as text in the model file format, with comments for the
+    estimated errors and times, see load_model_from_text(). Appending this to
+    the original model file overrides its settings.
+*/
+std::string TuneResult::to_text() {
+    std::ostringstream text;
+    std::string prefixes[2] = {"parallel", "serial"};
+    TuneSettings* settings[2] = {&parallel, &serial};
+
+    text << "# Autotuned for a maximum error of " << target_error << "\n";
+    for (int i = 0; i < 2; i++) {
+        if (!settings[i]->is_tuned) continue;
+
+        text << "# " << prefixes[i] << ": max error " << settings[i]->max_error
+             << ", est. time " << settings[i]->time << " s (vs "
+             << settings[i]->time_reference << " s for express = 0)\n";
+        text << prefixes[i] << "_express = " << settings[i]->express << "\n";
+        text << prefixes[i] << "_prune_n_electrons = " << settings[i]->prune_n_electrons
+             << "\n";
+        text << prefixes[i] << "_prune_frequency = " << settings[i]->prune_frequency
+             << "\n";
+    }
+
+    return text.str();
+}
+
+/*
+    Set the tuned settings in a model.
+*/
+void TuneResult::apply(CTIModel& model) {
+    ClockingModel* models[2] = {&model.parallel, &model.serial};
+    TuneSettings* settings[2] = {&parallel, &serial};
+
+    for (int i = 0; i < 2; i++) {
+        if (!settings[i]->is_tuned) continue;
+
+        models[i]->express = settings[i]->express;
+        models[i]->express_tolerance = 0.0;
+        models[i]->express_extrapolate = false;
+        models[i]->prune_n_electrons = settings[i]->prune_n_electrons;
+        models[i]->prune_frequency = settings[i]->prune_frequency;
+    }
+}
+
+// ========
+// Tuning
+// ========
+/*
+    A subset of the columns to probe with, half the brightest (which set the
+    error) and half spread evenly across the image (for the typical runtime).
+*/
+static std::valarray<std::valarray<double>> probe_columns(
+    std::valarray<std::valarray<double>>& image, int max_n_probe_columns) {
+
+    int n_rows = image.size();
+    int n_columns = image[0].size();
+    if (n_columns <= max_n_probe_columns) return image;
+
+    // Total charge in each column
+    std::valarray<double> column_totals(0.0, n_columns);
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        column_totals += image[row_index];
+
+    std::vector<int> order(n_columns);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return column_totals[a] > column_totals[b];
+    });
+
+    std::vector<bool> is_used(n_columns, false);
+    std::vector<int> columns;
+    int n_brightest = max_n_probe_columns / 2;
+    for (int i = 0; i < n_brightest; i++) {
+        columns.push_back(order[i]);
+        is_used[order[i]] = true;
+    }
+    int n_even = max_n_probe_columns - n_brightest;
+    for (int i = 0; (i < n_columns) && ((int)columns.size() < max_n_probe_columns);
+         i++) {
+        int column_index = (int)((double)i * n_columns / n_even) % n_columns;
+        if (is_used[column_index]) continue;
+        columns.push_back(column_index);
+        is_used[column_index] = true;
+    }
+
+    std::valarray<std::valarray<double>> probe(
+        std::valarray<double>(0.0, columns.size()), n_rows);
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        for (int i_column = 0; i_column < columns.size(); i_column++)
+            probe[row_index][i_column] = image[row_index][columns[i_column]];
+
+    return probe;
+}
+
+/*
+    Clock the probe image with a trial model, returning the runtime (s) and
+    setting the maximum error compared with the reference output, or setting
+    the reference output if it's empty.
+
+    The runtime is the minimum of n_repeats timings, since noise from e.g.
+    other processes or page faults only ever adds time, so a single timing of a
+    small probe can easily rank the trials in the wrong order.
+*/
+static double run_probe(
+    std::valarray<std::valarray<double>>& probe, ClockingModel& trial,
+    std::valarray<std::valarray<double>>& image_reference, double& max_error,
+    int n_repeats) {
+
+    struct timeval time_start;
+    struct timeval time_end;
+    std::valarray<std::valarray<double>> image;
+    double time = 0.0;
+
+    for (int i_repeat = 0; i_repeat < std::max(n_repeats, 1); i_repeat++) {
+        gettimeofday(&time_start, nullptr);
+        image = trial.clock_charge(probe);
+        gettimeofday(&time_end, nullptr);
+
+        double time_repeat = gettimelapsed(time_start, time_end);
+        if ((i_repeat == 0) || (time_repeat < time)) time = time_repeat;
+    }
+
+    max_error = 0.0;
+    if (image_reference.size() == 0)
+        image_reference = image;
+    else {
+        for (int row_index = 0; row_index < image.size(); row_index++)
+            max_error = std::max(
+                max_error,
+                std::abs(image[row_index] - image_reference[row_index]).max());
+    }
+
+    return time;
+}
+
+/*
+    Find the fastest express and pruning settings for clocking in one direction
+    that meet a target error, see autotune().
+
+    Parameters
+    ----------
+    image : std::valarray<std::valarray<double>>&
+        A representative image, with rows along the direction of clocking.
+
+    model : ClockingModel&
+        The model to tune, which isn't modified.
+
+    target_error : double
+        The target maximum error in any pixel (electrons).
+
+    max_n_probe_columns : int (opt.)
+        The maximum number of columns to clock for each trial, if the traps are
+        emptied between columns.
+
+    n_repeats : int (opt.)
+        The number of times to clock each trial, taking the fastest time.
+
+    Returns
+    -------
+    settings : TuneSettings
+        The tuned settings.
+*/
+TuneSettings tune_clocking_model(
+    std::valarray<std::valarray<double>>& image, ClockingModel& model,
+    double target_error, int max_n_probe_columns, int n_repeats) {
+
+    TuneSettings settings;
+    settings.express = model.express;
+    settings.prune_n_electrons = model.prune_n_electrons;
+    settings.prune_frequency = model.prune_frequency;
+    if (!model.has_traps()) return settings;
+
+    // Columns are only independent if the traps are emptied between them
+    std::valarray<std::valarray<double>> probe =
+        model.empty_traps_between_columns ? probe_columns(image, max_n_probe_columns)
+                                          : image;
+    int n_rows = probe.size();
+    double time_scale = (double)image[0].size() / probe[0].size();
+
+    ClockingModel trial = model;
+    trial.express_tolerance = 0.0;
+    trial.express_extrapolate = false;
+    trial.prepare(n_rows, probe[0].size());
+
+    // Reference
+    std::valarray<std::valarray<double>> image_reference;
+    double error;
+    trial.express = 0;
+    double time_reference = run_probe(probe, trial, image_reference, error, n_repeats);
+
+    settings.is_tuned = true;
+    settings.express = 0;
+    settings.max_error = 0.0;
+    settings.time = time_reference;
+    double time;
+
+    // The smallest express that meets the target
+    for (int express = 1; express < n_rows; express *= 2) {
+        trial.express = express;
+        time = run_probe(probe, trial, image_reference, error, n_repeats);
+        print_v(1, "Tune express %d: error %g, time %g s \n", express, error, time);
+
+        if (error <= target_error) {
+            settings.express = express;
+            settings.max_error = error;
+            settings.time = time;
+            break;
+        }
+    }
+    trial.express = settings.express;
+
+    // The fastest pruning that still meets the target, unless pruning is off,
+    // when prune_n_electrons only sets any trap-state collapse threshold
+    double trial_prune_n_electrons[5] = {1e-8, 1e-6, 1e-4, 1e-3, 1e-2};
+    bool is_pruned =
+        (model.prune_frequency > 0) || (model.settings.collapse_factor > 0.0);
+    for (int i = 0; (i < 5) && is_pruned; i++) {
+        if (trial_prune_n_electrons[i] <= model.prune_n_electrons) continue;
+
+        trial.prune_n_electrons = trial_prune_n_electrons[i];
+        time = run_probe(probe, trial, image_reference, error, n_repeats);
+        print_v(
+            1, "Tune prune_n_electrons %g: error %g, time %g s \n",
+            trial.prune_n_electrons, error, time);
+
+        if (error > target_error) break;
+        if (time < settings.time) {
+            settings.prune_n_electrons = trial.prune_n_electrons;
+            settings.max_error = error;
+            settings.time = time;
+        }
+    }
+    trial.prune_n_electrons = settings.prune_n_electrons;
+
+    int trial_prune_frequency[4] = {5, 10, 20, 50};
+    for (int i = 0; i < 4; i++) {
+        if (trial_prune_frequency[i] == settings.prune_frequency) continue;
+
+        trial.prune_frequency = trial_prune_frequency[i];
+        time = run_probe(probe, trial, image_reference, error, n_repeats);
+        print_v(
+            1, "Tune prune_frequency %d: error %g, time %g s \n", trial.prune_frequency,
+            error, time);
+
+        if ((error <= target_error) && (time < settings.time)) {
+            settings.prune_frequency = trial.prune_frequency;
+            settings.max_error = error;
+            settings.time = time;
+        }
+    }
+
+    // Scale the probe times to the full image
+    settings.time *= time_scale;
+    settings.time_reference = time_reference * time_scale;
+
+    return settings;
+}
+
+/*
+    Find the fastest express and pruning settings for a CTI model that meet a
+    target maximum error, by clocking reduced-size probes of a representative
+    image with a sequence of trial settings.
+
+    For each direction, the reference is the output with express = 0. First the
+    smallest express (in powers of 2) that meets the target is found, then the
+    largest prune_n_electrons that still does (if faster, and skipped if
+    prune_frequency is 0 so the traps aren't pruned), then the fastest
+    prune_frequency. The target is split equally between the directions, since
+    their errors roughly add. The serial probe is taken from the image after
+    parallel clocking, as in add_cti().
+
+    The probes are a subset of the columns (or rows for serial clocking): the
+    brightest, which set the error, and some spread across the image for the
+    typical runtime. Each trial's time is the fastest of n_repeats runs, to
+    reduce the timing noise for small probes. The times are scaled up for the
+    full image, but are only rough estimates.
+
+    Parameters
+    ----------
+    image : std::valarray<std::valarray<double>>&
+        A representative image, assumed to be in units of electrons.
+
+    model : CTIModel&
+        The model to tune, which isn't modified. Use TuneResult::apply() to set
+        the results.
+
+    target_error : double
+        The target maximum error in any pixel (electrons).
+
+    max_n_probe_columns : int (opt.)
+        The maximum number of columns (or rows) to clock for each trial.
+
+    n_repeats : int (opt.)
+        The number of times to clock each trial, taking the fastest time.
+
+    Returns
+    -------
+    result : TuneResult
+        The tuned settings, which can be saved in the model file format with
+        TuneResult::to_text().
+*/
+TuneResult autotune(
+    std::valarray<std::valarray<double>>& image, CTIModel& model,
+    double target_error, int max_n_probe_columns, int n_repeats) {
+
+    if (target_error <= 0.0) error("Target error (%g) must be positive", target_error);
+
+    TuneResult result;
+    result.target_error = target_error;
+    int n_directions = (int)model.parallel.has_traps() + (int)model.serial.has_traps();
+    if (n_directions == 0) return result;
+
+    print_v(1, "Tune parallel \n");
+    result.parallel = tune_clocking_model(
+        image, model.parallel, target_error / n_directions, max_n_probe_columns,
+        n_repeats);
+
+    if (model.serial.has_traps()) {
+        print_v(1, "Tune serial \n");
+        // Serial clocking sees the parallel trails
+        std::valarray<std::valarray<double>> image_serial = image;
+        if (model.parallel.has_traps())
+            image_serial = model.parallel.clock_charge(image);
+        image_serial = transpose(image_serial);
+        result.serial = tune_clocking_model(
+            image_serial, model.serial, target_error / n_directions,
+            max_n_probe_columns, n_repeats);
+    }
+
+    return result;
+}
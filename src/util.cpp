@@ -1,14 +1,24 @@
 
 #include "util.hpp"
 
+#include <dirent.h>
 #include <math.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/time.h>
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <valarray>
 #include <vector>
 
+#include "fits.hpp"
+
 // ========
 // Printing
 // ========
@@ -22,6 +32,31 @@
 int verbosity = 1;
 void set_verbosity(int v) { verbosity = v; }
 
+// Whether error() throws instead of exiting in this thread
+static thread_local bool errors_throw = false;
+
+/*
+    Class ThrowErrors.
+
+    While an instance exists, error() throws an ArcticError in this thread (and
+    in the threads of any parallelised loops that it runs) instead of exiting,
+    e.g. so that a server can reply with the error and carry on.
+*/
+ThrowErrors::ThrowErrors() : was_throwing(errors_throw) { errors_throw = true; }
+
+ThrowErrors::~ThrowErrors() { errors_throw = was_throwing; }
+
+/*
+    Print an error message and exit, or throw it, see error().
+*/
+void raise_error(const char* message) {
+    if (errors_throw) throw ArcticError(message);
+
+    fflush(stdout);
+    fprintf(stderr, "%s\n", message);
+    exit(1);
+}
+
 /*
     Print the compiled version, set in the makefile.
 */
@@ -106,6 +141,331 @@ void print_array_2D(std::valarray<std::valarray<double>>& array) {
     return;
 }
 
+// ========
+// Threads
+// ========
+/*
+    Set the global number of threads for parallelised loops:
+
+    0       Use all available hardware threads.
+    1       Run serially.
+    n       Use up to n threads.
+*/
+int n_threads = 0;
+void set_n_threads(int n) { n_threads = n; }
+
+// The maximum number of threads for loops run by this thread, or 0 for no limit
+static thread_local int thread_limit = 0;
+
+/*
+    Limit the parallelised loops run by the calling thread to n threads, e.g.
+    for its share of the threads in a pool of threads that each run their own
+    jobs, or 0 to remove the limit.
+*/
+void set_thread_limit(int n) { thread_limit = n; }
+
+/*
+    The actual number of threads to use, resolving the default of 0, and any
+    limit for the calling thread, see set_thread_limit().
+
+    Nested loops run serially, so this is 1 inside a parallelised loop, unless
+    the loop shares its threads between its tasks.
+*/
+int get_n_threads() {
+    int n_total = n_threads;
+    if (n_total <= 0) {
+        int n_hardware = std::thread::hardware_concurrency();
+        n_total = (n_hardware > 0) ? n_hardware : 1;
+    }
+
+    return (thread_limit > 0) ? std::min(thread_limit, n_total) : n_total;
+}
+
+/*
+    Run task(i) for each i in [0, n_tasks), shared dynamically between up to
+    get_n_threads() threads.
+
+    Tasks may finish in any order, so each must only write to its own outputs.
+    Runs serially in the calling thread if only one thread is used. If a task
+    throws, then the remaining tasks are skipped and the first exception is
+    rethrown in the calling thread.
+
+    Parameters
+    ----------
+    n_tasks : int
+        The number of tasks.
+
+    task : std::function<void(int)>
+        The function to run for each task index.
+
+    share_threads : bool (opt.)
+        If true, then any parallelised loops in the tasks use their worker's
+        share of the threads, e.g. for a few large tasks. Otherwise (default)
+        they run serially.
+*/
+void parallel_for(int n_tasks, std::function<void(int)> task, bool share_threads) {
+    int n_total_threads = get_n_threads();
+    int n_workers = std::min(n_total_threads, n_tasks);
+
+    if (n_workers <= 1) {
+        for (int i_task = 0; i_task < n_tasks; i_task++) task(i_task);
+        return;
+    }
+
+    // Each worker takes the next task until none remain
+    std::atomic<int> i_next_task(0);
+    bool caller_errors_throw = errors_throw;
+    std::exception_ptr first_exception;
+    std::mutex exception_mutex;
+    auto worker = [&](int i_worker) {
+        int previous_thread_limit = thread_limit;
+        thread_limit = 1;
+        if (share_threads)
+            thread_limit = n_total_threads / n_workers +
+                           ((i_worker < n_total_threads % n_workers) ? 1 : 0);
+        errors_throw = caller_errors_throw;
+        try {
+            for (int i_task = i_next_task++; i_task < n_tasks; i_task = i_next_task++)
+                task(i_task);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(exception_mutex);
+            if (!first_exception) first_exception = std::current_exception();
+            i_next_task = n_tasks;
+        }
+        thread_limit = previous_thread_limit;
+    };
+
+    std::vector<std::thread> threads;
+    for (int i_worker = 1; i_worker < n_workers; i_worker++)
+        threads.push_back(std::thread(worker, i_worker));
+    worker(0);
+    for (auto& thread : threads) thread.join();
+
+    if (first_exception) std::rethrow_exception(first_exception);
+}
+
+// ========
+// NUMA
+// ========
+/*
+    Set the global NUMA mode for parallelised loops over image strips:
+
+    0       Off.
+    -1      Use the NUMA nodes from /sys/devices/system/node.
+    n       Split the available CPUs into n pseudo-nodes, e.g. for testing the
+            NUMA-aware code on a single-socket machine.
+
+    See parallel_for_numa().
+*/
+int numa_mode = 0;
+void set_numa_mode(int mode) { numa_mode = mode; }
+
+/*
+    Parse a Linux CPU list, e.g. "0-3,8,10-11" from a sysfs cpulist file.
+
+    Parameters
+    ----------
+    cpu_list : const char*
+        The comma-separated CPU indices and ranges.
+
+    Returns
+    -------
+    cpus : std::vector<int>
+        The CPU indices.
+*/
+std::vector<int> parse_cpu_list(const char* cpu_list) {
+    std::vector<int> cpus;
+    const char* c = cpu_list;
+    char* end;
+    int first, last;
+
+    while (*c != '\0') {
+        first = strtol(c, &end, 10);
+        if (end == c) break;
+        last = first;
+        c = end;
+        if (*c == '-') {
+            c++;
+            last = strtol(c, &end, 10);
+            c = end;
+        }
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        if (*c == ',') c++;
+    }
+
+    return cpus;
+}
+
+/*
+    The CPUs of each NUMA node that this process is allowed to run on, as set
+    by numa_mode.
+
+    CPUs excluded by the process's affinity, e.g. by numactl --cpunodebind,
+    are left out, as are any nodes with no remaining CPUs. Falls back to a
+    single node if the sysfs node directory isn't available.
+
+    Returns
+    -------
+    nodes : std::vector<std::vector<int>>
+        The allowed CPU indices for each node.
+*/
+std::vector<std::vector<int>> get_numa_nodes() {
+    std::vector<std::vector<int>> nodes;
+    std::vector<int> allowed_cpus;
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &cpu_set)) allowed_cpus.push_back(cpu);
+    }
+    if (allowed_cpus.empty()) allowed_cpus.push_back(0);
+
+    // Pseudo-nodes, sharing out the CPUs
+    if (numa_mode > 0) {
+        int n_cpus = allowed_cpus.size();
+        nodes.resize(numa_mode);
+        for (int i_node = 0; i_node < numa_mode; i_node++) {
+            for (int i_cpu = i_node * n_cpus / numa_mode;
+                 i_cpu < (i_node + 1) * n_cpus / numa_mode; i_cpu++)
+                nodes[i_node].push_back(allowed_cpus[i_cpu]);
+
+            // Share CPUs if there are more nodes than CPUs
+            if (nodes[i_node].empty())
+                nodes[i_node].push_back(allowed_cpus[i_node % n_cpus]);
+        }
+        return nodes;
+    }
+
+    // Real nodes, in index order
+    std::vector<int> node_indices;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir != nullptr) {
+        struct dirent* entry;
+        int node_index;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (sscanf(entry->d_name, "node%d", &node_index) == 1)
+                node_indices.push_back(node_index);
+        }
+        closedir(dir);
+    }
+    std::sort(node_indices.begin(), node_indices.end());
+
+    char path[128];
+    char cpu_list[4096];
+    for (int node_index : node_indices) {
+        snprintf(
+            path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node_index);
+        FILE* f = fopen(path, "r");
+        if (f == nullptr) continue;
+        if (fgets(cpu_list, sizeof(cpu_list), f) == nullptr) cpu_list[0] = '\0';
+        fclose(f);
+
+        std::vector<int> cpus;
+        for (int cpu : parse_cpu_list(cpu_list)) {
+            if (std::find(allowed_cpus.begin(), allowed_cpus.end(), cpu) !=
+                allowed_cpus.end())
+                cpus.push_back(cpu);
+        }
+        if (!cpus.empty()) nodes.push_back(cpus);
+    }
+
+    if (nodes.empty()) nodes.push_back(allowed_cpus);
+
+    return nodes;
+}
+
+/*
+    Restrict the calling thread to run only on the given CPUs.
+
+    Returns
+    -------
+    pinned : bool
+        Whether the affinity was set successfully.
+*/
+bool pin_thread_to_cpus(const std::vector<int>& cpus) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus)
+        if ((cpu >= 0) && (cpu < CPU_SETSIZE)) CPU_SET(cpu, &cpu_set);
+
+    return sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0;
+}
+
+/*
+    Run task(i) for each i in [0, n_tasks), as for parallel_for(), but with
+    the tasks and threads shared between NUMA nodes, see set_numa_mode().
+
+    Consecutive blocks of tasks are assigned to each node, and each node's
+    share of the get_n_threads() threads is pinned to that node's CPUs. So any
+    memory that a task allocates and first touches, e.g. a copy of its image
+    strip and its trap managers, is placed on the node that processes it.
+
+    Same as parallel_for() if the NUMA mode is off or there is only one node.
+
+    Parameters
+    ----------
+    n_tasks : int
+        The number of tasks.
+
+    task : std::function<void(int)>
+        The function to run for each task index.
+*/
+void parallel_for_numa(int n_tasks, std::function<void(int)> task) {
+    if ((numa_mode == 0) || (get_n_threads() <= 1) || (n_tasks <= 1))
+        return parallel_for(n_tasks, task);
+
+    std::vector<std::vector<int>> nodes = get_numa_nodes();
+    int n_nodes = std::min((int)nodes.size(), n_tasks);
+    if (n_nodes <= 1) return parallel_for(n_tasks, task);
+
+    // Share the threads between the nodes in proportion to their CPUs
+    int n_cpus = 0;
+    for (int i_node = 0; i_node < n_nodes; i_node++) n_cpus += nodes[i_node].size();
+    int n_total_workers = std::max(get_n_threads(), n_nodes);
+
+    // Each node's block of tasks, and the next one to start
+    std::vector<int> i_task_start(n_nodes);
+    std::vector<int> i_task_stop(n_nodes);
+    std::vector<std::atomic<int>> i_next_task(n_nodes);
+    for (int i_node = 0; i_node < n_nodes; i_node++) {
+        i_task_start[i_node] = i_node * n_tasks / n_nodes;
+        i_next_task[i_node] = i_task_start[i_node];
+        i_task_stop[i_node] = (i_node + 1) * n_tasks / n_nodes;
+    }
+
+    // Each worker takes the next task on its node until none remain
+    bool caller_errors_throw = errors_throw;
+    std::exception_ptr first_exception;
+    std::mutex exception_mutex;
+    auto worker = [&](int i_node) {
+        thread_limit = 1;
+        errors_throw = caller_errors_throw;
+        pin_thread_to_cpus(nodes[i_node]);
+        try {
+            for (int i_task = i_next_task[i_node]++; i_task < i_task_stop[i_node];
+                 i_task = i_next_task[i_node]++)
+                task(i_task);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(exception_mutex);
+            if (!first_exception) first_exception = std::current_exception();
+            for (int i = 0; i < n_nodes; i++) i_next_task[i] = i_task_stop[i];
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i_node = 0; i_node < n_nodes; i_node++) {
+        int n_workers = std::max(
+            1, (int)(n_total_workers * nodes[i_node].size() / n_cpus));
+        n_workers = std::min(n_workers, i_task_stop[i_node] - i_task_start[i_node]);
+        for (int i_worker = 0; i_worker < n_workers; i_worker++)
+            threads.push_back(std::thread(worker, i_node));
+    }
+    for (auto& thread : threads) thread.join();
+
+    if (first_exception) std::rethrow_exception(first_exception);
+}
+
 // ========
 // Arrays
 // ========
@@ -187,28 +547,48 @@ std::valarray<std::valarray<double>> transpose(
         The loaded 2D image array.
 */
 std::valarray<std::valarray<double>> load_image_from_txt(const char* filename) {
-    FILE* f = fopen(filename, "r");
+    FILE* f = fopen(filename, "rb");
     if (!f) error("Failed to open image file '%s'", filename);
 
+    // Read the whole file at once, then parse it in memory, which is much
+    // faster than fscanf() for each value
+    fseek(f, 0, SEEK_END);
+    long n_bytes = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (n_bytes < 0) {
+        fclose(f);
+        error("Failed to read image file '%s'", filename);
+    }
+    std::vector<char> buffer(n_bytes + 1);
+    size_t n_read = fread(buffer.data(), 1, n_bytes, f);
+    fclose(f);
+    if (n_read != (size_t)n_bytes) error("Failed to read image file '%s'", filename);
+    buffer[n_bytes] = '\0';
+
+    char* position = buffer.data();
+    char* end;
+
     // Load image dimensions
-    int n_rows;
-    int n_columns;
-    int c = fscanf(f, "%d %d", &n_rows, &n_columns);
-    if (c != 2) error("Failed to read n_rows, n_columns '%s'", filename);
+    int n_rows = strtol(position, &end, 10);
+    bool failed = (end == position);
+    position = end;
+    int n_columns = strtol(position, &end, 10);
+    if (failed || (end == position) || (n_rows < 0) || (n_columns < 0))
+        error("Failed to read n_rows, n_columns '%s'", filename);
+    position = end;
 
     // Load image data
     std::valarray<std::valarray<double>> image(
         std::valarray<double>(n_columns), n_rows);
     for (int i_row = 0; i_row < n_rows; i_row++) {
         for (int i_col = 0; i_col < n_columns; i_col++) {
-            c = fscanf(f, "%lf", &image[i_row][i_col]);
-            if (c != 1)
+            image[i_row][i_col] = strtod(position, &end);
+            if (end == position)
                 error("Failed to read image [%d, %d] '%s'", i_row, i_col, filename);
+            position = end;
         }
     }
 
-    fclose(f);
-
     return image;
 }
 
@@ -234,6 +614,7 @@ void save_image_to_txt(
     const char* filename, std::valarray<std::valarray<double>> image) {
     FILE* f = fopen(filename, "w");
     if (!f) error("Failed to open file '%s'", filename);
+    setvbuf(f, nullptr, _IOFBF, 1 << 20);
 
     // Save image dimensions
     int n_rows = image.size();
@@ -253,6 +634,54 @@ void save_image_to_txt(
     return;
 }
 
+/*
+    Load a 2D image from a FITS file (see is_fits_filename()) with
+    load_image_from_fits(), or otherwise from a text file with
+    load_image_from_txt().
+*/
+std::valarray<std::valarray<double>> load_image_from_file(const char* filename) {
+    if (is_fits_filename(filename)) return load_image_from_fits(filename);
+
+    return load_image_from_txt(filename);
+}
+
+/*
+    Read the shape of the image that load_image_from_file() would load, without
+    loading its pixels, e.g. to budget the memory before loading it.
+
+    Parameters
+    ----------
+    filename : str
+        The path to the file.
+
+    n_rows, n_columns : int&
+        Set to the image shape.
+*/
+void load_image_shape_from_file(const char* filename, int& n_rows, int& n_columns) {
+    if (is_fits_filename(filename))
+        return load_image_shape_from_fits(filename, n_rows, n_columns);
+
+    FILE* f = fopen(filename, "rb");
+    if (!f) error("Failed to open image file '%s'", filename);
+    int n_read = fscanf(f, "%d %d", &n_rows, &n_columns);
+    fclose(f);
+    if ((n_read != 2) || (n_rows < 0) || (n_columns < 0))
+        error("Failed to read n_rows, n_columns '%s'", filename);
+}
+
+/*
+    Save a 2D image to a FITS file (see is_fits_filename()) with
+    save_image_to_fits() and the global fits_compression and
+    fits_quantize_step, or otherwise to a text file with save_image_to_txt().
+*/
+void save_image_to_file(
+    const char* filename, std::valarray<std::valarray<double>>& image) {
+    if (is_fits_filename(filename))
+        save_image_to_fits(filename, image, fits_compression, fits_quantize_step);
+    else
+        save_image_to_txt(filename, image);
+}
+
 // ========
 // Misc
 // ========
@@ -0,0 +1,172 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <new>
+#include <valarray>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "roe.hpp"
+#include "trap_managers.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+// ========
+// Counting allocator
+// ========
+/*
+    Replace the global operator new to count the heap allocations made by the
+    current thread while counting is switched on by count_allocations().
+*/
+static thread_local bool is_counting_allocations = false;
+static thread_local long n_allocations = 0;
+
+void* operator new(size_t size) {
+    if (is_counting_allocations) n_allocations++;
+
+    void* pointer = malloc(size > 0 ? size : 1);
+    if (pointer == nullptr) throw std::bad_alloc();
+
+    return pointer;
+}
+void operator delete(void* pointer) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t size) noexcept { free(pointer); }
+
+/*
+    The number of heap allocations made by running a function.
+*/
+template <class Function>
+long count_allocations(Function function) {
+    n_allocations = 0;
+    is_counting_allocations = true;
+    function();
+    is_counting_allocations = false;
+
+    return n_allocations;
+}
+
+// A deterministic mix of faint and bright pixels, spanning ~0.01 to ~1e4 e-
+static double pixel_value(int i) {
+    int hash = (i * 7919 + 104729) % 1000;
+    return 0.01 * pow(10.0, 6.0 * hash / 1000.0);
+}
+
+TEST_CASE("Test counting allocator", "[allocations]") {
+    REQUIRE(count_allocations([]() {}) == 0);
+    REQUIRE(count_allocations([]() { std::valarray<double> array(0.0, 10); }) == 1);
+}
+
+TEST_CASE("Test no allocations in the trap managers' steady state", "[allocations]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {0.5, 0.25, 0.25};
+    std::valarray<CCDPhase> phases(CCDPhase(1e4, 0.0, 0.5), 3);
+    std::valarray<double> fractions = {0.5, 0.25, 0.25};
+    CCD ccd(phases, fractions);
+    std::valarray<TrapInstantCapture> traps_ic = {
+        TrapInstantCapture(100.0, 2.0), TrapInstantCapture(30.0, 5.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(50.0, 3.0, 0.2)};
+    std::valarray<TrapInstantCaptureContinuum> traps_ic_co = {
+        TrapInstantCaptureContinuum(40.0, 4.0, 0.4)};
+    std::valarray<TrapSlowCaptureContinuum> traps_sc_co = {
+        TrapSlowCaptureContinuum(40.0, 4.0, 0.4, 0.1)};
+    int n_transfers = 300;
+
+    TrapManagerManager trap_manager_manager(
+        traps_ic, traps_sc, traps_ic_co, traps_sc_co, n_transfers, ccd, dwell_times);
+
+    // Release and capture, store, restore, and prune as in the clocking loop
+    long n = count_allocations([&]() {
+        for (int i_pass = 0; i_pass < 3; i_pass++) {
+            trap_manager_manager.restore_trap_states();
+
+            for (int i_pixel = 0; i_pixel < n_transfers; i_pixel++) {
+                for (int i_phase = 0; i_phase < 3; i_phase++)
+                    trap_manager_manager.n_electrons_released_and_captured(
+                        i_phase, pixel_value(i_pixel + i_phase));
+
+                if ((i_pixel + 1) % 20 == 0)
+                    trap_manager_manager.prune_watermarks((i_pass == 1) ? -1e-3 : 1e-3);
+                trap_manager_manager.collapse_trap_states(1e-10);
+                if (i_pixel == n_transfers / 2)
+                    trap_manager_manager.store_trap_states();
+            }
+        }
+
+        trap_manager_manager.reset_trap_states();
+        trap_manager_manager.store_trap_states();
+    });
+
+    REQUIRE(n == 0);
+}
+
+TEST_CASE("Test no allocations in clocking with a workspace", "[allocations]") {
+    set_verbosity(0);
+    set_n_threads(1);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e4, 0.0, 0.5));
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 2.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 3.0, 0.2)};
+    std::valarray<TrapInstantCaptureContinuum> traps_ic_co = {};
+    std::valarray<TrapSlowCaptureContinuum> traps_sc_co = {};
+    int n_rows = 60;
+    int express = 5;
+    ClockingWorkspace workspace;
+    TrapManagerManager trap_manager_manager(
+        traps_ic, traps_sc, traps_ic_co, traps_sc_co, n_rows, ccd, dwell_times);
+
+    // Images with the same number of rows but more columns, and more pixels
+    std::valarray<std::valarray<double>> image_narrow(
+        std::valarray<double>(0.0, 2), n_rows);
+    std::valarray<std::valarray<double>> image_wide(
+        std::valarray<double>(0.0, 40), n_rows);
+    for (int row_index = 0; row_index < n_rows; row_index++) {
+        for (int column_index = 0; column_index < 40; column_index++) {
+            if (column_index < 2)
+                image_narrow[row_index][column_index] = pixel_value(row_index);
+            image_wide[row_index][column_index] =
+                pixel_value(row_index * 40 + column_index);
+        }
+    }
+    std::valarray<std::valarray<double>> image_out, image_workspace;
+
+    auto clock = [&](std::valarray<std::valarray<double>>& image,
+                     ClockingWorkspace* workspace) {
+        image_out = clock_charge_in_one_direction(
+            image, &roe, &ccd, &traps_ic, &traps_sc, &traps_ic_co, &traps_sc_co,
+            express, 0, 0, -1, 0, -1, 0, -1, 1e-10, 20, 0, &trap_manager_manager,
+            workspace);
+    };
+
+    // Warm up the workspace
+    clock(image_wide, &workspace);
+    image_workspace = image_out;
+
+    SECTION("Same result as without the workspace") {
+        clock(image_wide, nullptr);
+        REQUIRE_THAT(flatten(image_workspace), Catch::Approx(flatten(image_out)));
+    }
+
+    SECTION("Allocations don't depend on the columns or pixels") {
+        long n_narrow = count_allocations([&]() { clock(image_narrow, &workspace); });
+        long n_wide = count_allocations([&]() { clock(image_wide, &workspace); });
+
+        // Only the per-call setup, e.g. the output image and express matrix
+        REQUIRE(n_wide == n_narrow);
+        REQUIRE(n_wide < 3 * n_rows + 100);
+    }
+
+    SECTION("Reusing the workspace avoids copying the trap managers") {
+        long n_without = count_allocations([&]() { clock(image_wide, nullptr); });
+        long n_with = count_allocations([&]() { clock(image_wide, &workspace); });
+
+        REQUIRE(n_with < n_without);
+    }
+
+    set_n_threads(0);
+}
@@ -844,6 +844,63 @@ class TestRemoveCTI:
             assert image_remove_cti == pytest.approx(image_pre_cti, abs=tolerance)
 
 
+class TestExtrapolatedExpress:
+    def test__add_and_remove_cti__return_error_estimate(self):
+        image_pre_cti = np.zeros((40, 3))
+        image_pre_cti[10:15, :] = 1000.0
+
+        roe = cti.ROE()
+        ccd = cti.CCD(phases=[cti.CCDPhase(full_well_depth=1e4, well_fill_power=0.8)])
+        traps = [cti.TrapInstantCapture(density=10.0, release_timescale=5.0)]
+
+        image_exact = cti.add_cti(
+            image=image_pre_cti,
+            parallel_roe=roe,
+            parallel_ccd=ccd,
+            parallel_traps=traps,
+            verbosity=0,
+        )
+        image_extrapolated, error_estimate = cti.add_cti(
+            image=image_pre_cti,
+            parallel_roe=roe,
+            parallel_ccd=ccd,
+            parallel_traps=traps,
+            parallel_express=2,
+            parallel_express_extrapolate=True,
+            verbosity=0,
+            return_error_estimate=True,
+        )
+
+        # Close to the full express, on the scale of the estimate
+        assert error_estimate > 0.0
+        assert image_extrapolated == pytest.approx(image_exact, abs=10 * error_estimate)
+
+        # Zero without extrapolating
+        image_express, error_estimate = cti.add_cti(
+            image=image_pre_cti,
+            parallel_roe=roe,
+            parallel_ccd=ccd,
+            parallel_traps=traps,
+            parallel_express=2,
+            verbosity=0,
+            return_error_estimate=True,
+        )
+        assert error_estimate == 0.0
+
+        image_remove_cti, error_estimate = cti.remove_cti(
+            image=image_exact,
+            n_iterations=2,
+            parallel_roe=roe,
+            parallel_ccd=ccd,
+            parallel_traps=traps,
+            parallel_express=2,
+            parallel_express_extrapolate=True,
+            verbosity=0,
+            return_error_estimate=True,
+        )
+        assert error_estimate > 0.0
+
+
 class TestCTIModelForHSTACS:
     def test__CTI_model_for_HST_ACS(self):
         # Julian dates
@@ -889,6 +946,38 @@ class TestCTIModelForHSTACS:
             assert ccd.phases[0].well_fill_power == 0.478
 
 
+class TestEstimateResources:
+    def test__estimate_resources__scales_with_image_and_express(self):
+        roe = cti.ROE()
+        ccd = cti.CCD(phases=[cti.CCDPhase(full_well_depth=1e4)])
+        traps = [cti.TrapInstantCapture(density=10.0, release_timescale=2.0)]
+
+        estimate_small = cti.estimate_resources(
+            (50, 20), parallel_roe=roe, parallel_ccd=ccd, parallel_traps=traps
+        )
+        estimate_large = cti.estimate_resources(
+            (100, 20), parallel_roe=roe, parallel_ccd=ccd, parallel_traps=traps
+        )
+        estimate_express = cti.estimate_resources(
+            (100, 20),
+            parallel_roe=roe,
+            parallel_ccd=ccd,
+            parallel_traps=traps,
+            parallel_express=5,
+            calibrate=False,
+        )
+
+        assert "serial" not in estimate_small
+        assert (
+            estimate_small["parallel"]["trap_manager_bytes"]
+            < estimate_large["parallel"]["trap_manager_bytes"]
+        )
+        assert estimate_small["peak_bytes"] < estimate_large["peak_bytes"]
+        assert estimate_large["runtime"] > 0.0
+        assert estimate_express["parallel"]["n_pixel_transfers"] == 100 * 20 * 3
+        assert estimate_express["runtime"] == 0.0
+
+
 class TestDictable:
 
 
@@ -0,0 +1,101 @@
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <valarray>
+#include <vector>
+
+#include "batch.hpp"
+#include "catch2/catch.hpp"
+#include "model.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test bounded queue", "[batch]") {
+    BoundedQueue<int> queue(2);
+    std::vector<int> popped;
+    int item;
+
+    SECTION("Order, blocking when full, and closing") {
+        std::thread consumer([&]() {
+            while (queue.pop(item)) popped.push_back(item);
+        });
+        for (int i = 0; i < 10; i++) queue.push(i);
+        queue.close();
+        consumer.join();
+
+        REQUIRE(popped.size() == 10);
+        for (int i = 0; i < 10; i++) REQUIRE(popped[i] == i);
+        REQUIRE(queue.pop(item) == false);
+    }
+}
+
+TEST_CASE("Test batch output filename", "[batch]") {
+    REQUIRE(batch_output_filename("a/image.txt", false) == "a/image_cti_removed.txt");
+    REQUIRE(batch_output_filename("a.b/image", true) == "a.b/image_cti_added");
+    REQUIRE(
+        batch_output_filename("a/image.fits.fz", false) ==
+        "a/image_cti_removed.fits.fz");
+    REQUIRE(batch_output_filename("a.b/image.fz", true) == "a.b/image_cti_added.fz");
+}
+
+TEST_CASE("Test run batch", "[batch]") {
+    set_verbosity(0);
+
+    CTIModel model;
+    std::string message;
+    REQUIRE(
+        load_model_from_text(
+            "parallel_trap_ic = 10.0, 0.8 \nserial_trap_sc = 5.0, 3.0, 0.2 \n", model,
+            message) == 0);
+
+    std::string prefix = "/tmp/arctic_test_batch_" + std::to_string(getpid());
+    std::vector<std::string> filenames;
+    std::valarray<std::valarray<std::valarray<double>>> images(5);
+
+    // Images of different shapes and levels
+    for (int i_image = 0; i_image < 5; i_image++) {
+        images[i_image] = std::valarray<std::valarray<double>>(
+            std::valarray<double>(0.0, 3 + i_image % 2), 6 + i_image);
+        images[i_image][2][1] = 100.0 * (i_image + 1);
+        images[i_image][4][0] = 50.0;
+        filenames.push_back(prefix + "_" + std::to_string(i_image) + ".txt");
+        save_image_to_txt(filenames[i_image].c_str(), images[i_image]);
+    }
+
+    SECTION("Same as one at a time, small queue and memory budget") {
+        REQUIRE(run_batch(filenames, model, true, -1, 1, 1e-4) == 0);
+
+        for (int i_image = 0; i_image < 5; i_image++) {
+            std::string filename = batch_output_filename(filenames[i_image], true);
+            std::valarray<std::valarray<double>> image_batch =
+                load_image_from_txt(filename.c_str());
+            std::valarray<std::valarray<double>> image_post_cti =
+                model.add_cti(images[i_image]);
+
+            REQUIRE(image_batch.size() == image_post_cti.size());
+            REQUIRE_THAT(
+                flatten(image_batch),
+                Catch::Approx(flatten(image_post_cti)).margin(1e-6));
+            remove(filename.c_str());
+        }
+    }
+
+    SECTION("Files that fail to load are skipped") {
+        std::vector<std::string> filenames_missing = {
+            filenames[0], prefix + "_missing.txt", filenames[1]};
+        REQUIRE(run_batch(filenames_missing, model, true, -1, 1, 1e-4) == 1);
+
+        for (int i_image = 0; i_image < 2; i_image++) {
+            std::string filename = batch_output_filename(filenames[i_image], true);
+            REQUIRE(access(filename.c_str(), F_OK) == 0);
+            remove(filename.c_str());
+        }
+        REQUIRE(
+            access(batch_output_filename(filenames_missing[1], true).c_str(), F_OK) !=
+            0);
+    }
+
+    for (int i_image = 0; i_image < 5; i_image++) remove(filenames[i_image].c_str());
+}
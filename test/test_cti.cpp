@@ -747,6 +747,640 @@ TEST_CASE("Test charge injection ROE, add CTI", "[cti]") {
     }
 }
 
+TEST_CASE("Test charge injection batch", "[cti]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    TrapInstantCapture trap(10.0, -1.0 / log(0.5));
+    std::valarray<TrapInstantCapture> traps_ic = {trap};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 3.0, 0.2)};
+    ROEChargeInjection roe(dwell_times, 0, -1, true, true);
+    CCD ccd(CCDPhase(1e3, 0.0, 1.0));
+    std::valarray<std::valarray<std::valarray<double>>> images, images_post_cti;
+    std::valarray<std::valarray<double>> image_post_cti;
+    int express = 3;
+
+    // Injection lines of different levels
+    images.resize(4);
+    for (int i_image = 0; i_image < 4; i_image++) {
+        images[i_image] =
+            std::valarray<std::valarray<double>>(std::valarray<double>(0.0, 3), 12);
+        for (int row = 0; row < 12; row += 4)
+            images[i_image][row] = 100.0 * (i_image + 1);
+    }
+
+    SECTION("Same as clocking each image individually") {
+        set_n_threads(2);
+        images_post_cti = clock_charge_injection_batch(
+            images, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, express);
+        set_n_threads(0);
+
+        REQUIRE(images_post_cti.size() == 4);
+        for (int i_image = 0; i_image < 4; i_image++) {
+            image_post_cti = add_cti(
+                images[i_image], &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+                express);
+
+            REQUIRE_THAT(
+                flatten(images_post_cti[i_image]),
+                Catch::Approx(flatten(image_post_cti)));
+        }
+    }
+}
+
+TEST_CASE("Test multi-threaded column strips", "[cti]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 2.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 3.0, 0.2)};
+    CCD ccd(CCDPhase(1e3, 0.0, 1.0));
+    std::valarray<std::valarray<double>> image_pre_cti, image_serial, image_threads;
+    int express = 3;
+
+    // Different pixels in each column
+    image_pre_cti =
+        std::valarray<std::valarray<double>>(std::valarray<double>(10.0, 7), 12);
+    for (int column = 0; column < 7; column++)
+        image_pre_cti[column + 2][column] = 100.0 * (column + 1);
+
+    SECTION("Same result for any number of threads") {
+        ROE roe(dwell_times);
+        set_n_threads(1);
+        image_serial = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            express);
+
+        for (int n : {2, 3, 16}) {
+            set_n_threads(n);
+            image_threads = clock_charge_in_one_direction(
+                image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+                express);
+            REQUIRE_THAT(flatten(image_threads), Catch::Approx(flatten(image_serial)));
+        }
+        set_n_threads(0);
+    }
+
+    SECTION("Same result with NUMA pseudo-nodes") {
+        ROE roe(dwell_times);
+        set_n_threads(1);
+        image_serial = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            express, 0, 2, 10, 1, 6);
+
+        set_n_threads(4);
+        for (int n : {-1, 2, 3}) {
+            set_numa_mode(n);
+            image_threads = clock_charge_in_one_direction(
+                image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+                express, 0, 2, 10, 1, 6);
+            REQUIRE_THAT(flatten(image_threads), Catch::Approx(flatten(image_serial)));
+        }
+        set_numa_mode(0);
+        set_n_threads(0);
+    }
+
+    SECTION("Traps not emptied between columns") {
+        ROE roe(dwell_times, 0, -1, false);
+        set_n_threads(1);
+        image_serial = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            express);
+
+        set_n_threads(4);
+        image_threads = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            express);
+        set_n_threads(0);
+        REQUIRE_THAT(flatten(image_threads), Catch::Approx(flatten(image_serial)));
+    }
+
+    SECTION("Speculative chunks with traps not emptied between columns") {
+        ROE roe(dwell_times, 0, -1, false);
+        set_n_threads(1);
+        image_serial = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            express);
+
+        // Mispredicted chunks are re-clocked, for any number of chunks
+        for (int n : {2, 3, 16}) {
+            for (int n_warmup_columns : {0, 1, 2}) {
+                set_n_threads(n);
+                set_speculative_columns(1e-12, n_warmup_columns);
+                image_threads = clock_charge_in_one_direction(
+                    image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr,
+                    nullptr, express);
+                REQUIRE_THAT(
+                    flatten(image_threads), Catch::Approx(flatten(image_serial)));
+            }
+        }
+
+        // Only the predicted states with a large tolerance, which are close
+        set_n_threads(3);
+        set_speculative_columns(1e10, 2);
+        image_threads = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            express);
+        std::vector<double> pixels_serial = flatten(image_serial);
+        std::vector<double> pixels_threads = flatten(image_threads);
+        for (int i_pixel = 0; i_pixel < pixels_serial.size(); i_pixel++)
+            REQUIRE(
+                pixels_threads[i_pixel] == Approx(pixels_serial[i_pixel]).margin(0.1));
+
+        set_speculative_columns(0.0);
+        set_n_threads(0);
+    }
+
+    SECTION("Charge injection") {
+        ROEChargeInjection roe(dwell_times);
+        set_n_threads(1);
+        image_serial = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            express);
+
+        set_n_threads(4);
+        image_threads = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            express);
+        set_n_threads(0);
+        REQUIRE_THAT(flatten(image_threads), Catch::Approx(flatten(image_serial)));
+    }
+}
+
+TEST_CASE("Test row segments for tall columns", "[cti]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 2.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 8.0, 0.2)};
+    CCD ccd(CCDPhase(1e4, 0.0, 0.5));
+    std::valarray<std::valarray<double>> image_pre_cti, image_serial, image_threads;
+    int n_rows = 300;
+    int n_columns = 3;
+
+    // Sky with a few bright sources in each column
+    image_pre_cti = std::valarray<std::valarray<double>>(
+        std::valarray<double>(5.0, n_columns), n_rows);
+    for (int row = 20; row < n_rows; row += 37)
+        for (int column = 0; column < n_columns; column++)
+            image_pre_cti[row + column][column] = 50.0 * (row % 7 + 1);
+
+    auto clock = [&](ROE& roe, int express, int n_threads) {
+        set_n_threads(n_threads);
+        return clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, express,
+            0, 0, -1, 0, -1, 0, -1, 1e-10, 20);
+    };
+
+    SECTION("Seams fixed up for any segments and warm-up") {
+        for (bool empty_traps_for_first_transfers : {false, true}) {
+            ROE roe(dwell_times, 0, -1, true, empty_traps_for_first_transfers);
+
+            for (int express : {1, 4, 0}) {
+                set_row_segments(0.0);
+                image_serial = clock(roe, express, 1);
+
+                for (int n_threads : {2, 5, 16}) {
+                    for (int n_warmup_rows : {0, 10, 100}) {
+                        set_row_segments(1e-20, n_warmup_rows);
+                        image_threads = clock(roe, express, n_threads);
+                        REQUIRE_THAT(
+                            flatten(image_threads),
+                            Catch::Approx(flatten(image_serial)));
+                    }
+                }
+            }
+        }
+    }
+
+    SECTION("Traps not emptied between columns") {
+        ROE roe(dwell_times, 0, -1, false);
+        set_row_segments(0.0);
+        image_serial = clock(roe, 3, 1);
+
+        set_row_segments(1e-20, 20);
+        image_threads = clock(roe, 3, 4);
+        REQUIRE_THAT(flatten(image_threads), Catch::Approx(flatten(image_serial)));
+    }
+
+    SECTION("Only the predicted states with a large tolerance, which are close") {
+        ROE roe(dwell_times);
+        set_row_segments(0.0);
+        image_serial = clock(roe, 2, 1);
+
+        set_row_segments(1e10, 100);
+        image_threads = clock(roe, 2, 8);
+        std::vector<double> pixels_serial = flatten(image_serial);
+        std::vector<double> pixels_threads = flatten(image_threads);
+        for (int i_pixel = 0; i_pixel < pixels_serial.size(); i_pixel++)
+            REQUIRE(
+                pixels_threads[i_pixel] == Approx(pixels_serial[i_pixel]).margin(0.1));
+    }
+
+    SECTION("Not used with pixels linked by the clock sequence") {
+        std::valarray<double> dwell_times_3 = {0.5, 0.25, 0.25};
+        std::valarray<CCDPhase> phases(CCDPhase(1e4, 0.0, 0.5), 3);
+        std::valarray<double> fractions = {0.5, 0.25, 0.25};
+        ROE roe(dwell_times_3, 0, -1, true, false, false);
+        CCD ccd_3(phases, fractions);
+        set_n_threads(1);
+        set_row_segments(0.0);
+
+        // Skip the first and last rows, since charge moves between pixels
+        image_serial = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd_3, &traps_ic, &traps_sc, nullptr, nullptr, 3, 0,
+            1, n_rows - 1);
+
+        set_n_threads(4);
+        set_row_segments(1e10, 0);
+        image_threads = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd_3, &traps_ic, &traps_sc, nullptr, nullptr, 3, 0,
+            1, n_rows - 1);
+        REQUIRE_THAT(flatten(image_threads), Catch::Approx(flatten(image_serial)));
+    }
+
+    set_row_segments(0.0);
+    set_n_threads(0);
+}
+
+TEST_CASE("Test collapsing negligible trap states", "[cti]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times, 0, -1, false);
+    CCD ccd(CCDPhase(1e4, 0.0, 0.5));
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 3.0)};
+    std::valarray<std::valarray<double>> image_pre_cti, image_default, image_off,
+        image_collapsed;
+    int n_rows = 150;
+    int n_columns = 2;
+
+    // A bright source, then empty sky long enough for the traps to release
+    // almost all their charge, then a faint source, and another in the next
+    // column for the traps carried over from the first
+    image_pre_cti = std::valarray<std::valarray<double>>(
+        std::valarray<double>(0.0, n_columns), n_rows);
+    image_pre_cti[5][0] = 1e4;
+    image_pre_cti[120][0] = 100.0;
+    image_pre_cti[20][1] = 5.0;
+
+    auto clock = [&]() {
+        return clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 0, 0, 0,
+            -1, 0, -1, 0, -1, 1e-10, 20);
+    };
+
+    SECTION("Default output unchanged") {
+        image_default = clock();
+
+        set_collapse_trap_states(0.0);
+        image_off = clock();
+        REQUIRE(flatten(image_off) == flatten(image_default));
+
+        // Collapsing the traps changes the faint sources when enabled, here
+        // below 1e-2 electrons
+        set_collapse_trap_states(1e8);
+        image_collapsed = clock();
+        REQUIRE(image_collapsed[120][0] != image_default[120][0]);
+        REQUIRE(image_collapsed[20][1] != image_default[20][1]);
+    }
+
+    set_collapse_trap_states(0.0);
+}
+
+TEST_CASE("Test checkpoints for re-clocking edited images", "[cti]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 2.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 8.0, 0.2)};
+    CCD ccd(CCDPhase(1e4, 0.0, 0.5));
+    std::valarray<std::valarray<double>> image_pre_cti, image_edited, image_serial,
+        image_checkpoints;
+    int n_rows = 40;
+    int n_columns = 6;
+
+    image_pre_cti = std::valarray<std::valarray<double>>(
+        std::valarray<double>(5.0, n_columns), n_rows);
+    for (int row = 3; row < n_rows - n_columns; row += 11)
+        for (int column = 0; column < n_columns; column++)
+            image_pre_cti[row + column][column] = 100.0 * (row % 5 + 1);
+
+    // Edit a couple of pixels, e.g. masking a cosmic ray
+    image_edited = image_pre_cti;
+    image_edited[15][2] = 800.0;
+    image_edited[16][2] = 300.0;
+    image_edited[30][4] = 0.0;
+    std::vector<int> first_changed_rows = {n_rows, n_rows, 15, n_rows, 30, n_rows};
+
+    auto clock = [&](std::valarray<std::valarray<double>>& image, ROE& roe,
+                     int express, ClockingCheckpoints* checkpoints) {
+        return clock_charge_in_one_direction(
+            image, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, express, 0, 2,
+            -1, 0, -1, 0, -1, 1e-10, 20, 0, nullptr, nullptr, checkpoints);
+    };
+
+    SECTION("Re-clocked from checkpoints, same as clocking the edited image") {
+        for (bool empty_traps_for_first_transfers : {false, true}) {
+            ROE roe(dwell_times, 0, -1, true, empty_traps_for_first_transfers);
+
+            for (int express : {1, 3, 0}) {
+                for (int interval : {1, 7, 100}) {
+                    ClockingCheckpoints checkpoints(interval);
+                    image_serial = clock(image_pre_cti, roe, express, nullptr);
+                    image_checkpoints =
+                        clock(image_pre_cti, roe, express, &checkpoints);
+                    REQUIRE_THAT(
+                        flatten(image_checkpoints),
+                        Catch::Approx(flatten(image_serial)));
+
+                    checkpoints.first_changed_rows = first_changed_rows;
+                    image_serial = clock(image_edited, roe, express, nullptr);
+                    image_checkpoints = clock(image_edited, roe, express, &checkpoints);
+                    REQUIRE_THAT(
+                        flatten(image_checkpoints),
+                        Catch::Approx(flatten(image_serial)));
+                    REQUIRE(checkpoints.first_changed_rows.empty());
+                }
+            }
+        }
+    }
+
+    SECTION("Only the changed columns are re-clocked") {
+        ROE roe(dwell_times);
+        ClockingCheckpoints checkpoints(10);
+        image_serial = clock(image_pre_cti, roe, 2, &checkpoints);
+
+        // Claim that nothing changed, so the previous output is reused
+        checkpoints.first_changed_rows = std::vector<int>(n_columns, n_rows);
+        image_checkpoints = clock(image_edited, roe, 2, &checkpoints);
+        REQUIRE_THAT(flatten(image_checkpoints), Catch::Approx(flatten(image_serial)));
+
+        // Without changed rows, the whole image is clocked again
+        image_serial = clock(image_edited, roe, 2, nullptr);
+        image_checkpoints = clock(image_edited, roe, 2, &checkpoints);
+        REQUIRE_THAT(flatten(image_checkpoints), Catch::Approx(flatten(image_serial)));
+    }
+
+    SECTION("Multiple threads") {
+        ROE roe(dwell_times);
+        ClockingCheckpoints checkpoints(5);
+        clock(image_pre_cti, roe, 4, &checkpoints);
+
+        set_n_threads(3);
+        checkpoints.first_changed_rows = first_changed_rows;
+        image_checkpoints = clock(image_edited, roe, 4, &checkpoints);
+        set_n_threads(0);
+
+        image_serial = clock(image_edited, roe, 4, nullptr);
+        REQUIRE_THAT(flatten(image_checkpoints), Catch::Approx(flatten(image_serial)));
+    }
+
+    SECTION("Only the states that a re-clock resumes from are kept, up to a limit") {
+        ROE roe(dwell_times);
+
+        // Not row 0, which starts from empty traps
+        ClockingCheckpoints checkpoints(10);
+        clock(image_pre_cti, roe, 1, &checkpoints);
+        REQUIRE(checkpoints.column_states[0].size() == 3);
+
+        // Express 0 would need hundreds per column, so the interval is doubled
+        checkpoints = ClockingCheckpoints(1, 20);
+        clock(image_pre_cti, roe, 0, &checkpoints);
+        REQUIRE(checkpoints.column_states[0].size() <= 20);
+        REQUIRE(checkpoints.active_interval > 1);
+
+        checkpoints.first_changed_rows = first_changed_rows;
+        image_checkpoints = clock(image_edited, roe, 0, &checkpoints);
+        image_serial = clock(image_edited, roe, 0, nullptr);
+        REQUIRE_THAT(flatten(image_checkpoints), Catch::Approx(flatten(image_serial)));
+    }
+
+    SECTION("Not used with traps not emptied between columns") {
+        ROE roe(dwell_times, 0, -1, false);
+        ClockingCheckpoints checkpoints(10);
+        clock(image_pre_cti, roe, 2, &checkpoints);
+        REQUIRE(checkpoints.column_states.empty());
+
+        checkpoints.first_changed_rows = first_changed_rows;
+        image_checkpoints = clock(image_edited, roe, 2, &checkpoints);
+        image_serial = clock(image_edited, roe, 2, nullptr);
+        REQUIRE_THAT(flatten(image_checkpoints), Catch::Approx(flatten(image_serial)));
+    }
+}
+
+TEST_CASE("Test trap density scales per column", "[cti]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 2.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 8.0, 0.2)};
+    CCD ccd(CCDPhase(1e4, 0.0, 0.5));
+    std::valarray<std::valarray<double>> image_pre_cti, image_columns, image_scaled,
+        image_column;
+    int n_rows = 40;
+    int n_columns = 6;
+    std::valarray<double> density_scales = {0.5, 1.0, 2.0, 3.0, 1.5, 0.25};
+
+    image_pre_cti = std::valarray<std::valarray<double>>(
+        std::valarray<double>(5.0, n_columns), n_rows);
+    for (int row = 3; row < n_rows - n_columns; row += 11)
+        for (int column = 0; column < n_columns; column++)
+            image_pre_cti[row + column][column] = 100.0 * (row % 5 + 1);
+
+    auto clock = [&](ROE& roe, std::valarray<double>* scales,
+                     ClockingCheckpoints* checkpoints) {
+        return clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 3, 0, 0,
+            -1, 0, -1, 0, -1, 1e-10, 20, 0, nullptr, nullptr, checkpoints, scales);
+    };
+
+    // Clock each column on its own with the scaled trap densities
+    auto clock_columns = [&](ROE& roe) {
+        std::valarray<std::valarray<double>> image = image_pre_cti;
+        image_column = std::valarray<std::valarray<double>>(
+            std::valarray<double>(0.0, 1), n_rows);
+        for (int column = 0; column < n_columns; column++) {
+            std::valarray<TrapInstantCapture> column_traps_ic = {
+                TrapInstantCapture(10.0 * density_scales[column], 2.0)};
+            std::valarray<TrapSlowCapture> column_traps_sc = {
+                TrapSlowCapture(5.0 * density_scales[column], 8.0, 0.2)};
+            for (int row = 0; row < n_rows; row++)
+                image_column[row][0] = image_pre_cti[row][column];
+            image_column = clock_charge_in_one_direction(
+                image_column, &roe, &ccd, &column_traps_ic, &column_traps_sc, nullptr,
+                nullptr, 3);
+            for (int row = 0; row < n_rows; row++)
+                image[row][column] = image_column[row][0];
+        }
+        return image;
+    };
+
+    SECTION("Same as clocking each column with scaled traps") {
+        ROE roe(dwell_times);
+        image_columns = clock_columns(roe);
+        for (int n_threads : {1, 3}) {
+            set_n_threads(n_threads);
+            image_scaled = clock(roe, &density_scales, nullptr);
+            REQUIRE_THAT(flatten(image_scaled), Catch::Approx(flatten(image_columns)));
+        }
+
+        // With checkpoints
+        ClockingCheckpoints checkpoints(7);
+        image_scaled = clock(roe, &density_scales, &checkpoints);
+        REQUIRE_THAT(flatten(image_scaled), Catch::Approx(flatten(image_columns)));
+        checkpoints.first_changed_rows = {n_rows, 10, n_rows, 3, n_rows, 20};
+        image_scaled = clock(roe, &density_scales, &checkpoints);
+        REQUIRE_THAT(flatten(image_scaled), Catch::Approx(flatten(image_columns)));
+
+        // With row segments
+        set_n_threads(8);
+        set_row_segments(1e-20, 10);
+        image_scaled = clock(roe, &density_scales, nullptr);
+        REQUIRE_THAT(flatten(image_scaled), Catch::Approx(flatten(image_columns)));
+        set_row_segments(0.0);
+        set_n_threads(0);
+
+        // Charge injection
+        ROEChargeInjection roe_charge_injection(dwell_times);
+        image_columns = clock_columns(roe_charge_injection);
+        image_scaled = clock(roe_charge_injection, &density_scales, nullptr);
+        REQUIRE_THAT(flatten(image_scaled), Catch::Approx(flatten(image_columns)));
+    }
+
+    SECTION("Traps not emptied between columns") {
+        ROE roe(dwell_times, 0, -1, false);
+        std::valarray<double> unit_scales(1.0, n_columns);
+        image_columns = clock(roe, nullptr, nullptr);
+        image_scaled = clock(roe, &unit_scales, nullptr);
+        REQUIRE_THAT(flatten(image_scaled), Catch::Approx(flatten(image_columns)));
+
+        // The same in speculative chunks as in order
+        image_columns = clock(roe, &density_scales, nullptr);
+        set_n_threads(3);
+        set_speculative_columns(1e-12, 1);
+        image_scaled = clock(roe, &density_scales, nullptr);
+        REQUIRE_THAT(flatten(image_scaled), Catch::Approx(flatten(image_columns)));
+        set_speculative_columns(0.0);
+        set_n_threads(0);
+    }
+
+    SECTION("From a coarse map") {
+        std::valarray<std::valarray<double>> density_map = {{1.0, 2.0}, {3.0, 4.0}};
+        std::valarray<double> scales = density_scales_from_map(density_map, 4);
+        std::vector<double> answer = {2.0, 2.0, 3.0, 3.0};
+        REQUIRE_THAT(
+            std::vector<double>(std::begin(scales), std::end(scales)),
+            Catch::Approx(answer));
+
+        scales = density_scales_from_map(density_map, 5);
+        answer = {2.0, 2.0, 2.0, 3.0, 3.0};
+        REQUIRE_THAT(
+            std::vector<double>(std::begin(scales), std::end(scales)),
+            Catch::Approx(answer));
+    }
+}
+
+TEST_CASE("Test trap states carried between exposures", "[cti]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 2.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 500.0, 0.2)};
+    CCD ccd(CCDPhase(1e4, 0.0, 0.5));
+    std::valarray<std::valarray<double>> image_bright, image_faint, image_all,
+        image_split, image_fresh, image_after;
+    std::vector<TrapStates> trap_states;
+    int n_rows = 30;
+    int n_columns = 5;
+
+    image_faint = std::valarray<std::valarray<double>>(
+        std::valarray<double>(5.0, n_columns), n_rows);
+    for (int column = 0; column < n_columns; column++)
+        image_faint[3 + 5 * column][column] = 200.0;
+    image_bright = image_faint;
+    for (int row = 0; row < n_rows; row++) image_bright[row] *= 100.0;
+
+    auto clock = [&](std::valarray<std::valarray<double>>& image, ROE& roe,
+                     int column_start, int column_stop,
+                     std::vector<TrapStates>* states) {
+        return clock_charge_in_one_direction(
+            image, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 4, 0, 0, -1,
+            column_start, column_stop, 0, -1, 1e-10, 20, 0, nullptr, nullptr, nullptr,
+            nullptr, states);
+    };
+
+    SECTION("Same as clocking the columns in one call") {
+        ROE roe(dwell_times, 0, -1, false);
+        image_all = clock(image_faint, roe, 0, -1, nullptr);
+
+        for (int n_threads : {1, 3}) {
+            set_n_threads(n_threads);
+            set_speculative_columns(1e-12, 1);
+            trap_states.clear();
+            image_split = clock(image_faint, roe, 0, 2, &trap_states);
+            REQUIRE(trap_states.size() == 1);
+            image_split = clock(image_split, roe, 2, -1, &trap_states);
+            REQUIRE(flatten(image_split) == flatten(image_all));
+            set_speculative_columns(0.0);
+            set_n_threads(0);
+        }
+    }
+
+    SECTION("Persistence from a previous exposure") {
+        ROE roe(dwell_times);
+        image_fresh = clock(image_faint, roe, 0, -1, nullptr);
+
+        // Empty states to start are the same as none
+        trap_states.clear();
+        image_after = clock(image_faint, roe, 0, -1, &trap_states);
+        REQUIRE(trap_states.size() == n_columns);
+        REQUIRE(flatten(image_after) == flatten(image_fresh));
+
+        // Less charge is captured after a bright exposure, by the slow traps
+        // that are still partly filled, in each column independently
+        trap_states.clear();
+        clock(image_bright, roe, 0, -1, &trap_states);
+        std::vector<TrapStates> trap_states_bright = trap_states;
+        image_after = clock(image_faint, roe, 0, -1, &trap_states);
+        for (int column = 0; column < n_columns; column++) {
+            double n_electrons_fresh = 0.0;
+            double n_electrons_after = 0.0;
+            for (int row = 0; row < n_rows; row++) {
+                n_electrons_fresh += image_fresh[row][column];
+                n_electrons_after += image_after[row][column];
+            }
+            REQUIRE(n_electrons_after > n_electrons_fresh + 1.0);
+        }
+
+        // The same from serialised states, and in strips of columns
+        trap_states = trap_states_bright;
+        for (TrapStates& states : trap_states) states.from_array(states.to_array());
+        set_n_threads(3);
+        image_split = clock(image_faint, roe, 0, -1, &trap_states);
+        set_n_threads(0);
+        REQUIRE(flatten(image_split) == flatten(image_after));
+
+        // Remove the CTI including the persistence, unlike from empty traps
+        for (bool use_states : {true, false}) {
+            trap_states = trap_states_bright;
+            image_split = remove_cti(
+                image_after, 6, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 4,
+                0, 0, -1, 0, -1, 1e-10, 20, nullptr, nullptr, nullptr, nullptr,
+                nullptr, nullptr, 0, 0, 0, -1, 0, -1, 1e-10, 20, nullptr, nullptr,
+                nullptr, use_states ? &trap_states : nullptr);
+            double max_error = 0.0;
+            for (int row = 0; row < n_rows; row++)
+                max_error = std::max(
+                    max_error, abs(image_split[row] - image_faint[row]).max());
+            if (use_states)
+                REQUIRE(max_error < 1e-2);
+            else
+                REQUIRE(max_error > 1.0);
+        }
+    }
+}
+
 TEST_CASE("Test trap pumping ROE, add CTI", "[cti]") {
     set_verbosity(0);
 
@@ -846,3 +1480,217 @@ TEST_CASE("Test trap pumping ROE, add CTI", "[cti]") {
         REQUIRE(image_post_cti[4][0] == image_pre_cti[4][0]);
     }
 }
+
+TEST_CASE("Test pump charge in all pixels", "[cti]") {
+    set_verbosity(0);
+
+    TrapInstantCapture trap(10.0, -1.0 / log(0.5));
+    std::valarray<TrapInstantCapture> traps_ic = {trap};
+    std::valarray<double> dwell_times(1.0 / 6.0, 6);
+    std::valarray<double> fraction_of_traps_per_phase = {0.2, 0.5, 0.3};
+    CCDPhase phase(1e4, 0.0, 0.8);
+    std::valarray<CCDPhase> phases = {phase, phase, phase};
+    CCD ccd(phases, fraction_of_traps_per_phase);
+    std::valarray<std::valarray<double>> image_pre_cti, image_post_cti, image_single,
+        image_sum;
+    image_pre_cti = {
+        // clang-format off
+        {100.0, 200.0},
+        {100.0, 300.0},
+        {500.0, 100.0},
+        {100.0, 900.0},
+        {100.0, 100.0},
+        {100.0, 200.0},
+        // clang-format on
+    };
+
+    SECTION("Single pixel, same as clocking one active row") {
+        int n_pumps = 5;
+        ROETrapPumping roe(dwell_times, n_pumps);
+
+        image_post_cti = pump_charge_in_all_pixels(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 2, 3, 0,
+            -1, 0.0);
+        image_single = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 0, 0, 2,
+            3);
+
+        REQUIRE_THAT(flatten(image_post_cti), Catch::Approx(flatten(image_single)));
+    }
+
+    SECTION("Multiple pixels, sum of single pixels, multithreaded") {
+        int n_pumps = 5;
+        ROETrapPumping roe(dwell_times, n_pumps);
+
+        set_n_threads(2);
+        image_post_cti = pump_charge_in_all_pixels(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 1, 5, 0,
+            -1, 0.0);
+        set_n_threads(0);
+
+        image_sum = image_pre_cti;
+        for (int row = 1; row < 5; row++) {
+            image_single = add_cti(
+                image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 0, 0,
+                row, row + 1);
+            image_sum += image_single - image_pre_cti;
+        }
+
+        REQUIRE_THAT(flatten(image_post_cti), Catch::Approx(flatten(image_sum)));
+
+        // Total charge is conserved, apart from any left in the traps
+        double total_pre = 0.0;
+        double total_post = 0.0;
+        for (int row = 0; row < 6; row++) {
+            total_pre += image_pre_cti[row].sum();
+            total_post += image_post_cti[row].sum();
+        }
+        REQUIRE(total_post < total_pre);
+        REQUIRE(total_post == Approx(total_pre).epsilon(1e-2));
+    }
+
+    SECTION("Many pumps, steady state matches explicit pumping") {
+        int n_pumps = 10000;
+        ROETrapPumping roe(dwell_times, n_pumps);
+
+        image_post_cti = pump_charge_in_all_pixels(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 1, 5, 0,
+            -1, 1e-6);
+        image_single = pump_charge_in_all_pixels(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 1, 5, 0,
+            -1, 0.0);
+
+        REQUIRE_THAT(
+            flatten(image_post_cti),
+            Catch::Approx(flatten(image_single)).epsilon(1e-4));
+
+        // Significant dipoles created
+        REQUIRE(image_post_cti[2][0] < image_pre_cti[2][0] - 10.0);
+        REQUIRE(image_post_cti[3][1] < image_pre_cti[3][1] - 10.0);
+    }
+}
+
+TEST_CASE("Test add CTI derivatives", "[cti]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    std::valarray<std::valarray<double>> image_pre_cti, image_post_cti, image_add,
+        image_plus, image_minus;
+    std::valarray<std::valarray<std::valarray<double>>> derivatives;
+    std::vector<double> test, answer;
+    ROE roe(dwell_times, 0, -1, true, false, true, true);
+    CCD ccd(CCDPhase(1e3, 0.0, 0.5));
+    image_pre_cti = {
+        // clang-format off
+        {0.0,   0.0,   0.0,  0.0},
+        {200.0, 0.0,   0.0,  0.0},
+        {0.0,   800.0, 0.0,  0.0},
+        {0.0,   0.0,   20.0, 0.0},
+        {0.0,   0.0,   0.0,  0.0},
+        {0.0,   0.0,   0.0,  0.0},
+        // clang-format on
+    };
+    double step = 1e-6;
+
+    SECTION("Parallel and serial, compare with finite differences") {
+        std::valarray<TrapInstantCapture> parallel_traps = {
+            TrapInstantCapture(10.0, 2.0), TrapInstantCapture(5.0, 8.0)};
+        std::valarray<TrapInstantCapture> serial_traps = {
+            TrapInstantCapture(3.0, 1.5)};
+        std::valarray<TrapInstantCapture> traps_plus, traps_minus;
+        int express = 3;
+
+        image_post_cti = add_cti_derivatives(
+            image_pre_cti, derivatives, &roe, &ccd, &parallel_traps, express, 0, 0,
+            -1, &roe, &ccd, &serial_traps, express);
+
+        REQUIRE(derivatives.size() == 6);
+
+        // Same image as add_cti() without pruning
+        image_add = add_cti(
+            image_pre_cti, &roe, &ccd, &parallel_traps, nullptr, nullptr, nullptr,
+            express, 0, 0, -1, 0, -1, 0.0, 0, &roe, &ccd, &serial_traps, nullptr,
+            nullptr, nullptr, express, 0, 0, -1, 0, -1, 0.0, 0);
+        REQUIRE_THAT(flatten(image_post_cti), Catch::Approx(flatten(image_add)));
+
+        // Each parameter
+        for (int i_deriv = 0; i_deriv < 6; i_deriv++) {
+            for (int sign = -1; sign <= 1; sign += 2) {
+                traps_plus = parallel_traps;
+                traps_minus = serial_traps;
+                std::valarray<TrapInstantCapture>& traps =
+                    (i_deriv < 4) ? traps_plus : traps_minus;
+                int i_trap = (i_deriv % 4) / 2;
+                if (i_deriv % 2 == 0)
+                    traps[i_trap] = TrapInstantCapture(
+                        traps[i_trap].density + sign * step,
+                        traps[i_trap].release_timescale);
+                else
+                    traps[i_trap] = TrapInstantCapture(
+                        traps[i_trap].density,
+                        traps[i_trap].release_timescale + sign * step);
+
+                image_add = add_cti(
+                    image_pre_cti, &roe, &ccd, &traps_plus, nullptr, nullptr,
+                    nullptr, express, 0, 0, -1, 0, -1, 0.0, 0, &roe, &ccd,
+                    &traps_minus, nullptr, nullptr, nullptr, express, 0, 0, -1, 0,
+                    -1, 0.0, 0);
+                if (sign == -1)
+                    image_minus = image_add;
+                else
+                    image_plus = image_add;
+            }
+
+            answer = flatten(image_plus);
+            test = flatten(image_minus);
+            for (unsigned int i = 0; i < answer.size(); i++)
+                answer[i] = (answer[i] - test[i]) / (2.0 * step);
+            test = flatten(derivatives[i_deriv]);
+            REQUIRE_THAT(test, Catch::Approx(answer).epsilon(1e-4).margin(1e-6));
+        }
+    }
+
+    SECTION("Multiphase, compare with finite differences") {
+        std::valarray<double> dwell_times_3 = {0.5, 0.25, 0.25};
+        ROE roe_3(dwell_times_3, 0, -1, true, false, true, true);
+        std::valarray<CCDPhase> phases = {
+            CCDPhase(1e3, 0.0, 0.5), CCDPhase(1e3, 0.0, 0.5), CCDPhase(1e3, 0.0, 0.5)};
+        std::valarray<double> fraction_of_traps_per_phase = {0.5, 0.25, 0.25};
+        CCD ccd_3(phases, fraction_of_traps_per_phase);
+        std::valarray<TrapInstantCapture> traps = {TrapInstantCapture(10.0, 3.0)};
+        std::valarray<TrapInstantCapture> traps_step;
+
+        // Skip the last row, since charge can be released into the next pixel
+        int window_stop = image_pre_cti.size() - 1;
+
+        image_post_cti = add_cti_derivatives(
+            image_pre_cti, derivatives, &roe_3, &ccd_3, &traps, 0, 0, 0, window_stop);
+
+        REQUIRE(derivatives.size() == 2);
+
+        for (int i_deriv = 0; i_deriv < 2; i_deriv++) {
+            for (int sign = -1; sign <= 1; sign += 2) {
+                traps_step = traps;
+                if (i_deriv == 0)
+                    traps_step[0] = TrapInstantCapture(10.0 + sign * step, 3.0);
+                else
+                    traps_step[0] = TrapInstantCapture(10.0, 3.0 + sign * step);
+
+                image_add = add_cti(
+                    image_pre_cti, &roe_3, &ccd_3, &traps_step, nullptr, nullptr,
+                    nullptr, 0, 0, 0, window_stop, 0, -1, 0.0, 0);
+                if (sign == -1)
+                    image_minus = image_add;
+                else
+                    image_plus = image_add;
+            }
+
+            answer = flatten(image_plus);
+            test = flatten(image_minus);
+            for (unsigned int i = 0; i < answer.size(); i++)
+                answer[i] = (answer[i] - test[i]) / (2.0 * step);
+            test = flatten(derivatives[i_deriv]);
+            REQUIRE_THAT(test, Catch::Approx(answer).epsilon(1e-4).margin(1e-6));
+        }
+    }
+}
@@ -0,0 +1,73 @@
+
+#include <math.h>
+
+#include <valarray>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "dual.hpp"
+
+TEST_CASE("Test dual arithmetic", "[dual]") {
+    Dual x(3.0, 2, 0);
+    Dual y(2.0, 2, 1);
+    Dual z;
+
+    SECTION("Constants") {
+        z = Dual(5.0);
+        REQUIRE(z.value == 5.0);
+        REQUIRE(z.derivative(0) == 0.0);
+        REQUIRE(z.derivative(1) == 0.0);
+
+        z = x + 1.0;
+        REQUIRE(z.value == 4.0);
+        REQUIRE(z.derivative(0) == 1.0);
+        REQUIRE(z.derivative(1) == 0.0);
+    }
+
+    SECTION("Add, subtract, multiply, divide") {
+        z = x + y;
+        REQUIRE(z.value == 5.0);
+        REQUIRE(z.derivative(0) == 1.0);
+        REQUIRE(z.derivative(1) == 1.0);
+
+        z = x - y;
+        REQUIRE(z.value == 1.0);
+        REQUIRE(z.derivative(0) == 1.0);
+        REQUIRE(z.derivative(1) == -1.0);
+
+        z = x * y;
+        REQUIRE(z.value == 6.0);
+        REQUIRE(z.derivative(0) == 2.0);
+        REQUIRE(z.derivative(1) == 3.0);
+
+        z = x / y;
+        REQUIRE(z.value == 1.5);
+        REQUIRE(z.derivative(0) == Approx(0.5));
+        REQUIRE(z.derivative(1) == Approx(-0.75));
+
+        z = 1.0 - x;
+        REQUIRE(z.value == -2.0);
+        REQUIRE(z.derivative(0) == -1.0);
+
+        z = x;
+        z *= 2.0;
+        REQUIRE(z.value == 6.0);
+        REQUIRE(z.derivative(0) == 2.0);
+    }
+
+    SECTION("Functions") {
+        z = exp(x * y);
+        REQUIRE(z.value == Approx(exp(6.0)));
+        REQUIRE(z.derivative(0) == Approx(2.0 * exp(6.0)));
+        REQUIRE(z.derivative(1) == Approx(3.0 * exp(6.0)));
+
+        z = pow(x, 0.5);
+        REQUIRE(z.value == Approx(sqrt(3.0)));
+        REQUIRE(z.derivative(0) == Approx(0.5 / sqrt(3.0)));
+        REQUIRE(z.derivative(1) == 0.0);
+
+        z = pow(Dual(0.0, 2, 0), 0.5);
+        REQUIRE(z.value == 0.0);
+        REQUIRE(z.derivative(0) == 0.0);
+    }
+}
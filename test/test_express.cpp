@@ -0,0 +1,172 @@
+
+#include <math.h>
+
+#include <algorithm>
+#include <valarray>
+
+#include "catch2/catch.hpp"
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "express.hpp"
+#include "roe.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test adaptive express", "[express]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e4, 0.0, 0.5));
+    std::valarray<TrapInstantCapture> traps_ic = {
+        TrapInstantCapture(10.0, -1.0 / log(0.5))};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 8.0, 0.2)};
+    int n_rows = 60;
+    int n_columns = 8;
+    std::valarray<int> column_express;
+    std::valarray<std::valarray<double>> image_pre_cti(
+        std::valarray<double>(0.0, n_columns), n_rows);
+    std::valarray<std::valarray<double>> image_exact, image_adaptive;
+
+    // Faint sky in most columns, and bright sources far from readout in one
+    image_pre_cti += std::valarray<double>(2.0, n_columns);
+    for (int row_index = 40; row_index < 44; row_index++)
+        image_pre_cti[row_index][5] = 8000.0;
+    image_pre_cti[50][5] = 3000.0;
+
+    image_exact = clock_charge_in_one_direction(
+        image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0);
+
+    SECTION("Zero tolerance, same as full express") {
+        image_adaptive = clock_charge_in_one_direction_adaptive_express(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0.0, 0,
+            0, 1e-10, 20, &column_express);
+
+        REQUIRE_THAT(flatten(image_adaptive), Catch::Approx(flatten(image_exact)));
+        for (int column_index = 0; column_index < n_columns; column_index++)
+            REQUIRE(column_express[column_index] == n_rows);
+    }
+
+    SECTION("Tolerance, bright column needs higher express") {
+        double tolerance = 0.01;
+        image_adaptive = clock_charge_in_one_direction_adaptive_express(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            tolerance, 0, 0, 1e-10, 20, &column_express);
+
+        for (int column_index = 0; column_index < n_columns; column_index++) {
+            if (column_index != 5) REQUIRE(column_express[column_index] < n_rows);
+            REQUIRE(column_express[column_index] <= column_express[5]);
+        }
+        REQUIRE(column_express[5] > column_express[0]);
+
+        // Error of the same order as the tolerance
+        REQUIRE_THAT(
+            flatten(image_adaptive),
+            Catch::Approx(flatten(image_exact)).margin(10.0 * tolerance));
+    }
+
+    SECTION("Maximum express") {
+        image_adaptive = clock_charge_in_one_direction_adaptive_express(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 1e-12, 6,
+            0, 1e-10, 20, &column_express);
+        image_exact = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 6);
+
+        REQUIRE(column_express[5] == 6);
+        REQUIRE_THAT(flatten(image_adaptive), Catch::Approx(flatten(image_exact)));
+    }
+}
+
+TEST_CASE("Test extrapolated express", "[express]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e4, 0.0, 0.8));
+    std::valarray<TrapInstantCapture> traps_ic = {
+        TrapInstantCapture(10.0, -1.0 / log(0.5)), TrapInstantCapture(5.0, 20.0)};
+    int n_rows = 100;
+    int n_columns = 3;
+    double error_estimate;
+    std::valarray<std::valarray<double>> image_pre_cti(
+        std::valarray<double>(50.0, n_columns), n_rows);
+    std::valarray<std::valarray<double>> image_exact, image_express, image_extrapolated;
+
+    // Bright sources at different distances from readout
+    for (int column_index = 0; column_index < n_columns; column_index++)
+        for (int row_index = 20; row_index < 25; row_index++)
+            image_pre_cti[row_index + 30 * column_index][column_index] =
+                2000.0 * (column_index + 1);
+
+    image_exact = clock_charge_in_one_direction(
+        image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 0);
+
+    SECTION("More accurate than twice the express") {
+        int express = 4;
+        image_express = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr,
+            2 * express);
+        image_extrapolated = clock_charge_in_one_direction_extrapolated_express(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, express,
+            0, 1e-10, 20, &error_estimate);
+
+        double error_express = 0.0;
+        double error_extrapolated = 0.0;
+        for (int row_index = 0; row_index < n_rows; row_index++) {
+            for (int column_index = 0; column_index < n_columns; column_index++) {
+                error_express = std::max(
+                    error_express, fabs(
+                                       image_express[row_index][column_index] -
+                                       image_exact[row_index][column_index]));
+                double error = image_extrapolated[row_index][column_index] -
+                               image_exact[row_index][column_index];
+                error_extrapolated = std::max(error_extrapolated, fabs(error));
+            }
+        }
+
+        REQUIRE(error_extrapolated < 0.2 * error_express);
+        // The estimate is of the 2 * express error, so above the extrapolated one
+        REQUIRE(error_estimate == Approx(error_express).epsilon(0.5));
+        REQUIRE(error_estimate > error_extrapolated);
+    }
+
+    SECTION("Full express") {
+        for (int express : {0, 50, 80}) {
+            image_extrapolated = clock_charge_in_one_direction_extrapolated_express(
+                image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr,
+                express, 0, 1e-10, 20, &error_estimate);
+
+            REQUIRE(error_estimate == 0.0);
+            REQUIRE_THAT(
+                flatten(image_extrapolated), Catch::Approx(flatten(image_exact)));
+        }
+    }
+
+    SECTION("No negative counts") {
+        // Faint pixels between many bright ones, where the extrapolation can
+        // overshoot below zero
+        CCD ccd_faint(CCDPhase(1e4, 0.0, 0.58));
+        std::valarray<TrapInstantCapture> traps_ic_long = {
+            TrapInstantCapture(10.0, 0.5), TrapInstantCapture(5.0, 20.0),
+            TrapInstantCapture(2.0, 300.0)};
+        n_rows = 200;
+        n_columns = 20;
+        image_pre_cti = std::valarray<std::valarray<double>>(
+            std::valarray<double>(0.0, n_columns), n_rows);
+        for (int row_index = 0; row_index < n_rows; row_index++)
+            for (int column_index = 0; column_index < n_columns; column_index++)
+                image_pre_cti[row_index][column_index] =
+                    ((row_index * 7 + column_index * 13) % 50 == 0)
+                        ? 8000.0
+                        : 0.5 * ((row_index + column_index) % 3);
+
+        for (int express : {1, 2}) {
+            image_extrapolated = clock_charge_in_one_direction_extrapolated_express(
+                image_pre_cti, &roe, &ccd_faint, &traps_ic_long, nullptr, nullptr,
+                nullptr, express, 0, 1e-10, 20, &error_estimate);
+
+            std::vector<double> pixels = flatten(image_extrapolated);
+            REQUIRE(*std::min_element(pixels.begin(), pixels.end()) >= 0.0);
+        }
+    }
+}
@@ -0,0 +1,222 @@
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <valarray>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "fits.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test FITS filename", "[fits]") {
+    REQUIRE(is_fits_filename("image.fits"));
+    REQUIRE(is_fits_filename("a/image.FIT"));
+    REQUIRE(is_fits_filename("image.fits.fz"));
+    REQUIRE(!is_fits_filename("image.txt"));
+    REQUIRE(!is_fits_filename("a.fits/image"));
+}
+
+TEST_CASE("Test Rice compression", "[fits]") {
+    std::vector<int> values;
+    std::vector<int> decompressed;
+    std::vector<unsigned char> bytes;
+
+    SECTION("Known bytes") {
+        values = {10, 11, 13, 13, 9, -2};
+        bytes = rice_compress(values.data(), values.size());
+        REQUIRE(bytes == std::vector<unsigned char>({0, 0, 0, 10, 28, 201, 28, 20}));
+
+        // Constant block
+        values = {1, 1, 1, 1};
+        bytes = rice_compress(values.data(), values.size(), 2);
+        REQUIRE(bytes == std::vector<unsigned char>({0, 1, 0}));
+    }
+
+    SECTION("Round trip, each number of bytes") {
+        int bytepixes[3] = {1, 2, 4};
+        for (int bytepix : bytepixes) {
+            int n_bits = 8 * bytepix;
+            long long minimum = (bytepix == 1) ? 0 : -(1LL << (n_bits - 1));
+            long long range = 1LL << n_bits;
+
+            // Smooth, constant, and noisy blocks, and wrapping differences
+            values.clear();
+            for (int i = 0; i < 100; i++) values.push_back(minimum + range / 2 + i / 3);
+            for (int i = 0; i < 40; i++) values.push_back(minimum + 7);
+            unsigned int seed = 1;
+            for (int i = 0; i < 97; i++) {
+                seed = seed * 1103515245 + 12345;
+                values.push_back(minimum + (long long)(seed >> 8) % range);
+            }
+            values.push_back(minimum);
+            values.push_back(minimum + range - 1);
+            values.push_back(minimum);
+
+            bytes = rice_compress(values.data(), values.size(), bytepix);
+            decompressed.assign(values.size(), 0);
+            REQUIRE(
+                rice_decompress(
+                    bytes.data(), bytes.size(), decompressed.data(), values.size(),
+                    bytepix) == 0);
+            REQUIRE(decompressed == values);
+
+            // Truncated
+            REQUIRE(
+                rice_decompress(
+                    bytes.data(), bytes.size() / 2, decompressed.data(), values.size(),
+                    bytepix) == 1);
+        }
+    }
+}
+
+TEST_CASE("Test save and load image FITS", "[fits]") {
+    std::string prefix = "/tmp/arctic_test_fits_" + std::to_string(getpid());
+    std::string filename;
+
+    // Noisy image with a bright pixel, a constant row, and null pixels
+    std::valarray<std::valarray<double>> image(std::valarray<double>(0.0, 37), 23);
+    unsigned int seed = 1;
+    for (int i_row = 0; i_row < 23; i_row++) {
+        for (int i_col = 0; i_col < 37; i_col++) {
+            seed = seed * 1103515245 + 12345;
+            image[i_row][i_col] = 100.0 + (seed >> 16) % 1000 / 77.0;
+        }
+    }
+    image[3][4] = 54321.123;
+    image[5] = 2.5;
+    image[7][8] = NAN;
+    std::valarray<std::valarray<double>> image_loaded;
+
+    SECTION("Uncompressed") {
+        filename = prefix + ".fits";
+        save_image_to_fits(filename.c_str(), image);
+        image_loaded = load_image_from_fits(filename.c_str());
+
+        REQUIRE(image_loaded.size() == 23);
+        REQUIRE(image_loaded[0].size() == 37);
+        REQUIRE(isnan(image_loaded[7][8]));
+        image_loaded[7][8] = image[7][8] = 0.0;
+        REQUIRE(flatten(image_loaded) == flatten(image));
+    }
+
+    SECTION("GZIP, lossless") {
+        filename = prefix + ".fits";
+        save_image_to_fits(filename.c_str(), image, fits_gzip);
+        image_loaded = load_image_from_fits(filename.c_str());
+
+        REQUIRE(image_loaded.size() == 23);
+        REQUIRE(image_loaded[0].size() == 37);
+        REQUIRE(isnan(image_loaded[7][8]));
+        image_loaded[7][8] = image[7][8] = 0.0;
+        REQUIRE(flatten(image_loaded) == flatten(image));
+    }
+
+    SECTION("Rice, quantised, by default for .fz") {
+        double step = 0.01;
+        filename = prefix + ".fits.fz";
+        save_image_to_fits(filename.c_str(), image, fits_auto, step);
+        image_loaded = load_image_from_fits(filename.c_str());
+
+        REQUIRE(image_loaded.size() == 23);
+        REQUIRE(image_loaded[0].size() == 37);
+        REQUIRE(isnan(image_loaded[7][8]));
+        image_loaded[7][8] = image[7][8] = 0.0;
+
+        // Within half a step, with errors that average out
+        double sum_error = 0.0;
+        for (int i_row = 0; i_row < 23; i_row++) {
+            for (int i_col = 0; i_col < 37; i_col++) {
+                double error = image_loaded[i_row][i_col] - image[i_row][i_col];
+                REQUIRE(fabs(error) <= step / 2.0 + 1e-9);
+                sum_error += error;
+            }
+        }
+        REQUIRE(fabs(sum_error / (23 * 37)) < step / 20.0);
+
+        // Compressed, after the two header blocks
+        FILE* f = fopen(filename.c_str(), "rb");
+        fseek(f, 0, SEEK_END);
+        REQUIRE(ftell(f) - 2 * 2880 < 23 * 37 * 8);
+        fclose(f);
+    }
+
+    SECTION("Same tiles with any number of threads") {
+        filename = prefix + ".fits.fz";
+        save_image_to_fits(filename.c_str(), image, fits_rice);
+        set_n_threads(1);
+        std::valarray<std::valarray<double>> image_serial =
+            load_image_from_fits(filename.c_str());
+        set_n_threads(4);
+        image_loaded = load_image_from_fits(filename.c_str());
+        set_n_threads(0);
+
+        image_serial[7][8] = image_loaded[7][8] = 0.0;
+        REQUIRE(flatten(image_loaded) == flatten(image_serial));
+    }
+
+    SECTION("Shape without loading") {
+        int n_rows = 0;
+        int n_columns = 0;
+        for (int compression : {fits_none, fits_rice}) {
+            filename = prefix + ".fits";
+            save_image_to_fits(filename.c_str(), image, compression);
+            load_image_shape_from_file(filename.c_str(), n_rows, n_columns);
+            REQUIRE(n_rows == 23);
+            REQUIRE(n_columns == 37);
+            n_rows = n_columns = 0;
+        }
+        remove(filename.c_str());
+
+        filename = prefix + ".txt";
+        save_image_to_file(filename.c_str(), image);
+        load_image_shape_from_file(filename.c_str(), n_rows, n_columns);
+        REQUIRE(n_rows == 23);
+        REQUIRE(n_columns == 37);
+    }
+
+    SECTION("Invalid files are closed before raising") {
+        filename = prefix + ".fits";
+        FILE* f = fopen(filename.c_str(), "wb");
+        std::vector<char> block(2880, ' ');
+        fwrite(block.data(), 1, block.size(), f);
+        fclose(f);
+
+        // The lowest free file descriptor is reused unless a file was left open
+        int fd_before = open("/dev/null", O_RDONLY);
+        close(fd_before);
+        int n_rows;
+        int n_columns;
+        {
+            ThrowErrors throw_errors;
+            REQUIRE_THROWS_AS(
+                load_image_shape_from_file(filename.c_str(), n_rows, n_columns),
+                ArcticError);
+            REQUIRE_THROWS_AS(load_image_from_file(filename.c_str()), ArcticError);
+        }
+        int fd_after = open("/dev/null", O_RDONLY);
+        close(fd_after);
+        REQUIRE(fd_after == fd_before);
+    }
+
+    SECTION("Text or FITS by file name") {
+        image[7][8] = 0.0;
+        set_fits_compression(fits_gzip);
+        filename = prefix + ".fits";
+        save_image_to_file(filename.c_str(), image);
+        set_fits_compression(fits_auto);
+        image_loaded = load_image_from_file(filename.c_str());
+        REQUIRE(flatten(image_loaded) == flatten(image));
+        remove(filename.c_str());
+
+        filename = prefix + ".txt";
+        save_image_to_file(filename.c_str(), image);
+        image_loaded = load_image_from_file(filename.c_str());
+        REQUIRE_THAT(flatten(image_loaded), Catch::Approx(flatten(image)));
+    }
+
+    remove(filename.c_str());
+}
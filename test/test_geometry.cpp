@@ -0,0 +1,167 @@
+
+#include <stdio.h>
+
+#include <string>
+#include <valarray>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "geometry.hpp"
+#include "model.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test readout region extract and insert", "[geometry]") {
+    std::valarray<std::valarray<double>> image = {
+        {0.0, 1.0, 2.0}, {3.0, 4.0, 5.0}, {6.0, 7.0, 8.0}, {9.0, 10.0, 11.0}};
+    std::valarray<std::valarray<double>> region_image;
+
+    SECTION("Flipped rows and columns") {
+        ReadoutRegion region(nullptr, 1, 4, 1, 3, true, true);
+        region_image = region.extract(image);
+
+        REQUIRE(region_image.size() == 3);
+        REQUIRE(region_image[0][0] == 11.0);
+        REQUIRE(region_image[0][1] == 10.0);
+        REQUIRE(region_image[2][1] == 4.0);
+
+        region_image[2][1] = -1.0;
+        region.insert(image, region_image);
+        REQUIRE(image[1][1] == -1.0);
+        REQUIRE(image[3][2] == 11.0);
+        REQUIRE(image[0][0] == 0.0);
+    }
+}
+
+TEST_CASE("Test add and remove CTI with a readout geometry", "[geometry]") {
+    set_verbosity(0);
+
+    CTIModel model_a, model_d;
+    std::string message;
+    REQUIRE(
+        load_model_from_text(
+            "parallel_trap_ic = 10.0, 0.8 \nserial_trap_sc = 5.0, 3.0, 0.2 \n",
+            model_a, message) == 0);
+    REQUIRE(
+        load_model_from_text("parallel_trap_ic = 20.0, 2.0 \n", model_d, message) ==
+        0);
+
+    int n_rows = 12;
+    int n_columns = 8;
+    std::valarray<std::valarray<double>> image_pre_cti(
+        std::valarray<double>(0.0, n_columns), n_rows);
+    std::valarray<std::valarray<double>> image_post_cti, image_quadrant,
+        image_remove_cti;
+    for (int row_index = 1; row_index < n_rows; row_index += 3)
+        for (int column_index = 1; column_index < n_columns; column_index += 2)
+            image_pre_cti[row_index][column_index] = 100.0 * row_index + column_index;
+
+    ReadoutGeometry geometry =
+        quadrant_geometry(n_rows, n_columns, &model_a, nullptr, nullptr, &model_d);
+
+    SECTION("Same as flipping each quadrant, multithreaded") {
+        set_n_threads(4);
+        image_post_cti = add_cti(image_pre_cti, geometry);
+        set_n_threads(0);
+
+        for (int i_region = 0; i_region < 4; i_region++) {
+            ReadoutRegion region = geometry.regions[i_region];
+            CTIModel* model = (i_region == 3) ? &model_d : &model_a;
+            int n_rows_q = n_rows / 2;
+            int n_columns_q = n_columns / 2;
+            int row_0 = (i_region >= 2) ? n_rows_q : 0;
+            int column_0 = (i_region % 2 == 1) ? n_columns_q : 0;
+
+            // Flip the quadrant manually so its readout is at [0][0]
+            image_quadrant = std::valarray<std::valarray<double>>(
+                std::valarray<double>(0.0, n_columns_q), n_rows_q);
+            for (int i = 0; i < n_rows_q; i++)
+                for (int j = 0; j < n_columns_q; j++)
+                    image_quadrant[i][j] = image_pre_cti
+                        [(i_region >= 2) ? row_0 + n_rows_q - 1 - i : row_0 + i]
+                        [(i_region % 2 == 1) ? column_0 + n_columns_q - 1 - j
+                                             : column_0 + j];
+            image_quadrant = model->add_cti(image_quadrant);
+
+            for (int i = 0; i < n_rows_q; i++)
+                for (int j = 0; j < n_columns_q; j++)
+                    REQUIRE(
+                        image_quadrant[i][j] ==
+                        Approx(image_post_cti
+                                   [(i_region >= 2) ? row_0 + n_rows_q - 1 - i
+                                                    : row_0 + i]
+                                   [(i_region % 2 == 1) ? column_0 + n_columns_q - 1 - j
+                                                        : column_0 + j]));
+        }
+
+        image_remove_cti = remove_cti(image_post_cti, 4, geometry);
+        REQUIRE_THAT(
+            flatten(image_remove_cti),
+            Catch::Approx(flatten(image_pre_cti)).margin(0.1));
+    }
+
+    SECTION("Pixels outside the regions unchanged") {
+        ReadoutGeometry geometry_partial;
+        geometry_partial.add_region(ReadoutRegion(&model_a, 0, -1, 0, 4));
+        image_post_cti = add_cti(image_pre_cti, geometry_partial);
+
+        for (int row_index = 0; row_index < n_rows; row_index++)
+            for (int column_index = 4; column_index < n_columns; column_index++)
+                REQUIRE(
+                    image_post_cti[row_index][column_index] ==
+                    image_pre_cti[row_index][column_index]);
+        REQUIRE(image_post_cti[1][1] < image_pre_cti[1][1]);
+    }
+
+    SECTION("Each region clocked on its share of the threads") {
+        std::valarray<std::valarray<double>> image_wide(
+            std::valarray<double>(10.0, 64), n_rows);
+        ReadoutGeometry geometry_halves;
+        geometry_halves.add_region(ReadoutRegion(&model_d, 0, -1, 0, 32));
+        geometry_halves.add_region(ReadoutRegion(&model_d, 0, -1, 32, 64, false, true));
+
+        // Each half's columns in 4 * 4 strips, instead of one strip per column
+        set_n_threads(8);
+        start_trace(1);
+        add_cti(image_wide, geometry_halves);
+        stop_trace();
+        set_n_threads(0);
+
+        int n_strips = 0;
+        for (const TraceEvent& event : get_trace_events())
+            if (std::string(event.name) == "strip") n_strips++;
+        REQUIRE(n_strips == 2 * 16);
+    }
+
+    SECTION("Regions of different shapes sharing a model are all prepared") {
+        int n_rows_odd = 13;
+        int n_columns_odd = 9;
+        std::valarray<std::valarray<double>> image_odd(
+            std::valarray<double>(10.0, n_columns_odd), n_rows_odd);
+        image_odd[12][8] = 1000.0;
+        ReadoutGeometry geometry_odd =
+            quadrant_geometry(n_rows_odd, n_columns_odd, &model_a);
+
+        // Every trap manager setup is for preparing one of the 4 shapes, in
+        // each direction, rather than for clocking with unprepared models
+        start_trace(1);
+        image_post_cti = add_cti(image_odd, geometry_odd);
+        stop_trace();
+
+        int n_prepared = 0;
+        int n_setups = 0;
+        for (const TraceEvent& event : get_trace_events()) {
+            if (std::string(event.name) == "prepare_model") n_prepared++;
+            if (std::string(event.name) == "trap_manager_setup") n_setups++;
+        }
+        REQUIRE(n_prepared == 4 * 2);
+        REQUIRE(n_setups == n_prepared);
+
+        // Same as clocking the flipped quadrant with its own model
+        CTIModel model_quadrant = model_a;
+        image_quadrant = geometry_odd.regions[3].extract(image_odd);
+        image_quadrant = model_quadrant.add_cti(image_quadrant);
+        REQUIRE(image_quadrant[0][0] == Approx(image_post_cti[12][8]));
+        REQUIRE(image_post_cti[12][8] < 1000.0);
+    }
+}
@@ -0,0 +1,171 @@
+
+#include <stdio.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <valarray>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "jobs.hpp"
+#include "model.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test job queue", "[jobs]") {
+    set_verbosity(0);
+
+    std::shared_ptr<CTIModel> model(new CTIModel());
+    std::string message;
+    REQUIRE(
+        load_model_from_text(
+            "parallel_trap_ic = 10.0, 0.8 \n"
+            "serial_trap_sc = 5.0, 3.0, 0.2 \n",
+            *model, message) == 0);
+
+    int n_rows = 12;
+    int n_columns = 6;
+    std::valarray<std::valarray<double>> image_pre_cti(
+        std::valarray<double>(0.0, n_columns), n_rows);
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        image_pre_cti[row_index][(row_index * 5) % n_columns] = 100.0 + row_index;
+    model->prepare(n_rows, n_columns);
+
+    std::valarray<std::valarray<double>> image_add = model->add_cti(image_pre_cti);
+    std::valarray<std::valarray<double>> image_remove =
+        model->remove_cti(image_add, 2);
+    std::valarray<std::valarray<double>> image_out;
+
+    SECTION("Submit, poll, and wait") {
+        JobQueue queue(2);
+        long handle_add = queue.submit(CTIJob(model, image_pre_cti));
+        long handle_remove = queue.submit(CTIJob(model, image_add, false, 2));
+        REQUIRE(handle_add != handle_remove);
+        REQUIRE(queue.poll(handle_add) != job_unknown);
+
+        REQUIRE(queue.wait(handle_remove, &image_out) == job_done);
+        REQUIRE_THAT(flatten(image_out), Catch::Approx(flatten(image_remove)));
+        REQUIRE(queue.wait(handle_add, &image_out) == job_done);
+        REQUIRE_THAT(flatten(image_out), Catch::Approx(flatten(image_add)));
+
+        // Collected jobs are forgotten
+        REQUIRE(queue.poll(handle_add) == job_unknown);
+        REQUIRE(queue.wait(handle_add, &image_out) == job_unknown);
+        REQUIRE(queue.n_pending() == 0);
+    }
+
+    SECTION("Cancel queued jobs") {
+        JobQueue queue(1);
+        int n_jobs = 50;
+        std::vector<long> handles;
+        for (int i_job = 0; i_job < n_jobs; i_job++)
+            handles.push_back(queue.submit(CTIJob(model, image_add, false, 5)));
+
+        // The last job can't have started while the worker is busy with others
+        REQUIRE(queue.cancel(handles[n_jobs - 1]));
+        REQUIRE_FALSE(queue.cancel(handles[n_jobs - 1]));
+        REQUIRE(queue.wait(handles[n_jobs - 1], &image_out) == job_cancelled);
+        REQUIRE_THAT(flatten(image_out), Catch::Approx(flatten(image_add)));
+
+        std::valarray<std::valarray<double>> image_remove_5 =
+            model->remove_cti(image_add, 5);
+        int n_done = 0;
+        for (int i_job = 0; i_job < n_jobs - 1; i_job++) {
+            queue.cancel(handles[i_job]);
+            JobStatus status = queue.wait(handles[i_job], &image_out);
+            REQUIRE(((status == job_done) || (status == job_cancelled)));
+            if (status == job_done) {
+                n_done++;
+                REQUIRE_THAT(
+                    flatten(image_out), Catch::Approx(flatten(image_remove_5)));
+            }
+        }
+        REQUIRE(n_done < n_jobs - 1);
+    }
+
+    SECTION("Completion queue") {
+        JobQueue queue(3);
+        std::set<long> handles;
+        for (int i_job = 0; i_job < 6; i_job++)
+            handles.insert(queue.submit(CTIJob(model, image_pre_cti)));
+
+        long handle;
+        while ((handle = queue.wait_any()) != -1) {
+            REQUIRE(handles.erase(handle) == 1);
+            REQUIRE(queue.poll(handle) == job_done);
+            REQUIRE(queue.wait(handle, &image_out) == job_done);
+            REQUIRE_THAT(flatten(image_out), Catch::Approx(flatten(image_add)));
+        }
+        REQUIRE(handles.empty());
+        REQUIRE(queue.wait_any(0.01) == -1);
+    }
+
+    SECTION("Callbacks") {
+        std::mutex mutex;
+        std::vector<std::valarray<std::valarray<double>>> images_out;
+        std::atomic<int> n_callbacks(0);
+        {
+            JobQueue queue(2);
+            for (int i_job = 0; i_job < 4; i_job++) {
+                long handle = queue.submit(
+                    CTIJob(model, image_pre_cti),
+                    [&](long handle, JobStatus status,
+                        std::valarray<std::valarray<double>>& image) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (status == job_done) images_out.push_back(std::move(image));
+                        n_callbacks++;
+                    });
+                REQUIRE(handle > 0);
+            }
+
+            // Jobs with callbacks aren't in the completion queue
+            REQUIRE(queue.wait_any() == -1);
+            REQUIRE(queue.n_pending() == 0);
+        }
+
+        REQUIRE(n_callbacks == 4);
+        REQUIRE(images_out.size() == 4);
+        for (int i_job = 0; i_job < 4; i_job++)
+            REQUIRE_THAT(flatten(images_out[i_job]), Catch::Approx(flatten(image_add)));
+    }
+
+    SECTION("Failed jobs") {
+        // More trap density scales than image columns
+        std::shared_ptr<CTIModel> model_bad(new CTIModel());
+        REQUIRE(
+            load_model_from_text(
+                "parallel_trap_ic = 10.0, 0.8 \n"
+                "parallel_density_scales = 1, 1, 1, 1, 1, 1, 1 \n",
+                *model_bad, message) == 0);
+        model_bad->prepare(n_rows, n_columns);
+
+        JobQueue queue(2);
+        long handle_bad = queue.submit(CTIJob(model_bad, image_pre_cti));
+        long handle_good = queue.submit(CTIJob(model, image_pre_cti));
+
+        std::string error_message;
+        REQUIRE(queue.wait(handle_bad, &image_out, &error_message) == job_failed);
+        REQUIRE(error_message.find("density map") != std::string::npos);
+        REQUIRE(flatten(image_out) == flatten(image_pre_cti));
+
+        // Other jobs are unaffected
+        REQUIRE(queue.wait(handle_good, &image_out, &error_message) == job_done);
+        REQUIRE(error_message.empty());
+        REQUIRE_THAT(flatten(image_out), Catch::Approx(flatten(image_add)));
+
+        // With a callback
+        std::string callback_message;
+        JobStatus callback_status = job_unknown;
+        queue.submit(
+            CTIJob(model_bad, image_pre_cti),
+            [&](long handle, JobStatus status,
+                std::valarray<std::valarray<double>>& image) {
+                callback_status = status;
+                callback_message = queue.error_message(handle);
+            });
+        REQUIRE(queue.wait_any() == -1);
+        REQUIRE(callback_status == job_failed);
+        REQUIRE(callback_message.find("density map") != std::string::npos);
+    }
+}
@@ -0,0 +1,225 @@
+
+#include <math.h>
+
+#include <valarray>
+
+#include "catch2/catch.hpp"
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "linear.hpp"
+#include "roe.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test trail kernels", "[linear]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e4, 0.0, 1.0));
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 2.0)};
+    int n_rows = 20;
+
+    SECTION("Single pixel at a kernel row, same as exact") {
+        TrailKernels trail_kernels(
+            n_rows, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 0, 0, 50.0, 5);
+
+        REQUIRE(trail_kernels.n_kernels == 5);
+        REQUIRE(trail_kernels.kernel_rows[0] == 0);
+        REQUIRE(trail_kernels.kernel_rows[4] == n_rows - 1);
+        REQUIRE(trail_kernels.d_min == 0);
+        REQUIRE(trail_kernels.d_max > 0);
+        REQUIRE(trail_kernels.trail_fraction > 0.0);
+
+        std::valarray<std::valarray<double>> image_pre_cti(
+            std::valarray<double>(0.0, 1), n_rows);
+        image_pre_cti[trail_kernels.kernel_rows[2]][0] = 50.0;
+
+        std::valarray<std::valarray<double>> image_post_cti =
+            clock_charge_in_one_direction(
+                image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr);
+        std::valarray<std::valarray<double>> image_linear = image_pre_cti;
+        trail_kernels.add_trails(image_pre_cti, image_linear, 0);
+
+        REQUIRE_THAT(flatten(image_linear), Catch::Approx(flatten(image_post_cti)));
+    }
+}
+
+TEST_CASE("Test add and remove CTI linearised", "[linear]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e4, 0.0, 1.0));
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(1.0, 2.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(0.5, 5.0, 0.5)};
+    int n_rows = 40;
+    int n_columns = 6;
+    double error_bound;
+    std::valarray<std::valarray<double>> image_pre_cti(
+        std::valarray<double>(0.0, n_columns), n_rows);
+    std::valarray<std::valarray<double>> image_post_cti, image_linear;
+
+    // Faint, separated pixels in most columns and one bright column
+    for (int column_index = 0; column_index < n_columns; column_index++) {
+        image_pre_cti[5 + column_index][column_index] = 20.0 + column_index;
+        image_pre_cti[30 - column_index][column_index] = 40.0;
+    }
+    image_pre_cti[12][4] = 5000.0;
+
+    SECTION("Parallel, bright column exact, faint within the bound") {
+        image_post_cti =
+            add_cti(image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr);
+        image_linear = add_cti_linearised(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0, 0,
+            nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, 50.0, 8,
+            &error_bound);
+
+        REQUIRE(error_bound > 0.0);
+        for (int column_index = 0; column_index < n_columns; column_index++) {
+            double total_error = 0.0;
+            for (int row_index = 0; row_index < n_rows; row_index++)
+                total_error += fabs(
+                    image_linear[row_index][column_index] -
+                    image_post_cti[row_index][column_index]);
+
+            if (column_index == 4)
+                REQUIRE(total_error == Approx(0.0).margin(1e-9));
+            else
+                REQUIRE(total_error <= error_bound);
+        }
+    }
+
+    SECTION("Parallel and serial, remove CTI") {
+        image_post_cti = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0, 0, 0,
+            -1, 0, -1, 1e-10, 20, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr);
+        image_linear = remove_cti_linearised(
+            image_post_cti, 4, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0, 0,
+            &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 0, 0, 50.0, 8,
+            &error_bound);
+
+        REQUIRE(error_bound > 0.0);
+        REQUIRE_THAT(
+            flatten(image_linear),
+            Catch::Approx(flatten(image_pre_cti)).margin(error_bound));
+    }
+
+    SECTION("Remove trails inverts add trails") {
+        TrailKernels trail_kernels(
+            n_rows, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0, 0, 50.0, 8);
+        image_post_cti = image_pre_cti;
+        image_linear = image_pre_cti;
+        for (int column_index = 0; column_index < n_columns; column_index++) {
+            trail_kernels.add_trails(image_pre_cti, image_post_cti, column_index);
+            trail_kernels.remove_trails(image_post_cti, image_linear, column_index);
+        }
+
+        REQUIRE_THAT(
+            flatten(image_linear), Catch::Approx(flatten(image_pre_cti)).margin(1e-9));
+    }
+
+    SECTION("Estimate as the start of remove CTI") {
+        image_post_cti = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0, 0, 0,
+            -1, 0, -1, 1e-10, 20, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr);
+        image_linear = estimate_remove_cti_linearised(
+            image_post_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0, 0,
+            &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, 0, 0, 50.0, 8);
+
+        // Fewer iterations from the estimate are as accurate as more without
+        std::valarray<std::valarray<double>> image_remove_cti = remove_cti(
+            image_post_cti, 3, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0,
+            0, 0, -1, 0, -1, 1e-10, 20, &roe, &ccd, &traps_ic, nullptr, nullptr,
+            nullptr);
+        std::valarray<std::valarray<double>> image_from_estimate = remove_cti(
+            image_post_cti, 2, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0,
+            0, 0, -1, 0, -1, 1e-10, 20, &roe, &ccd, &traps_ic, nullptr, nullptr,
+            nullptr, 0, 0, 0, -1, 0, -1, 1e-10, 20, &image_linear);
+
+        double residual_post_cti = 0.0;
+        double residual_estimate = 0.0;
+        double residual_remove_cti = 0.0;
+        double residual_from_estimate = 0.0;
+        for (int row_index = 0; row_index < n_rows; row_index++) {
+            for (int column_index = 0; column_index < n_columns; column_index++) {
+                double pixel = image_pre_cti[row_index][column_index];
+                residual_post_cti +=
+                    fabs(image_post_cti[row_index][column_index] - pixel);
+                residual_estimate +=
+                    fabs(image_linear[row_index][column_index] - pixel);
+                residual_remove_cti +=
+                    fabs(image_remove_cti[row_index][column_index] - pixel);
+                residual_from_estimate +=
+                    fabs(image_from_estimate[row_index][column_index] - pixel);
+            }
+        }
+
+        REQUIRE(residual_estimate < 0.1 * residual_post_cti);
+        REQUIRE(residual_from_estimate < residual_remove_cti);
+    }
+}
+
+TEST_CASE("Test linearised trails with well_fill_power != 1", "[linear]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e4, 0.0, 0.58));
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(1.0, 2.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(0.5, 5.0, 0.5)};
+    int n_rows = 40;
+    std::valarray<double> n_electrons = {1.0, 2.0, 3.0, 7.0, 10.0, 30.0, 70.0, 100.0};
+    int n_columns = n_electrons.size();
+    std::valarray<std::valarray<double>> image_pre_cti(
+        std::valarray<double>(0.0, n_columns), n_rows);
+    std::valarray<std::valarray<double>> image_post_cti, image_linear;
+
+    // A single pixel in each column, from faint up to the threshold
+    for (int column_index = 0; column_index < n_columns; column_index++)
+        image_pre_cti[7 + 2 * column_index][column_index] = n_electrons[column_index];
+
+    SECTION("Faint pixels interpolated between flux levels") {
+        double error_bound;
+        std::valarray<double> column_error_bounds;
+        image_post_cti = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr);
+        image_linear = clock_charge_in_one_direction_linearised(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0, 0,
+            100.0, 8, &error_bound, 1e-10, 20, &column_error_bounds);
+
+        REQUIRE(column_error_bounds.max() == error_bound);
+        for (int column_index = 0; column_index < n_columns; column_index++) {
+            double total_change = 0.0;
+            double total_error = 0.0;
+            for (int row_index = 0; row_index < n_rows; row_index++) {
+                total_change += fabs(
+                    image_post_cti[row_index][column_index] -
+                    image_pre_cti[row_index][column_index]);
+                total_error += fabs(
+                    image_linear[row_index][column_index] -
+                    image_post_cti[row_index][column_index]);
+            }
+
+            REQUIRE(total_error < 0.02 * total_change);
+            REQUIRE(total_error <= column_error_bounds[column_index]);
+        }
+    }
+
+    SECTION("Remove trails inverts add trails") {
+        TrailKernels trail_kernels(
+            n_rows, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0, 0, 100.0, 8);
+        REQUIRE(trail_kernels.flux_levels.max() == 100.0);
+        REQUIRE(trail_kernels.flux_levels.min() < 1.0);
+
+        image_post_cti = image_pre_cti;
+        image_linear = image_pre_cti;
+        for (int column_index = 0; column_index < n_columns; column_index++) {
+            trail_kernels.add_trails(image_pre_cti, image_post_cti, column_index);
+            trail_kernels.remove_trails(image_post_cti, image_linear, column_index);
+        }
+
+        REQUIRE_THAT(
+            flatten(image_linear), Catch::Approx(flatten(image_pre_cti)).margin(1e-6));
+    }
+}
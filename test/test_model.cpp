@@ -0,0 +1,365 @@
+
+#include <stdio.h>
+
+#include <string>
+#include <valarray>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "express.hpp"
+#include "linear.hpp"
+#include "model.hpp"
+#include "roe.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test load model from text", "[model]") {
+    CTIModel model;
+    std::string message;
+
+    SECTION("Valid model") {
+        std::string text =
+            "# Parallel \n"
+            "parallel_trap_ic = 10.0, 0.8 \n"
+            "parallel_trap_ic = 3.0 4.0  # Second species \n"
+            "parallel_trap_sc = 5.0, 3.0, 0.2 \n"
+            "parallel_full_well_depth = 1e3 \n"
+            "parallel_express = 5 \n"
+            "parallel_express_tolerance = 0.01 \n"
+            "parallel_collapse_factor = 1e6 \n"
+            "parallel_speculative_tolerance = 1e-6 \n"
+            "parallel_speculative_n_warmup_columns = 3 \n"
+            "parallel_row_segment_tolerance = 1e-20 \n"
+            "parallel_row_segment_n_warmup_rows = 50 \n"
+            "parallel_continuum_table_tolerance = 1e-5 \n"
+            "\n"
+            "serial_trap_ic_co = 2.0, 1.5, 0.3 \n"
+            "serial_empty_traps_for_first_transfers = 1 \n"
+            "n_iterations = 4 \n";
+
+        REQUIRE(load_model_from_text(text, model, message) == 0);
+
+        REQUIRE(model.parallel.traps_ic.size() == 2);
+        REQUIRE(model.parallel.traps_ic[1].density == 3.0);
+        REQUIRE(model.parallel.traps_ic[1].release_timescale == 4.0);
+        REQUIRE(model.parallel.traps_sc.size() == 1);
+        REQUIRE(model.parallel.traps_sc[0].capture_timescale == 0.2);
+        REQUIRE(model.parallel.full_well_depth == 1e3);
+        REQUIRE(model.parallel.express == 5);
+        REQUIRE(model.parallel.express_tolerance == 0.01);
+        REQUIRE(model.parallel.settings.collapse_factor == 1e6);
+        REQUIRE(model.serial.settings.collapse_factor == 0.0);
+        REQUIRE(model.parallel.settings.speculative_tolerance == 1e-6);
+        REQUIRE(model.parallel.settings.speculative_n_warmup_columns == 3);
+        REQUIRE(model.parallel.settings.row_segment_tolerance == 1e-20);
+        REQUIRE(model.parallel.settings.row_segment_n_warmup_rows == 50);
+        REQUIRE(model.parallel.settings.continuum_table_tolerance == 1e-5);
+        REQUIRE(model.serial.traps_ic_co.size() == 1);
+        REQUIRE(model.serial.empty_traps_for_first_transfers == true);
+        REQUIRE(model.serial.has_traps());
+        REQUIRE(model.n_iterations == 4);
+    }
+
+    SECTION("Invalid models") {
+        REQUIRE(load_model_from_text("parallel_trap_ic = 10.0", model, message) == 1);
+        REQUIRE(message == "Line 1: trap_ic requires 2 or 4 values");
+
+        REQUIRE(load_model_from_text("\nparallel_express 5", model, message) == 1);
+        REQUIRE(message == "Line 2: expected name = value");
+
+        REQUIRE(load_model_from_text("serial_nope = 1", model, message) == 1);
+        REQUIRE(message == "Line 1: Unknown parameter nope");
+
+        REQUIRE(load_model_from_text("parallel_express = x", model, message) == 1);
+
+        REQUIRE(
+            load_model_from_text("serial_density_scales = 1.0, 0.0", model, message) ==
+            1);
+        REQUIRE(message == "Serial: density_scales must be positive");
+
+        REQUIRE(
+            load_model_from_text("serial_collapse_factor = -1", model, message) == 1);
+        REQUIRE(message == "Serial: collapse_factor can't be negative");
+
+        REQUIRE(
+            load_model_from_text(
+                "parallel_express_tolerance = 0.1\n"
+                "parallel_empty_traps_between_columns = 0",
+                model, message) == 1);
+        REQUIRE(
+            message ==
+            "Parallel: express_tolerance requires empty_traps_between_columns");
+
+        REQUIRE(
+            load_model_from_text(
+                "parallel_dwell_times = 0.5, 0.5\n"
+                "parallel_fraction_of_traps_per_phase = 1.0",
+                model, message) == 1);
+
+        CTIModel model_extrapolate;
+        REQUIRE(
+            load_model_from_text(
+                "serial_express_extrapolate = 1\n"
+                "serial_express_tolerance = 0.1",
+                model_extrapolate, message) == 1);
+        REQUIRE(
+            message ==
+            "Serial: express_tolerance can't be used with express_extrapolate");
+    }
+}
+
+TEST_CASE("Test CTI model add and remove CTI", "[model]") {
+    set_verbosity(0);
+
+    CTIModel model;
+    std::string message;
+    std::string text =
+        "parallel_trap_ic = 10.0, 0.8 \n"
+        "parallel_trap_ic_co = 5.0, 2.0, 0.5 \n"
+        "parallel_express = 3 \n"
+        "serial_trap_sc = 5.0, 3.0, 0.2 \n"
+        "serial_window_offset = 2 \n";
+    REQUIRE(load_model_from_text(text, model, message) == 0);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e4, 0.0, 1.0));
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 0.8)};
+    std::valarray<TrapInstantCaptureContinuum> traps_ic_co = {
+        TrapInstantCaptureContinuum(5.0, 2.0, 0.5)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 3.0, 0.2)};
+    std::valarray<std::valarray<double>> image_pre_cti, image_post_cti, image_model;
+
+    image_pre_cti =
+        std::valarray<std::valarray<double>>(std::valarray<double>(0.0, 5), 8);
+    image_pre_cti[2][1] = 800.0;
+    image_pre_cti[5][3] = 300.0;
+
+    SECTION("Same as add_cti and remove_cti, prepared or not") {
+        image_post_cti = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr, 3, 0,
+            0, -1, 0, -1, 1e-10, 20, &roe, &ccd, nullptr, &traps_sc, nullptr, nullptr,
+            0, 2);
+
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+
+        model.prepare(8, 5);
+        REQUIRE(model.parallel.n_rows_prepared == 8);
+        REQUIRE(model.serial.n_rows_prepared == 5);
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+
+        image_post_cti = remove_cti(
+            image_post_cti, 2, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr,
+            3, 0, 0, -1, 0, -1, 1e-10, 20, &roe, &ccd, nullptr, &traps_sc, nullptr,
+            nullptr, 0, 2);
+        image_model = model.add_cti(image_pre_cti);
+        image_model = model.remove_cti(image_model, 2);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+    }
+
+    SECTION("Trap density scales") {
+        model.parallel.density_scales = {1.0, 2.0};
+        model.serial.density_scales = {0.5, 1.0, 1.5, 2.0};
+        std::valarray<double> parallel_density_scales = {1.0, 1.0, 1.0, 2.0, 2.0};
+        std::valarray<double> serial_density_scales = {0.5, 0.5, 1.0, 1.0,
+                                                       1.5, 1.5, 2.0, 2.0};
+        image_post_cti = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr, 3, 0,
+            0, -1, 0, -1, 1e-10, 20, &roe, &ccd, nullptr, &traps_sc, nullptr, nullptr,
+            0, 2, 0, -1, 0, -1, 1e-10, 20, 0, 0, &parallel_density_scales,
+            &serial_density_scales);
+
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+
+        model.prepare(8, 5);
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+    }
+
+    SECTION("Extrapolated express") {
+        double error_estimate = -1.0;
+        double model_error_estimate = -1.0;
+        model.parallel.express_extrapolate = true;
+        image_post_cti = clock_charge_in_one_direction_extrapolated_express(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr, 3, 0,
+            1e-10, 20, &error_estimate);
+        image_post_cti = add_cti(
+            image_post_cti, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0,
+            0, -1, 0, -1, 1e-10, 20, &roe, &ccd, nullptr, &traps_sc, nullptr, nullptr,
+            0, 2);
+        REQUIRE(error_estimate > 0.0);
+
+        // The same with add_cti()
+        model_error_estimate = -1.0;
+        image_model = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr, 3, 0,
+            0, -1, 0, -1, 1e-10, 20, &roe, &ccd, nullptr, &traps_sc, nullptr, nullptr,
+            0, 2, 0, -1, 0, -1, 1e-10, 20, 0, 0, nullptr, nullptr, nullptr, nullptr,
+            true, false, &model_error_estimate);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+        REQUIRE(model_error_estimate == Approx(error_estimate));
+
+        model_error_estimate = -1.0;
+        image_model =
+            model.add_cti(image_pre_cti, nullptr, nullptr, &model_error_estimate);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+        REQUIRE(model_error_estimate == Approx(error_estimate));
+
+        model.prepare(8, 5);
+        model_error_estimate = -1.0;
+        image_model =
+            model.add_cti(image_pre_cti, nullptr, nullptr, &model_error_estimate);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+        REQUIRE(model_error_estimate == Approx(error_estimate));
+
+        // The estimate from the last iteration's added CTI
+        model_error_estimate = -1.0;
+        model.remove_cti(image_post_cti, 2, nullptr, nullptr, &model_error_estimate);
+        REQUIRE(model_error_estimate > 0.0);
+
+        // Zero without extrapolated express
+        model.parallel.express_extrapolate = false;
+        model.add_cti(image_pre_cti, nullptr, nullptr, &model_error_estimate);
+        REQUIRE(model_error_estimate == 0.0);
+    }
+
+    SECTION("Trap-state collapse setting") {
+        std::valarray<std::valarray<double>> image_default =
+            model.add_cti(image_pre_cti);
+
+        // The model's settings instead of the global defaults
+        set_collapse_trap_states(1e12);
+        image_post_cti = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr, 3, 0,
+            0, -1, 0, -1, 1e-10, 20, &roe, &ccd, nullptr, &traps_sc, nullptr, nullptr,
+            0, 2);
+        set_collapse_trap_states(0.0);
+        REQUIRE(flatten(image_post_cti) != flatten(image_default));
+
+        model.parallel.settings.collapse_factor = 1e12;
+        model.serial.settings.collapse_factor = 1e12;
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+
+        model.prepare(8, 5);
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+    }
+
+    SECTION("Speculative columns setting") {
+        // Speculative serial chunks that start from empty traps
+        ROE roe_carry(dwell_times, 0, -1, false);
+        model.serial.empty_traps_between_columns = false;
+        set_n_threads(3);
+        std::valarray<std::valarray<double>> image_default =
+            model.add_cti(image_pre_cti);
+
+        set_speculative_columns(1e10, 0);
+        image_post_cti = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr, 3, 0,
+            0, -1, 0, -1, 1e-10, 20, &roe_carry, &ccd, nullptr, &traps_sc, nullptr,
+            nullptr, 0, 2);
+        set_speculative_columns(0.0);
+        REQUIRE(flatten(image_post_cti) != flatten(image_default));
+
+        model.serial.settings.speculative_tolerance = 1e10;
+        model.serial.settings.speculative_n_warmup_columns = 0;
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+        set_n_threads(0);
+    }
+
+    SECTION("Row segments setting") {
+        // Parallel segments of rows that start from empty traps
+        set_n_threads(8);
+        std::valarray<std::valarray<double>> image_default =
+            model.add_cti(image_pre_cti);
+
+        set_row_segments(1e10, 0);
+        image_post_cti = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr, 3, 0,
+            0, -1, 0, -1, 1e-10, 20, &roe, &ccd, nullptr, &traps_sc, nullptr, nullptr,
+            0, 2);
+        set_row_segments(0.0);
+        REQUIRE(flatten(image_post_cti) != flatten(image_default));
+
+        model.parallel.settings.row_segment_tolerance = 1e10;
+        model.parallel.settings.row_segment_n_warmup_rows = 0;
+        model.serial.settings.row_segment_tolerance = 1e10;
+        model.serial.settings.row_segment_n_warmup_rows = 0;
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+        set_n_threads(0);
+    }
+
+    SECTION("Continuum table tolerance setting") {
+        set_continuum_table_tolerance(1e-5);
+        image_post_cti = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr, 3, 0,
+            0, -1, 0, -1, 1e-10, 20, &roe, &ccd, nullptr, &traps_sc, nullptr, nullptr,
+            0, 2);
+        set_continuum_table_tolerance(0.0);
+
+        model.parallel.settings.continuum_table_tolerance = 1e-5;
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+
+        model.prepare(8, 5);
+        TrapManagerInstantCaptureContinuum& trap_manager_ic_co =
+            model.parallel.trap_manager_manager.trap_managers_ic_co[0];
+        REQUIRE(trap_manager_ic_co.table_tolerance == 1e-5);
+        REQUIRE(trap_manager_ic_co.traps[0].n_intp < trap_manager_ic_co.n_intp);
+        image_model = model.add_cti(image_pre_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_post_cti)));
+    }
+
+    SECTION("Start remove_cti from the linearised estimate") {
+        image_post_cti = model.add_cti(image_pre_cti);
+        std::valarray<std::valarray<double>> image_estimate;
+        image_estimate = estimate_remove_cti_linearised(
+            image_post_cti, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0,
+            &roe, &ccd, nullptr, &traps_sc, nullptr, nullptr, 0, 2);
+        image_estimate = estimate_remove_cti_linearised(
+            image_estimate, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr, 3,
+            0);
+        image_model = model.estimate_remove_cti(image_post_cti);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_estimate)));
+
+        image_estimate = remove_cti(
+            image_post_cti, 2, &roe, &ccd, &traps_ic, nullptr, &traps_ic_co, nullptr,
+            3, 0, 0, -1, 0, -1, 1e-10, 20, &roe, &ccd, nullptr, &traps_sc, nullptr,
+            nullptr, 0, 2, 0, -1, 0, -1, 1e-10, 20, &image_model);
+        image_model = model.remove_cti(image_post_cti, 2, nullptr, &image_model);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_estimate)));
+    }
+
+    SECTION("Remove CTI again after editing a few pixels") {
+        image_post_cti = model.add_cti(image_pre_cti);
+        CTICheckpoints checkpoints(3);
+        std::valarray<std::valarray<double>> image_full;
+        image_model = model.remove_cti(image_post_cti, 2, &checkpoints);
+        REQUIRE(checkpoints.parallel.size() == 2);
+
+        std::vector<std::pair<int, int>> changed_pixels = {{4, 2}, {6, 0}};
+        image_post_cti[4][2] = 50.0;
+        image_post_cti[6][0] = 0.0;
+        image_model =
+            model.remove_cti_again(image_post_cti, changed_pixels, checkpoints);
+        image_full = model.remove_cti(image_post_cti, 2);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_full)));
+
+        // And again, with the prepared model
+        model.prepare(8, 5);
+        changed_pixels = {{1, 4}};
+        image_post_cti[1][4] = 20.0;
+        image_model =
+            model.remove_cti_again(image_post_cti, changed_pixels, checkpoints);
+        image_full = model.remove_cti(image_post_cti, 2);
+        REQUIRE_THAT(flatten(image_model), Catch::Approx(flatten(image_full)));
+    }
+}
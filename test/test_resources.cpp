@@ -0,0 +1,121 @@
+
+#include <string>
+#include <valarray>
+
+#include "catch2/catch.hpp"
+#include "ccd.hpp"
+#include "model.hpp"
+#include "resources.hpp"
+#include "roe.hpp"
+#include "trap_managers.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test estimate resources", "[resources]") {
+    set_verbosity(0);
+    set_n_threads(1);
+
+    std::valarray<double> dwell_times = {0.5, 0.25, 0.25};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e4, 0.0, 1.0));
+    std::valarray<CCDPhase> phases(CCDPhase(1e4, 0.0, 1.0), 3);
+    std::valarray<double> fraction_of_traps_per_phase = {0.5, 0.25, 0.25};
+    CCD ccd_3_phase(phases, fraction_of_traps_per_phase);
+    std::valarray<TrapInstantCapture> traps_ic = {
+        TrapInstantCapture(10.0, 2.0), TrapInstantCapture(3.0, 5.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 5.0, 0.5)};
+    int n_rows = 50;
+    int n_columns = 20;
+    int express = 7;
+
+    SECTION("Memory matches the allocations") {
+        ResourceEstimate estimate = estimate_resources(
+            n_rows, n_columns, &roe, &ccd_3_phase, &traps_ic, &traps_sc, nullptr,
+            nullptr, express, 0, false);
+
+        roe.set_express_matrix_from_rows_and_express(n_rows, express, 0);
+        REQUIRE(
+            estimate.express_bytes ==
+            (sizeof(double) + sizeof(bool)) * roe.express_matrix.size());
+
+        std::valarray<TrapInstantCaptureContinuum> traps_ic_co = {};
+        std::valarray<TrapSlowCaptureContinuum> traps_sc_co = {};
+        TrapManagerManager trap_manager_manager(
+            traps_ic, traps_sc, traps_ic_co, traps_sc_co, n_rows, ccd_3_phase,
+            dwell_times);
+        double n_bytes = 0.0;
+        for (int phase_index = 0; phase_index < 3; phase_index++) {
+            n_bytes += trap_manager_manager.trap_managers_ic[phase_index]
+                           .watermark_volumes.size() +
+                       trap_manager_manager.trap_managers_ic[phase_index]
+                           .watermark_fills.size() +
+                       trap_manager_manager.trap_managers_sc[phase_index]
+                           .watermark_volumes.size() +
+                       trap_manager_manager.trap_managers_sc[phase_index]
+                           .watermark_fills.size();
+        }
+        // Including the stored copies
+        REQUIRE(estimate.trap_manager_bytes == 2.0 * sizeof(double) * n_bytes);
+
+        REQUIRE(estimate.image_bytes == 2.0 * sizeof(double) * n_rows * n_columns);
+        REQUIRE(estimate.peak_bytes > estimate.trap_manager_bytes);
+        REQUIRE(estimate.runtime == 0.0);
+    }
+
+    SECTION("Persistent traps scale with the columns") {
+        ROE roe_persistent(dwell_times, 0, -1, false);
+        ResourceEstimate estimate = estimate_resources(
+            n_rows, n_columns, &roe, &ccd_3_phase, &traps_ic, &traps_sc, nullptr,
+            nullptr, express, 0, false);
+        ResourceEstimate estimate_persistent = estimate_resources(
+            n_rows, n_columns, &roe_persistent, &ccd_3_phase, &traps_ic, &traps_sc,
+            nullptr, nullptr, express, 0, false);
+
+        REQUIRE(
+            estimate_persistent.trap_manager_bytes ==
+            Approx(estimate.trap_manager_bytes * n_columns).epsilon(0.01));
+    }
+
+    SECTION("Runtime and model") {
+        std::valarray<double> dwell_times_1 = {1.0};
+        ROE roe_1(dwell_times_1);
+        ResourceEstimate estimate = estimate_resources(
+            n_rows, n_columns, &roe_1, &ccd, &traps_ic, &traps_sc, nullptr, nullptr,
+            express);
+        REQUIRE(estimate.runtime > 0.0);
+        REQUIRE(
+            estimate.n_pixel_transfers ==
+            (double)n_columns * n_rows * (express + 1) / 2.0);
+
+        CTIModel model;
+        std::string message;
+        REQUIRE(
+            load_model_from_text(
+                "parallel_trap_ic = 10.0, 2.0 \n"
+                "parallel_trap_ic = 3.0, 5.0 \n"
+                "parallel_trap_sc = 5.0, 5.0, 0.5 \n"
+                "parallel_express = 7 \n"
+                "serial_trap_ic = 10.0, 2.0 \n",
+                model, message) == 0);
+        ResourceEstimate estimate_model =
+            estimate_resources(n_rows, n_columns, model, 3);
+        REQUIRE(estimate_model.runtime > estimate.runtime);
+        REQUIRE(estimate_model.peak_bytes > estimate.peak_bytes);
+        REQUIRE(
+            estimate_model.to_text().find("peak_bytes = ") != std::string::npos);
+    }
+
+    SECTION("Trap managers copied for each thread") {
+        ResourceEstimate estimate = estimate_resources(
+            n_rows, n_columns, &roe, &ccd_3_phase, &traps_ic, &traps_sc, nullptr,
+            nullptr, express, 0, false);
+        set_n_threads(4);
+        ResourceEstimate estimate_threads = estimate_resources(
+            n_rows, n_columns, &roe, &ccd_3_phase, &traps_ic, &traps_sc, nullptr,
+            nullptr, express, 0, false);
+
+        REQUIRE(estimate_threads.trap_manager_bytes == 5 * estimate.trap_manager_bytes);
+    }
+
+    set_n_threads(0);
+}
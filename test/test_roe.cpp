@@ -1036,6 +1036,12 @@ TEST_CASE("Test charge injection ROE", "[roe]") {
         REQUIRE(test == answer);
         REQUIRE(roe.n_express_passes == 5);
 
+        // One multiplier per express pass
+        answer = {3, 3, 3, 3, 0};
+        test.assign(
+            std::begin(roe.express_multipliers), std::end(roe.express_multipliers));
+        REQUIRE(test == answer);
+
         express = 12;
         roe.set_express_matrix_from_rows_and_express(n_rows, express, offset);
         answer = {
@@ -1230,6 +1236,11 @@ TEST_CASE("Test charge injection ROE", "[roe]") {
 
                             REQUIRE(round(tmp_col.sum()) == n_rows + offset);
                         }
+
+                        // Same for the single multiplier per express pass
+                        REQUIRE(roe.express_multipliers.size() == n_passes);
+                        REQUIRE(
+                            round(roe.express_multipliers.sum()) == n_rows + offset);
                     }
                 }
             }
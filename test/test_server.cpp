@@ -0,0 +1,190 @@
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <valarray>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "model.hpp"
+#include "server.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test model cache", "[server]") {
+    ModelCache cache(2);
+    std::string message;
+    std::shared_ptr<CTIModel> model_a, model_b;
+
+    SECTION("Hits, misses, and least-recently-used eviction") {
+        model_a = cache.get("parallel_trap_ic = 10.0, 0.8", 10, 4, message);
+        REQUIRE(model_a != nullptr);
+        REQUIRE(model_a->parallel.n_rows_prepared == 10);
+        REQUIRE(cache.get("parallel_trap_ic = 10.0, 0.8", 10, 4, message) == model_a);
+        REQUIRE(cache.n_hits == 1);
+        REQUIRE(cache.n_misses == 1);
+
+        // Different shape, then different model, evicts the first
+        model_b = cache.get("parallel_trap_ic = 10.0, 0.8", 20, 4, message);
+        REQUIRE(model_b != model_a);
+        REQUIRE(cache.get("parallel_trap_ic = 1.0, 0.8", 10, 4, message) != nullptr);
+        REQUIRE(cache.size() == 2);
+        REQUIRE(cache.get("parallel_trap_ic = 10.0, 0.8", 10, 4, message) != model_a);
+        REQUIRE(cache.n_misses == 4);
+
+        // Invalid model
+        REQUIRE(cache.get("parallel_trap_ic = 10.0", 10, 4, message) == nullptr);
+        REQUIRE(cache.size() == 2);
+    }
+}
+
+TEST_CASE("Test thread pool", "[server]") {
+    set_n_threads(4);
+
+    SECTION("A lone task uses every thread") {
+        std::atomic<int> n_task_threads(0);
+        {
+            ThreadPool pool(4);
+            pool.submit([&] { n_task_threads = get_n_threads(); });
+        }
+        REQUIRE(n_task_threads == 4);
+    }
+
+    SECTION("Concurrent tasks share the threads") {
+        std::atomic<int> n_started(0);
+        std::atomic<int> n_task_threads_total(0);
+        {
+            ThreadPool pool(4);
+            for (int i_task = 0; i_task < 4; i_task++)
+                pool.submit([&] {
+                    n_task_threads_total += get_n_threads();
+                    n_started++;
+                    while (n_started < 4) std::this_thread::yield();
+                });
+        }
+        // Each task's share of the threads between the tasks running as it starts
+        REQUIRE(n_task_threads_total == 4 + 2 + 1 + 1);
+    }
+
+    set_n_threads(0);
+}
+
+TEST_CASE("Test server", "[server]") {
+    set_verbosity(0);
+
+    std::string socket_path = "/tmp/arctic_test_" + std::to_string(getpid()) + ".sock";
+    std::string model_path = "/tmp/arctic_test_" + std::to_string(getpid()) + ".txt";
+    std::string shm_name = "/arctic_test_" + std::to_string(getpid());
+    std::string model_text =
+        "parallel_trap_ic = 10.0, 0.8 \n"
+        "serial_trap_sc = 5.0, 3.0, 0.2 \n";
+    int n_rows = 6;
+    int n_columns = 4;
+
+    FILE* f = fopen(model_path.c_str(), "w");
+    fprintf(f, "%s", model_text.c_str());
+    fclose(f);
+
+    // Image in shared memory
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR, 0600);
+    REQUIRE(fd >= 0);
+    REQUIRE(ftruncate(fd, n_rows * n_columns * sizeof(double)) == 0);
+    double* data = (double*)mmap(
+        nullptr, n_rows * n_columns * sizeof(double), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    close(fd);
+    std::valarray<std::valarray<double>> image_pre_cti(
+        std::valarray<double>(0.0, n_columns), n_rows);
+    image_pre_cti[2][1] = 800.0;
+    for (int row_index = 0; row_index < n_rows; row_index++)
+        for (int column_index = 0; column_index < n_columns; column_index++)
+            data[row_index * n_columns + column_index] =
+                image_pre_cti[row_index][column_index];
+
+    std::thread server(run_server, socket_path.c_str(), 4, 2);
+
+    // Wait for the server to start
+    std::string reply;
+    for (int i_try = 0; i_try < 500; i_try++) {
+        reply = send_server_request(socket_path.c_str(), "ping");
+        if (reply == "ok") break;
+        usleep(10000);
+    }
+
+    SECTION("Add and remove CTI in shared memory") {
+        REQUIRE(reply == "ok");
+
+        std::string request = "add " + shm_name + " " + std::to_string(n_rows) + " " +
+                              std::to_string(n_columns) + " " + model_path;
+        reply = send_server_request(socket_path.c_str(), request);
+        REQUIRE(reply.substr(0, 3) == "ok ");
+        // No extrapolated express error estimate
+        REQUIRE(reply.substr(reply.rfind(' ')) == " 0");
+
+        // Compare with the model directly
+        CTIModel model;
+        std::string message;
+        REQUIRE(load_model_from_text(model_text, model, message) == 0);
+        std::valarray<std::valarray<double>> image_post_cti =
+            model.add_cti(image_pre_cti);
+        for (int row_index = 0; row_index < n_rows; row_index++)
+            for (int column_index = 0; column_index < n_columns; column_index++)
+                REQUIRE(
+                    data[row_index * n_columns + column_index] ==
+                    Approx(image_post_cti[row_index][column_index]));
+
+        request = "remove " + shm_name + " " + std::to_string(n_rows) + " " +
+                  std::to_string(n_columns) + " 3 " + model_path;
+        reply = send_server_request(socket_path.c_str(), request);
+        REQUIRE(reply.substr(0, 3) == "ok ");
+        REQUIRE(data[2 * n_columns + 1] == Approx(800.0).epsilon(1e-3));
+
+        // The second job reused the cached model
+        reply = send_server_request(socket_path.c_str(), "stats");
+        REQUIRE(reply == "ok hits=1 misses=1 models=1");
+
+        // Errors
+        reply = send_server_request(socket_path.c_str(), "add nope 6 4 " + model_path);
+        REQUIRE(reply.substr(0, 6) == "error ");
+        reply = send_server_request(socket_path.c_str(), "nope");
+        REQUIRE(reply == "error Unknown request nope");
+    }
+
+    SECTION("Errors replied without echoing the model or stopping the server") {
+        std::string bad_model_path = model_path + ".bad";
+        std::string request = "add " + shm_name + " " + std::to_string(n_rows) + " " +
+                              std::to_string(n_columns) + " " + bad_model_path;
+
+        // Not a model file
+        FILE* f_bad = fopen(bad_model_path.c_str(), "w");
+        fprintf(f_bad, "secret_value = 42 \n");
+        fclose(f_bad);
+        reply = send_server_request(socket_path.c_str(), request);
+        REQUIRE(reply == "error Invalid model file " + bad_model_path);
+
+        // A valid model that fails while clocking, with more density scales
+        // than image columns
+        f_bad = fopen(bad_model_path.c_str(), "w");
+        fprintf(
+            f_bad, "%sparallel_density_scales = 1, 1, 1, 1, 1 \n", model_text.c_str());
+        fclose(f_bad);
+        reply = send_server_request(socket_path.c_str(), request);
+        REQUIRE(reply.substr(0, 6) == "error ");
+        REQUIRE(reply.find("density map") != std::string::npos);
+        REQUIRE(data[2 * n_columns + 1] == 800.0);
+
+        REQUIRE(send_server_request(socket_path.c_str(), "ping") == "ok");
+        remove(bad_model_path.c_str());
+    }
+
+    REQUIRE(send_server_request(socket_path.c_str(), "shutdown") == "ok");
+    server.join();
+
+    munmap(data, n_rows * n_columns * sizeof(double));
+    shm_unlink(shm_name.c_str());
+    remove(model_path.c_str());
+}
@@ -0,0 +1,159 @@
+
+#include <stdio.h>
+
+#include <valarray>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "roe.hpp"
+#include "sparse.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test image and event conversions", "[sparse]") {
+    std::valarray<PixelEvent> events = {
+        PixelEvent(3, 1, 10.0), PixelEvent(0, 2, 5.0), PixelEvent(3, 1, 2.0)};
+    std::valarray<std::valarray<double>> image;
+
+    SECTION("Duplicates summed, round trip") {
+        image = image_from_events(events, 5, 4);
+
+        REQUIRE(image.size() == 5);
+        REQUIRE(image[0].size() == 4);
+        REQUIRE(image[3][1] == 12.0);
+        REQUIRE(image[0][2] == 5.0);
+
+        events = events_from_image(image);
+
+        REQUIRE(events.size() == 2);
+        REQUIRE(events[0].row == 0);
+        REQUIRE(events[0].column == 2);
+        REQUIRE(events[1].row == 3);
+        REQUIRE(events[1].n_electrons == 12.0);
+
+        events = events_from_image(image, 6.0);
+
+        REQUIRE(events.size() == 1);
+    }
+}
+
+TEST_CASE("Test add and remove CTI sparse", "[sparse]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e4, 0.0, 1.0));
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 2.0)};
+    std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(5.0, 5.0, 0.5)};
+    int n_rows = 30;
+    int n_columns = 12;
+    std::valarray<std::valarray<double>> image_pre_cti, image_post_cti, image_sparse;
+    std::valarray<PixelEvent> events_pre_cti, events_post_cti, events_remove_cti;
+
+    // A few events, including two sharing a column
+    events_pre_cti = {
+        PixelEvent(4, 2, 800.0), PixelEvent(20, 2, 300.0), PixelEvent(11, 7, 1500.0),
+        PixelEvent(25, 10, 50.0)};
+    image_pre_cti = image_from_events(events_pre_cti, n_rows, n_columns);
+
+    SECTION("Parallel and serial, same as dense") {
+        image_post_cti = add_cti(
+            image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr, 0, 3,
+            0, -1, 0, -1, 1e-10, 20, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr,
+            0, 1);
+
+        // Exactly, with the full trails
+        events_post_cti = add_cti_sparse(
+            events_pre_cti, n_rows, n_columns, &roe, &ccd, &traps_ic, &traps_sc,
+            nullptr, nullptr, 0, 3, n_rows, 1e-10, 20, &roe, &ccd, &traps_ic, nullptr,
+            nullptr, nullptr, 0, 1, n_columns, 1e-10, 20, 0.0, 0.0);
+        image_sparse = image_from_events(events_post_cti, n_rows, n_columns);
+
+        REQUIRE_THAT(flatten(image_sparse), Catch::Approx(flatten(image_post_cti)));
+
+        // To within the cut, with the default trails
+        events_post_cti = add_cti_sparse(
+            events_pre_cti, n_rows, n_columns, &roe, &ccd, &traps_ic, &traps_sc,
+            nullptr, nullptr, 0, 3, -1, 1e-10, 20, &roe, &ccd, &traps_ic, nullptr,
+            nullptr, nullptr, 0, 1);
+        image_sparse = image_from_events(events_post_cti, n_rows, n_columns);
+
+        REQUIRE_THAT(
+            flatten(image_sparse),
+            Catch::Approx(flatten(image_post_cti)).margin(2e-3));
+    }
+
+    SECTION("Output bounded by the number of events, not the image size") {
+        std::valarray<PixelEvent> events_small, events_large;
+        events_pre_cti = std::valarray<PixelEvent>(10);
+        for (int i_event = 0; i_event < 10; i_event++)
+            events_pre_cti[i_event] =
+                PixelEvent(10 + 17 * i_event, 5 + 13 * i_event, 1000.0);
+
+        // Express 1, for the same express multipliers in both images
+        events_small = add_cti_sparse(
+            events_pre_cti, 500, 500, &roe, &ccd, &traps_ic, &traps_sc, nullptr,
+            nullptr, 1, 0, -1, 1e-10, 20, &roe, &ccd, &traps_ic, nullptr, nullptr,
+            nullptr, 1);
+        events_large = add_cti_sparse(
+            events_pre_cti, 4000, 4000, &roe, &ccd, &traps_ic, &traps_sc, nullptr,
+            nullptr, 1, 0, -1, 1e-10, 20, &roe, &ccd, &traps_ic, nullptr, nullptr,
+            nullptr, 1);
+
+        // Trails of under 50 pixels in each direction behind each event
+        REQUIRE(events_large.size() == events_small.size());
+        REQUIRE(events_large.size() < 10 * 50 * 50);
+        bool same_pixels = true;
+        double min_n_electrons = 1e300;
+        for (int i_event = 0; i_event < events_large.size(); i_event++) {
+            PixelEvent event = events_large[i_event];
+            same_pixels &= (event.row == events_small[i_event].row) &&
+                           (event.column == events_small[i_event].column);
+            min_n_electrons = std::min(min_n_electrons, event.n_electrons);
+        }
+        REQUIRE(same_pixels);
+        REQUIRE(min_n_electrons > 1e-3);
+    }
+
+    SECTION("Truncated trails and threshold") {
+        image_post_cti =
+            add_cti(image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr);
+
+        events_post_cti = add_cti_sparse(
+            events_pre_cti, n_rows, n_columns, &roe, &ccd, &traps_ic, &traps_sc,
+            nullptr, nullptr, 0, 0, 3, 1e-10, 20, nullptr, nullptr, nullptr, nullptr,
+            nullptr, nullptr, 0, 0, -1, 1e-10, 20, 0.01);
+
+        // Only the trails within range are modelled, and later events in the
+        // same column see empty traps
+        for (int i_event = 0; i_event < events_post_cti.size(); i_event++) {
+            PixelEvent event = events_post_cti[i_event];
+            REQUIRE(event.n_electrons > 0.01);
+            REQUIRE(
+                event.n_electrons ==
+                Approx(image_post_cti[event.row][event.column]).epsilon(0.02));
+            REQUIRE(
+                (((event.column == 2) && (event.row >= 4) && (event.row <= 7)) ||
+                 ((event.column == 2) && (event.row >= 20) && (event.row <= 23)) ||
+                 ((event.column == 7) && (event.row >= 11) && (event.row <= 14)) ||
+                 ((event.column == 10) && (event.row >= 25) && (event.row <= 28))));
+        }
+    }
+
+    SECTION("Remove CTI, same as dense") {
+        image_post_cti =
+            add_cti(image_pre_cti, &roe, &ccd, &traps_ic, &traps_sc, nullptr, nullptr);
+        events_post_cti = events_from_image(image_post_cti);
+
+        image_sparse =
+            remove_cti(image_post_cti, 3, &roe, &ccd, &traps_ic, &traps_sc, nullptr);
+        events_remove_cti = remove_cti_sparse(
+            events_post_cti, 3, n_rows, n_columns, &roe, &ccd, &traps_ic, &traps_sc);
+
+        image_post_cti = image_from_events(events_remove_cti, n_rows, n_columns);
+
+        REQUIRE_THAT(flatten(image_post_cti), Catch::Approx(flatten(image_sparse)));
+    }
+}
@@ -0,0 +1,94 @@
+
+#include <stdio.h>
+
+#include <set>
+#include <string>
+#include <valarray>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "ccd.hpp"
+#include "cti.hpp"
+#include "roe.hpp"
+#include "trace.hpp"
+#include "traps.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test trace spans", "[trace]") {
+    set_verbosity(0);
+
+    std::valarray<double> dwell_times = {1.0};
+    ROE roe(dwell_times);
+    CCD ccd(CCDPhase(1e3, 0.0, 1.0));
+    std::valarray<TrapInstantCapture> traps_ic = {TrapInstantCapture(10.0, 2.0)};
+    std::valarray<std::valarray<double>> image_pre_cti, image_post_cti;
+    int n_columns = 6;
+    int express = 3;
+
+    image_pre_cti = std::valarray<std::valarray<double>>(
+        std::valarray<double>(10.0, n_columns), 8);
+    for (int column = 0; column < n_columns; column++)
+        image_pre_cti[column + 1][column] = 100.0 * (column + 1);
+
+    SECTION("Nothing recorded when off") {
+        start_trace(2);
+        stop_trace();
+        image_post_cti = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, express);
+
+        REQUIRE(get_trace_events().size() == 0);
+    }
+
+    SECTION("Column spans from every thread") {
+        set_n_threads(3);
+        start_trace(2);
+        image_post_cti = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, express);
+        stop_trace();
+        set_n_threads(0);
+
+        std::vector<TraceEvent> events = get_trace_events();
+        std::set<int> column_indices;
+        int n_express_passes = 0;
+        for (const TraceEvent& event : events) {
+            REQUIRE(event.duration_ns >= 0);
+            if (std::string(event.name) == "column")
+                column_indices.insert(event.index);
+            else if (std::string(event.name) == "express_pass")
+                n_express_passes++;
+        }
+        REQUIRE(column_indices.size() == n_columns);
+        REQUIRE(*column_indices.begin() == 0);
+        REQUIRE(*column_indices.rbegin() == n_columns - 1);
+        REQUIRE(n_express_passes == n_columns * express);
+
+        // Sorted by start time
+        for (int i = 1; i < events.size(); i++)
+            REQUIRE(events[i].start_ns >= events[i - 1].start_ns);
+
+        // Lower levels record fewer spans
+        start_trace(1);
+        image_post_cti = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, express);
+        stop_trace();
+        for (const TraceEvent& event : get_trace_events())
+            REQUIRE(std::string(event.name) != "column");
+    }
+
+    SECTION("Chrome trace-event JSON") {
+        start_trace(2);
+        image_post_cti = clock_charge_in_one_direction(
+            image_pre_cti, &roe, &ccd, &traps_ic, nullptr, nullptr, nullptr, express);
+        stop_trace();
+
+        std::string json = trace_events_to_json(get_trace_events());
+        REQUIRE(json.find("{\"traceEvents\": [") == 0);
+        REQUIRE(json.find("\"name\": \"column\"") != std::string::npos);
+        REQUIRE(json.find("\"ph\": \"X\"") != std::string::npos);
+        REQUIRE(json.find("\"args\": {\"index\": 0}") != std::string::npos);
+        REQUIRE(json.find("\"thread_name\"") != std::string::npos);
+
+        clear_trace();
+        REQUIRE(get_trace_events().size() == 0);
+    }
+}
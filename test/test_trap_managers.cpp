@@ -245,6 +245,25 @@ TEST_CASE("Test initialisation", "[trap_managers]") {
             trap_manager_sc_co.watermark_fills.sum() ==
             trap_manager_sc_co.n_watermarks * trap_manager_sc_co.empty_watermark);
     }
+
+    SECTION("Adaptive continuum tables") {
+        set_continuum_table_tolerance(1e-6);
+        TrapManagerInstantCaptureContinuum trap_manager_ic_co(
+            std::valarray<TrapInstantCaptureContinuum>{trap_4}, max_n_transfers,
+            ccd_phase, dwell_time);
+        TrapManagerSlowCaptureContinuum trap_manager_sc_co(
+            std::valarray<TrapSlowCaptureContinuum>{trap_5}, max_n_transfers,
+            ccd_phase, dwell_time);
+        set_continuum_table_tolerance(0.0);
+        trap_manager_ic_co.setup();
+        trap_manager_sc_co.setup();
+
+        REQUIRE(trap_manager_ic_co.table_tolerance == 1e-6);
+        REQUIRE(trap_manager_ic_co.traps[0].log_time_table.size() > 0);
+        REQUIRE(trap_manager_ic_co.traps[0].n_intp < trap_manager_ic_co.n_intp);
+        REQUIRE(trap_manager_sc_co.traps[0].log_time_table.size() > 0);
+        REQUIRE(trap_manager_sc_co.traps[0].log_time_capture_table.size() > 0);
+    }
 }
 
 TEST_CASE("Test utilities", "[trap_managers]") {
@@ -528,6 +547,54 @@ TEST_CASE("Test utilities", "[trap_managers]") {
             std::end(trap_manager.watermark_fills));
         REQUIRE_THAT(test, Catch::Approx(answer));
     }
+
+    SECTION("Prune watermarks, clearing the vacated ones") {
+        std::vector<double> test, answer;
+        TrapManagerSlowCapture trap_manager(
+            std::valarray<TrapSlowCapture>{trap_3}, 4, ccd_phase, dwell_time);
+        trap_manager.setup();
+        trap_manager.n_active_watermarks = 3;
+        trap_manager.watermark_volumes = {0.5, 0.2, 0.1, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        trap_manager.watermark_fills = {8.0, 1e-5, 2.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        double n_trapped_electrons = trap_manager.n_trapped_electrons_total();
+
+        // The faint middle watermark is merged into its neighbours
+        trap_manager.prune_watermarks(1e-3);
+        REQUIRE(trap_manager.n_active_watermarks == 2);
+        REQUIRE(
+            trap_manager.n_trapped_electrons_total() == Approx(n_trapped_electrons));
+        double delta_volume_below = 0.5 * (0.2 * 1e-5) / (0.5 * 8.0);
+        answer = {0.5 + delta_volume_below, 0.3 - delta_volume_below, 0.0, 0.0, 0.0,
+                  0.0, 0.0, 0.0, 0.0};
+        test.assign(
+            std::begin(trap_manager.watermark_volumes),
+            std::end(trap_manager.watermark_volumes));
+        REQUIRE_THAT(test, Catch::Approx(answer));
+        answer = {8.0, 2.0 * 0.1 / (0.3 - delta_volume_below), 0.0, 0.0, 0.0,
+                  0.0, 0.0, 0.0, 0.0};
+        test.assign(
+            std::begin(trap_manager.watermark_fills),
+            std::end(trap_manager.watermark_fills));
+        REQUIRE_THAT(test, Catch::Approx(answer));
+
+        // So capture above all the watermarks is the same as for the same
+        // watermarks set directly, without stale ones above them
+        TrapManagerSlowCapture trap_manager_direct(
+            std::valarray<TrapSlowCapture>{trap_3}, 4, ccd_phase, dwell_time);
+        trap_manager_direct.setup();
+        trap_manager_direct.n_active_watermarks = 2;
+        trap_manager_direct.watermark_volumes = trap_manager.watermark_volumes;
+        trap_manager_direct.watermark_fills = trap_manager.watermark_fills;
+        trap_manager_direct.watermark_volumes[2] = 0.0;
+        trap_manager_direct.watermark_fills[2] = 0.0;
+        double n_electrons = 5e3;
+        REQUIRE(
+            trap_manager.n_electrons_released_and_captured(n_electrons) ==
+            Approx(trap_manager_direct.n_electrons_released_and_captured(n_electrons)));
+        REQUIRE(
+            trap_manager.n_trapped_electrons_total() ==
+            Approx(trap_manager_direct.n_trapped_electrons_total()));
+    }
 }
 
 TEST_CASE("Test manager manager", "[trap_managers]") {
@@ -1121,6 +1188,109 @@ TEST_CASE("Test manager manager", "[trap_managers]") {
             REQUIRE_THAT(test, Catch::Approx(answer));
         }
     }
+
+    SECTION("Collapse negligible trap states") {
+        std::valarray<TrapInstantCapture> traps_ic = {trap_1, trap_2};
+        std::valarray<TrapSlowCapture> traps_sc = {};
+        std::valarray<TrapInstantCaptureContinuum> traps_ic_co = {};
+        std::valarray<TrapSlowCaptureContinuum> traps_sc_co = {};
+        ROE roe;
+        CCD ccd(ccd_phase);
+
+        max_n_transfers = 3;
+        TrapManagerManager t_m_m(
+            traps_ic, traps_sc, traps_ic_co, traps_sc_co, max_n_transfers, ccd,
+            roe.dwell_times);
+
+        // Faint watermarks left behind after a bright pixel, 8e-9 e- in total
+        std::valarray<double> volumes = {0.3, 0.2, 0.0, 0.0};
+        std::valarray<double> fills = {1e-8, 1e-8, 1e-8, 0.0, 0.0, 0.0, 0.0, 0.0};
+        t_m_m.trap_managers_ic[0].n_active_watermarks = 2;
+        t_m_m.trap_managers_ic[0].watermark_volumes = volumes;
+        t_m_m.trap_managers_ic[0].watermark_fills = fills;
+
+        REQUIRE(t_m_m.trap_managers_ic[0].n_trapped_electrons_total() ==
+                Approx(8e-9));
+        REQUIRE(t_m_m.trap_managers_ic[0].n_trapped_electrons_up_to(1e-10) ==
+                Approx(6e-9));
+
+        // Not negligible
+        REQUIRE(t_m_m.collapse_trap_states(1e-10) == false);
+        REQUIRE(t_m_m.trap_managers_ic[0].n_active_watermarks == 2);
+
+        // Negligible
+        REQUIRE(t_m_m.collapse_trap_states(1e-8) == true);
+        REQUIRE(t_m_m.trap_managers_ic[0].n_active_watermarks == 0);
+        REQUIRE(t_m_m.trap_managers_ic[0].n_trapped_electrons_total() == 0.0);
+        REQUIRE(t_m_m.trap_managers_ic[0].watermark_volumes.max() == 0.0);
+
+        // Already empty
+        REQUIRE(t_m_m.collapse_trap_states(1e-8) == false);
+    }
+
+    SECTION("Save, load, and compare trap states") {
+        std::valarray<TrapInstantCapture> traps_ic = {trap_1, trap_2};
+        std::valarray<TrapSlowCapture> traps_sc = {TrapSlowCapture(10.0, 1.0, 0.1)};
+        std::valarray<TrapInstantCaptureContinuum> traps_ic_co = {};
+        std::valarray<TrapSlowCaptureContinuum> traps_sc_co = {};
+        ROE roe;
+        CCD ccd(ccd_phase);
+        TrapStates states, states_loaded, states_empty;
+
+        max_n_transfers = 3;
+        TrapManagerManager t_m_m(
+            traps_ic, traps_sc, traps_ic_co, traps_sc_co, max_n_transfers, ccd,
+            roe.dwell_times);
+        TrapManagerManager t_m_m_loaded = t_m_m;
+        REQUIRE(t_m_m.all_trap_managers().size() == 2);
+        t_m_m.save_trap_states(states_empty);
+
+        // Active watermarks that don't start at the first index
+        std::valarray<double> volumes = {0.0, 0.5, 0.2, 0.0};
+        std::valarray<double> fills = {0.0, 0.0, 0.8, 0.4, 0.3, 0.1, 0.0, 0.0};
+        t_m_m.trap_managers_ic[0].i_first_active_wmk = 1;
+        t_m_m.trap_managers_ic[0].n_active_watermarks = 2;
+        t_m_m.trap_managers_ic[0].watermark_volumes = volumes;
+        t_m_m.trap_managers_ic[0].watermark_fills = fills;
+        t_m_m.save_trap_states(states);
+        REQUIRE(states.watermark_volumes[0].size() == 2);
+        REQUIRE(states.watermark_fills[0].size() == 4);
+        REQUIRE(states.watermark_volumes[1].size() == 0);
+
+        // Loaded compactly into other trap managers, and stored
+        t_m_m_loaded.load_trap_states(states);
+        t_m_m_loaded.reset_trap_states();
+        t_m_m_loaded.restore_trap_states();
+        REQUIRE(t_m_m_loaded.trap_managers_ic[0].i_first_active_wmk == 0);
+        REQUIRE(t_m_m_loaded.trap_managers_ic[0].n_active_watermarks == 2);
+        REQUIRE(
+            t_m_m_loaded.trap_managers_ic[0].n_trapped_electrons_total() ==
+            Approx(t_m_m.trap_managers_ic[0].n_trapped_electrons_total()));
+        t_m_m_loaded.save_trap_states(states_loaded);
+        REQUIRE(states_loaded.difference(states) == 0.0);
+
+        // The difference from empty traps is the number of trapped electrons
+        double n_trapped_electrons = 0.5 * (0.8 + 0.4) + 0.2 * (0.3 + 0.1);
+        REQUIRE(states.difference(states_empty) == Approx(n_trapped_electrons));
+        REQUIRE(states_empty.difference(states) == Approx(n_trapped_electrons));
+
+        // Lower watermarks, so different fills from 0.4-0.5 and none above 0.6
+        states_loaded.watermark_volumes[0][0] = 0.4;
+        REQUIRE(
+            states_loaded.difference(states) ==
+            Approx(0.1 * (0.5 + 0.3) + 0.1 * (0.3 + 0.1)));
+
+        // Serialised into a flat array and back
+        states.density_scale = 2.5;
+        std::valarray<double> array = states.to_array();
+        std::vector<double> answer = {2.5, 2,   2,   4,   0.5, 0.2, 0.8,
+                                      0.4, 0.3, 0.1, 0.0, 0.0};
+        REQUIRE(std::vector<double>(std::begin(array), std::end(array)) == answer);
+        states_loaded.from_array(array);
+        REQUIRE(states_loaded.density_scale == 2.5);
+        REQUIRE(states_loaded.watermark_volumes[1].size() == 0);
+        REQUIRE(states_loaded.difference(states) == 0.0);
+    }
 }
 
 TEST_CASE("Test instant-capture traps: release", "[trap_managers]") {
@@ -613,3 +613,94 @@ TEST_CASE("Test slow-capture continuum traps", "[traps]") {
                 std::numeric_limits<double>::max()) == trap_2.fill_capture_long_time);
     }
 }
+
+TEST_CASE("Test adaptive continuum interpolation tables", "[traps]") {
+    TrapInstantCaptureContinuum trap_ic(10.0, -1.0 / log(0.5), 0.5);
+    TrapSlowCaptureContinuum trap_sc(8.0, -1.0 / log(0.5), 0.5, 1.0);
+    int n_intp = 1000;
+    double time_min = 0.1;
+    double time_max = 99;
+    double tolerance = 1e-6;
+    double dwell_time = 1.0;
+
+    trap_ic.prep_fill_fraction_and_time_elapsed_tables(
+        time_min, time_max, n_intp, tolerance);
+    trap_sc.prep_fill_fraction_and_time_elapsed_tables(
+        time_min, time_max, n_intp, tolerance);
+    trap_sc.prep_fill_fraction_after_slow_capture_tables(
+        dwell_time, time_min, time_max, n_intp, tolerance);
+
+    SECTION("Fewer, non-uniform knots") {
+        int n_knots = trap_ic.log_time_table.size();
+        REQUIRE(n_knots < n_intp);
+        REQUIRE(trap_ic.n_intp == n_knots);
+        REQUIRE(trap_ic.fill_fraction_table.size() == n_knots);
+        REQUIRE(trap_ic.knot_index_table.size() == n_knots - 1);
+
+        // Decreasing times, and increasing fill fractions
+        REQUIRE(trap_ic.log_time_table[0] == Approx(log(time_max)));
+        REQUIRE(trap_ic.log_time_table[n_knots - 1] == Approx(log(time_min)));
+        for (int i = 1; i < n_knots; i++) {
+            REQUIRE(trap_ic.log_time_table[i] < trap_ic.log_time_table[i - 1]);
+            REQUIRE(
+                trap_ic.fill_fraction_table[i] >= trap_ic.fill_fraction_table[i - 1]);
+        }
+        REQUIRE(trap_ic.fill_fraction_table[0] == Approx(trap_ic.fill_min));
+        REQUIRE(trap_ic.fill_fraction_table[n_knots - 1] == Approx(trap_ic.fill_max));
+
+        // Separate knots for the capture table, without changing the fill table
+        REQUIRE(trap_sc.log_time_capture_table.size() < n_intp / 2);
+        REQUIRE(trap_sc.n_intp == trap_sc.log_time_table.size());
+    }
+
+    SECTION("Within the tolerance") {
+        for (double log10_time = -1.0; log10_time <= 1.99; log10_time += 0.01) {
+            double time = pow(10, log10_time);
+            REQUIRE(
+                trap_ic.fill_fraction_from_time_elapsed_table(time) ==
+                Approx(trap_ic.fill_fraction_from_time_elapsed(time))
+                    .epsilon(0)
+                    .margin(3 * tolerance));
+            REQUIRE(
+                trap_sc.fill_fraction_from_time_elapsed_table(time) ==
+                Approx(trap_sc.fill_fraction_from_time_elapsed(time))
+                    .epsilon(0)
+                    .margin(3 * tolerance));
+            REQUIRE(
+                trap_sc.fill_fraction_after_slow_capture_table(time) ==
+                Approx(trap_sc.fill_fraction_after_slow_capture(time, dwell_time))
+                    .epsilon(0)
+                    .margin(3 * tolerance));
+        }
+
+        for (double log10_fill = -2; log10_fill < -0.2; log10_fill += 0.2) {
+            double fill = pow(10, log10_fill);
+            REQUIRE(
+                trap_ic.time_elapsed_from_fill_fraction_table(fill) ==
+                Approx(trap_ic.time_elapsed_from_fill_fraction(fill, time_max))
+                    .epsilon(1e-3));
+        }
+
+        // Outside table still close
+        REQUIRE(
+            trap_ic.fill_fraction_from_time_elapsed_table(100) ==
+            Approx(trap_ic.fill_fraction_from_time_elapsed(100))
+                .epsilon(0)
+                .margin(3 * tolerance));
+
+        // Full and empty
+        REQUIRE(trap_ic.fill_fraction_from_time_elapsed_table(0.0) == 1.0);
+        REQUIRE(
+            trap_ic.fill_fraction_from_time_elapsed_table(
+                std::numeric_limits<double>::max()) == 0.0);
+        REQUIRE(trap_ic.time_elapsed_from_fill_fraction_table(1.0) == 0.0);
+    }
+
+    SECTION("Back to uniform") {
+        trap_ic.prep_fill_fraction_and_time_elapsed_tables(time_min, time_max, n_intp);
+
+        REQUIRE(trap_ic.log_time_table.size() == 0);
+        REQUIRE(trap_ic.n_intp == n_intp);
+        REQUIRE(trap_ic.fill_fraction_table.size() == n_intp);
+    }
+}
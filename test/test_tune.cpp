@@ -0,0 +1,80 @@
+
+#include <math.h>
+
+#include <string>
+#include <valarray>
+
+#include "catch2/catch.hpp"
+#include "model.hpp"
+#include "tune.hpp"
+#include "util.hpp"
+
+TEST_CASE("Test autotune", "[tune]") {
+    set_verbosity(0);
+
+    CTIModel model;
+    std::string message;
+    std::string text =
+        "parallel_trap_ic = 10.0, 0.8 \n"
+        "parallel_trap_ic = 3.0, 4.0 \n"
+        "serial_trap_ic = 3.0, 2.0 \n";
+    REQUIRE(load_model_from_text(text, model, message) == 0);
+
+    // Sky with some sources
+    int n_rows = 80;
+    int n_columns = 90;
+    std::valarray<std::valarray<double>> image(
+        std::valarray<double>(5.0, n_columns), n_rows);
+    for (int i = 0; i < 12; i++)
+        image[(17 * i + 11) % n_rows][(29 * i + 3) % n_columns] = 2000.0 + 300.0 * i;
+    std::valarray<std::valarray<double>> image_reference = model.add_cti(image);
+
+    SECTION("Tuned settings meet the target") {
+        double target_error = 0.5;
+        TuneResult result = autotune(image, model, target_error, 32);
+
+        REQUIRE(result.parallel.is_tuned);
+        REQUIRE(result.serial.is_tuned);
+        REQUIRE(result.parallel.max_error <= target_error / 2);
+        REQUIRE(result.serial.max_error <= target_error / 2);
+        REQUIRE(result.parallel.express > 0);
+
+        // Error for the full image of the same order as the target
+        CTIModel model_tuned = model;
+        result.apply(model_tuned);
+        REQUIRE(model_tuned.parallel.express == result.parallel.express);
+        std::valarray<std::valarray<double>> image_tuned = model_tuned.add_cti(image);
+        REQUIRE_THAT(
+            flatten(image_tuned),
+            Catch::Approx(flatten(image_reference)).margin(2.0 * target_error));
+
+        // Round trip through the model file format
+        CTIModel model_loaded;
+        REQUIRE(
+            load_model_from_text(text + result.to_text(), model_loaded, message) == 0);
+        REQUIRE(model_loaded.parallel.express == result.parallel.express);
+        REQUIRE(
+            model_loaded.parallel.prune_n_electrons ==
+            Approx(result.parallel.prune_n_electrons));
+        REQUIRE(model_loaded.serial.prune_frequency == result.serial.prune_frequency);
+        REQUIRE(model_loaded.parallel.traps_ic.size() == 2);
+    }
+
+    SECTION("Tighter target needs at least as high express") {
+        TuneResult result_loose = autotune(image, model, 1.0, 32);
+        TuneResult result_tight = autotune(image, model, 1e-6, 32);
+
+        int express_loose = result_loose.parallel.express;
+        int express_tight = result_tight.parallel.express;
+        if (express_tight == 0) express_tight = n_rows;
+        REQUIRE(express_loose <= express_tight);
+    }
+
+    SECTION("No prune_n_electrons trials without pruning") {
+        model.parallel.prune_frequency = 0;
+        TuneResult result = autotune(image, model, 0.5, 32, 1);
+
+        REQUIRE(result.parallel.is_tuned);
+        REQUIRE(result.parallel.prune_n_electrons == model.parallel.prune_n_electrons);
+    }
+}
@@ -1,4 +1,8 @@
 
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
 #include <valarray>
 #include <vector>
 
@@ -147,3 +151,88 @@ TEST_CASE("Demo 2D-style 1D valarray slicing", "[util]") {
     image_.assign(std::begin(image), std::end(image));
     REQUIRE(image_ == answer);
 }
+
+TEST_CASE("Test NUMA nodes", "[util]") {
+    std::vector<int> answer;
+
+    SECTION("Parse CPU lists") {
+        answer = {0, 1, 2, 3, 8, 10, 11};
+        REQUIRE(parse_cpu_list("0-3,8,10-11\n") == answer);
+        answer = {5};
+        REQUIRE(parse_cpu_list("5") == answer);
+        REQUIRE(parse_cpu_list("").empty());
+    }
+
+    SECTION("Allowed CPUs in real and pseudo nodes") {
+        std::vector<std::vector<int>> nodes;
+
+        set_numa_mode(-1);
+        nodes = get_numa_nodes();
+        REQUIRE(nodes.size() >= 1);
+        for (auto& node : nodes) REQUIRE(node.size() >= 1);
+
+        set_numa_mode(3);
+        nodes = get_numa_nodes();
+        REQUIRE(nodes.size() == 3);
+        for (auto& node : nodes) REQUIRE(node.size() >= 1);
+        set_numa_mode(0);
+    }
+
+    SECTION("Run every task once") {
+        std::vector<int> n_runs(50, 0);
+
+        set_n_threads(4);
+        set_numa_mode(2);
+        parallel_for_numa(50, [&](int i_task) { n_runs[i_task]++; });
+        set_numa_mode(0);
+        set_n_threads(0);
+
+        answer = std::vector<int>(50, 1);
+        REQUIRE(n_runs == answer);
+    }
+}
+
+TEST_CASE("Test thread limits for nested loops", "[util]") {
+    std::vector<int> n_inner_threads(3, 0);
+    set_n_threads(8);
+
+    SECTION("Nested loops run serially") {
+        parallel_for(3, [&](int i_task) { n_inner_threads[i_task] = get_n_threads(); });
+        REQUIRE(n_inner_threads == std::vector<int>({1, 1, 1}));
+    }
+
+    SECTION("Shared between the tasks") {
+        parallel_for(
+            3, [&](int i_task) { n_inner_threads[i_task] = get_n_threads(); }, true);
+        // Each task runs on one of the workers with 3, 3, and 2 threads
+        for (int i_task = 0; i_task < 3; i_task++) {
+            REQUIRE(n_inner_threads[i_task] >= 2);
+            REQUIRE(n_inner_threads[i_task] <= 3);
+        }
+        REQUIRE(get_n_threads() == 8);
+    }
+
+    SECTION("Limited for the calling thread") {
+        set_thread_limit(2);
+        REQUIRE(get_n_threads() == 2);
+        set_thread_limit(0);
+        REQUIRE(get_n_threads() == 8);
+    }
+
+    set_n_threads(0);
+}
+
+TEST_CASE("Test save and load image txt", "[util]") {
+    std::valarray<std::valarray<double>> image = {
+        {0.0, 1.5, -2.25}, {1e-3, 123456.5, 7.0}};
+    std::string filename = "/tmp/arctic_test_util_" + std::to_string(getpid()) + ".txt";
+
+    save_image_to_txt(filename.c_str(), image);
+    std::valarray<std::valarray<double>> image_loaded =
+        load_image_from_txt(filename.c_str());
+    remove(filename.c_str());
+
+    REQUIRE(image_loaded.size() == 2);
+    REQUIRE(image_loaded[0].size() == 3);
+    REQUIRE(flatten(image_loaded) == flatten(image));
+}